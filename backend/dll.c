@@ -44,7 +44,7 @@
 
 /* Please increase version number with every change
    (don't forget to update dll.desc) */
-#define DLL_VERSION "1.0.13"
+#define DLL_VERSION "1.0.14"
 
 #ifdef _AIX
 # include "lalloca.h"		/* MUST come first for AIX! */
@@ -131,6 +131,13 @@ posix_dlsym (void *handle, const char *func)
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_PTHREAD_CREATE
+# include <pthread.h>
+# include <sys/time.h>
+#endif
 
 #include "../include/sane/sane.h"
 #include "../include/sane/sanei.h"
@@ -152,6 +159,8 @@ posix_dlsym (void *handle, const char *func)
 #include "../include/sane/sanei_config.h"
 #define DLL_CONFIG_FILE "dll.conf"
 #define DLL_ALIASES_FILE "dll.aliases"
+#define DLL_CACHE_FILE "dll.cache"
+#define DLL_HOTPLUG_DIR "/dev/bus/usb"
 
 #include "../include/sane/sanei_usb.h"
 
@@ -199,6 +208,15 @@ struct backend
   u_int inited:1;		/* has the backend been initialized? */
   void *handle;			/* handle returned by dlopen() */
   void *(*op[NUM_OPS]) (void);
+  time_t no_devices;		/* when it found no devices, or 0 */
+#ifdef HAVE_PTHREAD_CREATE
+  int probing;			/* has a probe thread been started? */
+  int probed;			/* has the probe thread finished? */
+  pthread_t probe_thread;
+  SANE_Bool probe_local_only;
+  SANE_Status probe_status;
+  const SANE_Device **probe_list;
+#endif
 };
 
 #define BE_ENTRY(be,func)       sane_##be##_##func
@@ -218,27 +236,26 @@ struct backend
   extern SANE_Status BE_ENTRY(name,set_io_mode) (SANE_Handle, SANE_Bool);           \
   extern SANE_Status BE_ENTRY(name,get_select_fd) (SANE_Handle, SANE_Int *);
 
-#define PRELOAD_DEFN(name)                      \
+/* designated initializers leave the remaining fields zeroed */
+#define PRELOAD_DEFN(be)                        \
 {                                               \
-  0 /* next */, #name,                          \
-  1 /* permanent */,                            \
-  1 /* loaded */,                               \
-  0 /* inited */,                               \
-  0 /* handle */,                               \
-  {                                             \
-    BE_ENTRY(name,init),                        \
-    BE_ENTRY(name,exit),                        \
-    BE_ENTRY(name,get_devices),                 \
-    BE_ENTRY(name,open),                        \
-    BE_ENTRY(name,close),                       \
-    BE_ENTRY(name,get_option_descriptor),       \
-    BE_ENTRY(name,control_option),              \
-    BE_ENTRY(name,get_parameters),              \
-    BE_ENTRY(name,start),                       \
-    BE_ENTRY(name,read),                        \
-    BE_ENTRY(name,cancel),                      \
-    BE_ENTRY(name,set_io_mode),                 \
-    BE_ENTRY(name,get_select_fd)                \
+  .name = #be,                                  \
+  .permanent = 1,                               \
+  .loaded = 1,                                  \
+  .op = {                                       \
+    BE_ENTRY(be,init),                          \
+    BE_ENTRY(be,exit),                          \
+    BE_ENTRY(be,get_devices),                   \
+    BE_ENTRY(be,open),                          \
+    BE_ENTRY(be,close),                         \
+    BE_ENTRY(be,get_option_descriptor),         \
+    BE_ENTRY(be,control_option),                \
+    BE_ENTRY(be,get_parameters),                \
+    BE_ENTRY(be,start),                         \
+    BE_ENTRY(be,read),                          \
+    BE_ENTRY(be,cancel),                        \
+    BE_ENTRY(be,set_io_mode),                   \
+    BE_ENTRY(be,get_select_fd)                  \
   }                                             \
 }
 
@@ -247,7 +264,7 @@ struct backend
 #include "dll-preload.h"
 #else
 static struct backend preloaded_backends[] = {
- { 0, 0, 0, 0, 0, 0, {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }}
+ { .name = 0 }
 };
 #endif
 #endif
@@ -276,6 +293,12 @@ static struct alias *first_alias;
 static SANE_Auth_Callback auth_callback;
 static struct backend *first_backend;
 
+#ifdef HAVE_PTHREAD_CREATE
+/* protects the probe results of the backends */
+static pthread_mutex_t probe_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t probe_cond = PTHREAD_COND_INITIALIZER;
+#endif
+
 #ifndef __BEOS__
 static const char *op_name[] = {
   "init", "exit", "get_devices", "open", "close", "get_option_descriptor",
@@ -671,6 +694,288 @@ init (struct backend *be)
 }
 
 
+/* Returns the number in the environment variable, or the default value. */
+static long
+get_env_number (const char *name, long default_value)
+{
+  const char *value = getenv (name);
+  char *end;
+  long number;
+
+  if (!value || !*value)
+    return default_value;
+
+  number = strtol (value, &end, 10);
+  if (end == value || number < 0)
+    {
+      DBG (1, "get_env_number: ignoring invalid value `%s' of %s\n", value,
+	   name);
+      return default_value;
+    }
+  return number;
+}
+
+#ifdef HAVE_PTHREAD_CREATE
+static void *
+probe_thread (void *arg)
+{
+  struct backend *be = arg;
+  const SANE_Device **be_list = NULL;
+  SANE_Status status = SANE_STATUS_GOOD;
+
+  if (!be->inited)
+    status = init (be);
+  if (status == SANE_STATUS_GOOD)
+    status = (*(op_get_devs_t)be->op[OP_GET_DEVS]) (&be_list,
+						    be->probe_local_only);
+
+  pthread_mutex_lock (&probe_mutex);
+  be->probe_status = status;
+  be->probe_list = be_list;
+  be->probed = 1;
+  pthread_cond_broadcast (&probe_cond);
+  pthread_mutex_unlock (&probe_mutex);
+  return NULL;
+}
+#endif /* HAVE_PTHREAD_CREATE */
+
+/* Waits for the probe thread of a backend, which may still be running if
+   it timed out, so that the backend can be used again. */
+static void
+finish_probe (struct backend *be)
+{
+#ifdef HAVE_PTHREAD_CREATE
+  if (!be->probing)
+    return;
+
+  DBG (3, "finish_probe: waiting for backend `%s'\n", be->name);
+  pthread_join (be->probe_thread, NULL);
+  be->probing = 0;
+#else
+  (void) be;
+#endif
+}
+
+/*
+ * The cache file lists the backends that found no devices, with the time
+ * of the probe. Such backends aren't even loaded by sane_get_devices() for
+ * SANE_DLL_CACHE_TIME seconds, or until a USB device is plugged in.
+ */
+static char *
+get_cache_path (void)
+{
+  const char *dir = getenv ("XDG_CACHE_HOME");
+  const char *subdir = "/sane/";
+  char *path;
+
+  if (!dir || !*dir)
+    {
+      dir = getenv ("HOME");
+      subdir = "/.cache/sane/";
+    }
+  if (!dir || !*dir)
+    return NULL;
+
+  path = malloc (strlen (dir) + strlen (subdir) + strlen (DLL_CACHE_FILE) + 1);
+  if (path)
+    sprintf (path, "%s%s%s", dir, subdir, DLL_CACHE_FILE);
+  return path;
+}
+
+/* Returns the time of the last change of the USB device nodes. */
+static time_t
+get_hotplug_time (void)
+{
+  char path[PATH_MAX];
+  struct dirent *entry;
+  struct stat st;
+  time_t latest = 0;
+  DIR *dir;
+
+  if (stat (DLL_HOTPLUG_DIR, &st) == 0)
+    latest = st.st_mtime;
+
+  dir = opendir (DLL_HOTPLUG_DIR);
+  if (!dir)
+    return latest;
+
+  while ((entry = readdir (dir)) != NULL)
+    {
+      if (entry->d_name[0] == '.')
+	continue;
+      snprintf (path, sizeof (path), "%s/%s", DLL_HOTPLUG_DIR, entry->d_name);
+      if (stat (path, &st) == 0 && st.st_mtime > latest)
+	latest = st.st_mtime;
+    }
+  closedir (dir);
+  return latest;
+}
+
+static void
+load_cache (void)
+{
+  char line[PATH_MAX];
+  struct backend *be;
+  char *path;
+  FILE *fp;
+
+  path = get_cache_path ();
+  fp = path ? fopen (path, "r") : NULL;
+  free (path);
+  if (!fp)
+    return;
+
+  while (fgets (line, sizeof (line), fp))
+    {
+      char name[PATH_MAX];
+      long when;
+
+      if (sscanf (line, "%1023s %ld", name, &when) != 2)
+	continue;
+      for (be = first_backend; be; be = be->next)
+	if (strcmp (be->name, name) == 0)
+	  be->no_devices = when;
+    }
+  fclose (fp);
+}
+
+static void
+save_cache (void)
+{
+  struct backend *be;
+  char *path, *tmp_path, *slash;
+  FILE *fp;
+
+  path = get_cache_path ();
+  if (!path)
+    return;
+
+  /* create the directories, the last one may be missing */
+  slash = strrchr (path, '/');
+  *slash = '\0';
+  if (mkdir (path, 0755) < 0 && errno == ENOENT)
+    {
+      char *parent = strrchr (path, '/');
+
+      *parent = '\0';
+      mkdir (path, 0755);
+      *parent = '/';
+      mkdir (path, 0755);
+    }
+  *slash = '/';
+
+  tmp_path = malloc (strlen (path) + 5);
+  if (!tmp_path)
+    {
+      free (path);
+      return;
+    }
+  sprintf (tmp_path, "%s.tmp", path);
+
+  fp = fopen (tmp_path, "w");
+  if (fp)
+    {
+      for (be = first_backend; be; be = be->next)
+	if (be->no_devices)
+	  fprintf (fp, "%s %ld\n", be->name, (long) be->no_devices);
+      if (fclose (fp) == 0 && rename (tmp_path, path) == 0)
+	DBG (4, "save_cache: wrote %s\n", path);
+      else
+	unlink (tmp_path);
+    }
+  else
+    DBG (2, "save_cache: cannot write %s: %s\n", tmp_path, strerror (errno));
+
+  free (tmp_path);
+  free (path);
+}
+
+#define ASSERT_SPACE(n)                                                    \
+  {                                                                        \
+    if (devlist_len + (n) > devlist_size)                                  \
+      {                                                                    \
+        devlist_size += (n) + 15;                                          \
+        if (devlist)                                                       \
+          devlist = realloc (devlist, devlist_size * sizeof (devlist[0])); \
+        else                                                               \
+          devlist = malloc (devlist_size * sizeof (devlist[0]));           \
+        if (!devlist)                                                      \
+          return SANE_STATUS_NO_MEM;                                       \
+      }                                                                    \
+  }
+
+/* Adds the devices of a backend to devlist. */
+static SANE_Status
+add_devices (struct backend *be, const SANE_Device ** be_list)
+{
+  char *full_name;
+  int i, num_devs;
+  size_t len;
+
+  /* count the number of devices for this backend: */
+  for (num_devs = 0; be_list[num_devs]; ++num_devs)
+    ;
+
+  ASSERT_SPACE (num_devs);
+
+  for (i = 0; i < num_devs; ++i)
+    {
+      SANE_Device *dev;
+      char *mem;
+      struct alias *alias;
+
+      for (alias = first_alias; alias != NULL; alias = alias->next)
+	{
+	  len = strlen (be->name);
+	  if (strlen (alias->oldname) <= len)
+	    continue;
+	  if (strncmp (alias->oldname, be->name, len) == 0
+	      && alias->oldname[len] == ':'
+	      && strcmp (&alias->oldname[len + 1], be_list[i]->name) == 0)
+	    break;
+	}
+
+      if (alias)
+	{
+	  if (!alias->newname)	/* hidden device */
+	    continue;
+
+	  len = strlen (alias->newname);
+	  mem = malloc (sizeof (*dev) + len + 1);
+	  if (!mem)
+	    return SANE_STATUS_NO_MEM;
+
+	  full_name = mem + sizeof (*dev);
+	  strcpy (full_name, alias->newname);
+	}
+      else
+	{
+	  /* create a new device entry with a device name that is the
+	     sum of the backend name a colon and the backend's device
+	     name: */
+	  len = strlen (be->name) + 1 + strlen (be_list[i]->name);
+	  mem = malloc (sizeof (*dev) + len + 1);
+	  if (!mem)
+	    return SANE_STATUS_NO_MEM;
+
+	  full_name = mem + sizeof (*dev);
+	  strcpy (full_name, be->name);
+	  strcat (full_name, ":");
+	  strcat (full_name, be_list[i]->name);
+	}
+
+      dev = (SANE_Device *) mem;
+      dev->name = full_name;
+      dev->vendor = be_list[i]->vendor;
+      dev->model = be_list[i]->model;
+      dev->type = be_list[i]->type;
+
+      devlist[devlist_len++] = dev;
+    }
+  return SANE_STATUS_GOOD;
+}
+
+
 static void
 add_alias (const char *line_param)
 {
@@ -986,6 +1291,7 @@ sane_exit (void)
   for (be = first_backend; be; be = next)
     {
       next = be->next;
+      finish_probe (be);
       if (be->loaded)
 	{
 	  if (be->inited)
@@ -1065,22 +1371,15 @@ sane_get_devices (const SANE_Device *** device_list, SANE_Bool local_only)
   const SANE_Device **be_list;
   struct backend *be;
   SANE_Status status;
-  char *full_name;
-  int i, num_devs;
-  size_t len;
-#define ASSERT_SPACE(n)                                                    \
-  {                                                                        \
-    if (devlist_len + (n) > devlist_size)                                  \
-      {                                                                    \
-        devlist_size += (n) + 15;                                          \
-        if (devlist)                                                       \
-          devlist = realloc (devlist, devlist_size * sizeof (devlist[0])); \
-        else                                                               \
-          devlist = malloc (devlist_size * sizeof (devlist[0]));           \
-        if (!devlist)                                                      \
-          return SANE_STATUS_NO_MEM;                                       \
-      }                                                                    \
-  }
+  long cache_time = get_env_number ("SANE_DLL_CACHE_TIME", 0);
+  time_t now = time (NULL), hotplug_time = 0;
+  int i;
+#ifdef HAVE_PTHREAD_CREATE
+  long timeout = get_env_number ("SANE_DLL_TIMEOUT", 0);
+  int parallel = get_env_number ("SANE_DLL_PARALLEL", 0) != 0;
+  struct timespec deadline;
+  struct timeval tv;
+#endif
 
   DBG (3, "sane_get_devices\n");
 
@@ -1089,77 +1388,112 @@ sane_get_devices (const SANE_Device *** device_list, SANE_Bool local_only)
       free ((void *) devlist[i]);
   devlist_len = 0;
 
+  if (cache_time > 0)
+    {
+      load_cache ();
+      hotplug_time = get_hotplug_time ();
+    }
+
+  /* backends that found no devices recently are skipped */
   for (be = first_backend; be; be = be->next)
+    if (be->no_devices && (now - be->no_devices >= cache_time
+			   || be->no_devices <= hotplug_time))
+      be->no_devices = 0;
+
+#ifdef HAVE_PTHREAD_CREATE
+  /* If requested, probe the backends in parallel. Preloaded backends share
+     the sanei code, so they are probed one after the other below. */
+  for (be = first_backend; parallel && be; be = be->next)
     {
-      if (!be->inited)
-	if (init (be) != SANE_STATUS_GOOD)
-	  continue;
+      int probed;
 
-      status = (*(op_get_devs_t)be->op[OP_GET_DEVS]) (&be_list, local_only);
-      if (status != SANE_STATUS_GOOD || !be_list)
+      if (be->permanent || (cache_time > 0 && be->no_devices))
 	continue;
 
-      /* count the number of devices for this backend: */
-      for (num_devs = 0; be_list[num_devs]; ++num_devs);
+      pthread_mutex_lock (&probe_mutex);
+      probed = be->probed;
+      pthread_mutex_unlock (&probe_mutex);
+      if (be->probing && !probed)
+	continue;		/* still busy since the last call */
+
+      finish_probe (be);
+      be->probed = 0;
+      be->probe_local_only = local_only;
+      if (pthread_create (&be->probe_thread, NULL, probe_thread, be) == 0)
+	be->probing = 1;
+      else
+	DBG (1, "sane_get_devices: cannot start thread for backend `%s'\n",
+	     be->name);
+    }
 
-      ASSERT_SPACE (num_devs);
+  gettimeofday (&tv, NULL);
+  deadline.tv_sec = tv.tv_sec + timeout;
+  deadline.tv_nsec = tv.tv_usec * 1000;
+#endif /* HAVE_PTHREAD_CREATE */
 
-      for (i = 0; i < num_devs; ++i)
+  for (be = first_backend; be; be = be->next)
+    {
+      if (cache_time > 0 && be->no_devices)
+	{
+	  DBG (4, "sane_get_devices: skipping backend `%s', it found no "
+	       "devices at %ld\n", be->name, (long) be->no_devices);
+	  continue;
+	}
+
+#ifdef HAVE_PTHREAD_CREATE
+      if (be->probing)
 	{
-	  SANE_Device *dev;
-	  char *mem;
-	  struct alias *alias;
+	  int timed_out = 0;
 
-	  for (alias = first_alias; alias != NULL; alias = alias->next)
+	  pthread_mutex_lock (&probe_mutex);
+	  while (!be->probed && !timed_out)
 	    {
-	      len = strlen (be->name);
-	      if (strlen (alias->oldname) <= len)
-		continue;
-	      if (strncmp (alias->oldname, be->name, len) == 0
-		  && alias->oldname[len] == ':'
-		  && strcmp (&alias->oldname[len + 1], be_list[i]->name) == 0)
-		break;
+	      if (timeout > 0)
+		timed_out = pthread_cond_timedwait (&probe_cond, &probe_mutex,
+						    &deadline) == ETIMEDOUT;
+	      else
+		pthread_cond_wait (&probe_cond, &probe_mutex);
 	    }
+	  pthread_mutex_unlock (&probe_mutex);
 
-	  if (alias)
+	  if (timed_out)
 	    {
-	      if (!alias->newname)	/* hidden device */
-		continue;
+	      DBG (1, "sane_get_devices: backend `%s' didn't answer within "
+		   "%ld seconds\n", be->name, timeout);
+	      continue;
+	    }
 
-	      len = strlen (alias->newname);
-	      mem = malloc (sizeof (*dev) + len + 1);
-	      if (!mem)
-		return SANE_STATUS_NO_MEM;
+	  finish_probe (be);
+	  status = be->probe_status;
+	  be_list = be->probe_list;
+	}
+      else
+#endif /* HAVE_PTHREAD_CREATE */
+	{
+	  status = SANE_STATUS_GOOD;
+	  if (!be->inited)
+	    status = init (be);
+	  if (status == SANE_STATUS_GOOD)
+	    status = (*(op_get_devs_t)be->op[OP_GET_DEVS]) (&be_list,
+							    local_only);
+	}
 
-	      full_name = mem + sizeof (*dev);
-	      strcpy (full_name, alias->newname);
-	    }
-	  else
-	    {
-	      /* create a new device entry with a device name that is the
-	         sum of the backend name a colon and the backend's device
-	         name: */
-	      len = strlen (be->name) + 1 + strlen (be_list[i]->name);
-	      mem = malloc (sizeof (*dev) + len + 1);
-	      if (!mem)
-		return SANE_STATUS_NO_MEM;
-
-	      full_name = mem + sizeof (*dev);
-	      strcpy (full_name, be->name);
-	      strcat (full_name, ":");
-	      strcat (full_name, be_list[i]->name);
-	    }
+      /* only a search for all devices tells that there are none */
+      if (!local_only)
+	be->no_devices =
+	  (status != SANE_STATUS_GOOD || !be_list || !be_list[0]) ? now : 0;
 
-	  dev = (SANE_Device *) mem;
-	  dev->name = full_name;
-	  dev->vendor = be_list[i]->vendor;
-	  dev->model = be_list[i]->model;
-	  dev->type = be_list[i]->type;
+      if (status != SANE_STATUS_GOOD || !be_list)
+	continue;
 
-	  devlist[devlist_len++] = dev;
-	}
+      status = add_devices (be, be_list);
+      if (status != SANE_STATUS_GOOD)
+	return status;
     }
 
+  if (cache_time > 0 && !local_only)
+    save_cache ();
+
   /* terminate device list with NULL entry: */
   ASSERT_SPACE (1);
   devlist[devlist_len++] = 0;
@@ -1284,6 +1618,7 @@ sane_open (SANE_String_Const full_name, SANE_Handle * meta_handle)
     }
   free(be_name);
 
+  finish_probe (be);
   if (!be->inited)
     {
       status = init (be);
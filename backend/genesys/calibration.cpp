@@ -0,0 +1,194 @@
+/* sane - Scanner Access Now Easy.
+
+   Copyright (C) 2019 Povilas Kanapickas <povilas@radix.lt>
+
+   This file is part of the SANE package.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+   MA 02111-1307, USA.
+
+   As a special exception, the authors of SANE give permission for
+   additional uses of the libraries contained in this release of SANE.
+
+   The exception is that, if you link a SANE library with other files
+   to produce an executable, this does not by itself cause the
+   resulting executable to be covered by the GNU General Public
+   License.  Your use of that executable is in no way restricted on
+   account of linking the SANE library code into it.
+
+   This exception does not, however, invalidate any other reasons why
+   the executable file might be covered by the GNU General Public
+   License.
+
+   If you submit changes to SANE to the maintainers to be included in
+   a subsequent release, you agree by submitting the changes that
+   those changes may be distributed with this exception intact.
+
+   If you write modifications of your own for SANE, it is your choice
+   whether to permit this exception to apply to your modifications.
+   If you do not wish that, delete this exception notice.
+*/
+
+
+#define DEBUG_DECLARE_ONLY
+
+#include "calibration.h"
+#include "error.h"
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+namespace genesys {
+
+std::size_t CalibrationKeyHash::operator()(const CalibrationKey& key) const
+{
+    std::size_t seed = 0;
+    auto combine = [&seed](std::size_t value)
+    {
+        seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    };
+    combine(static_cast<std::size_t>(key.scan_method));
+    combine(key.xres);
+    combine(key.yres);
+    combine(key.channels);
+    combine(key.startx);
+    combine(key.pixels);
+    return seed;
+}
+
+CalibrationStore::CalibrationStore(std::initializer_list<Genesys_Calibration_Cache> entries) :
+    entries_{entries}
+{
+    rebuild_index();
+    evict();
+}
+
+CalibrationStore::CalibrationStore(const CalibrationStore& other) :
+    entries_{other.entries_},
+    max_size_{other.max_size_}
+{
+    rebuild_index();
+}
+
+CalibrationStore& CalibrationStore::operator=(const CalibrationStore& other)
+{
+    entries_ = other.entries_;
+    max_size_ = other.max_size_;
+    rebuild_index();
+    return *this;
+}
+
+void CalibrationStore::clear()
+{
+    entries_.clear();
+    index_.clear();
+}
+
+void CalibrationStore::set_max_size(std::size_t max_size)
+{
+    max_size_ = max_size;
+    evict();
+}
+
+Genesys_Calibration_Cache* CalibrationStore::find(const CalibrationKey& key)
+{
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        return nullptr;
+    }
+    return &*it->second;
+}
+
+void CalibrationStore::mark_used(const CalibrationKey& key)
+{
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        entries_.splice(entries_.begin(), entries_, it->second);
+    }
+}
+
+Genesys_Calibration_Cache& CalibrationStore::insert(Genesys_Calibration_Cache entry)
+{
+    CalibrationKey key{entry.params};
+
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        *it->second = std::move(entry);
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return entries_.front();
+    }
+
+    entries_.push_front(std::move(entry));
+    index_.emplace(key, entries_.begin());
+    evict();
+    return entries_.front();
+}
+
+void CalibrationStore::rebuild_index()
+{
+    index_.clear();
+    for (auto it = entries_.begin(); it != entries_.end();) {
+        // only the most recently used entry is kept if there are duplicate keys
+        if (!index_.emplace(CalibrationKey{it->params}, it).second) {
+            it = entries_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void CalibrationStore::evict()
+{
+    while (entries_.size() > max_size_) {
+        index_.erase(CalibrationKey{entries_.back().params});
+        entries_.pop_back();
+    }
+}
+
+std::vector<unsigned> parse_calibration_resolutions(const std::string& value,
+                                                    const std::vector<unsigned>& supported)
+{
+    std::vector<unsigned> resolutions;
+
+    std::istringstream in{value};
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        auto first = item.find_first_not_of(" \t");
+        if (first == std::string::npos) {
+            continue;
+        }
+        auto last = item.find_last_not_of(" \t");
+        item = item.substr(first, last - first + 1);
+
+        char* end = nullptr;
+        unsigned long resolution = std::strtoul(item.c_str(), &end, 10);
+        if (*end != '\0' || resolution == 0) {
+            throw SaneException(SANE_STATUS_INVAL, "invalid resolution '%s'", item.c_str());
+        }
+        if (std::find(supported.begin(), supported.end(), resolution) == supported.end()) {
+            throw SaneException(SANE_STATUS_INVAL, "resolution %lu is not supported", resolution);
+        }
+        if (std::find(resolutions.begin(), resolutions.end(), resolution) == resolutions.end()) {
+            resolutions.push_back(static_cast<unsigned>(resolution));
+        }
+    }
+
+    if (resolutions.empty()) {
+        resolutions = supported;
+    }
+    return resolutions;
+}
+
+} // namespace genesys
@@ -47,6 +47,11 @@
 #include "sensor.h"
 #include "settings.h"
 #include <ctime>
+#include <initializer_list>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace genesys {
 
@@ -100,6 +105,130 @@ void serialize(Stream& str, Genesys_Calibration_Cache& x)
     serialize(str, x.dark_average_data);
 }
 
+// The scan parameters that must match for a calibration cache entry to be usable. See
+// sanei_genesys_is_compatible_calibration().
+struct CalibrationKey
+{
+    CalibrationKey() = default;
+    explicit CalibrationKey(const SetupParams& params) :
+        scan_method{params.scan_method},
+        xres{params.xres},
+        yres{params.yres},
+        channels{params.channels},
+        startx{params.startx},
+        pixels{params.pixels}
+    {}
+
+    ScanMethod scan_method = ScanMethod::FLATBED;
+    unsigned xres = 0;
+    unsigned yres = 0;
+    unsigned channels = 0;
+    unsigned startx = 0;
+    unsigned pixels = 0;
+
+    bool operator==(const CalibrationKey& other) const
+    {
+        return scan_method == other.scan_method &&
+            xres == other.xres &&
+            yres == other.yres &&
+            channels == other.channels &&
+            startx == other.startx &&
+            pixels == other.pixels;
+    }
+};
+
+struct CalibrationKeyHash
+{
+    std::size_t operator()(const CalibrationKey& key) const;
+};
+
+// Stores calibration cache entries indexed by CalibrationKey. The entries are kept in the order
+// of their last use and the least recently used entries are evicted when there are more than
+// max_size() of them.
+class CalibrationStore
+{
+public:
+    using Entries = std::list<Genesys_Calibration_Cache>;
+    using iterator = Entries::iterator;
+    using const_iterator = Entries::const_iterator;
+
+    static constexpr std::size_t DEFAULT_MAX_SIZE = 100;
+
+    CalibrationStore() = default;
+
+    // the most recently used entry is the first one
+    CalibrationStore(std::initializer_list<Genesys_Calibration_Cache> entries);
+
+    CalibrationStore(const CalibrationStore& other);
+    CalibrationStore(CalibrationStore&& other) = default;
+    CalibrationStore& operator=(const CalibrationStore& other);
+    CalibrationStore& operator=(CalibrationStore&& other) = default;
+
+    bool empty() const { return entries_.empty(); }
+    std::size_t size() const { return entries_.size(); }
+
+    // clears the entries, but keeps the maximum size
+    void clear();
+
+    std::size_t max_size() const { return max_size_; }
+    void set_max_size(std::size_t max_size);
+
+    // Returns the entry with the given key or nullptr if there's no such entry
+    Genesys_Calibration_Cache* find(const CalibrationKey& key);
+
+    // Makes the entry with the given key the most recently used one
+    void mark_used(const CalibrationKey& key);
+
+    // Adds the entry as the most recently used one, replacing any entry with the same key
+    Genesys_Calibration_Cache& insert(Genesys_Calibration_Cache entry);
+
+    // Iterates the entries from the most to the least recently used one
+    iterator begin() { return entries_.begin(); }
+    iterator end() { return entries_.end(); }
+    const_iterator begin() const { return entries_.begin(); }
+    const_iterator end() const { return entries_.end(); }
+
+    bool operator==(const CalibrationStore& other) const { return entries_ == other.entries_; }
+
+private:
+    void rebuild_index();
+    void evict();
+
+    Entries entries_;
+    std::unordered_map<CalibrationKey, iterator, CalibrationKeyHash> index_;
+    std::size_t max_size_ = DEFAULT_MAX_SIZE;
+};
+
+// The entries are stored in the same format as a std::vector from the most to the least recently
+// used one.
+inline void serialize(std::ostream& str, CalibrationStore& x)
+{
+    serialize(str, x.size());
+    serialize_newline(str);
+
+    for (auto& entry : x) {
+        serialize(str, entry);
+        serialize_newline(str);
+    }
+}
+
+inline void serialize(std::istream& str, CalibrationStore& x)
+{
+    std::vector<Genesys_Calibration_Cache> entries;
+    serialize(str, entries);
+
+    x.clear();
+    for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+        x.insert(std::move(*it));
+    }
+}
+
+// Parses a comma separated list of resolutions to calibrate ahead of time. Blank items are
+// ignored and duplicates are dropped. Throws SaneException if an item is not a number or is
+// not in supported. An empty list selects all supported resolutions.
+std::vector<unsigned> parse_calibration_resolutions(const std::string& value,
+                                                    const std::vector<unsigned>& supported);
+
 } // namespace genesys
 
 #endif // BACKEND_GENESYS_CALIBRATION_H
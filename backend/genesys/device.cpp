@@ -108,6 +108,9 @@ void Genesys_Device::clear()
 
     white_average_data.clear();
     dark_average_data.clear();
+
+    clear_pipeline();
+    pipeline_buffer_pool.clear();
 }
 
 ImagePipelineNodeBufferedCallableSource& Genesys_Device::get_pipeline_source()
@@ -115,6 +118,55 @@ ImagePipelineNodeBufferedCallableSource& Genesys_Device::get_pipeline_source()
     return static_cast<ImagePipelineNodeBufferedCallableSource&>(pipeline.front());
 }
 
+void Genesys_Device::start_pipeline_read_ahead()
+{
+    if (pipeline_read_ahead) {
+        return;
+    }
+
+    // sheetfed scanners access the scanner and adjust the amount of data to read when the end
+    // of the document is detected, which must happen on the thread calling sane_read.
+    if (model->is_sheetfed) {
+        throw SaneException(SANE_STATUS_UNSUPPORTED);
+    }
+
+    auto row_bytes = pipeline.get_output_row_bytes();
+    auto chunk_size = std::max<std::size_t>(1, session.buffer_size_read / row_bytes) * row_bytes;
+
+    // the chunk count is not important as the reader thread is limited by the scanner anyway
+    pipeline_read_ahead.reset(new ReadAheadBuffer(chunk_size,
+                                                  total_bytes_to_read - total_bytes_read, 4,
+                                                  [this](std::size_t size, std::uint8_t* data)
+    {
+        return pipeline_buffer.get_data(size, data);
+    }));
+    pipeline_read_ahead->start();
+}
+
+void Genesys_Device::stop_pipeline_read_ahead()
+{
+    // the reader thread of pipeline_read_ahead may be waiting for the reader thread of the
+    // pipeline source, so both need to be asked to stop before waiting for either of them.
+    if (pipeline_read_ahead) {
+        pipeline_read_ahead->request_stop();
+    }
+    if (!pipeline.empty()) {
+        get_pipeline_source().request_stop_read_ahead();
+    }
+    pipeline_read_ahead.reset();
+    if (!pipeline.empty()) {
+        get_pipeline_source().stop_read_ahead();
+    }
+}
+
+void Genesys_Device::clear_pipeline()
+{
+    stop_pipeline_read_ahead();
+    pipeline_buffer = ImageBuffer{};
+    pipeline.clear();
+    pipeline_buffer_pool.evict_unused();
+}
+
 bool Genesys_Device::is_head_pos_known(ScanHeadId scan_head) const
 {
     switch (scan_head) {
@@ -259,7 +259,7 @@ struct Genesys_Device
     Genesys_Device() = default;
     ~Genesys_Device();
 
-    using Calibration = std::vector<Genesys_Calibration_Cache>;
+    using Calibration = CalibrationStore;
 
     // frees commonly used data
     void clear();
@@ -333,14 +333,38 @@ struct Genesys_Device
     // array describing the order of the sub-segments of the sensor
     std::vector<unsigned> segment_order;
 
+    // the intermediate buffers of `pipeline` and `pipeline_buffer` are taken from this pool so
+    // that they are reused across scans. Must be declared before the users of the pool.
+    ImageBufferPool pipeline_buffer_pool;
+
     // stores information about how the input image should be processed
     ImagePipelineStack pipeline;
 
     // an buffer that allows reading from `pipeline` in chunks of any size
     ImageBuffer pipeline_buffer;
 
+    // reads from `pipeline_buffer` on a separate thread when the frontend requested non-blocking
+    // reads
+    std::unique_ptr<ReadAheadBuffer> pipeline_read_ahead;
+
+    // whether sane_read should return only data that is available without waiting for the
+    // scanner
+    bool non_blocking_read = false;
+
     ImagePipelineNodeBufferedCallableSource& get_pipeline_source();
 
+    // Starts reading from `pipeline_buffer` on a separate thread unless this has been done
+    // already. Not supported for sheetfed scanners.
+    void start_pipeline_read_ahead();
+
+    // stops reading data from the scanner on separate threads, if the pipeline does that. Must
+    // be called before accessing the scanner once the pipeline has started reading.
+    void stop_pipeline_read_ahead();
+
+    // Destroys the pipeline once the scan has finished. Of the buffers in
+    // `pipeline_buffer_pool`, only those that the scan has used are kept for the next one.
+    void clear_pipeline();
+
     std::unique_ptr<ScannerInterface> interface;
 
     bool is_head_pos_known(ScanHeadId scan_head) const;
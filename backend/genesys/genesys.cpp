@@ -81,6 +81,7 @@
 #include <iterator>
 #include <list>
 #include <numeric>
+#include <sstream>
 #include <exception>
 #include <vector>
 
@@ -178,6 +179,13 @@ static const SANE_Range expiration_range = {
   1		/* quantization */
 };
 
+// range for the maximum number of calibration cache entries
+static const SANE_Range calibration_cache_size_range = {
+    1,      // minimum
+    10000,  // maximum
+    1       // quantization
+};
+
 const Genesys_Sensor& sanei_genesys_find_sensor_any(const Genesys_Device* dev)
 {
     DBG_HELPER(dbg);
@@ -3586,6 +3594,29 @@ static void genesys_send_shading_coefficient(Genesys_Device* dev, const Genesys_
 }
 
 
+/**
+ * search calibration cache list for an entry matching the current scan settings.
+ * @param dev scanner's device
+ * @param sensor sensor used for the current scan settings
+ * @return the matching cache entry or nullptr if there is none
+ */
+static const Genesys_Calibration_Cache*
+genesys_find_calibration(Genesys_Device* dev, const Genesys_Sensor& sensor)
+{
+    // if no cache or no function to evaluate cache entry ther can be no match/
+    if (dev->calibration_cache.empty()) {
+        return nullptr;
+    }
+
+    auto session = dev->cmd_set->calculate_scan_session(dev, sensor, dev->settings);
+
+    auto* cache = dev->calibration_cache.find(CalibrationKey{session.params});
+    if (cache && sanei_genesys_is_compatible_calibration(dev, session, cache, false)) {
+        return cache;
+    }
+    return nullptr;
+}
+
 /**
  * search calibration cache list for an entry matching required scan.
  * If one is found, set device calibration with it
@@ -3598,38 +3629,30 @@ genesys_restore_calibration(Genesys_Device * dev, Genesys_Sensor& sensor)
 {
     DBG_HELPER(dbg);
 
-    // if no cache or no function to evaluate cache entry ther can be no match/
-    if (dev->calibration_cache.empty()) {
-        return false;
-    }
+    auto* cache = genesys_find_calibration(dev, sensor);
 
-    auto session = dev->cmd_set->calculate_scan_session(dev, sensor, dev->settings);
+    if (cache) {
+        dev->frontend = cache->frontend;
+        // we don't restore the gamma fields
+        sensor.exposure = cache->sensor.exposure;
 
-  /* we walk the link list of calibration cache in search for a
-   * matching one */
-  for (auto& cache : dev->calibration_cache)
-    {
-        if (sanei_genesys_is_compatible_calibration(dev, session, &cache, false)) {
-            dev->frontend = cache.frontend;
-          /* we don't restore the gamma fields */
-          sensor.exposure = cache.sensor.exposure;
+        dev->calib_session = cache->session;
+        dev->average_size = cache->average_size;
 
-            dev->calib_session = cache.session;
-          dev->average_size = cache.average_size;
+        dev->dark_average_data = cache->dark_average_data;
+        dev->white_average_data = cache->white_average_data;
 
-          dev->dark_average_data = cache.dark_average_data;
-          dev->white_average_data = cache.white_average_data;
+        dev->calibration_cache.mark_used(CalibrationKey{cache->params});
 
-            if (!dev->cmd_set->has_send_shading_data()) {
+        if (!dev->cmd_set->has_send_shading_data()) {
             genesys_send_shading_coefficient(dev, sensor);
-          }
+        }
 
-          DBG(DBG_proc, "%s: restored\n", __func__);
-          return true;
-	}
+        DBG(DBG_proc, "%s: restored\n", __func__);
+        return true;
     }
-  DBG(DBG_proc, "%s: completed(nothing found)\n", __func__);
-  return false;
+    DBG(DBG_proc, "%s: completed(nothing found)\n", __func__);
+    return false;
 }
 
 
@@ -3642,39 +3665,26 @@ static void genesys_save_calibration(Genesys_Device* dev, const Genesys_Sensor&
 
     auto session = dev->cmd_set->calculate_scan_session(dev, sensor, dev->settings);
 
-  auto found_cache_it = dev->calibration_cache.end();
-  for (auto cache_it = dev->calibration_cache.begin(); cache_it != dev->calibration_cache.end();
-       cache_it++)
-    {
-        if (sanei_genesys_is_compatible_calibration(dev, session, &*cache_it, true)) {
-            found_cache_it = cache_it;
-            break;
-        }
-    }
-
-  /* if we found on overridable cache, we reuse it */
-  if (found_cache_it == dev->calibration_cache.end())
-    {
-      /* create a new cache entry and insert it in the linked list */
-      dev->calibration_cache.push_back(Genesys_Calibration_Cache());
-      found_cache_it = std::prev(dev->calibration_cache.end());
-    }
+    // any existing entry with the same parameters is replaced
+    Genesys_Calibration_Cache cache;
 
-  found_cache_it->average_size = dev->average_size;
+    cache.average_size = dev->average_size;
 
-  found_cache_it->dark_average_data = dev->dark_average_data;
-  found_cache_it->white_average_data = dev->white_average_data;
+    cache.dark_average_data = dev->dark_average_data;
+    cache.white_average_data = dev->white_average_data;
 
-    found_cache_it->params = session.params;
-  found_cache_it->frontend = dev->frontend;
-  found_cache_it->sensor = sensor;
+    cache.params = session.params;
+    cache.frontend = dev->frontend;
+    cache.sensor = sensor;
 
-    found_cache_it->session = dev->calib_session;
+    cache.session = dev->calib_session;
 
 #ifdef HAVE_SYS_TIME_H
     gettimeofday(&time, nullptr);
-  found_cache_it->last_calibration = time.tv_sec;
+    cache.last_calibration = time.tv_sec;
 #endif
+
+    dev->calibration_cache.insert(std::move(cache));
 }
 
 static void genesys_flatbed_calibration(Genesys_Device* dev, Genesys_Sensor& sensor)
@@ -4239,13 +4249,25 @@ static void genesys_read_ordered_data(Genesys_Device* dev, SANE_Byte* destinatio
             *len = dev->total_bytes_to_read - dev->total_bytes_read;
         }
 
-        dev->pipeline_buffer.get_data(*len, destination);
+        if (dev->non_blocking_read) {
+            dev->start_pipeline_read_ahead();
+            if (!dev->pipeline_read_ahead->finished()) {
+                *len = std::min(*len, dev->pipeline_read_ahead->available());
+            }
+        }
+
+        if (dev->pipeline_read_ahead) {
+            dev->pipeline_read_ahead->get_data(*len, destination);
+        } else {
+            dev->pipeline_buffer.get_data(*len, destination);
+        }
         dev->total_bytes_read += *len;
     }
 
   /* end scan if all needed data have been read */
    if(dev->total_bytes_read >= dev->total_bytes_to_read)
     {
+        dev->stop_pipeline_read_ahead();
         dev->cmd_set->end_scan(dev, &dev->reg, true);
         if (dev->model->is_sheetfed) {
             dev->cmd_set->eject_document (dev);
@@ -4422,6 +4444,106 @@ static void calc_parameters(Genesys_Scanner* s)
     s->params = calculate_scan_parameters(*s->dev, s->dev->settings);
 }
 
+/** @brief returns the resolutions selected by the prefetch-calibration-resolutions option
+ * An empty list selects all resolutions supported for the current scan source.
+ */
+static std::vector<unsigned> get_prefetch_calibration_resolutions(const Genesys_Scanner& s)
+{
+    return parse_calibration_resolutions(s.prefetch_calibration_resolutions,
+                                         s.dev->model->get_resolutions(s.scan_method));
+}
+
+/** @brief calibrates the scanner for a list of resolutions ahead of time
+ * The calibration is done for the current mode and source at each of the resolutions returned
+ * by get_prefetch_calibration_resolutions(). The results are stored in the calibration cache
+ * so that subsequent scans at these resolutions do not need to calibrate. Resolutions that
+ * already have a matching cache entry are skipped and the lamp is warmed up only once.
+ */
+static void genesys_prefetch_calibration(Genesys_Scanner* s)
+{
+    DBG_HELPER(dbg);
+    auto* dev = s->dev;
+
+    if (dev->model->is_sheetfed) {
+        throw SaneException(SANE_STATUS_UNSUPPORTED,
+                            "calibration prefetch is not supported on sheetfed scanners");
+    }
+
+    bool shading_disabled =
+            has_flag(dev->model->flags, ModelFlag::DISABLE_ADC_CALIBRATION) &&
+            has_flag(dev->model->flags, ModelFlag::DISABLE_EXPOSURE_CALIBRATION) &&
+            has_flag(dev->model->flags, ModelFlag::DISABLE_SHADING_CALIBRATION);
+    if (shading_disabled) {
+        DBG(DBG_warn, "%s: no calibration done\n", __func__);
+        return;
+    }
+
+    auto resolutions = get_prefetch_calibration_resolutions(*s);
+    auto saved_resolution = s->resolution;
+    bool warmed_up = false;
+
+    try {
+        for (auto resolution : resolutions) {
+            s->resolution = resolution;
+            calc_parameters(s);
+
+            auto& sensor = sanei_genesys_find_sensor_for_write(dev, dev->settings.xres,
+                                                               dev->settings.get_channels(),
+                                                               dev->settings.scan_method);
+            if (genesys_find_calibration(dev, sensor)) {
+                DBG(DBG_info, "%s: calibration for %u dpi is already cached\n", __func__,
+                    resolution);
+                continue;
+            }
+
+            if (!warmed_up) {
+                if (dev->parking) {
+                    sanei_genesys_wait_for_home(dev);
+                }
+                dev->cmd_set->save_power(dev, false);
+
+                if (has_flag(dev->model->flags, ModelFlag::WARMUP) &&
+                    dev->settings.scan_method != ScanMethod::TRANSPARENCY_INFRARED)
+                {
+                    if (dev->settings.scan_method == ScanMethod::TRANSPARENCY) {
+                        scanner_move_to_ta(*dev);
+                    }
+                    genesys_warmup_lamp(dev);
+                }
+                warmed_up = true;
+            }
+
+            dev->parking = false;
+            dev->cmd_set->move_back_home(dev, true);
+
+            if (dev->settings.scan_method == ScanMethod::TRANSPARENCY ||
+                dev->settings.scan_method == ScanMethod::TRANSPARENCY_INFRARED)
+            {
+                scanner_move_to_ta(*dev);
+            }
+
+            DBG(DBG_info, "%s: calibrating for %u dpi\n", __func__, resolution);
+            dev->interface->record_progress_message("prefetch_calibration");
+            genesys_scanner_calibration(dev, sensor);
+            genesys_save_calibration(dev, sensor);
+            dev->cmd_set->wait_for_motor_stop(dev);
+        }
+    } catch (...) {
+        s->resolution = saved_resolution;
+        catch_all_exceptions(__func__, [&](){ calc_parameters(s); });
+        catch_all_exceptions(__func__, [&](){ dev->cmd_set->save_power(dev, true); });
+        throw;
+    }
+
+    s->resolution = saved_resolution;
+    calc_parameters(s);
+
+    if (warmed_up) {
+        dev->cmd_set->move_back_home(dev, true);
+        dev->cmd_set->save_power(dev, true);
+    }
+}
+
 static void create_bpp_list (Genesys_Scanner * s, const std::vector<unsigned>& bpp)
 {
     s->bpp_list[0] = bpp.size();
@@ -4883,6 +5005,38 @@ static void init_options(Genesys_Scanner* s)
   s->opt[OPT_EXPIRATION_TIME].constraint.range = &expiration_range;
   s->expiration_time = 60;  // 60 minutes by default
 
+    // maximum number of calibration cache entries
+    s->opt[OPT_CALIBRATION_CACHE_SIZE].name = "calibration-cache-size";
+    s->opt[OPT_CALIBRATION_CACHE_SIZE].title = SANE_I18N("Calibration cache size");
+    s->opt[OPT_CALIBRATION_CACHE_SIZE].desc = SANE_I18N(
+        "Maximum number of cached calibrations. The least recently used calibrations are "
+        "removed when the cache is full.");
+    s->opt[OPT_CALIBRATION_CACHE_SIZE].type = SANE_TYPE_INT;
+    s->opt[OPT_CALIBRATION_CACHE_SIZE].unit = SANE_UNIT_NONE;
+    s->opt[OPT_CALIBRATION_CACHE_SIZE].constraint_type = SANE_CONSTRAINT_RANGE;
+    s->opt[OPT_CALIBRATION_CACHE_SIZE].constraint.range = &calibration_cache_size_range;
+    s->calibration_cache_size = CalibrationStore::DEFAULT_MAX_SIZE;
+    s->dev->calibration_cache.set_max_size(s->calibration_cache_size);
+
+    // resolutions to calibrate ahead of time
+    s->opt[OPT_PREFETCH_CALIBRATION_RESOLUTIONS].name = "prefetch-calibration-resolutions";
+    s->opt[OPT_PREFETCH_CALIBRATION_RESOLUTIONS].title =
+            SANE_I18N("Prefetch calibration resolutions");
+    s->opt[OPT_PREFETCH_CALIBRATION_RESOLUTIONS].desc = SANE_I18N(
+        "Comma separated list of resolutions to calibrate when prefetching calibration. "
+        "An empty list selects all resolutions supported by the current source.");
+    s->opt[OPT_PREFETCH_CALIBRATION_RESOLUTIONS].type = SANE_TYPE_STRING;
+    s->opt[OPT_PREFETCH_CALIBRATION_RESOLUTIONS].unit = SANE_UNIT_NONE;
+    s->opt[OPT_PREFETCH_CALIBRATION_RESOLUTIONS].size = 256;
+    s->opt[OPT_PREFETCH_CALIBRATION_RESOLUTIONS].constraint_type = SANE_CONSTRAINT_NONE;
+    if (model->is_sheetfed) {
+        s->opt[OPT_PREFETCH_CALIBRATION_RESOLUTIONS].cap = SANE_CAP_INACTIVE;
+    } else {
+        s->opt[OPT_PREFETCH_CALIBRATION_RESOLUTIONS].cap =
+                SANE_CAP_SOFT_DETECT | SANE_CAP_SOFT_SELECT | SANE_CAP_ADVANCED;
+    }
+    s->prefetch_calibration_resolutions.clear();
+
   /* Powersave time (turn lamp off) */
   s->opt[OPT_LAMP_OFF_TIME].name = "lamp-off-time";
   s->opt[OPT_LAMP_OFF_TIME].title = SANE_I18N ("Lamp off time");
@@ -5040,6 +5194,22 @@ static void init_options(Genesys_Scanner* s)
   else
     s->opt[OPT_CALIBRATE].cap = SANE_CAP_INACTIVE;
 
+  // prefetch calibration button
+  s->opt[OPT_PREFETCH_CALIBRATION].name = "prefetch-calibration";
+  s->opt[OPT_PREFETCH_CALIBRATION].title = SANE_I18N("Prefetch calibration");
+  s->opt[OPT_PREFETCH_CALIBRATION].desc = SANE_I18N(
+    "Calibrate the current mode at all resolutions listed in the prefetch calibration "
+    "resolutions option and store the results in the calibration cache");
+  s->opt[OPT_PREFETCH_CALIBRATION].type = SANE_TYPE_BUTTON;
+  s->opt[OPT_PREFETCH_CALIBRATION].unit = SANE_UNIT_NONE;
+  s->opt[OPT_PREFETCH_CALIBRATION].size = 0;
+  s->opt[OPT_PREFETCH_CALIBRATION].constraint_type = SANE_CONSTRAINT_NONE;
+  if (model->is_sheetfed)
+    s->opt[OPT_PREFETCH_CALIBRATION].cap = SANE_CAP_INACTIVE;
+  else
+    s->opt[OPT_PREFETCH_CALIBRATION].cap =
+      SANE_CAP_SOFT_DETECT | SANE_CAP_SOFT_SELECT | SANE_CAP_ADVANCED;
+
   /* clear calibration cache button */
   s->opt[OPT_CLEAR_CALIBRATION].name = "clear-calibration";
   s->opt[OPT_CLEAR_CALIBRATION].title = SANE_I18N ("Clear calibration");
@@ -5731,6 +5901,9 @@ static void get_option_value(Genesys_Scanner* s, int option, void* val)
     case OPT_EXPIRATION_TIME:
         *reinterpret_cast<SANE_Word*>(val) = s->expiration_time;
         break;
+    case OPT_CALIBRATION_CACHE_SIZE:
+        *reinterpret_cast<SANE_Word*>(val) = s->calibration_cache_size;
+        break;
     case OPT_CUSTOM_GAMMA:
         *reinterpret_cast<SANE_Word*>(val) = s->custom_gamma;
         break;
@@ -5745,6 +5918,9 @@ static void get_option_value(Genesys_Scanner* s, int option, void* val)
     case OPT_CALIBRATION_FILE:
         std::strcpy(reinterpret_cast<char*>(val), s->calibration_file.c_str());
         break;
+    case OPT_PREFETCH_CALIBRATION_RESOLUTIONS:
+        std::strcpy(reinterpret_cast<char*>(val), s->prefetch_calibration_resolutions.c_str());
+        break;
     case OPT_SOURCE:
         std::strcpy(reinterpret_cast<char*>(val), scan_method_to_option_string(s->scan_method));
         break;
@@ -5833,16 +6009,7 @@ static void get_option_value(Genesys_Scanner* s, int option, void* val)
             // scanner needs calibration for current mode unless a matching calibration cache is
             // found
 
-            bool result = true;
-
-            auto session = dev->cmd_set->calculate_scan_session(dev, *sensor, dev->settings);
-
-            for (auto& cache : dev->calibration_cache) {
-                if (sanei_genesys_is_compatible_calibration(dev, session, &cache, false)) {
-                    *reinterpret_cast<SANE_Bool*>(val) = SANE_FALSE;
-                }
-            }
-            *reinterpret_cast<SANE_Bool*>(val) = result;
+            *reinterpret_cast<SANE_Bool*>(val) = genesys_find_calibration(dev, *sensor) == nullptr;
             break;
         }
     default:
@@ -5861,6 +6028,7 @@ static void set_calibration_value(Genesys_Scanner* s, const char* val)
 
     std::string new_calib_path = val;
     Genesys_Device::Calibration new_calibration;
+    new_calibration.set_max_size(dev->calibration_cache.max_size());
 
     bool is_calib_success = false;
     catch_all_exceptions(__func__, [&]()
@@ -6024,6 +6192,22 @@ static void set_option_value(Genesys_Scanner* s, int option, void *val, SANE_Int
             }
             break;
         }
+        case OPT_CALIBRATION_CACHE_SIZE: {
+            s->calibration_cache_size = *reinterpret_cast<SANE_Word*>(val);
+            dev->calibration_cache.set_max_size(s->calibration_cache_size);
+            break;
+        }
+        case OPT_PREFETCH_CALIBRATION_RESOLUTIONS: {
+            std::string previous = s->prefetch_calibration_resolutions;
+            s->prefetch_calibration_resolutions = reinterpret_cast<const char*>(val);
+            try {
+                get_prefetch_calibration_resolutions(*s);
+            } catch (...) {
+                s->prefetch_calibration_resolutions = previous;
+                throw;
+            }
+            break;
+        }
         case OPT_CUSTOM_GAMMA: {
       *myinfo |= SANE_INFO_RELOAD_PARAMS | SANE_INFO_RELOAD_OPTIONS;
         s->custom_gamma = *reinterpret_cast<SANE_Bool*>(val);
@@ -6114,6 +6298,11 @@ static void set_option_value(Genesys_Scanner* s, int option, void *val, SANE_Int
             *myinfo |= SANE_INFO_RELOAD_PARAMS | SANE_INFO_RELOAD_OPTIONS;
             break;
         }
+        case OPT_PREFETCH_CALIBRATION: {
+            genesys_prefetch_calibration(s);
+            *myinfo |= SANE_INFO_RELOAD_PARAMS | SANE_INFO_RELOAD_OPTIONS;
+            break;
+        }
         case OPT_CLEAR_CALIBRATION: {
             dev->calibration_cache.clear();
 
@@ -6280,6 +6469,7 @@ void sane_start_impl(SANE_Handle handle)
     // parameters will be overwritten below, but that's OK.
 
     calc_parameters(s);
+    dev->non_blocking_read = false;
     genesys_start_scan(dev, s->lamp_off);
 
     s->scanning = true;
@@ -6374,6 +6564,10 @@ void sane_cancel_impl(SANE_Handle handle)
     s->scanning = false;
     dev->read_active = false;
 
+    // the reader thread must not access the scanner concurrently with the code below, and the
+    // image data of the scan isn't needed anymore
+    dev->clear_pipeline();
+
     // no need to end scan if we are parking the head
     if (!dev->parking) {
         dev->cmd_set->end_scan(dev, &dev->reg, true);
@@ -6407,13 +6601,18 @@ void sane_set_io_mode_impl(SANE_Handle handle, SANE_Bool non_blocking)
     DBG_HELPER_ARGS(dbg, "handle = %p, non_blocking = %s", handle,
                     non_blocking == SANE_TRUE ? "true" : "false");
     Genesys_Scanner* s = reinterpret_cast<Genesys_Scanner*>(handle);
+    auto* dev = s->dev;
 
     if (!s->scanning) {
         throw SaneException("not scanning");
     }
-    if (non_blocking) {
+
+    // The data is read on a separate thread in non-blocking mode, see
+    // Genesys_Device::start_pipeline_read_ahead()
+    if (non_blocking && dev->model->is_sheetfed) {
         throw SaneException(SANE_STATUS_UNSUPPORTED);
     }
+    dev->non_blocking_read = non_blocking;
 }
 
 SANE_GENESYS_API_LINKAGE
@@ -6429,11 +6628,17 @@ void sane_get_select_fd_impl(SANE_Handle handle, SANE_Int* fd)
 {
     DBG_HELPER_ARGS(dbg, "handle = %p, fd = %p", handle, reinterpret_cast<void*>(fd));
     Genesys_Scanner* s = reinterpret_cast<Genesys_Scanner*>(handle);
+    auto* dev = s->dev;
 
     if (!s->scanning) {
         throw SaneException("not scanning");
     }
-    throw SaneException(SANE_STATUS_UNSUPPORTED);
+    if (is_testing_mode()) {
+        throw SaneException(SANE_STATUS_UNSUPPORTED);
+    }
+
+    dev->start_pipeline_read_ahead();
+    *fd = dev->pipeline_read_ahead->get_select_fd();
 }
 
 SANE_GENESYS_API_LINKAGE
@@ -116,6 +116,8 @@ enum Genesys_Option
   OPT_COLOR_FILTER,
   OPT_CALIBRATION_FILE,
   OPT_EXPIRATION_TIME,
+  OPT_CALIBRATION_CACHE_SIZE,
+  OPT_PREFETCH_CALIBRATION_RESOLUTIONS,
 
   OPT_SENSOR_GROUP,
   OPT_SCAN_SW,
@@ -129,6 +131,7 @@ enum Genesys_Option
   OPT_NEED_CALIBRATION_SW,
   OPT_BUTTON_GROUP,
   OPT_CALIBRATE,
+  OPT_PREFETCH_CALIBRATION,
   OPT_CLEAR_CALIBRATION,
   OPT_FORCE_CALIBRATION,
   OPT_IGNORE_OFFSETS,
@@ -210,6 +213,7 @@ struct Genesys_Scanner
     SANE_Word contrast = 0;
     SANE_Word brightness = 0;
     SANE_Word expiration_time = 0;
+    SANE_Word calibration_cache_size = 0;
     bool custom_gamma = false;
 
     SANE_Word pos_top_left_y = 0;
@@ -223,6 +227,11 @@ struct Genesys_Scanner
     ScanMethod scan_method = ScanMethod::FLATBED;
 
     std::string calibration_file;
+
+    // comma separated list of resolutions to calibrate when the prefetch-calibration button
+    // is pressed
+    std::string prefetch_calibration_resolutions;
+
     // Button states
     GenesysButton buttons[NUM_BUTTONS];
 
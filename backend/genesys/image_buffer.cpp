@@ -47,13 +47,161 @@
 #include "image.h"
 #include "utilities.h"
 
+#include <iterator>
+#include <unistd.h>
+
 namespace genesys {
 
-ImageBuffer::ImageBuffer(std::size_t size, ProducerCallback producer) :
+constexpr std::size_t ImageBufferPool::DEFAULT_MAX_BUFFER_COUNT;
+constexpr std::size_t ImageBufferPool::DEFAULT_MAX_BYTES;
+
+std::vector<std::uint8_t> ImageBufferPool::acquire(std::size_t size)
+{
+    std::vector<std::uint8_t> buffer;
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+
+        auto it = std::lower_bound(buffers_.begin(), buffers_.end(), size,
+                                   [](const Entry& e, std::size_t s)
+        {
+            return e.data.capacity() < s;
+        });
+        if (it == buffers_.end() || it->data.capacity() / 2 > size) {
+            // grow the largest buffer that is too small instead. Much larger buffers are left
+            // over from larger scans and would keep their memory in use.
+            it = it == buffers_.begin() ? buffers_.end() : std::prev(it);
+        }
+        if (it != buffers_.end()) {
+            bytes_ -= it->data.capacity();
+            buffer = std::move(it->data);
+            buffers_.erase(it);
+        }
+    }
+    buffer.resize(size);
+    return buffer;
+}
+
+void ImageBufferPool::release(std::vector<std::uint8_t>&& buffer)
+{
+    if (buffer.capacity() == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock{mutex_};
+    auto it = std::upper_bound(buffers_.begin(), buffers_.end(), buffer.capacity(),
+                               [](std::size_t s, const Entry& e)
+    {
+        return s < e.data.capacity();
+    });
+    bytes_ += buffer.capacity();
+    buffers_.insert(it, Entry{std::move(buffer)});
+    evict_excess();
+}
+
+std::size_t ImageBufferPool::buffer_count() const
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    return buffers_.size();
+}
+
+std::size_t ImageBufferPool::byte_count() const
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    return bytes_;
+}
+
+void ImageBufferPool::set_max_buffer_count(std::size_t count)
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    max_buffer_count_ = count;
+    evict_excess();
+}
+
+void ImageBufferPool::set_max_bytes(std::size_t bytes)
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    max_bytes_ = bytes;
+    evict_excess();
+}
+
+void ImageBufferPool::evict_unused()
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    for (const auto& e : buffers_) {
+        if (!e.used) {
+            bytes_ -= e.data.capacity();
+        }
+    }
+    buffers_.erase(std::remove_if(buffers_.begin(), buffers_.end(),
+                                  [](const Entry& e) { return !e.used; }),
+                   buffers_.end());
+
+    for (auto& e : buffers_) {
+        e.used = false;
+    }
+}
+
+void ImageBufferPool::clear()
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    buffers_.clear();
+    bytes_ = 0;
+}
+
+void ImageBufferPool::evict_excess()
+{
+    if (buffers_.size() > max_buffer_count_) {
+        auto end = buffers_.begin() + (buffers_.size() - max_buffer_count_);
+        for (auto it = buffers_.begin(); it != end; ++it) {
+            bytes_ -= it->data.capacity();
+        }
+        buffers_.erase(buffers_.begin(), end);
+    }
+    while (bytes_ > max_bytes_) {
+        bytes_ -= buffers_.back().data.capacity();
+        buffers_.pop_back();
+    }
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer&& other) noexcept :
+    pool_{other.pool_},
+    data_{std::move(other.data_)}
+{
+    other.data_.clear();
+}
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept
+{
+    if (this != &other) {
+        release();
+        pool_ = other.pool_;
+        data_ = std::move(other.data_);
+        other.data_.clear();
+    }
+    return *this;
+}
+
+void PooledBuffer::resize(std::size_t size)
+{
+    if (pool_ && data_.capacity() == 0) {
+        data_ = pool_->acquire(size);
+        return;
+    }
+    data_.resize(size);
+}
+
+void PooledBuffer::release()
+{
+    if (pool_) {
+        pool_->release(std::move(data_));
+    }
+    data_ = std::vector<std::uint8_t>{};
+}
+
+ImageBuffer::ImageBuffer(std::size_t size, ProducerCallback producer, ImageBufferPool* pool) :
     producer_{producer},
-    size_{size}
+    size_{size},
+    buffer_{pool}
 {
-    buffer_.resize(size_);
 }
 
 bool ImageBuffer::get_data(std::size_t size, std::uint8_t* out_data)
@@ -93,6 +241,10 @@ bool ImageBuffer::get_data(std::size_t size, std::uint8_t* out_data)
             aligned_size_to_read = align_multiple_ceil(size_to_read, last_read_multiple_);
         }
 
+        // the storage is acquired on first use so that the pool can be set after construction
+        if (buffer_.size() < size_) {
+            buffer_.resize(size_);
+        }
         got_data &= producer_(aligned_size_to_read, buffer_.data());
         curr_size_ = size_to_read;
 
@@ -107,4 +259,180 @@ bool ImageBuffer::get_data(std::size_t size, std::uint8_t* out_data)
     return got_data;
 }
 
+ReadAheadBuffer::ReadAheadBuffer(std::size_t chunk_size, std::uint64_t total_size,
+                                 std::size_t chunk_count, ProducerCallback producer) :
+    producer_{producer},
+    chunk_size_{chunk_size},
+    remaining_size_{total_size}
+{
+    if (chunk_size_ == 0 || chunk_count == 0) {
+        throw SaneException("Invalid read ahead buffer size");
+    }
+    if (::pipe(notify_pipe_) != 0) {
+        throw SaneException(SANE_STATUS_IO_ERROR, "Could not create pipe");
+    }
+    for (std::size_t i = 0; i < chunk_count; ++i) {
+        free_buffers_.emplace_back(chunk_size_);
+    }
+}
+
+ReadAheadBuffer::~ReadAheadBuffer()
+{
+    stop();
+    ::close(notify_pipe_[0]);
+    ::close(notify_pipe_[1]);
+}
+
+void ReadAheadBuffer::start()
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (started_ || stop_) {
+        return;
+    }
+    started_ = true;
+    thread_ = std::thread{[this]() { thread_main(); }};
+}
+
+std::size_t ReadAheadBuffer::available() const
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (stop_) {
+        return 0;
+    }
+    std::size_t size = curr_chunk_.data.size() - curr_chunk_offset_;
+    for (const auto& chunk : filled_chunks_) {
+        size += chunk.data.size();
+    }
+    return size;
+}
+
+bool ReadAheadBuffer::finished() const
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    return stop_ || finished_;
+}
+
+void ReadAheadBuffer::thread_main()
+{
+    auto notify = [this]()
+    {
+        std::uint8_t value = 0;
+        if (::write(notify_pipe_[1], &value, 1) != 1) {
+            DBG(DBG_error, "%s: could not write to notification pipe\n", __func__);
+        }
+        cond_.notify_all();
+    };
+
+    try {
+        bool got_data = true;
+        while (got_data && remaining_size_ > 0) {
+            Chunk chunk;
+            {
+                std::unique_lock<std::mutex> lock{mutex_};
+                cond_.wait(lock, [&]() { return stop_ || !free_buffers_.empty(); });
+                if (stop_) {
+                    return;
+                }
+                chunk.data = std::move(free_buffers_.back());
+                free_buffers_.pop_back();
+            }
+
+            auto size = std::min<std::uint64_t>(chunk_size_, remaining_size_);
+            remaining_size_ -= size;
+
+            chunk.data.resize(size);
+            got_data = producer_(size, chunk.data.data());
+            chunk.got_data = got_data;
+
+            std::lock_guard<std::mutex> lock{mutex_};
+            filled_chunks_.push_back(std::move(chunk));
+            notify();
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        exception_ = std::current_exception();
+    }
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    finished_ = true;
+    notify();
+}
+
+bool ReadAheadBuffer::wait_next_chunk()
+{
+    std::unique_lock<std::mutex> lock{mutex_};
+    cond_.wait(lock, [&]() { return stop_ || finished_ || !filled_chunks_.empty(); });
+
+    if (!stop_ && !filled_chunks_.empty()) {
+        curr_chunk_ = std::move(filled_chunks_.front());
+        curr_chunk_offset_ = 0;
+        filled_chunks_.pop_front();
+        return true;
+    }
+    if (exception_) {
+        std::rethrow_exception(exception_);
+    }
+    return false;
+}
+
+void ReadAheadBuffer::release_curr_chunk()
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    std::uint8_t value = 0;
+    if (::read(notify_pipe_[0], &value, 1) != 1) {
+        DBG(DBG_error, "%s: could not read from notification pipe\n", __func__);
+    }
+
+    free_buffers_.push_back(std::move(curr_chunk_.data));
+    curr_chunk_ = Chunk{};
+    curr_chunk_offset_ = 0;
+    cond_.notify_all();
+}
+
+bool ReadAheadBuffer::get_data(std::size_t size, std::uint8_t* out_data)
+{
+    start();
+
+    bool got_data = true;
+    while (size > 0) {
+        if (curr_chunk_offset_ == curr_chunk_.data.size()) {
+            if (!wait_next_chunk()) {
+                return false;
+            }
+            got_data &= curr_chunk_.got_data;
+        }
+
+        auto bytes_copy = std::min(size, curr_chunk_.data.size() - curr_chunk_offset_);
+        std::memcpy(out_data, curr_chunk_.data.data() + curr_chunk_offset_, bytes_copy);
+        out_data += bytes_copy;
+        size -= bytes_copy;
+        curr_chunk_offset_ += bytes_copy;
+
+        if (curr_chunk_offset_ == curr_chunk_.data.size()) {
+            release_curr_chunk();
+        }
+    }
+    return got_data;
+}
+
+void ReadAheadBuffer::request_stop()
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        stop_ = true;
+    }
+    cond_.notify_all();
+}
+
+void ReadAheadBuffer::stop()
+{
+    request_stop();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    curr_chunk_ = Chunk{};
+    curr_chunk_offset_ = 0;
+}
+
 } // namespace genesys
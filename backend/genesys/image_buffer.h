@@ -47,10 +47,110 @@
 #include "enums.h"
 #include "row_buffer.h"
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace genesys {
 
+// A pool of byte buffers that outlives individual image pipelines. Buffers released to the pool
+// are handed out again by later acquire() calls so that the memory used by the pipeline is
+// allocated only once across many scans. The pool holds at most a number of buffers and a number
+// of bytes. The class is thread-safe.
+class ImageBufferPool
+{
+public:
+    static constexpr std::size_t DEFAULT_MAX_BUFFER_COUNT = 32;
+    static constexpr std::size_t DEFAULT_MAX_BYTES = 64 * 1024 * 1024;
+
+    ImageBufferPool() = default;
+    ImageBufferPool(const ImageBufferPool&) = delete;
+    ImageBufferPool& operator=(const ImageBufferPool&) = delete;
+
+    // Returns a buffer of the given size. The smallest pooled buffer whose capacity is large
+    // enough, but not more than twice the size, is reused. If there is none, the largest pooled
+    // buffer that is too small is grown. The contents of the returned buffer are unspecified.
+    std::vector<std::uint8_t> acquire(std::size_t size);
+
+    // Returns the buffer to the pool. If the pool holds too many buffers, the smallest ones are
+    // freed. If it holds too many bytes, the largest ones are freed.
+    void release(std::vector<std::uint8_t>&& buffer);
+
+    std::size_t buffer_count() const;
+
+    // Returns the total capacity of the pooled buffers
+    std::size_t byte_count() const;
+
+    void set_max_buffer_count(std::size_t count);
+
+    void set_max_bytes(std::size_t bytes);
+
+    // Frees the pooled buffers that have not been released to the pool since the previous call.
+    // When called at the end of each scan, the pool keeps only what the last scan has used.
+    void evict_unused();
+
+    void clear();
+
+private:
+    struct Entry
+    {
+        explicit Entry(std::vector<std::uint8_t>&& buffer) : data{std::move(buffer)} {}
+
+        std::vector<std::uint8_t> data;
+        // whether the buffer has been released since the last evict_unused() call
+        bool used = true;
+    };
+
+    void evict_excess();
+
+    mutable std::mutex mutex_;
+    // sorted by capacity
+    std::vector<Entry> buffers_;
+    std::size_t bytes_ = 0;
+    std::size_t max_buffer_count_ = DEFAULT_MAX_BUFFER_COUNT;
+    std::size_t max_bytes_ = DEFAULT_MAX_BYTES;
+};
+
+// A byte buffer that takes its storage from an ImageBufferPool on first use and returns it on
+// destruction. Without a pool it behaves like a plain std::vector.
+class PooledBuffer
+{
+public:
+    PooledBuffer() = default;
+    explicit PooledBuffer(ImageBufferPool* pool) : pool_{pool} {}
+
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    PooledBuffer(PooledBuffer&& other) noexcept;
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+
+    ~PooledBuffer() { release(); }
+
+    // Sets the pool that the storage is returned to. Storage that has been already acquired is
+    // kept.
+    void set_pool(ImageBufferPool* pool) { pool_ = pool; }
+
+    // Changes the size of the buffer. Existing contents up to the new size are preserved.
+    void resize(std::size_t size);
+
+    std::uint8_t* data() { return data_.data(); }
+    const std::uint8_t* data() const { return data_.data(); }
+    std::size_t size() const { return data_.size(); }
+    bool empty() const { return data_.empty(); }
+
+    // Returns the storage to the pool
+    void release();
+
+private:
+    ImageBufferPool* pool_ = nullptr;
+    std::vector<std::uint8_t> data_;
+};
+
 // This class allows reading from row-based source in smaller or larger chunks of data
 class ImageBuffer
 {
@@ -59,7 +159,10 @@ public:
     static constexpr std::uint64_t BUFFER_SIZE_UNSET = std::numeric_limits<std::uint64_t>::max();
 
     ImageBuffer() {}
-    ImageBuffer(std::size_t size, ProducerCallback producer);
+    ImageBuffer(std::size_t size, ProducerCallback producer, ImageBufferPool* pool = nullptr);
+
+    // Sets the pool that the storage of the buffer is taken from
+    void set_pool(ImageBufferPool* pool) { buffer_.set_pool(pool); }
 
     std::size_t available() const { return curr_size_ - buffer_offset_; }
 
@@ -82,7 +185,79 @@ private:
     std::uint64_t last_read_multiple_ = BUFFER_SIZE_UNSET;
 
     std::size_t buffer_offset_ = 0;
-    std::vector<std::uint8_t> buffer_;
+    PooledBuffer buffer_;
+};
+
+// This class calls the producer from a separate thread so that up to chunk_count chunks of
+// chunk_size bytes are read ahead of the consumer. The producer is asked for total_size bytes
+// in total.
+class ReadAheadBuffer
+{
+public:
+    using ProducerCallback = std::function<bool(std::size_t size, std::uint8_t* out_data)>;
+
+    ReadAheadBuffer(std::size_t chunk_size, std::uint64_t total_size, std::size_t chunk_count,
+                    ProducerCallback producer);
+    ~ReadAheadBuffer();
+
+    ReadAheadBuffer(const ReadAheadBuffer&) = delete;
+    ReadAheadBuffer& operator=(const ReadAheadBuffer&) = delete;
+
+    // Starts the reader thread unless it has been already started. get_data() calls this as well.
+    void start();
+
+    // Returns the number of bytes that can be read without waiting for the reader thread
+    std::size_t available() const;
+
+    // Returns true if the reader thread won't produce any more data
+    bool finished() const;
+
+    // Returns a file descriptor that is readable whenever there is data available or the reader
+    // thread has finished
+    int get_select_fd() const { return notify_pipe_[0]; }
+
+    // Reads size bytes, waiting for the reader thread if needed. Returns false if the producer
+    // failed or reading has been stopped. Exceptions thrown by the producer are rethrown here.
+    bool get_data(std::size_t size, std::uint8_t* out_data);
+
+    // Asks the reader thread to stop without waiting for it
+    void request_stop();
+
+    // Stops the reader thread, waiting for the current call to the producer to complete. Any data
+    // that has been read ahead is discarded and subsequent reads will not return any data.
+    void stop();
+
+private:
+    struct Chunk
+    {
+        std::vector<std::uint8_t> data;
+        bool got_data = true;
+    };
+
+    void thread_main();
+    bool wait_next_chunk();
+    void release_curr_chunk();
+
+    ProducerCallback producer_;
+    std::size_t chunk_size_ = 0;
+    std::uint64_t remaining_size_ = 0;
+
+    // accessed only by the consumer
+    Chunk curr_chunk_;
+    std::size_t curr_chunk_offset_ = 0;
+
+    // The members below are shared with the reader thread and protected by mutex_. The pipe
+    // holds one byte for each chunk that has not been fully consumed and one for the end of data.
+    std::thread thread_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<Chunk> filled_chunks_;
+    std::vector<std::vector<std::uint8_t>> free_buffers_;
+    bool started_ = false;
+    bool stop_ = false;
+    bool finished_ = false;
+    std::exception_ptr exception_;
+    int notify_pipe_[2] = { -1, -1 };
 };
 
 } // namespace genesys
@@ -48,11 +48,62 @@
 #include "low.h"
 #include <cmath>
 #include <numeric>
+#include <type_traits>
+
+// The vectorized kernels rely on SSE2 being part of the x86-64 baseline and on per-function target
+// attributes for AVX2.
+#if defined(__x86_64__) && (defined(__clang__) || \
+    (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define GENESYS_HAS_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define GENESYS_HAS_X86_SIMD 0
+#endif
 
 namespace genesys {
 
 ImagePipelineNode::~ImagePipelineNode() {}
 
+bool ImagePipelineNode::get_next_rows(std::size_t count, std::uint8_t* out_data,
+                                      std::size_t row_stride)
+{
+    bool got_data = true;
+    for (std::size_t i = 0; i < count; ++i) {
+        got_data &= get_next_row_data(out_data + i * row_stride);
+    }
+    return got_data;
+}
+
+namespace {
+
+// Reads count rows from source into buffer so that the buffer afterwards contains history_rows
+// rows that were read previously followed by the count new rows. On the first read history_rows
+// additional rows are read from the source instead. buffer_rows tracks the number of rows in the
+// buffer across calls.
+bool read_rows_keeping_history(ImagePipelineNode& source, PooledBuffer& buffer,
+                               std::size_t& buffer_rows, std::size_t history_rows,
+                               std::size_t count)
+{
+    auto row_bytes = source.get_row_bytes();
+    std::size_t rows_to_read = count;
+
+    if (buffer_rows == 0) {
+        rows_to_read += history_rows;
+    } else if (history_rows > 0) {
+        std::memmove(buffer.data(), buffer.data() + (buffer_rows - history_rows) * row_bytes,
+                     history_rows * row_bytes);
+    }
+
+    buffer_rows = history_rows + count;
+    buffer.resize(buffer_rows * row_bytes);
+
+    return source.get_next_rows(rows_to_read,
+                                buffer.data() + (buffer_rows - rows_to_read) * row_bytes,
+                                row_bytes);
+}
+
+} // namespace
+
 bool ImagePipelineNodeCallableSource::get_next_row_data(std::uint8_t* out_data)
 {
     bool got_data = producer_(get_row_bytes(), out_data);
@@ -67,24 +118,95 @@ ImagePipelineNodeBufferedCallableSource::ImagePipelineNodeBufferedCallableSource
     width_{width},
     height_{height},
     format_{format},
-    buffer_{input_batch_size, producer}
+    buffer_{input_batch_size, producer},
+    input_batch_size_{input_batch_size}
 {
     buffer_.set_remaining_size(height_ * get_row_bytes());
 }
 
+ImagePipelineNodeBufferedCallableSource::~ImagePipelineNodeBufferedCallableSource()
+{
+    stop_read_ahead();
+}
+
+void ImagePipelineNodeBufferedCallableSource::set_remaining_bytes(std::size_t bytes)
+{
+    if (read_ahead_) {
+        throw SaneException("Can't adjust remaining bytes after reading ahead has started");
+    }
+    buffer_.set_remaining_size(bytes);
+}
+
+void ImagePipelineNodeBufferedCallableSource::enable_read_ahead(std::size_t chunk_count)
+{
+    if (read_ahead_) {
+        throw SaneException("Reading ahead has already started");
+    }
+    read_ahead_chunk_count_ = chunk_count;
+}
+
+void ImagePipelineNodeBufferedCallableSource::stop_read_ahead()
+{
+    if (read_ahead_) {
+        read_ahead_->stop();
+    }
+}
+
+void ImagePipelineNodeBufferedCallableSource::request_stop_read_ahead()
+{
+    if (read_ahead_) {
+        read_ahead_->request_stop();
+    }
+}
+
 bool ImagePipelineNodeBufferedCallableSource::get_next_row_data(std::uint8_t* out_data)
 {
-    if (curr_row_ >= get_height()) {
-        DBG(DBG_warn, "%s: reading out of bounds. Row %zu, height: %zu\n", __func__,
-            curr_row_, get_height());
-        eof_ = true;
-        return false;
+    return get_next_rows(1, out_data, get_row_bytes());
+}
+
+bool ImagePipelineNodeBufferedCallableSource::get_next_rows(std::size_t count,
+                                                            std::uint8_t* out_data,
+                                                            std::size_t row_stride)
+{
+    auto height = get_height();
+    auto row_bytes = get_row_bytes();
+    auto read_rows = curr_row_ < height ? std::min(count, height - curr_row_) : 0;
+
+    if (read_ahead_chunk_count_ > 0 && !read_ahead_) {
+        // the reader thread reads whole rows through buffer_
+        auto chunk_size = std::max<std::size_t>(1, input_batch_size_ / row_bytes) * row_bytes;
+        read_ahead_.reset(new ReadAheadBuffer(chunk_size, (height - curr_row_) * row_bytes,
+                                              read_ahead_chunk_count_,
+                                              [this](std::size_t size, std::uint8_t* data)
+        {
+            return buffer_.get_data(size, data);
+        }));
     }
 
+    auto get_data = [&](std::size_t size, std::uint8_t* data)
+    {
+        if (read_ahead_) {
+            return read_ahead_->get_data(size, data);
+        }
+        return buffer_.get_data(size, data);
+    };
+
     bool got_data = true;
 
-    got_data &= buffer_.get_data(get_row_bytes(), out_data);
-    curr_row_++;
+    if (row_stride == row_bytes) {
+        got_data &= get_data(row_bytes * read_rows, out_data);
+    } else {
+        for (std::size_t i = 0; i < read_rows; ++i) {
+            got_data &= get_data(row_bytes, out_data + i * row_stride);
+        }
+    }
+    curr_row_ += read_rows;
+
+    if (read_rows < count) {
+        DBG(DBG_warn, "%s: reading out of bounds. Row %zu, height: %zu\n", __func__,
+            curr_row_, height);
+        got_data = false;
+    }
     if (!got_data) {
         eof_ = true;
     }
@@ -109,15 +231,29 @@ ImagePipelineNodeArraySource::ImagePipelineNodeArraySource(std::size_t width, st
 
 bool ImagePipelineNodeArraySource::get_next_row_data(std::uint8_t* out_data)
 {
-    if (next_row_ >= height_) {
-        eof_ = true;
-        return false;
-    }
+    return get_next_rows(1, out_data, get_row_bytes());
+}
 
+bool ImagePipelineNodeArraySource::get_next_rows(std::size_t count, std::uint8_t* out_data,
+                                                 std::size_t row_stride)
+{
     auto row_bytes = get_row_bytes();
-    std::memcpy(out_data, data_.data() + row_bytes * next_row_, row_bytes);
-    next_row_++;
+    auto read_rows = next_row_ < height_ ? std::min(count, height_ - next_row_) : 0;
+    const auto* in_data = data_.data() + row_bytes * next_row_;
 
+    if (row_stride == row_bytes) {
+        std::memcpy(out_data, in_data, row_bytes * read_rows);
+    } else {
+        for (std::size_t i = 0; i < read_rows; ++i) {
+            std::memcpy(out_data + i * row_stride, in_data + i * row_bytes, row_bytes);
+        }
+    }
+    next_row_ += read_rows;
+
+    if (read_rows < count) {
+        eof_ = true;
+        return false;
+    }
     return true;
 }
 
@@ -128,29 +264,75 @@ ImagePipelineNodeImageSource::ImagePipelineNodeImageSource(const Image& source)
 
 bool ImagePipelineNodeImageSource::get_next_row_data(std::uint8_t* out_data)
 {
-    if (next_row_ >= get_height()) {
-        return false;
+    return get_next_rows(1, out_data, get_row_bytes());
+}
+
+bool ImagePipelineNodeImageSource::get_next_rows(std::size_t count, std::uint8_t* out_data,
+                                                 std::size_t row_stride)
+{
+    auto height = get_height();
+    auto row_bytes = get_row_bytes();
+    auto read_rows = next_row_ < height ? std::min(count, height - next_row_) : 0;
+
+    for (std::size_t i = 0; i < read_rows; ++i) {
+        std::memcpy(out_data + i * row_stride, source_.get_row_ptr(next_row_ + i), row_bytes);
     }
-    std::memcpy(out_data, source_.get_row_ptr(next_row_), get_row_bytes());
-    next_row_++;
-    return true;
+    next_row_ += read_rows;
+
+    return read_rows == count;
 }
 
 bool ImagePipelineNodeFormatConvert::get_next_row_data(std::uint8_t* out_data)
+{
+    return get_next_rows(1, out_data, get_row_bytes());
+}
+
+bool ImagePipelineNodeFormatConvert::get_next_rows(std::size_t count, std::uint8_t* out_data,
+                                                   std::size_t row_stride)
 {
     auto src_format = source_.get_format();
     if (src_format == dst_format_) {
-        return source_.get_next_row_data(out_data);
+        return source_.get_next_rows(count, out_data, row_stride);
     }
 
-    buffer_.clear();
-    buffer_.resize(source_.get_row_bytes());
-    bool got_data = source_.get_next_row_data(buffer_.data());
+    auto src_row_bytes = source_.get_row_bytes();
+    buffer_.resize(src_row_bytes * count);
+    bool got_data = source_.get_next_rows(count, buffer_.data(), src_row_bytes);
 
-    convert_pixel_row_format(buffer_.data(), src_format, out_data, dst_format_, get_width());
+    for (std::size_t i = 0; i < count; ++i) {
+        convert_pixel_row_format(buffer_.data() + i * src_row_bytes, src_format,
+                                 out_data + i * row_stride, dst_format_, get_width());
+    }
     return got_data;
 }
 
+template<PixelFormat Format>
+struct ImagePipelineNodeDesegment::RowKernel
+{
+    using Function = RowKernelFunction;
+
+    static void apply(const ImagePipelineNodeDesegment& node,
+                      const std::uint8_t* in_data, std::uint8_t* out_data)
+    {
+        auto segment_count = node.segment_order_.size();
+        auto pixels_per_chunk = node.pixels_per_chunk_;
+        std::size_t groups_count = node.output_width_ / (segment_count * pixels_per_chunk);
+
+        for (std::size_t igroup = 0; igroup < groups_count; ++igroup) {
+            for (std::size_t isegment = 0; isegment < segment_count; ++isegment) {
+                auto input_offset = igroup * pixels_per_chunk;
+                input_offset += node.segment_pixels_ * node.segment_order_[isegment];
+                auto output_offset = (igroup * segment_count + isegment) * pixels_per_chunk;
+
+                for (std::size_t ipixel = 0; ipixel < pixels_per_chunk; ++ipixel) {
+                    auto pixel = get_raw_pixel_from_row<Format>(in_data, input_offset + ipixel);
+                    set_raw_pixel_to_row<Format>(out_data, output_offset + ipixel, pixel);
+                }
+            }
+        }
+    }
+};
+
 ImagePipelineNodeDesegment::ImagePipelineNodeDesegment(ImagePipelineNode& source,
                                                        std::size_t output_width,
                                                        const std::vector<unsigned>& segment_order,
@@ -162,8 +344,7 @@ ImagePipelineNodeDesegment::ImagePipelineNodeDesegment(ImagePipelineNode& source
     segment_order_{segment_order},
     segment_pixels_{segment_pixels},
     interleaved_lines_{interleaved_lines},
-    pixels_per_chunk_{pixels_per_chunk},
-    buffer_{source_.get_row_bytes()}
+    pixels_per_chunk_{pixels_per_chunk}
 {
     DBG_HELPER_ARGS(dbg, "segment_count=%zu, segment_size=%zu, interleaved_lines=%zu, "
                          "pixels_per_shunk=%zu", segment_order.size(), segment_pixels,
@@ -173,6 +354,7 @@ ImagePipelineNodeDesegment::ImagePipelineNodeDesegment(ImagePipelineNode& source
         throw SaneException("Height is not a multiple of the number of lines to interelave %zu/%zu",
                             source_.get_height(), interleaved_lines_);
     }
+    row_kernel_ = select_pixel_format_kernel<RowKernel>(get_format());
 }
 
 ImagePipelineNodeDesegment::ImagePipelineNodeDesegment(ImagePipelineNode& source,
@@ -185,8 +367,7 @@ ImagePipelineNodeDesegment::ImagePipelineNodeDesegment(ImagePipelineNode& source
     output_width_{output_width},
     segment_pixels_{segment_pixels},
     interleaved_lines_{interleaved_lines},
-    pixels_per_chunk_{pixels_per_chunk},
-    buffer_{source_.get_row_bytes()}
+    pixels_per_chunk_{pixels_per_chunk}
 {
     DBG_HELPER_ARGS(dbg, "segment_count=%zu, segment_size=%zu, interleaved_lines=%zu, "
                     "pixels_per_shunk=%zu", segment_count, segment_pixels, interleaved_lines,
@@ -194,39 +375,27 @@ ImagePipelineNodeDesegment::ImagePipelineNodeDesegment(ImagePipelineNode& source
 
     segment_order_.resize(segment_count);
     std::iota(segment_order_.begin(), segment_order_.end(), 0);
+    row_kernel_ = select_pixel_format_kernel<RowKernel>(get_format());
 }
 
 bool ImagePipelineNodeDesegment::get_next_row_data(uint8_t* out_data)
 {
-    bool got_data = true;
-
-    buffer_.clear();
-    for (std::size_t i = 0; i < interleaved_lines_; ++i) {
-        buffer_.push_back();
-        got_data &= source_.get_next_row_data(buffer_.get_row_ptr(i));
-    }
-    if (!buffer_.is_linear()) {
-        throw SaneException("Buffer is not linear");
-    }
-
-    auto format = get_format();
-    auto segment_count = segment_order_.size();
-
-    const std::uint8_t* in_data = buffer_.get_row_ptr(0);
+    return get_next_rows(1, out_data, get_row_bytes());
+}
 
-    std::size_t groups_count = output_width_ / (segment_order_.size() * pixels_per_chunk_);
+bool ImagePipelineNodeDesegment::get_next_rows(std::size_t count, std::uint8_t* out_data,
+                                               std::size_t row_stride)
+{
+    // the interleaved lines of each output row are read into consecutive memory
+    auto src_row_bytes = source_.get_row_bytes();
+    auto src_block_bytes = src_row_bytes * interleaved_lines_;
 
-    for (std::size_t igroup = 0; igroup < groups_count; ++igroup) {
-        for (std::size_t isegment = 0; isegment < segment_count; ++isegment) {
-            auto input_offset = igroup * pixels_per_chunk_;
-            input_offset += segment_pixels_ * segment_order_[isegment];
-            auto output_offset = (igroup * segment_count + isegment) * pixels_per_chunk_;
+    buffer_.resize(src_block_bytes * count);
+    bool got_data = source_.get_next_rows(count * interleaved_lines_, buffer_.data(),
+                                          src_row_bytes);
 
-            for (std::size_t ipixel = 0; ipixel < pixels_per_chunk_; ++ipixel) {
-                auto pixel = get_raw_pixel_from_row(in_data, input_offset + ipixel, format);
-                set_raw_pixel_to_row(out_data, output_offset + ipixel, pixel, format);
-            }
-        }
+    for (std::size_t irow = 0; irow < count; ++irow) {
+        row_kernel_(*this, buffer_.data() + irow * src_block_bytes, out_data + irow * row_stride);
     }
     return got_data;
 }
@@ -251,12 +420,21 @@ ImagePipelineNodeSwap16BitEndian::ImagePipelineNodeSwap16BitEndian(ImagePipeline
 
 bool ImagePipelineNodeSwap16BitEndian::get_next_row_data(std::uint8_t* out_data)
 {
-    bool got_data = source_.get_next_row_data(out_data);
+    return get_next_rows(1, out_data, get_row_bytes());
+}
+
+bool ImagePipelineNodeSwap16BitEndian::get_next_rows(std::size_t count, std::uint8_t* out_data,
+                                                     std::size_t row_stride)
+{
+    bool got_data = source_.get_next_rows(count, out_data, row_stride);
     if (needs_swapping_) {
         std::size_t pixels = get_row_bytes() / 2;
-        for (std::size_t i = 0; i < pixels; ++i) {
-            std::swap(*out_data, *(out_data + 1));
-            out_data += 2;
+        for (std::size_t irow = 0; irow < count; ++irow) {
+            std::uint8_t* data = out_data + irow * row_stride;
+            for (std::size_t i = 0; i < pixels; ++i) {
+                std::swap(*data, *(data + 1));
+                data += 2;
+            }
         }
     }
     return got_data;
@@ -269,33 +447,45 @@ ImagePipelineNodeInvert::ImagePipelineNodeInvert(ImagePipelineNode& source) :
 
 bool ImagePipelineNodeInvert::get_next_row_data(std::uint8_t* out_data)
 {
-    bool got_data = source_.get_next_row_data(out_data);
+    return get_next_rows(1, out_data, get_row_bytes());
+}
+
+bool ImagePipelineNodeInvert::get_next_rows(std::size_t count, std::uint8_t* out_data,
+                                            std::size_t row_stride)
+{
+    bool got_data = source_.get_next_rows(count, out_data, row_stride);
     auto num_values = get_width() * get_pixel_channels(source_.get_format());
     auto depth = get_pixel_format_depth(source_.get_format());
 
     switch (depth) {
         case 16: {
-            auto* data = reinterpret_cast<std::uint16_t*>(out_data);
-            for (std::size_t i = 0; i < num_values; ++i) {
-                *data = 0xffff - *data;
-                data++;
+            for (std::size_t irow = 0; irow < count; ++irow) {
+                auto* data = reinterpret_cast<std::uint16_t*>(out_data + irow * row_stride);
+                for (std::size_t i = 0; i < num_values; ++i) {
+                    *data = 0xffff - *data;
+                    data++;
+                }
             }
             break;
         }
         case 8: {
-            auto* data = out_data;
-            for (std::size_t i = 0; i < num_values; ++i) {
-                *data = 0xff - *data;
-                data++;
+            for (std::size_t irow = 0; irow < count; ++irow) {
+                auto* data = out_data + irow * row_stride;
+                for (std::size_t i = 0; i < num_values; ++i) {
+                    *data = 0xff - *data;
+                    data++;
+                }
             }
             break;
         }
         case 1: {
-            auto* data = out_data;
             auto num_bytes = (num_values + 7) / 8;
-            for (std::size_t i = 0; i < num_bytes; ++i) {
-                *data = ~*data;
-                data++;
+            for (std::size_t irow = 0; irow < count; ++irow) {
+                auto* data = out_data + irow * row_stride;
+                for (std::size_t i = 0; i < num_bytes; ++i) {
+                    *data = ~*data;
+                    data++;
+                }
             }
             break;
         }
@@ -306,39 +496,59 @@ bool ImagePipelineNodeInvert::get_next_row_data(std::uint8_t* out_data)
     return got_data;
 }
 
+template<PixelFormat Format>
+struct ImagePipelineNodeMergeMonoLines::RowKernel
+{
+    using Function = RowKernelFunction;
+
+    // the output is written as RGB, BGR differs only in the interpretation of the channels
+    static constexpr PixelFormat OutputFormat =
+            PixelFormatTraits<Format>::depth == 1 ? PixelFormat::RGB111 :
+            PixelFormatTraits<Format>::depth == 8 ? PixelFormat::RGB888 : PixelFormat::RGB161616;
+
+    static void apply(std::size_t width, const std::uint8_t* row0, const std::uint8_t* row1,
+                      const std::uint8_t* row2, std::uint8_t* out_data)
+    {
+        for (std::size_t x = 0; x < width; ++x) {
+            std::uint16_t ch0 = get_raw_channel_from_row<Format>(row0, x, 0);
+            std::uint16_t ch1 = get_raw_channel_from_row<Format>(row1, x, 0);
+            std::uint16_t ch2 = get_raw_channel_from_row<Format>(row2, x, 0);
+            set_raw_channel_to_row<OutputFormat>(out_data, x, 0, ch0);
+            set_raw_channel_to_row<OutputFormat>(out_data, x, 1, ch1);
+            set_raw_channel_to_row<OutputFormat>(out_data, x, 2, ch2);
+        }
+    }
+};
+
 ImagePipelineNodeMergeMonoLines::ImagePipelineNodeMergeMonoLines(ImagePipelineNode& source,
                                                                  ColorOrder color_order) :
-    source_(source),
-    buffer_(source_.get_row_bytes())
+    source_(source)
 {
     DBG_HELPER_ARGS(dbg, "color_order %d", static_cast<unsigned>(color_order));
 
     output_format_ = get_output_format(source_.get_format(), color_order);
+    row_kernel_ = select_pixel_format_kernel<RowKernel>(source_.get_format());
 }
 
 bool ImagePipelineNodeMergeMonoLines::get_next_row_data(std::uint8_t* out_data)
 {
-    bool got_data = true;
-
-    buffer_.clear();
-    for (unsigned i = 0; i < 3; ++i) {
-        buffer_.push_back();
-        got_data &= source_.get_next_row_data(buffer_.get_row_ptr(i));
-    }
+    return get_next_rows(1, out_data, get_row_bytes());
+}
 
-    const auto* row0 = buffer_.get_row_ptr(0);
-    const auto* row1 = buffer_.get_row_ptr(1);
-    const auto* row2 = buffer_.get_row_ptr(2);
+bool ImagePipelineNodeMergeMonoLines::get_next_rows(std::size_t count, std::uint8_t* out_data,
+                                                    std::size_t row_stride)
+{
+    auto src_row_bytes = source_.get_row_bytes();
+    buffer_.resize(src_row_bytes * 3 * count);
+    bool got_data = source_.get_next_rows(count * 3, buffer_.data(), src_row_bytes);
 
-    auto format = source_.get_format();
+    auto width = get_width();
 
-    for (std::size_t x = 0, width = get_width(); x < width; ++x) {
-        std::uint16_t ch0 = get_raw_channel_from_row(row0, x, 0, format);
-        std::uint16_t ch1 = get_raw_channel_from_row(row1, x, 0, format);
-        std::uint16_t ch2 = get_raw_channel_from_row(row2, x, 0, format);
-        set_raw_channel_to_row(out_data, x, 0, ch0, output_format_);
-        set_raw_channel_to_row(out_data, x, 1, ch1, output_format_);
-        set_raw_channel_to_row(out_data, x, 2, ch2, output_format_);
+    for (std::size_t irow = 0; irow < count; ++irow) {
+        const auto* row0 = buffer_.data() + (irow * 3) * src_row_bytes;
+        const auto* row1 = row0 + src_row_bytes;
+        const auto* row2 = row1 + src_row_bytes;
+        row_kernel_(width, row0, row1, row2, out_data + irow * row_stride);
     }
     return got_data;
 }
@@ -419,10 +629,28 @@ PixelFormat ImagePipelineNodeSplitMonoLines::get_output_format(PixelFormat input
     throw SaneException("Unsupported input format %d", static_cast<unsigned>(input_format));
 }
 
+template<PixelFormat Format>
+struct ImagePipelineNodeComponentShiftLines::RowKernel
+{
+    using Function = RowKernelFunction;
+
+    static void apply(std::size_t width, const std::uint8_t* row0, const std::uint8_t* row1,
+                      const std::uint8_t* row2, std::uint8_t* out_data)
+    {
+        for (std::size_t x = 0; x < width; ++x) {
+            std::uint16_t ch0 = get_raw_channel_from_row<Format>(row0, x, 0);
+            std::uint16_t ch1 = get_raw_channel_from_row<Format>(row1, x, 1);
+            std::uint16_t ch2 = get_raw_channel_from_row<Format>(row2, x, 2);
+            set_raw_channel_to_row<Format>(out_data, x, 0, ch0);
+            set_raw_channel_to_row<Format>(out_data, x, 1, ch1);
+            set_raw_channel_to_row<Format>(out_data, x, 2, ch2);
+        }
+    }
+};
+
 ImagePipelineNodeComponentShiftLines::ImagePipelineNodeComponentShiftLines(
         ImagePipelineNode& source, unsigned shift_r, unsigned shift_g, unsigned shift_b) :
-    source_(source),
-    buffer_{source.get_row_bytes()}
+    source_(source)
 {
     DBG_HELPER_ARGS(dbg, "shifts={%d, %d, %d}", shift_r, shift_g, shift_b);
 
@@ -449,41 +677,55 @@ ImagePipelineNodeComponentShiftLines::ImagePipelineNodeComponentShiftLines(
     } else {
         height_ -= extra_height_;
     }
+    row_kernel_ = select_pixel_format_kernel<RowKernel>(get_format());
 }
 
 bool ImagePipelineNodeComponentShiftLines::get_next_row_data(std::uint8_t* out_data)
 {
-    bool got_data = true;
+    return get_next_rows(1, out_data, get_row_bytes());
+}
 
-    if (!buffer_.empty()) {
-        buffer_.pop_front();
-    }
-    while (buffer_.height() < extra_height_ + 1) {
-        buffer_.push_back();
-        got_data &= source_.get_next_row_data(buffer_.get_back_row_ptr());
-    }
+bool ImagePipelineNodeComponentShiftLines::get_next_rows(std::size_t count,
+                                                         std::uint8_t* out_data,
+                                                         std::size_t row_stride)
+{
+    bool got_data = read_rows_keeping_history(source_, buffer_, buffer_rows_, extra_height_,
+                                              count);
 
-    auto format = get_format();
-    const auto* row0 = buffer_.get_row_ptr(channel_shifts_[0]);
-    const auto* row1 = buffer_.get_row_ptr(channel_shifts_[1]);
-    const auto* row2 = buffer_.get_row_ptr(channel_shifts_[2]);
+    auto width = get_width();
+    auto src_row_bytes = source_.get_row_bytes();
 
-    for (std::size_t x = 0, width = get_width(); x < width; ++x) {
-        std::uint16_t ch0 = get_raw_channel_from_row(row0, x, 0, format);
-        std::uint16_t ch1 = get_raw_channel_from_row(row1, x, 1, format);
-        std::uint16_t ch2 = get_raw_channel_from_row(row2, x, 2, format);
-        set_raw_channel_to_row(out_data, x, 0, ch0, format);
-        set_raw_channel_to_row(out_data, x, 1, ch1, format);
-        set_raw_channel_to_row(out_data, x, 2, ch2, format);
+    for (std::size_t irow = 0; irow < count; ++irow) {
+        const auto* row0 = buffer_.data() + (irow + channel_shifts_[0]) * src_row_bytes;
+        const auto* row1 = buffer_.data() + (irow + channel_shifts_[1]) * src_row_bytes;
+        const auto* row2 = buffer_.data() + (irow + channel_shifts_[2]) * src_row_bytes;
+        row_kernel_(width, row0, row1, row2, out_data + irow * row_stride);
     }
     return got_data;
 }
 
+template<PixelFormat Format>
+struct ImagePipelineNodePixelShiftLines::RowKernel
+{
+    using Function = RowKernelFunction;
+
+    static void apply(std::size_t width, const std::uint8_t* const* rows, std::size_t row_count,
+                      std::uint8_t* out_data)
+    {
+        for (std::size_t x = 0; x < width;) {
+            for (std::size_t irow = 0; irow < row_count && x < width; irow++, x++) {
+                RawPixel pixel = get_raw_pixel_from_row<Format>(rows[irow], x);
+                set_raw_pixel_to_row<Format>(out_data, x, pixel);
+            }
+        }
+    }
+};
+
 ImagePipelineNodePixelShiftLines::ImagePipelineNodePixelShiftLines(
         ImagePipelineNode& source, const std::vector<std::size_t>& shifts) :
     source_(source),
     pixel_shifts_{shifts},
-    buffer_{get_row_bytes()}
+    rows_(shifts.size(), nullptr)
 {
     extra_height_ = *std::max_element(pixel_shifts_.begin(), pixel_shifts_.end());
     height_ = source_.get_height();
@@ -492,39 +734,52 @@ ImagePipelineNodePixelShiftLines::ImagePipelineNodePixelShiftLines(
     } else {
         height_ -= extra_height_;
     }
+    row_kernel_ = select_pixel_format_kernel<RowKernel>(get_format());
 }
 
 bool ImagePipelineNodePixelShiftLines::get_next_row_data(std::uint8_t* out_data)
 {
-    bool got_data = true;
+    return get_next_rows(1, out_data, get_row_bytes());
+}
 
-    if (!buffer_.empty()) {
-        buffer_.pop_front();
-    }
-    while (buffer_.height() < extra_height_ + 1) {
-        buffer_.push_back();
-        got_data &= source_.get_next_row_data(buffer_.get_back_row_ptr());
-    }
+bool ImagePipelineNodePixelShiftLines::get_next_rows(std::size_t count, std::uint8_t* out_data,
+                                                     std::size_t row_stride)
+{
+    bool got_data = read_rows_keeping_history(source_, buffer_, buffer_rows_, extra_height_,
+                                              count);
 
-    auto format = get_format();
+    auto width = get_width();
     auto shift_count = pixel_shifts_.size();
+    auto src_row_bytes = source_.get_row_bytes();
 
-    std::vector<std::uint8_t*> rows;
-    rows.resize(shift_count, nullptr);
-
-    for (std::size_t irow = 0; irow < shift_count; ++irow) {
-        rows[irow] = buffer_.get_row_ptr(pixel_shifts_[irow]);
-    }
-
-    for (std::size_t x = 0, width = get_width(); x < width;) {
-        for (std::size_t irow = 0; irow < shift_count && x < width; irow++, x++) {
-            RawPixel pixel = get_raw_pixel_from_row(rows[irow], x, format);
-            set_raw_pixel_to_row(out_data, x, pixel, format);
+    for (std::size_t i = 0; i < count; ++i) {
+        for (std::size_t irow = 0; irow < shift_count; ++irow) {
+            rows_[irow] = buffer_.data() + (i + pixel_shifts_[irow]) * src_row_bytes;
         }
+        row_kernel_(width, rows_.data(), shift_count, out_data + i * row_stride);
     }
     return got_data;
 }
 
+template<PixelFormat Format>
+struct ImagePipelineNodePixelShiftColumns::RowKernel
+{
+    using Function = RowKernelFunction;
+
+    static void apply(std::size_t width, const std::uint8_t* in_data,
+                      const std::vector<std::size_t>& shifts, std::uint8_t* out_data)
+    {
+        auto shift_count = shifts.size();
+
+        for (std::size_t x = 0; x < width; x += shift_count) {
+            for (std::size_t ishift = 0; ishift < shift_count && x + ishift < width; ishift++) {
+                RawPixel pixel = get_raw_pixel_from_row<Format>(in_data, x + shifts[ishift]);
+                set_raw_pixel_to_row<Format>(out_data, x + ishift, pixel);
+            }
+        }
+    }
+};
+
 ImagePipelineNodePixelShiftColumns::ImagePipelineNodePixelShiftColumns(
         ImagePipelineNode& source, const std::vector<std::size_t>& shifts) :
     source_(source),
@@ -537,25 +792,29 @@ ImagePipelineNodePixelShiftColumns::ImagePipelineNodePixelShiftColumns(
     } else {
         width_ -= extra_width_;
     }
-    temp_buffer_.resize(source_.get_row_bytes());
+    row_kernel_ = select_pixel_format_kernel<RowKernel>(get_format());
 }
 
 bool ImagePipelineNodePixelShiftColumns::get_next_row_data(std::uint8_t* out_data)
+{
+    return get_next_rows(1, out_data, get_row_bytes());
+}
+
+bool ImagePipelineNodePixelShiftColumns::get_next_rows(std::size_t count, std::uint8_t* out_data,
+                                                       std::size_t row_stride)
 {
     if (width_ == 0) {
         throw SaneException("Attempt to read zero-width line");
     }
-    bool got_data = source_.get_next_row_data(temp_buffer_.data());
+    auto src_row_bytes = source_.get_row_bytes();
+    temp_buffer_.resize(src_row_bytes * count);
+    bool got_data = source_.get_next_rows(count, temp_buffer_.data(), src_row_bytes);
 
-    auto format = get_format();
-    auto shift_count = pixel_shifts_.size();
+    auto width = get_width();
 
-    for (std::size_t x = 0, width = get_width(); x < width; x += shift_count) {
-        for (std::size_t ishift = 0; ishift < shift_count && x + ishift < width; ishift++) {
-            RawPixel pixel = get_raw_pixel_from_row(temp_buffer_.data(), x + pixel_shifts_[ishift],
-                                                    format);
-            set_raw_pixel_to_row(out_data, x + ishift, pixel, format);
-        }
+    for (std::size_t irow = 0; irow < count; ++irow) {
+        row_kernel_(width, temp_buffer_.data() + irow * src_row_bytes, pixel_shifts_,
+                    out_data + irow * row_stride);
     }
     return got_data;
 }
@@ -590,9 +849,7 @@ ImagePipelineNodeExtract::ImagePipelineNodeExtract(ImagePipelineNode& source,
     offset_y_{offset_y},
     width_{width},
     height_{height}
-{
-    cached_line_.resize(source_.get_row_bytes());
-}
+{}
 
 ImagePipelineNodeExtract::~ImagePipelineNodeExtract() {}
 
@@ -600,64 +857,252 @@ ImagePipelineNodeScaleRows::ImagePipelineNodeScaleRows(ImagePipelineNode& source
                                                        std::size_t width) :
     source_(source),
     width_{width}
+{}
+
+bool ImagePipelineNodeScaleRows::get_next_row_data(std::uint8_t* out_data)
 {
-    cached_line_.resize(source_.get_row_bytes());
+    return get_next_rows(1, out_data, get_row_bytes());
 }
 
-bool ImagePipelineNodeScaleRows::get_next_row_data(std::uint8_t* out_data)
+bool ImagePipelineNodeScaleRows::get_next_rows(std::size_t count, std::uint8_t* out_data,
+                                               std::size_t row_stride)
 {
     auto src_width = source_.get_width();
     auto dst_width = width_;
 
-    bool got_data = source_.get_next_row_data(cached_line_.data());
+    auto src_row_bytes = source_.get_row_bytes();
+    cached_line_.resize(src_row_bytes * count);
+    bool got_data = source_.get_next_rows(count, cached_line_.data(), src_row_bytes);
 
-    const auto* src_data = cached_line_.data();
     auto format = get_format();
     auto channels = get_pixel_channels(format);
 
-    if (src_width > dst_width) {
-        // average
-        std::uint32_t counter = src_width / 2;
-        unsigned src_x = 0;
-        for (unsigned dst_x = 0; dst_x < dst_width; dst_x++) {
-            unsigned avg[3] = {0, 0, 0};
-            unsigned count = 0;
-            while (counter < src_width && src_x < src_width) {
-                counter += dst_width;
+    for (std::size_t irow = 0; irow < count; ++irow) {
+        const auto* src_data = cached_line_.data() + irow * src_row_bytes;
+        auto* out_row = out_data + irow * row_stride;
+
+        if (src_width > dst_width) {
+            // average
+            std::uint32_t counter = src_width / 2;
+            unsigned src_x = 0;
+            for (unsigned dst_x = 0; dst_x < dst_width; dst_x++) {
+                unsigned avg[3] = {0, 0, 0};
+                unsigned avg_count = 0;
+                while (counter < src_width && src_x < src_width) {
+                    counter += dst_width;
+
+                    for (unsigned c = 0; c < channels; c++) {
+                        avg[c] += get_raw_channel_from_row(src_data, src_x, c, format);
+                    }
+
+                    src_x++;
+                    avg_count++;
+                }
+                counter -= src_width;
+
+                for (unsigned c = 0; c < channels; c++) {
+                    set_raw_channel_to_row(out_row, dst_x, c, avg[c] / avg_count, format);
+                }
+            }
+        } else {
+            // interpolate and copy pixels
+            std::uint32_t counter = dst_width / 2;
+            unsigned dst_x = 0;
 
+            for (unsigned src_x = 0; src_x < src_width; src_x++) {
+                unsigned avg[3] = {0, 0, 0};
                 for (unsigned c = 0; c < channels; c++) {
                     avg[c] += get_raw_channel_from_row(src_data, src_x, c, format);
                 }
+                while ((counter < dst_width || src_x + 1 == src_width) && dst_x < dst_width) {
+                    counter += src_width;
 
-                src_x++;
-                count++;
+                    for (unsigned c = 0; c < channels; c++) {
+                        set_raw_channel_to_row(out_row, dst_x, c, avg[c], format);
+                    }
+                    dst_x++;
+                }
+                counter -= dst_width;
             }
-            counter -= src_width;
+        }
+    }
+    return got_data;
+}
+
+ResampleFilter get_default_resample_filter(std::size_t src_size, std::size_t dst_size)
+{
+    return src_size > dst_size ? ResampleFilter::BOX : ResampleFilter::BILINEAR;
+}
+
+constexpr unsigned ResampleWeights::WEIGHT_SHIFT;
+constexpr std::uint32_t ResampleWeights::WEIGHT_ONE;
+
+ResampleWeights compute_resample_weights(std::size_t src_size, std::size_t dst_size,
+                                         ResampleFilter filter)
+{
+    if (src_size == 0 || dst_size == 0) {
+        throw SaneException("Invalid resample size %zu %zu", src_size, dst_size);
+    }
 
-            for (unsigned c = 0; c < channels; c++) {
-                set_raw_channel_to_row(out_data, dst_x, c, avg[c] / count, format);
+    ResampleWeights ret;
+    ret.first.reserve(dst_size);
+    ret.offsets.reserve(dst_size + 1);
+    ret.offsets.push_back(0);
+
+    double scale = static_cast<double>(src_size) / dst_size;
+    std::vector<double> taps;
+    std::vector<std::int64_t> quantized;
+
+    for (std::size_t i = 0; i < dst_size; ++i) {
+        std::size_t first = 0;
+        taps.clear();
+
+        if (filter == ResampleFilter::BOX) {
+            double start = i * scale;
+            double end = (i + 1) * scale;
+            first = static_cast<std::size_t>(std::floor(start));
+            auto last = std::min(src_size, static_cast<std::size_t>(std::ceil(end)));
+            for (std::size_t k = first; k < last; ++k) {
+                double overlap = std::min(end, k + 1.0) - std::max(start, static_cast<double>(k));
+                taps.push_back(overlap / scale);
             }
+        } else {
+            // pixel centers are aligned
+            double x = (i + 0.5) * scale - 0.5;
+            x = clamp(x, 0.0, static_cast<double>(src_size - 1));
+            first = static_cast<std::size_t>(std::floor(x));
+            double frac = x - first;
+            taps.push_back(1.0 - frac);
+            if (first + 1 < src_size) {
+                taps.push_back(frac);
+            }
+        }
+
+        // quantize so that the weights sum to exactly one
+        quantized.clear();
+        std::int64_t sum = 0;
+        for (auto tap : taps) {
+            quantized.push_back(std::llround(tap * ResampleWeights::WEIGHT_ONE));
+            sum += quantized.back();
+        }
+        auto largest = std::max_element(quantized.begin(), quantized.end());
+        *largest += ResampleWeights::WEIGHT_ONE - sum;
+
+        // drop the taps that don't contribute
+        std::size_t begin = 0;
+        std::size_t end = quantized.size();
+        while (quantized[begin] == 0) {
+            begin++;
+        }
+        while (quantized[end - 1] == 0) {
+            end--;
+        }
+
+        ret.first.push_back(first + begin);
+        for (std::size_t t = begin; t < end; ++t) {
+            ret.weights.push_back(static_cast<std::uint32_t>(quantized[t]));
         }
+        ret.offsets.push_back(ret.weights.size());
+    }
+    return ret;
+}
+
+namespace {
+
+template<unsigned Depth>
+inline std::uint32_t load_sample(const std::uint8_t* data, std::size_t i)
+{
+    if (Depth == 16) {
+        return data[i * 2] | (data[i * 2 + 1] << 8);
+    }
+    return data[i];
+}
+
+template<unsigned Depth>
+inline void store_sample(std::uint8_t* data, std::size_t i, std::uint32_t value)
+{
+    if (Depth == 16) {
+        data[i * 2] = value & 0xff;
+        data[i * 2 + 1] = (value >> 8) & 0xff;
     } else {
-        // interpolate and copy pixels
-        std::uint32_t counter = dst_width / 2;
-        unsigned dst_x = 0;
-
-        for (unsigned src_x = 0; src_x < src_width; src_x++) {
-            unsigned avg[3] = {0, 0, 0};
-            for (unsigned c = 0; c < channels; c++) {
-                avg[c] += get_raw_channel_from_row(src_data, src_x, c, format);
-            }
-            while ((counter < dst_width || src_x + 1 == src_width) && dst_x < dst_width) {
-                counter += src_width;
+        data[i] = value;
+    }
+}
 
-                for (unsigned c = 0; c < channels; c++) {
-                    set_raw_channel_to_row(out_data, dst_x, c, avg[c], format);
-                }
-                dst_x++;
+inline std::uint32_t finish_weighted_sum(std::uint32_t sum)
+{
+    return (sum + (ResampleWeights::WEIGHT_ONE / 2)) >> ResampleWeights::WEIGHT_SHIFT;
+}
+
+template<unsigned Depth, unsigned Channels>
+void resample_row(const ResampleWeights& weights, const std::uint8_t* in_data,
+                  std::uint8_t* out_data)
+{
+    for (std::size_t x = 0, width = weights.size(); x < width; ++x) {
+        const auto* w = weights.get_weights(x);
+        auto tap_count = weights.tap_count(x);
+        auto first_sample = weights.first[x] * Channels;
+
+        std::uint32_t sums[Channels] = {};
+        for (std::size_t t = 0; t < tap_count; ++t) {
+            for (unsigned c = 0; c < Channels; ++c) {
+                sums[c] += w[t] * load_sample<Depth>(in_data, first_sample + t * Channels + c);
             }
-            counter -= dst_width;
         }
+        for (unsigned c = 0; c < Channels; ++c) {
+            store_sample<Depth>(out_data, x * Channels + c, finish_weighted_sum(sums[c]));
+        }
+    }
+}
+
+} // namespace
+
+ImagePipelineNodeResampleRows::ImagePipelineNodeResampleRows(ImagePipelineNode& source,
+                                                             std::size_t width,
+                                                             ResampleFilter filter) :
+    source_(source),
+    width_{width}
+{
+    auto format = get_format();
+    auto depth = get_pixel_format_depth(format);
+    auto channels = get_pixel_channels(format);
+
+    if (depth == 8 && channels == 1) {
+        row_kernel_ = resample_row<8, 1>;
+    } else if (depth == 8 && channels == 3) {
+        row_kernel_ = resample_row<8, 3>;
+    } else if (depth == 16 && channels == 1) {
+        row_kernel_ = resample_row<16, 1>;
+    } else if (depth == 16 && channels == 3) {
+        row_kernel_ = resample_row<16, 3>;
+    } else {
+        throw SaneException("Unsupported format for resampling %d",
+                            static_cast<unsigned>(format));
+    }
+
+    if (width_ > 0 && source_.get_width() > 0) {
+        weights_ = compute_resample_weights(source_.get_width(), width_, filter);
+    }
+}
+
+bool ImagePipelineNodeResampleRows::get_next_row_data(std::uint8_t* out_data)
+{
+    return get_next_rows(1, out_data, get_row_bytes());
+}
+
+bool ImagePipelineNodeResampleRows::get_next_rows(std::size_t count, std::uint8_t* out_data,
+                                                  std::size_t row_stride)
+{
+    if (weights_.size() == 0) {
+        throw SaneException("Attempt to resample zero-width line");
+    }
+
+    auto src_row_bytes = source_.get_row_bytes();
+    buffer_.resize(src_row_bytes * count);
+    bool got_data = source_.get_next_rows(count, buffer_.data(), src_row_bytes);
+
+    for (std::size_t irow = 0; irow < count; ++irow) {
+        row_kernel_(weights_, buffer_.data() + irow * src_row_bytes, out_data + irow * row_stride);
     }
     return got_data;
 }
@@ -666,6 +1111,8 @@ bool ImagePipelineNodeExtract::get_next_row_data(std::uint8_t* out_data)
 {
     bool got_data = true;
 
+    cached_line_.resize(source_.get_row_bytes());
+
     while (current_line_ < offset_y_) {
         got_data &= source_.get_next_row_data(cached_line_.data());
         current_line_++;
@@ -710,58 +1157,458 @@ bool ImagePipelineNodeExtract::get_next_row_data(std::uint8_t* out_data)
     return got_data;
 }
 
-ImagePipelineNodeCalibrate::ImagePipelineNodeCalibrate(ImagePipelineNode& source,
-                                                       const std::vector<std::uint16_t>& bottom,
-                                                       const std::vector<std::uint16_t>& top,
-                                                       std::size_t x_start) :
-    source_{source}
+namespace {
+
+// Computes the calibrated value of a single sample. The vectorized implementations below must
+// produce exactly the same results.
+inline std::int32_t calibrate_sample(std::int32_t value, float offset, float multiplier,
+                                     std::int32_t max_value)
+{
+    float value_f = static_cast<float>(value) / max_value;
+    value_f = (value_f - offset) * multiplier;
+    value_f = std::round(value_f * max_value);
+    return clamp<std::int32_t>(static_cast<std::int32_t>(value_f), 0, max_value);
+}
+
+template<unsigned Depth>
+void calibrate_samples_scalar(std::uint8_t* data, std::size_t begin, std::size_t count,
+                              const float* offset, const float* multiplier)
+{
+    for (std::size_t i = begin; i < count; ++i) {
+        if (Depth == 8) {
+            data[i] = calibrate_sample(data[i], offset[i], multiplier[i], 255);
+        } else {
+            std::int32_t value = data[i * 2] | (data[i * 2 + 1] << 8);
+            value = calibrate_sample(value, offset[i], multiplier[i], 65535);
+            data[i * 2] = value & 0xff;
+            data[i * 2 + 1] = (value >> 8) & 0xff;
+        }
+    }
+}
+
+template<unsigned Depth>
+void calibrate_samples_scalar(std::uint8_t* data, std::size_t count,
+                              const float* offset, const float* multiplier)
+{
+    calibrate_samples_scalar<Depth>(data, 0, count, offset, multiplier);
+}
+
+#if GENESYS_HAS_X86_SIMD
+
+// Computes the calibrated values of 4 samples in the same way as calibrate_sample()
+inline __m128i calibrate_samples_sse2(__m128i values, const float* offset,
+                                      const float* multiplier, __m128 max_value_f,
+                                      __m128i max_value)
+{
+    __m128 value_f = _mm_div_ps(_mm_cvtepi32_ps(values), max_value_f);
+    value_f = _mm_mul_ps(_mm_sub_ps(value_f, _mm_loadu_ps(offset)), _mm_loadu_ps(multiplier));
+    value_f = _mm_mul_ps(value_f, max_value_f);
+
+    // std::round rounds halfway cases away from zero which is not available as a rounding mode.
+    // The adjustment is done on floats so that out of range values convert to the same integer
+    // as in the scalar code.
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 rounded = _mm_cvtepi32_ps(_mm_cvttps_epi32(value_f));
+    __m128 frac = _mm_sub_ps(value_f, rounded);
+    rounded = _mm_add_ps(rounded, _mm_and_ps(_mm_cmpge_ps(frac, _mm_set1_ps(0.5f)), one));
+    rounded = _mm_sub_ps(rounded, _mm_and_ps(_mm_cmple_ps(frac, _mm_set1_ps(-0.5f)), one));
+    __m128i result = _mm_cvttps_epi32(rounded);
+
+    // SSE2 has no 32-bit integer min and max
+    result = _mm_and_si128(result, _mm_cmpgt_epi32(result, _mm_setzero_si128()));
+    __m128i over = _mm_cmpgt_epi32(result, max_value);
+    return _mm_or_si128(_mm_and_si128(over, max_value), _mm_andnot_si128(over, result));
+}
+
+void calibrate_samples_8bit_sse2(std::uint8_t* data, std::size_t count,
+                                 const float* offset, const float* multiplier)
+{
+    const __m128 max_value_f = _mm_set1_ps(255.0f);
+    const __m128i max_value = _mm_set1_epi32(255);
+    const __m128i zero = _mm_setzero_si128();
+
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i values = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(data + i));
+        values = _mm_unpacklo_epi8(values, zero);
+
+        __m128i lo = calibrate_samples_sse2(_mm_unpacklo_epi16(values, zero),
+                                            offset + i, multiplier + i, max_value_f, max_value);
+        __m128i hi = calibrate_samples_sse2(_mm_unpackhi_epi16(values, zero),
+                                            offset + i + 4, multiplier + i + 4,
+                                            max_value_f, max_value);
+        values = _mm_packs_epi32(lo, hi);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(data + i), _mm_packus_epi16(values, values));
+    }
+    calibrate_samples_scalar<8>(data, i, count, offset, multiplier);
+}
+
+void calibrate_samples_16bit_sse2(std::uint8_t* data, std::size_t count,
+                                  const float* offset, const float* multiplier)
+{
+    const __m128 max_value_f = _mm_set1_ps(65535.0f);
+    const __m128i max_value = _mm_set1_epi32(65535);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias32 = _mm_set1_epi32(0x8000);
+    const __m128i bias16 = _mm_set1_epi16(static_cast<short>(0x8000));
+
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 2));
+
+        __m128i lo = calibrate_samples_sse2(_mm_unpacklo_epi16(values, zero),
+                                            offset + i, multiplier + i, max_value_f, max_value);
+        __m128i hi = calibrate_samples_sse2(_mm_unpackhi_epi16(values, zero),
+                                            offset + i + 4, multiplier + i + 4,
+                                            max_value_f, max_value);
+
+        // SSE2 only has signed saturating pack, so shift the values into the signed range
+        values = _mm_packs_epi32(_mm_sub_epi32(lo, bias32), _mm_sub_epi32(hi, bias32));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i * 2),
+                         _mm_xor_si128(values, bias16));
+    }
+    calibrate_samples_scalar<16>(data, i, count, offset, multiplier);
+}
+
+// Computes the calibrated values of 8 samples in the same way as calibrate_sample()
+__attribute__((target("avx2")))
+inline __m256i calibrate_samples_avx2(__m256i values, const float* offset,
+                                      const float* multiplier, __m256 max_value_f,
+                                      __m256i max_value)
+{
+    __m256 value_f = _mm256_div_ps(_mm256_cvtepi32_ps(values), max_value_f);
+    value_f = _mm256_mul_ps(_mm256_sub_ps(value_f, _mm256_loadu_ps(offset)),
+                            _mm256_loadu_ps(multiplier));
+    value_f = _mm256_mul_ps(value_f, max_value_f);
+
+    // see calibrate_samples_sse2()
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 rounded = _mm256_cvtepi32_ps(_mm256_cvttps_epi32(value_f));
+    __m256 frac = _mm256_sub_ps(value_f, rounded);
+    rounded = _mm256_add_ps(rounded, _mm256_and_ps(
+                                _mm256_cmp_ps(frac, _mm256_set1_ps(0.5f), _CMP_GE_OQ), one));
+    rounded = _mm256_sub_ps(rounded, _mm256_and_ps(
+                                _mm256_cmp_ps(frac, _mm256_set1_ps(-0.5f), _CMP_LE_OQ), one));
+    __m256i result = _mm256_cvttps_epi32(rounded);
+
+    return _mm256_min_epi32(_mm256_max_epi32(result, _mm256_setzero_si256()), max_value);
+}
+
+__attribute__((target("avx2")))
+void calibrate_samples_8bit_avx2(std::uint8_t* data, std::size_t count,
+                                 const float* offset, const float* multiplier)
+{
+    const __m256 max_value_f = _mm256_set1_ps(255.0f);
+    const __m256i max_value = _mm256_set1_epi32(255);
+
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i values = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(data + i));
+        __m256i result = calibrate_samples_avx2(_mm256_cvtepu8_epi32(values),
+                                                offset + i, multiplier + i,
+                                                max_value_f, max_value);
+        values = _mm_packs_epi32(_mm256_castsi256_si128(result),
+                                 _mm256_extracti128_si256(result, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(data + i), _mm_packus_epi16(values, values));
+    }
+    calibrate_samples_scalar<8>(data, i, count, offset, multiplier);
+}
+
+__attribute__((target("avx2")))
+void calibrate_samples_16bit_avx2(std::uint8_t* data, std::size_t count,
+                                  const float* offset, const float* multiplier)
+{
+    const __m256 max_value_f = _mm256_set1_ps(65535.0f);
+    const __m256i max_value = _mm256_set1_epi32(65535);
+
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 2));
+        __m256i result = calibrate_samples_avx2(_mm256_cvtepu16_epi32(values),
+                                                offset + i, multiplier + i,
+                                                max_value_f, max_value);
+        values = _mm_packus_epi32(_mm256_castsi256_si128(result),
+                                  _mm256_extracti128_si256(result, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i * 2), values);
+    }
+    calibrate_samples_scalar<16>(data, i, count, offset, multiplier);
+}
+
+#endif // GENESYS_HAS_X86_SIMD
+
+using CalibrateSamplesFunction = void (*)(std::uint8_t* data, std::size_t count,
+                                          const float* offset, const float* multiplier);
+
+// Returns nullptr if calibration is not supported for the given depth
+CalibrateSamplesFunction select_calibrate_samples_kernel(unsigned depth, SimdLevel max_simd_level)
+{
+    auto simd_level = std::min(max_simd_level, get_max_simd_level());
+    static_cast<void>(simd_level);
+
+    if (depth == 8) {
+#if GENESYS_HAS_X86_SIMD
+        if (simd_level == SimdLevel::AVX2) {
+            return calibrate_samples_8bit_avx2;
+        }
+        if (simd_level == SimdLevel::SSE2) {
+            return calibrate_samples_8bit_sse2;
+        }
+#endif
+        return calibrate_samples_scalar<8>;
+    }
+    if (depth == 16) {
+#if GENESYS_HAS_X86_SIMD
+        if (simd_level == SimdLevel::AVX2) {
+            return calibrate_samples_16bit_avx2;
+        }
+        if (simd_level == SimdLevel::SSE2) {
+            return calibrate_samples_16bit_sse2;
+        }
+#endif
+        return calibrate_samples_scalar<16>;
+    }
+    return nullptr;
+}
+
+void compute_calibration_factors(const std::vector<std::uint16_t>& bottom,
+                                 const std::vector<std::uint16_t>& top, std::size_t x_start,
+                                 std::vector<float>& offset, std::vector<float>& multiplier)
 {
     std::size_t size = 0;
     if (bottom.size() >= x_start && top.size() >= x_start) {
         size = std::min(bottom.size() - x_start, top.size() - x_start);
     }
 
-    offset_.reserve(size);
-    multiplier_.reserve(size);
+    offset.reserve(size);
+    multiplier.reserve(size);
 
     for (std::size_t i = 0; i < size; ++i) {
-        offset_.push_back(bottom[i + x_start] / 65535.0f);
-        multiplier_.push_back(65535.0f / (top[i + x_start] - bottom[i + x_start]));
+        offset.push_back(bottom[i + x_start] / 65535.0f);
+        multiplier.push_back(65535.0f / (top[i + x_start] - bottom[i + x_start]));
     }
 }
 
+} // namespace
+
+SimdLevel get_max_simd_level()
+{
+#if GENESYS_HAS_X86_SIMD
+    // SSE2 is part of the x86-64 baseline
+    static const SimdLevel level = __builtin_cpu_supports("avx2") ? SimdLevel::AVX2
+                                                                   : SimdLevel::SSE2;
+    return level;
+#else
+    return SimdLevel::NONE;
+#endif
+}
+
+ImagePipelineNodeCalibrate::ImagePipelineNodeCalibrate(ImagePipelineNode& source,
+                                                       const std::vector<std::uint16_t>& bottom,
+                                                       const std::vector<std::uint16_t>& top,
+                                                       std::size_t x_start,
+                                                       SimdLevel max_simd_level) :
+    source_{source}
+{
+    compute_calibration_factors(bottom, top, x_start, offset_, multiplier_);
+    sample_kernel_ = select_calibrate_samples_kernel(get_pixel_format_depth(get_format()),
+                                                     max_simd_level);
+}
+
 bool ImagePipelineNodeCalibrate::get_next_row_data(std::uint8_t* out_data)
 {
-    bool ret = source_.get_next_row_data(out_data);
+    return get_next_rows(1, out_data, get_row_bytes());
+}
 
-    auto format = get_format();
-    auto depth = get_pixel_format_depth(format);
-    std::size_t max_value = 1;
-    switch (depth) {
-        case 8: max_value = 255; break;
-        case 16: max_value = 65535; break;
-        default:
-            throw SaneException("Unsupported depth for calibration %d", depth);
+bool ImagePipelineNodeCalibrate::get_next_rows(std::size_t count, std::uint8_t* out_data,
+                                               std::size_t row_stride)
+{
+    bool ret = source_.get_next_rows(count, out_data, row_stride);
+
+    if (sample_kernel_ == nullptr) {
+        throw SaneException("Unsupported depth for calibration %d",
+                            get_pixel_format_depth(get_format()));
     }
-    unsigned channels = get_pixel_channels(format);
 
-    std::size_t max_calib_i = offset_.size();
-    std::size_t curr_calib_i = 0;
+    // the calibration data is laid out in the same way as the samples within each row
+    std::size_t sample_count = std::min(get_width() * get_pixel_channels(get_format()),
+                                        offset_.size());
 
-    for (std::size_t x = 0, width = get_width(); x < width && curr_calib_i < max_calib_i; ++x) {
-        for (unsigned ch = 0; ch < channels && curr_calib_i < max_calib_i; ++ch) {
-            std::int32_t value = get_raw_channel_from_row(out_data, x, ch, format);
+    for (std::size_t irow = 0; irow < count; ++irow) {
+        sample_kernel_(out_data + irow * row_stride, sample_count,
+                       offset_.data(), multiplier_.data());
+    }
+    return ret;
+}
+
+namespace {
 
-            float value_f = static_cast<float>(value) / max_value;
-            value_f = (value_f - offset_[curr_calib_i]) * multiplier_[curr_calib_i];
-            value_f = std::round(value_f * max_value);
-            value = clamp<std::int32_t>(static_cast<std::int32_t>(value_f), 0, max_value);
-            set_raw_channel_to_row(out_data, x, ch, value, format);
+// Applies the byte swapping, inversion and channel order reversal steps of
+// ImagePipelineNodeSampleOps to the given number of pixels in place
+template<unsigned Depth, bool Swap, bool Invert, bool Reverse>
+void apply_sample_ops(std::uint8_t* data, std::size_t pixels, unsigned channels)
+{
+    using Sample = typename std::conditional<Depth == 16, std::uint16_t, std::uint8_t>::type;
+    constexpr unsigned max_value = Depth == 16 ? 0xffff : 0xff;
 
-            curr_calib_i++;
+    auto process = [](Sample value) -> Sample
+    {
+        if (Swap && Depth == 16) {
+            value = static_cast<Sample>(((value >> 8) & 0xff) | ((value & 0xff) << 8));
+        }
+        if (Invert) {
+            value = static_cast<Sample>(max_value - value);
         }
+        return value;
+    };
+
+    if (Reverse) {
+        // the channel order can only be reversed for 3-channel formats
+        for (std::size_t x = 0; x < pixels; ++x) {
+            Sample values[3];
+            std::memcpy(values, data, sizeof(values));
+            Sample out[3] = { process(values[2]), process(values[1]), process(values[0]) };
+            std::memcpy(data, out, sizeof(out));
+            data += sizeof(values);
+        }
+        return;
     }
-    return ret;
+
+    std::size_t count = pixels * channels;
+    for (std::size_t i = 0; i < count; ++i) {
+        Sample value;
+        std::memcpy(&value, data, sizeof(value));
+        value = process(value);
+        std::memcpy(data, &value, sizeof(value));
+        data += sizeof(value);
+    }
+}
+
+void invert_1bit_samples(std::uint8_t* data, std::size_t pixels, unsigned channels)
+{
+    auto num_bytes = (pixels * channels + 7) / 8;
+    for (std::size_t i = 0; i < num_bytes; ++i) {
+        data[i] = ~data[i];
+    }
+}
+
+using SampleOpsFunction = void (*)(std::uint8_t* data, std::size_t pixels, unsigned channels);
+
+template<unsigned Depth>
+SampleOpsFunction select_sample_ops_kernel(bool swap, bool invert, bool reverse)
+{
+    static const SampleOpsFunction kernels[] = {
+        apply_sample_ops<Depth, false, false, false>,
+        apply_sample_ops<Depth, false, false, true>,
+        apply_sample_ops<Depth, false, true, false>,
+        apply_sample_ops<Depth, false, true, true>,
+        apply_sample_ops<Depth, true, false, false>,
+        apply_sample_ops<Depth, true, false, true>,
+        apply_sample_ops<Depth, true, true, false>,
+        apply_sample_ops<Depth, true, true, true>,
+    };
+    return kernels[(swap ? 4 : 0) + (invert ? 2 : 0) + (reverse ? 1 : 0)];
+}
+
+bool is_channel_order_reversal(PixelFormat src_format, PixelFormat dst_format)
+{
+    return (src_format == PixelFormat::RGB888 && dst_format == PixelFormat::BGR888) ||
+           (src_format == PixelFormat::BGR888 && dst_format == PixelFormat::RGB888) ||
+           (src_format == PixelFormat::RGB161616 && dst_format == PixelFormat::BGR161616) ||
+           (src_format == PixelFormat::BGR161616 && dst_format == PixelFormat::RGB161616);
+}
+
+} // namespace
+
+constexpr std::size_t ImagePipelineNodeSampleOps::TILE_PIXELS;
+
+ImagePipelineNodeSampleOps::ImagePipelineNodeSampleOps(ImagePipelineNode& source,
+                                                       const ImagePipelineSampleOps& ops,
+                                                       SimdLevel max_simd_level) :
+    source_(source),
+    output_format_{source.get_format()}
+{
+    auto src_format = source_.get_format();
+    depth_ = get_pixel_format_depth(src_format);
+
+    bool reverse = false;
+    if (ops.dst_format != PixelFormat::UNKNOWN && ops.dst_format != src_format) {
+        if (!is_channel_order_reversal(src_format, ops.dst_format)) {
+            throw SaneException("Unsupported format conversion %d %d",
+                                static_cast<unsigned>(src_format),
+                                static_cast<unsigned>(ops.dst_format));
+        }
+        reverse = true;
+        output_format_ = ops.dst_format;
+    }
+
+    // same as ImagePipelineNodeSwap16BitEndian, swapping does nothing for other depths
+    bool swap = ops.swap_16bit_endian && depth_ == 16;
+
+    if (depth_ == 1) {
+        if (ops.invert) {
+            sample_ops_kernel_ = invert_1bit_samples;
+        }
+    } else if (swap || ops.invert || reverse) {
+        if (depth_ == 8) {
+            sample_ops_kernel_ = select_sample_ops_kernel<8>(swap, ops.invert, reverse);
+        } else if (depth_ == 16) {
+            sample_ops_kernel_ = select_sample_ops_kernel<16>(swap, ops.invert, reverse);
+        }
+    }
+
+    if (ops.calibrate) {
+        calibrate_ = true;
+        calibrate_kernel_ = select_calibrate_samples_kernel(depth_, max_simd_level);
+        compute_calibration_factors(ops.calibration_bottom, ops.calibration_top,
+                                    ops.calibration_x_start, offset_, multiplier_);
+    }
+}
+
+bool ImagePipelineNodeSampleOps::get_next_row_data(std::uint8_t* out_data)
+{
+    return get_next_rows(1, out_data, get_row_bytes());
+}
+
+bool ImagePipelineNodeSampleOps::get_next_rows(std::size_t count, std::uint8_t* out_data,
+                                               std::size_t row_stride)
+{
+    // all supported operations keep the row size, so they can be done in place
+    bool got_data = source_.get_next_rows(count, out_data, row_stride);
+
+    if (calibrate_ && calibrate_kernel_ == nullptr) {
+        throw SaneException("Unsupported depth for calibration %d", depth_);
+    }
+
+    auto width = get_width();
+    auto channels = get_pixel_channels(output_format_);
+
+    // the rows are processed in tiles that fit into the L1 cache, so that all operations are
+    // applied while the data is hot. 1-bit rows are processed as a whole.
+    std::size_t tile_pixels = depth_ == 1 ? width : TILE_PIXELS;
+
+    // the calibration data is laid out in the same way as the samples within each row
+    std::size_t calib_samples = std::min(width * channels, offset_.size());
+
+    for (std::size_t irow = 0; irow < count; ++irow) {
+        auto* row = out_data + irow * row_stride;
+
+        for (std::size_t x = 0; x < width; x += tile_pixels) {
+            auto pixels = std::min(tile_pixels, width - x);
+            auto* tile = row + get_pixel_row_bytes(output_format_, x);
+
+            if (sample_ops_kernel_) {
+                sample_ops_kernel_(tile, pixels, channels);
+            }
+
+            std::size_t first_sample = x * channels;
+            if (calibrate_kernel_ && first_sample < calib_samples) {
+                auto samples = std::min(pixels * channels, calib_samples - first_sample);
+                calibrate_kernel_(tile, samples, offset_.data() + first_sample,
+                                  multiplier_.data() + first_sample);
+            }
+        }
+    }
+    return got_data;
 }
 
 ImagePipelineNodeDebug::ImagePipelineNodeDebug(ImagePipelineNode& source,
@@ -787,9 +1634,17 @@ ImagePipelineNodeDebug::~ImagePipelineNodeDebug()
 
 bool ImagePipelineNodeDebug::get_next_row_data(std::uint8_t* out_data)
 {
-    buffer_.push_back();
-    bool got_data = source_.get_next_row_data(out_data);
-    std::memcpy(buffer_.get_back_row_ptr(), out_data, get_row_bytes());
+    return get_next_rows(1, out_data, get_row_bytes());
+}
+
+bool ImagePipelineNodeDebug::get_next_rows(std::size_t count, std::uint8_t* out_data,
+                                           std::size_t row_stride)
+{
+    bool got_data = source_.get_next_rows(count, out_data, row_stride);
+    for (std::size_t i = 0; i < count; ++i) {
+        buffer_.push_back();
+        std::memcpy(buffer_.get_back_row_ptr(), out_data + i * row_stride, get_row_bytes());
+    }
     return got_data;
 }
 
@@ -858,6 +1713,24 @@ void ImagePipelineStack::clear()
     nodes_.clear();
 }
 
+void ImagePipelineStack::set_buffer_pool(ImageBufferPool* pool)
+{
+    buffer_pool_ = pool;
+    for (auto& node : nodes_) {
+        node->set_buffer_pool(pool);
+    }
+}
+
+constexpr std::size_t ImagePipelineStack::BLOCK_ROWS;
+
+void ImagePipelineStack::get_rows_in_blocks(std::size_t count, std::uint8_t* out_data,
+                                            std::size_t row_stride)
+{
+    for (std::size_t y = 0; y < count; y += BLOCK_ROWS) {
+        get_next_rows(std::min(BLOCK_ROWS, count - y), out_data + row_stride * y, row_stride);
+    }
+}
+
 std::vector<std::uint8_t> ImagePipelineStack::get_all_data()
 {
     auto row_bytes = get_output_row_bytes();
@@ -866,9 +1739,7 @@ std::vector<std::uint8_t> ImagePipelineStack::get_all_data()
     std::vector<std::uint8_t> ret;
     ret.resize(row_bytes * height);
 
-    for (std::size_t i = 0; i < height; ++i) {
-        get_next_row_data(ret.data() + row_bytes * i);
-    }
+    get_rows_in_blocks(height, ret.data(), row_bytes);
     return ret;
 }
 
@@ -879,8 +1750,8 @@ Image ImagePipelineStack::get_image()
     Image ret;
     ret.resize(get_output_width(), height, get_output_format());
 
-    for (std::size_t i = 0; i < height; ++i) {
-        get_next_row_data(ret.get_row_ptr(i));
+    if (height > 0) {
+        get_rows_in_blocks(height, ret.get_row_ptr(0), ret.get_row_bytes());
     }
     return ret;
 }
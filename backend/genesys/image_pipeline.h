@@ -73,6 +73,16 @@ public:
     // returns true if the row was filled successfully, false otherwise (e.g. if not enough data
     // was available.
     virtual bool get_next_row_data(std::uint8_t* out_data) = 0;
+
+    // reads count rows into out_data, the start of consecutive rows being row_stride bytes apart.
+    // Returns true if all rows were filled successfully. The default implementation calls
+    // get_next_row_data() for each row. Nodes that can process blocks of rows at once override
+    // this and implement get_next_row_data() in terms of it.
+    virtual bool get_next_rows(std::size_t count, std::uint8_t* out_data, std::size_t row_stride);
+
+    // Sets the pool that the node takes its intermediate buffers from. ImagePipelineStack calls
+    // this before any data is read.
+    virtual void set_buffer_pool(ImageBufferPool* pool) { (void) pool; }
 };
 
 // A pipeline node that produces data from a callable
@@ -114,6 +124,7 @@ public:
     ImagePipelineNodeBufferedCallableSource(std::size_t width, std::size_t height,
                                             PixelFormat format, std::size_t input_batch_size,
                                             ProducerCallback producer);
+    ~ImagePipelineNodeBufferedCallableSource() override;
 
     std::size_t get_width() const override { return width_; }
     std::size_t get_height() const override { return height_; }
@@ -122,11 +133,25 @@ public:
     bool eof() const override { return eof_; }
 
     bool get_next_row_data(std::uint8_t* out_data) override;
+    bool get_next_rows(std::size_t count, std::uint8_t* out_data, std::size_t row_stride) override;
 
+    // The remaining bytes must not be accessed once reading ahead has started, as the producer
+    // is then called from a separate thread.
     std::size_t remaining_bytes() const { return buffer_.remaining_size(); }
-    void set_remaining_bytes(std::size_t bytes) { buffer_.set_remaining_size(bytes); }
+    void set_remaining_bytes(std::size_t bytes);
     void set_last_read_multiple(std::size_t bytes) { buffer_.set_last_read_multiple(bytes); }
 
+    // Enables calling the producer from a separate thread that keeps up to chunk_count chunks of
+    // data read ahead of the consumer, so that the producer can work while the rest of the
+    // pipeline processes data. The thread is started on the first read.
+    void enable_read_ahead(std::size_t chunk_count);
+
+    // Stops the reader thread, see ReadAheadBuffer::stop() and ReadAheadBuffer::request_stop()
+    void stop_read_ahead();
+    void request_stop_read_ahead();
+
+    void set_buffer_pool(ImageBufferPool* pool) override { buffer_.set_pool(pool); }
+
 private:
     ProducerCallback producer_;
     std::size_t width_ = 0;
@@ -137,6 +162,11 @@ private:
     std::size_t curr_row_ = 0;
 
     ImageBuffer buffer_;
+    std::size_t input_batch_size_ = 0;
+
+    // zero if reading ahead is disabled
+    std::size_t read_ahead_chunk_count_ = 0;
+    std::unique_ptr<ReadAheadBuffer> read_ahead_;
 };
 
 // A pipeline node that produces data from the given array.
@@ -153,6 +183,7 @@ public:
     bool eof() const override { return eof_; }
 
     bool get_next_row_data(std::uint8_t* out_data) override;
+    bool get_next_rows(std::size_t count, std::uint8_t* out_data, std::size_t row_stride) override;
 
 private:
     std::size_t width_ = 0;
@@ -179,6 +210,7 @@ public:
     bool eof() const override { return next_row_ >= get_height(); }
 
     bool get_next_row_data(std::uint8_t* out_data) override;
+    bool get_next_rows(std::size_t count, std::uint8_t* out_data, std::size_t row_stride) override;
 
 private:
     const Image& source_;
@@ -203,11 +235,14 @@ public:
     bool eof() const override { return source_.eof(); }
 
     bool get_next_row_data(std::uint8_t* out_data) override;
+    bool get_next_rows(std::size_t count, std::uint8_t* out_data, std::size_t row_stride) override;
+
+    void set_buffer_pool(ImageBufferPool* pool) override { buffer_.set_pool(pool); }
 
 private:
     ImagePipelineNode& source_;
     PixelFormat dst_format_;
-    std::vector<std::uint8_t> buffer_;
+    PooledBuffer buffer_;
 };
 
 // A pipeline node that handles data that comes out of segmented sensors. Note that the width of
@@ -239,6 +274,9 @@ public:
     bool eof() const override { return source_.eof(); }
 
     bool get_next_row_data(std::uint8_t* out_data) override;
+    bool get_next_rows(std::size_t count, std::uint8_t* out_data, std::size_t row_stride) override;
+
+    void set_buffer_pool(ImageBufferPool* pool) override { buffer_.set_pool(pool); }
 
 private:
     ImagePipelineNode& source_;
@@ -248,7 +286,12 @@ private:
     std::size_t interleaved_lines_ = 0;
     std::size_t pixels_per_chunk_ = 0;
 
-    RowBuffer buffer_;
+    PooledBuffer buffer_;
+
+    template<PixelFormat Format> struct RowKernel;
+    using RowKernelFunction = void (*)(const ImagePipelineNodeDesegment& node,
+                                       const std::uint8_t* in_data, std::uint8_t* out_data);
+    RowKernelFunction row_kernel_ = nullptr;
 };
 
 // A pipeline node that deinterleaves data on multiple lines
@@ -273,6 +316,7 @@ public:
     bool eof() const override { return source_.eof(); }
 
     bool get_next_row_data(std::uint8_t* out_data) override;
+    bool get_next_rows(std::size_t count, std::uint8_t* out_data, std::size_t row_stride) override;
 
 private:
     ImagePipelineNode& source_;
@@ -291,6 +335,7 @@ public:
     bool eof() const override { return source_.eof(); }
 
     bool get_next_row_data(std::uint8_t* out_data) override;
+    bool get_next_rows(std::size_t count, std::uint8_t* out_data, std::size_t row_stride) override;
 
 private:
     ImagePipelineNode& source_;
@@ -310,6 +355,9 @@ public:
     bool eof() const override { return source_.eof(); }
 
     bool get_next_row_data(std::uint8_t* out_data) override;
+    bool get_next_rows(std::size_t count, std::uint8_t* out_data, std::size_t row_stride) override;
+
+    void set_buffer_pool(ImageBufferPool* pool) override { buffer_.set_pool(pool); }
 
 private:
     static PixelFormat get_output_format(PixelFormat input_format, ColorOrder order);
@@ -317,7 +365,13 @@ private:
     ImagePipelineNode& source_;
     PixelFormat output_format_ = PixelFormat::UNKNOWN;
 
-    RowBuffer buffer_;
+    PooledBuffer buffer_;
+
+    template<PixelFormat Format> struct RowKernel;
+    using RowKernelFunction = void (*)(std::size_t width, const std::uint8_t* row0,
+                                       const std::uint8_t* row1, const std::uint8_t* row2,
+                                       std::uint8_t* out_data);
+    RowKernelFunction row_kernel_ = nullptr;
 };
 
 // A pipeline node that splits a color channel into 3 mono lines
@@ -334,13 +388,15 @@ public:
 
     bool get_next_row_data(std::uint8_t* out_data) override;
 
+    void set_buffer_pool(ImageBufferPool* pool) override { buffer_.set_pool(pool); }
+
 private:
     static PixelFormat get_output_format(PixelFormat input_format);
 
     ImagePipelineNode& source_;
     PixelFormat output_format_ = PixelFormat::UNKNOWN;
 
-    std::vector<std::uint8_t> buffer_;
+    PooledBuffer buffer_;
     unsigned next_channel_ = 0;
 };
 
@@ -358,6 +414,9 @@ public:
     bool eof() const override { return source_.eof(); }
 
     bool get_next_row_data(std::uint8_t* out_data) override;
+    bool get_next_rows(std::size_t count, std::uint8_t* out_data, std::size_t row_stride) override;
+
+    void set_buffer_pool(ImageBufferPool* pool) override { buffer_.set_pool(pool); }
 
 private:
     ImagePipelineNode& source_;
@@ -366,7 +425,14 @@ private:
 
     std::array<unsigned, 3> channel_shifts_;
 
-    RowBuffer buffer_;
+    PooledBuffer buffer_;
+    std::size_t buffer_rows_ = 0;
+
+    template<PixelFormat Format> struct RowKernel;
+    using RowKernelFunction = void (*)(std::size_t width, const std::uint8_t* row0,
+                                       const std::uint8_t* row1, const std::uint8_t* row2,
+                                       std::uint8_t* out_data);
+    RowKernelFunction row_kernel_ = nullptr;
 };
 
 // A pipeline node that shifts pixels across lines by the given offsets (performs vertical
@@ -384,6 +450,9 @@ public:
     bool eof() const override { return source_.eof(); }
 
     bool get_next_row_data(std::uint8_t* out_data) override;
+    bool get_next_rows(std::size_t count, std::uint8_t* out_data, std::size_t row_stride) override;
+
+    void set_buffer_pool(ImageBufferPool* pool) override { buffer_.set_pool(pool); }
 
 private:
     ImagePipelineNode& source_;
@@ -392,7 +461,16 @@ private:
 
     std::vector<std::size_t> pixel_shifts_;
 
-    RowBuffer buffer_;
+    PooledBuffer buffer_;
+    std::size_t buffer_rows_ = 0;
+
+    // pointers to the source rows of the current output row
+    std::vector<const std::uint8_t*> rows_;
+
+    template<PixelFormat Format> struct RowKernel;
+    using RowKernelFunction = void (*)(std::size_t width, const std::uint8_t* const* rows,
+                                       std::size_t row_count, std::uint8_t* out_data);
+    RowKernelFunction row_kernel_ = nullptr;
 };
 
 // A pipeline node that shifts pixels across columns by the given offsets. Each row is divided
@@ -411,6 +489,9 @@ public:
     bool eof() const override { return source_.eof(); }
 
     bool get_next_row_data(std::uint8_t* out_data) override;
+    bool get_next_rows(std::size_t count, std::uint8_t* out_data, std::size_t row_stride) override;
+
+    void set_buffer_pool(ImageBufferPool* pool) override { temp_buffer_.set_pool(pool); }
 
 private:
     ImagePipelineNode& source_;
@@ -419,7 +500,13 @@ private:
 
     std::vector<std::size_t> pixel_shifts_;
 
-    std::vector<std::uint8_t> temp_buffer_;
+    PooledBuffer temp_buffer_;
+
+    template<PixelFormat Format> struct RowKernel;
+    using RowKernelFunction = void (*)(std::size_t width, const std::uint8_t* in_data,
+                                       const std::vector<std::size_t>& shifts,
+                                       std::uint8_t* out_data);
+    RowKernelFunction row_kernel_ = nullptr;
 };
 
 // exposed for tests
@@ -445,6 +532,8 @@ public:
 
     bool get_next_row_data(std::uint8_t* out_data) override;
 
+    void set_buffer_pool(ImageBufferPool* pool) override { cached_line_.set_pool(pool); }
+
 private:
     ImagePipelineNode& source_;
     std::size_t offset_x_ = 0;
@@ -453,7 +542,7 @@ private:
     std::size_t height_ = 0;
 
     std::size_t current_line_ = 0;
-    std::vector<std::uint8_t> cached_line_;
+    PooledBuffer cached_line_;
 };
 
 // A pipeline node that scales rows to the specified width by using a point filter
@@ -469,21 +558,106 @@ public:
     bool eof() const override { return source_.eof(); }
 
     bool get_next_row_data(std::uint8_t* out_data) override;
+    bool get_next_rows(std::size_t count, std::uint8_t* out_data, std::size_t row_stride) override;
+
+    void set_buffer_pool(ImageBufferPool* pool) override { cached_line_.set_pool(pool); }
 
 private:
     ImagePipelineNode& source_;
     std::size_t width_ = 0;
 
-    std::vector<std::uint8_t> cached_line_;
+    PooledBuffer cached_line_;
 };
 
+// Filters used by the resampling pipeline nodes
+enum class ResampleFilter
+{
+    // each destination pixel is the average of the source area that it covers
+    BOX,
+    // each destination pixel is interpolated from the two nearest source pixels
+    BILINEAR,
+};
+
+// Returns area averaging for downscaling and bilinear interpolation for upscaling
+ResampleFilter get_default_resample_filter(std::size_t src_size, std::size_t dst_size);
+
+// Describes how the source positions along one dimension contribute to each destination
+// position. The weights of each destination position are fixed point numbers that sum to
+// WEIGHT_ONE.
+struct ResampleWeights
+{
+    static constexpr unsigned WEIGHT_SHIFT = 14;
+    static constexpr std::uint32_t WEIGHT_ONE = 1 << WEIGHT_SHIFT;
+
+    // the first contributing source position for each destination position
+    std::vector<std::size_t> first;
+
+    // the weights of destination position i are at [offsets[i], offsets[i + 1])
+    std::vector<std::size_t> offsets;
+    std::vector<std::uint32_t> weights;
+
+    std::size_t size() const { return first.size(); }
+    std::size_t tap_count(std::size_t i) const { return offsets[i + 1] - offsets[i]; }
+    const std::uint32_t* get_weights(std::size_t i) const { return weights.data() + offsets[i]; }
+};
+
+// exposed for tests
+ResampleWeights compute_resample_weights(std::size_t src_size, std::size_t dst_size,
+                                         ResampleFilter filter);
+
+// A pipeline node that resamples rows to the specified width. Unlike ImagePipelineNodeScaleRows,
+// all source pixels contribute to the output when downscaling, so there is no aliasing. Only
+// 8-bit and 16-bit formats are supported.
+class ImagePipelineNodeResampleRows : public ImagePipelineNode
+{
+public:
+    ImagePipelineNodeResampleRows(ImagePipelineNode& source, std::size_t width,
+                                  ResampleFilter filter);
+
+    std::size_t get_width() const override { return width_; }
+    std::size_t get_height() const override { return source_.get_height(); }
+    PixelFormat get_format() const override { return source_.get_format(); }
+
+    bool eof() const override { return source_.eof(); }
+
+    bool get_next_row_data(std::uint8_t* out_data) override;
+    bool get_next_rows(std::size_t count, std::uint8_t* out_data, std::size_t row_stride) override;
+
+    void set_buffer_pool(ImageBufferPool* pool) override { buffer_.set_pool(pool); }
+
+private:
+    ImagePipelineNode& source_;
+    std::size_t width_ = 0;
+    ResampleWeights weights_;
+
+    PooledBuffer buffer_;
+
+    using RowKernelFunction = void (*)(const ResampleWeights& weights, const std::uint8_t* in_data,
+                                       std::uint8_t* out_data);
+    RowKernelFunction row_kernel_ = nullptr;
+};
+
+// Instruction set extensions that vectorized pipeline kernels may use
+enum class SimdLevel
+{
+    NONE,
+    SSE2,
+    AVX2,
+};
+
+// Returns the most capable instruction set extension supported by both the build and the CPU
+SimdLevel get_max_simd_level();
+
 // A pipeline node that mimics the calibration behavior on Genesys chips
 class ImagePipelineNodeCalibrate : public ImagePipelineNode
 {
 public:
 
+    // max_simd_level limits the instruction set extensions that are used. This is useful only for
+    // tests.
     ImagePipelineNodeCalibrate(ImagePipelineNode& source, const std::vector<std::uint16_t>& bottom,
-                               const std::vector<std::uint16_t>& top, std::size_t x_start);
+                               const std::vector<std::uint16_t>& top, std::size_t x_start,
+                               SimdLevel max_simd_level = SimdLevel::AVX2);
 
     std::size_t get_width() const override { return source_.get_width(); }
     std::size_t get_height() const override { return source_.get_height(); }
@@ -492,12 +666,84 @@ public:
     bool eof() const override { return source_.eof(); }
 
     bool get_next_row_data(std::uint8_t* out_data) override;
+    bool get_next_rows(std::size_t count, std::uint8_t* out_data, std::size_t row_stride) override;
 
 private:
     ImagePipelineNode& source_;
 
     std::vector<float> offset_;
     std::vector<float> multiplier_;
+
+    // applies calibration to the given number of consecutive samples
+    using SampleKernelFunction = void (*)(std::uint8_t* data, std::size_t count,
+                                          const float* offset, const float* multiplier);
+    SampleKernelFunction sample_kernel_ = nullptr;
+};
+
+// Per-sample operations that ImagePipelineNodeSampleOps applies in a single pass. The operations
+// are applied in the order in which they are listed, which is the order in which the equivalent
+// separate nodes are used in the scanning pipeline.
+struct ImagePipelineSampleOps
+{
+    // see ImagePipelineNodeSwap16BitEndian
+    bool swap_16bit_endian = false;
+
+    // see ImagePipelineNodeInvert
+    bool invert = false;
+
+    // see ImagePipelineNodeFormatConvert. Only conversions that reverse the order of the color
+    // channels are supported. PixelFormat::UNKNOWN leaves the format unchanged.
+    PixelFormat dst_format = PixelFormat::UNKNOWN;
+
+    // see ImagePipelineNodeCalibrate
+    bool calibrate = false;
+    std::vector<std::uint16_t> calibration_bottom;
+    std::vector<std::uint16_t> calibration_top;
+    std::size_t calibration_x_start = 0;
+
+    bool empty() const
+    {
+        return !swap_16bit_endian && !invert && dst_format == PixelFormat::UNKNOWN && !calibrate;
+    }
+};
+
+// A pipeline node that fuses several per-sample operations, so that the row data is read and
+// written once instead of once per operation.
+class ImagePipelineNodeSampleOps : public ImagePipelineNode
+{
+public:
+    static constexpr std::size_t TILE_PIXELS = 256;
+
+    // max_simd_level limits the instruction set extensions that are used for calibration. This
+    // is useful only for tests.
+    ImagePipelineNodeSampleOps(ImagePipelineNode& source, const ImagePipelineSampleOps& ops,
+                               SimdLevel max_simd_level = SimdLevel::AVX2);
+
+    std::size_t get_width() const override { return source_.get_width(); }
+    std::size_t get_height() const override { return source_.get_height(); }
+    PixelFormat get_format() const override { return output_format_; }
+
+    bool eof() const override { return source_.eof(); }
+
+    bool get_next_row_data(std::uint8_t* out_data) override;
+    bool get_next_rows(std::size_t count, std::uint8_t* out_data, std::size_t row_stride) override;
+
+private:
+    ImagePipelineNode& source_;
+    PixelFormat output_format_ = PixelFormat::UNKNOWN;
+    unsigned depth_ = 0;
+
+    // applies the operations other than calibration to the given number of pixels
+    using SampleOpsFunction = void (*)(std::uint8_t* data, std::size_t pixels, unsigned channels);
+    SampleOpsFunction sample_ops_kernel_ = nullptr;
+
+    bool calibrate_ = false;
+    std::vector<float> offset_;
+    std::vector<float> multiplier_;
+
+    using CalibrateFunction = void (*)(std::uint8_t* data, std::size_t count,
+                                       const float* offset, const float* multiplier);
+    CalibrateFunction calibrate_kernel_ = nullptr;
 };
 
 class ImagePipelineNodeDebug : public ImagePipelineNode
@@ -513,6 +759,7 @@ public:
     bool eof() const override { return source_.eof(); }
 
     bool get_next_row_data(std::uint8_t* out_data) override;
+    bool get_next_rows(std::size_t count, std::uint8_t* out_data, std::size_t row_stride) override;
 
 private:
     ImagePipelineNode& source_;
@@ -523,17 +770,23 @@ private:
 class ImagePipelineStack
 {
 public:
+    // get_all_data() and get_image() pull the image through the pipeline in blocks of at most
+    // this many rows, so that intermediate nodes don't need buffers for the whole image
+    static constexpr std::size_t BLOCK_ROWS = 64;
+
     ImagePipelineStack() {}
     ImagePipelineStack(ImagePipelineStack&& other)
     {
         clear();
         nodes_ = std::move(other.nodes_);
+        buffer_pool_ = other.buffer_pool_;
     }
 
     ImagePipelineStack& operator=(ImagePipelineStack&& other)
     {
         clear();
         nodes_ = std::move(other.nodes_);
+        buffer_pool_ = other.buffer_pool_;
         return *this;
     }
 
@@ -553,8 +806,14 @@ public:
 
     bool eof() const { return nodes_.back()->eof(); }
 
+    bool empty() const { return nodes_.empty(); }
+
     void clear();
 
+    // Sets the pool that the nodes take their intermediate buffers from, both the existing ones
+    // and the ones that are added later. The pool must outlive the nodes.
+    void set_buffer_pool(ImageBufferPool* pool);
+
     template<class Node, class... Args>
     Node& push_first_node(Args&&... args)
     {
@@ -562,6 +821,7 @@ public:
             throw SaneException("Trying to append first node when there are existing nodes");
         }
         nodes_.emplace_back(std::unique_ptr<Node>(new Node(std::forward<Args>(args)...)));
+        nodes_.back()->set_buffer_pool(buffer_pool_);
         return static_cast<Node&>(*nodes_.back());
     }
 
@@ -571,6 +831,7 @@ public:
         ensure_node_exists();
         nodes_.emplace_back(std::unique_ptr<Node>(new Node(*nodes_.back(),
                                                            std::forward<Args>(args)...)));
+        nodes_.back()->set_buffer_pool(buffer_pool_);
         return static_cast<Node&>(*nodes_.back());
     }
 
@@ -579,6 +840,11 @@ public:
         return nodes_.back()->get_next_row_data(out_data);
     }
 
+    bool get_next_rows(std::size_t count, std::uint8_t* out_data, std::size_t row_stride)
+    {
+        return nodes_.back()->get_next_rows(count, out_data, row_stride);
+    }
+
     std::vector<std::uint8_t> get_all_data();
 
     Image get_image();
@@ -586,7 +852,10 @@ public:
 private:
     void ensure_node_exists() const;
 
+    void get_rows_in_blocks(std::size_t count, std::uint8_t* out_data, std::size_t row_stride);
+
     std::vector<std::unique_ptr<ImagePipelineNode>> nodes_;
+    ImageBufferPool* buffer_pool_ = nullptr;
 };
 
 } // namespace genesys
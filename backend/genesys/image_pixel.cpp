@@ -68,7 +68,6 @@ const PixelFormatDesc s_known_pixel_formats[] = {
     { PixelFormat::BGR161616, 16, 3, ColorOrder::BGR },
 };
 
-
 ColorOrder get_pixel_format_color_order(PixelFormat format)
 {
     for (const auto& desc : s_known_pixel_formats) {
@@ -78,7 +77,6 @@ ColorOrder get_pixel_format_color_order(PixelFormat format)
     throw SaneException("Unknown pixel format %d", static_cast<unsigned>(format));
 }
 
-
 unsigned get_pixel_format_depth(PixelFormat format)
 {
     for (const auto& desc : s_known_pixel_formats) {
@@ -121,31 +119,18 @@ PixelFormat create_pixel_format(unsigned depth, unsigned channels, ColorOrder or
                        static_cast<unsigned>(order));
 }
 
-static inline unsigned read_bit(const std::uint8_t* data, std::size_t x)
-{
-    return (data[x / 8] >> (7 - (x % 8))) & 0x1;
-}
-
-static inline void write_bit(std::uint8_t* data, std::size_t x, unsigned value)
-{
-    value = (value & 0x1) << (7 - (x % 8));
-    std::uint8_t mask = 0x1 << (7 - (x % 8));
-
-    data[x / 8] = (data[x / 8] & ~mask) | (value & mask);
-}
-
 Pixel get_pixel_from_row(const std::uint8_t* data, std::size_t x, PixelFormat format)
 {
     switch (format) {
         case PixelFormat::I1: {
-            std::uint16_t val = read_bit(data, x) ? 0xffff : 0x0000;
+            std::uint16_t val = read_bit_from_row(data, x) ? 0xffff : 0x0000;
             return Pixel(val, val, val);
         }
         case PixelFormat::RGB111: {
             x *= 3;
-            std::uint16_t r = read_bit(data, x) ? 0xffff : 0x0000;
-            std::uint16_t g = read_bit(data, x + 1) ? 0xffff : 0x0000;
-            std::uint16_t b = read_bit(data, x + 2) ? 0xffff : 0x0000;
+            std::uint16_t r = read_bit_from_row(data, x) ? 0xffff : 0x0000;
+            std::uint16_t g = read_bit_from_row(data, x + 1) ? 0xffff : 0x0000;
+            std::uint16_t b = read_bit_from_row(data, x + 2) ? 0xffff : 0x0000;
             return Pixel(r, g, b);
         }
         case PixelFormat::I8: {
@@ -194,13 +179,13 @@ void set_pixel_to_row(std::uint8_t* data, std::size_t x, Pixel pixel, PixelForma
 {
     switch (format) {
         case PixelFormat::I1:
-            write_bit(data, x, pixel.r & 0x8000 ? 1 : 0);
+            write_bit_to_row(data, x, pixel.r & 0x8000 ? 1 : 0);
             return;
         case PixelFormat::RGB111: {
             x *= 3;
-            write_bit(data, x, pixel.r & 0x8000 ? 1 : 0);
-            write_bit(data, x + 1,pixel.g & 0x8000 ? 1 : 0);
-            write_bit(data, x + 2, pixel.b & 0x8000 ? 1 : 0);
+            write_bit_to_row(data, x, pixel.r & 0x8000 ? 1 : 0);
+            write_bit_to_row(data, x + 1,pixel.g & 0x8000 ? 1 : 0);
+            write_bit_to_row(data, x + 2, pixel.b & 0x8000 ? 1 : 0);
             return;
         }
         case PixelFormat::I8: {
@@ -262,30 +247,21 @@ RawPixel get_raw_pixel_from_row(const std::uint8_t* data, std::size_t x, PixelFo
 {
     switch (format) {
         case PixelFormat::I1:
-            return RawPixel(read_bit(data, x));
-        case PixelFormat::RGB111: {
-            x *= 3;
-            return RawPixel(read_bit(data, x) << 2 |
-                            (read_bit(data, x + 1) << 1) |
-                            (read_bit(data, x + 2)));
-        }
+            return get_raw_pixel_from_row<PixelFormat::I1>(data, x);
+        case PixelFormat::RGB111:
+            return get_raw_pixel_from_row<PixelFormat::RGB111>(data, x);
         case PixelFormat::I8:
-            return RawPixel(data[x]);
-        case PixelFormat::I16: {
-            x *= 2;
-            return RawPixel(data[x], data[x + 1]);
-        }
+            return get_raw_pixel_from_row<PixelFormat::I8>(data, x);
         case PixelFormat::RGB888:
-        case PixelFormat::BGR888: {
-            x *= 3;
-            return RawPixel(data[x], data[x + 1], data[x + 2]);
-        }
+            return get_raw_pixel_from_row<PixelFormat::RGB888>(data, x);
+        case PixelFormat::BGR888:
+            return get_raw_pixel_from_row<PixelFormat::BGR888>(data, x);
+        case PixelFormat::I16:
+            return get_raw_pixel_from_row<PixelFormat::I16>(data, x);
         case PixelFormat::RGB161616:
-        case PixelFormat::BGR161616: {
-            x *= 6;
-            return RawPixel(data[x], data[x + 1], data[x + 2],
-                            data[x + 3], data[x + 4], data[x + 5]);
-        }
+            return get_raw_pixel_from_row<PixelFormat::RGB161616>(data, x);
+        case PixelFormat::BGR161616:
+            return get_raw_pixel_from_row<PixelFormat::BGR161616>(data, x);
         default:
             throw SaneException("Unknown pixel format %d", static_cast<unsigned>(format));
     }
@@ -295,43 +271,29 @@ void set_raw_pixel_to_row(std::uint8_t* data, std::size_t x, RawPixel pixel, Pix
 {
     switch (format) {
         case PixelFormat::I1:
-            write_bit(data, x, pixel.data[0] & 0x1);
+            set_raw_pixel_to_row<PixelFormat::I1>(data, x, pixel);
             return;
-        case PixelFormat::RGB111: {
-            x *= 3;
-            write_bit(data, x, (pixel.data[0] >> 2) & 0x1);
-            write_bit(data, x + 1, (pixel.data[0] >> 1) & 0x1);
-            write_bit(data, x + 2, (pixel.data[0]) & 0x1);
+        case PixelFormat::RGB111:
+            set_raw_pixel_to_row<PixelFormat::RGB111>(data, x, pixel);
             return;
-        }
         case PixelFormat::I8:
-            data[x] = pixel.data[0];
-            return;
-        case PixelFormat::I16: {
-            x *= 2;
-            data[x] = pixel.data[0];
-            data[x + 1] = pixel.data[1];
+            set_raw_pixel_to_row<PixelFormat::I8>(data, x, pixel);
             return;
-        }
         case PixelFormat::RGB888:
-        case PixelFormat::BGR888: {
-            x *= 3;
-            data[x] = pixel.data[0];
-            data[x + 1] = pixel.data[1];
-            data[x + 2] = pixel.data[2];
+            set_raw_pixel_to_row<PixelFormat::RGB888>(data, x, pixel);
+            return;
+        case PixelFormat::BGR888:
+            set_raw_pixel_to_row<PixelFormat::BGR888>(data, x, pixel);
+            return;
+        case PixelFormat::I16:
+            set_raw_pixel_to_row<PixelFormat::I16>(data, x, pixel);
             return;
-        }
         case PixelFormat::RGB161616:
-        case PixelFormat::BGR161616: {
-            x *= 6;
-            data[x] = pixel.data[0];
-            data[x + 1] = pixel.data[1];
-            data[x + 2] = pixel.data[2];
-            data[x + 3] = pixel.data[3];
-            data[x + 4] = pixel.data[4];
-            data[x + 5] = pixel.data[5];
+            set_raw_pixel_to_row<PixelFormat::RGB161616>(data, x, pixel);
+            return;
+        case PixelFormat::BGR161616:
+            set_raw_pixel_to_row<PixelFormat::BGR161616>(data, x, pixel);
             return;
-        }
         default:
             throw SaneException("Unknown pixel format %d", static_cast<unsigned>(format));
     }
@@ -342,21 +304,21 @@ std::uint16_t get_raw_channel_from_row(const std::uint8_t* data, std::size_t x,
 {
     switch (format) {
         case PixelFormat::I1:
-            return read_bit(data, x);
+            return get_raw_channel_from_row<PixelFormat::I1>(data, x, channel);
         case PixelFormat::RGB111:
-            return read_bit(data, x * 3 + channel);
+            return get_raw_channel_from_row<PixelFormat::RGB111>(data, x, channel);
         case PixelFormat::I8:
-            return data[x];
-        case PixelFormat::I16: {
-            x *= 2;
-            return data[x] | (data[x + 1] << 8);
-        }
+            return get_raw_channel_from_row<PixelFormat::I8>(data, x, channel);
         case PixelFormat::RGB888:
+            return get_raw_channel_from_row<PixelFormat::RGB888>(data, x, channel);
         case PixelFormat::BGR888:
-            return data[x * 3 + channel];
+            return get_raw_channel_from_row<PixelFormat::BGR888>(data, x, channel);
+        case PixelFormat::I16:
+            return get_raw_channel_from_row<PixelFormat::I16>(data, x, channel);
         case PixelFormat::RGB161616:
+            return get_raw_channel_from_row<PixelFormat::RGB161616>(data, x, channel);
         case PixelFormat::BGR161616:
-            return data[x * 6 + channel * 2] | (data[x * 6 + channel * 2 + 1]) << 8;
+            return get_raw_channel_from_row<PixelFormat::BGR161616>(data, x, channel);
         default:
             throw SaneException("Unknown pixel format %d", static_cast<unsigned>(format));
     }
@@ -367,34 +329,29 @@ void set_raw_channel_to_row(std::uint8_t* data, std::size_t x, unsigned channel,
 {
     switch (format) {
         case PixelFormat::I1:
-            write_bit(data, x, pixel & 0x1);
+            set_raw_channel_to_row<PixelFormat::I1>(data, x, channel, pixel);
             return;
-        case PixelFormat::RGB111: {
-            write_bit(data, x * 3 + channel, pixel & 0x1);
+        case PixelFormat::RGB111:
+            set_raw_channel_to_row<PixelFormat::RGB111>(data, x, channel, pixel);
             return;
-        }
         case PixelFormat::I8:
-            data[x] = pixel;
-            return;
-        case PixelFormat::I16: {
-            x *= 2;
-            data[x] = pixel;
-            data[x + 1] = pixel >> 8;
+            set_raw_channel_to_row<PixelFormat::I8>(data, x, channel, pixel);
             return;
-        }
         case PixelFormat::RGB888:
-        case PixelFormat::BGR888: {
-            x *= 3;
-            data[x + channel] = pixel;
+            set_raw_channel_to_row<PixelFormat::RGB888>(data, x, channel, pixel);
+            return;
+        case PixelFormat::BGR888:
+            set_raw_channel_to_row<PixelFormat::BGR888>(data, x, channel, pixel);
+            return;
+        case PixelFormat::I16:
+            set_raw_channel_to_row<PixelFormat::I16>(data, x, channel, pixel);
             return;
-        }
         case PixelFormat::RGB161616:
-        case PixelFormat::BGR161616: {
-            x *= 6;
-            data[x + channel * 2] = pixel;
-            data[x + channel * 2 + 1] = pixel >> 8;
+            set_raw_channel_to_row<PixelFormat::RGB161616>(data, x, channel, pixel);
+            return;
+        case PixelFormat::BGR161616:
+            set_raw_channel_to_row<PixelFormat::BGR161616>(data, x, channel, pixel);
             return;
-        }
         default:
             throw SaneException("Unknown pixel format %d", static_cast<unsigned>(format));
     }
@@ -412,30 +369,6 @@ void set_pixel_to_row(std::uint8_t* data, std::size_t x, Pixel pixel)
     set_pixel_to_row(data, x, pixel, Format);
 }
 
-template<PixelFormat Format>
-RawPixel get_raw_pixel_from_row(const std::uint8_t* data, std::size_t x)
-{
-    return get_raw_pixel_from_row(data, x, Format);
-}
-
-template<PixelFormat Format>
-void set_raw_pixel_to_row(std::uint8_t* data, std::size_t x, RawPixel pixel)
-{
-    set_raw_pixel_to_row(data, x, pixel, Format);
-}
-
-template<PixelFormat Format>
-std::uint16_t get_raw_channel_from_row(const std::uint8_t* data, std::size_t x, unsigned channel)
-{
-    return get_raw_channel_from_row(data, x, channel, Format);
-}
-
-template<PixelFormat Format>
-void set_raw_channel_to_row(std::uint8_t* data, std::size_t x, unsigned channel, std::uint16_t pixel)
-{
-    set_raw_channel_to_row(data, x, channel, pixel, Format);
-}
-
 template Pixel get_pixel_from_row<PixelFormat::I1>(const std::uint8_t* data, std::size_t x);
 template Pixel get_pixel_from_row<PixelFormat::RGB111>(const std::uint8_t* data, std::size_t x);
 template Pixel get_pixel_from_row<PixelFormat::I8>(const std::uint8_t* data, std::size_t x);
@@ -445,32 +378,6 @@ template Pixel get_pixel_from_row<PixelFormat::I16>(const std::uint8_t* data, st
 template Pixel get_pixel_from_row<PixelFormat::RGB161616>(const std::uint8_t* data, std::size_t x);
 template Pixel get_pixel_from_row<PixelFormat::BGR161616>(const std::uint8_t* data, std::size_t x);
 
-template RawPixel get_raw_pixel_from_row<PixelFormat::I1>(const std::uint8_t* data, std::size_t x);
-template RawPixel get_raw_pixel_from_row<PixelFormat::RGB111>(const std::uint8_t* data, std::size_t x);
-template RawPixel get_raw_pixel_from_row<PixelFormat::I8>(const std::uint8_t* data, std::size_t x);
-template RawPixel get_raw_pixel_from_row<PixelFormat::RGB888>(const std::uint8_t* data, std::size_t x);
-template RawPixel get_raw_pixel_from_row<PixelFormat::BGR888>(const std::uint8_t* data, std::size_t x);
-template RawPixel get_raw_pixel_from_row<PixelFormat::I16>(const std::uint8_t* data, std::size_t x);
-template RawPixel get_raw_pixel_from_row<PixelFormat::RGB161616>(const std::uint8_t* data, std::size_t x);
-template RawPixel get_raw_pixel_from_row<PixelFormat::BGR161616>(const std::uint8_t* data, std::size_t x);
-
-template std::uint16_t get_raw_channel_from_row<PixelFormat::I1>(
-        const std::uint8_t* data, std::size_t x, unsigned channel);
-template std::uint16_t get_raw_channel_from_row<PixelFormat::RGB111>(
-        const std::uint8_t* data, std::size_t x, unsigned channel);
-template std::uint16_t get_raw_channel_from_row<PixelFormat::I8>(
-        const std::uint8_t* data, std::size_t x, unsigned channel);
-template std::uint16_t get_raw_channel_from_row<PixelFormat::RGB888>(
-        const std::uint8_t* data, std::size_t x, unsigned channel);
-template std::uint16_t get_raw_channel_from_row<PixelFormat::BGR888>(
-        const std::uint8_t* data, std::size_t x, unsigned channel);
-template std::uint16_t get_raw_channel_from_row<PixelFormat::I16>(
-        const std::uint8_t* data, std::size_t x, unsigned channel);
-template std::uint16_t get_raw_channel_from_row<PixelFormat::RGB161616>(
-        const std::uint8_t* data, std::size_t x, unsigned channel);
-template std::uint16_t get_raw_channel_from_row<PixelFormat::BGR161616>
-        (const std::uint8_t* data, std::size_t x, unsigned channel);
-
 template void set_pixel_to_row<PixelFormat::I1>(std::uint8_t* data, std::size_t x, Pixel pixel);
 template void set_pixel_to_row<PixelFormat::RGB111>(std::uint8_t* data, std::size_t x, Pixel pixel);
 template void set_pixel_to_row<PixelFormat::I8>(std::uint8_t* data, std::size_t x, Pixel pixel);
@@ -480,30 +387,4 @@ template void set_pixel_to_row<PixelFormat::I16>(std::uint8_t* data, std::size_t
 template void set_pixel_to_row<PixelFormat::RGB161616>(std::uint8_t* data, std::size_t x, Pixel pixel);
 template void set_pixel_to_row<PixelFormat::BGR161616>(std::uint8_t* data, std::size_t x, Pixel pixel);
 
-template void set_raw_pixel_to_row<PixelFormat::I1>(std::uint8_t* data, std::size_t x, RawPixel pixel);
-template void set_raw_pixel_to_row<PixelFormat::RGB111>(std::uint8_t* data, std::size_t x, RawPixel pixel);
-template void set_raw_pixel_to_row<PixelFormat::I8>(std::uint8_t* data, std::size_t x, RawPixel pixel);
-template void set_raw_pixel_to_row<PixelFormat::RGB888>(std::uint8_t* data, std::size_t x, RawPixel pixel);
-template void set_raw_pixel_to_row<PixelFormat::BGR888>(std::uint8_t* data, std::size_t x, RawPixel pixel);
-template void set_raw_pixel_to_row<PixelFormat::I16>(std::uint8_t* data, std::size_t x, RawPixel pixel);
-template void set_raw_pixel_to_row<PixelFormat::RGB161616>(std::uint8_t* data, std::size_t x, RawPixel pixel);
-template void set_raw_pixel_to_row<PixelFormat::BGR161616>(std::uint8_t* data, std::size_t x, RawPixel pixel);
-
-template void set_raw_channel_to_row<PixelFormat::I1>(
-        std::uint8_t* data, std::size_t x, unsigned channel, std::uint16_t pixel);
-template void set_raw_channel_to_row<PixelFormat::RGB111>(
-        std::uint8_t* data, std::size_t x, unsigned channel, std::uint16_t pixel);
-template void set_raw_channel_to_row<PixelFormat::I8>(
-        std::uint8_t* data, std::size_t x, unsigned channel, std::uint16_t pixel);
-template void set_raw_channel_to_row<PixelFormat::RGB888>(
-        std::uint8_t* data, std::size_t x, unsigned channel, std::uint16_t pixel);
-template void set_raw_channel_to_row<PixelFormat::BGR888>(
-        std::uint8_t* data, std::size_t x, unsigned channel, std::uint16_t pixel);
-template void set_raw_channel_to_row<PixelFormat::I16>(
-        std::uint8_t* data, std::size_t x, unsigned channel, std::uint16_t pixel);
-template void set_raw_channel_to_row<PixelFormat::RGB161616>(
-        std::uint8_t* data, std::size_t x, unsigned channel, std::uint16_t pixel);
-template void set_raw_channel_to_row<PixelFormat::BGR161616>(
-        std::uint8_t* data, std::size_t x, unsigned channel, std::uint16_t pixel);
-
 } // namespace genesys
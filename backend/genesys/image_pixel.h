@@ -45,6 +45,7 @@
 #define BACKEND_GENESYS_IMAGE_PIXEL_H
 
 #include "enums.h"
+#include "error.h"
 #include <algorithm>
 #include <cstdint>
 #include <cstddef>
@@ -127,18 +128,209 @@ void set_raw_channel_to_row(std::uint8_t* data, std::size_t x, unsigned channel,
 template<PixelFormat Format>
 Pixel get_pixel_from_row(const std::uint8_t* data, std::size_t x);
 template<PixelFormat Format>
-void set_pixel_to_row(std::uint8_t* data, std::size_t x, RawPixel pixel);
+void set_pixel_to_row(std::uint8_t* data, std::size_t x, Pixel pixel);
 
+// Compile-time description of the pixel formats, matching get_pixel_format_depth() and
+// get_pixel_channels().
+template<unsigned Depth, unsigned Channels>
+struct PixelFormatTraitsBase
+{
+    static constexpr unsigned depth = Depth;
+    static constexpr unsigned channels = Channels;
+};
+
+template<PixelFormat Format> struct PixelFormatTraits;
+template<> struct PixelFormatTraits<PixelFormat::I1> : PixelFormatTraitsBase<1, 1> {};
+template<> struct PixelFormatTraits<PixelFormat::RGB111> : PixelFormatTraitsBase<1, 3> {};
+template<> struct PixelFormatTraits<PixelFormat::I8> : PixelFormatTraitsBase<8, 1> {};
+template<> struct PixelFormatTraits<PixelFormat::RGB888> : PixelFormatTraitsBase<8, 3> {};
+template<> struct PixelFormatTraits<PixelFormat::BGR888> : PixelFormatTraitsBase<8, 3> {};
+template<> struct PixelFormatTraits<PixelFormat::I16> : PixelFormatTraitsBase<16, 1> {};
+template<> struct PixelFormatTraits<PixelFormat::RGB161616> : PixelFormatTraitsBase<16, 3> {};
+template<> struct PixelFormatTraits<PixelFormat::BGR161616> : PixelFormatTraitsBase<16, 3> {};
+
+inline unsigned read_bit_from_row(const std::uint8_t* data, std::size_t x)
+{
+    return (data[x / 8] >> (7 - (x % 8))) & 0x1;
+}
+
+inline void write_bit_to_row(std::uint8_t* data, std::size_t x, unsigned value)
+{
+    value = (value & 0x1) << (7 - (x % 8));
+    std::uint8_t mask = 0x1 << (7 - (x % 8));
+
+    data[x / 8] = (data[x / 8] & ~mask) | (value & mask);
+}
+
+// The following are specialized versions of the raw pixel accessors above. They are defined
+// inline, so that the format is resolved at compile time and loops over pixels don't switch on
+// the format for each pixel.
 template<PixelFormat Format>
-Pixel get_raw_pixel_from_row(const std::uint8_t* data, std::size_t x);
+inline RawPixel get_raw_pixel_from_row(const std::uint8_t* data, std::size_t x)
+{
+    switch (Format) {
+        case PixelFormat::I1:
+            return RawPixel(read_bit_from_row(data, x));
+        case PixelFormat::RGB111: {
+            x *= 3;
+            return RawPixel(read_bit_from_row(data, x) << 2 |
+                            (read_bit_from_row(data, x + 1) << 1) |
+                            (read_bit_from_row(data, x + 2)));
+        }
+        case PixelFormat::I8:
+            return RawPixel(data[x]);
+        case PixelFormat::I16: {
+            x *= 2;
+            return RawPixel(data[x], data[x + 1]);
+        }
+        case PixelFormat::RGB888:
+        case PixelFormat::BGR888: {
+            x *= 3;
+            return RawPixel(data[x], data[x + 1], data[x + 2]);
+        }
+        case PixelFormat::RGB161616:
+        case PixelFormat::BGR161616: {
+            x *= 6;
+            return RawPixel(data[x], data[x + 1], data[x + 2],
+                            data[x + 3], data[x + 4], data[x + 5]);
+        }
+        default:
+            throw SaneException("Unknown pixel format %d", static_cast<unsigned>(Format));
+    }
+}
+
 template<PixelFormat Format>
-void set_raw_pixel_to_row(std::uint8_t* data, std::size_t x, RawPixel pixel);
+inline void set_raw_pixel_to_row(std::uint8_t* data, std::size_t x, RawPixel pixel)
+{
+    switch (Format) {
+        case PixelFormat::I1:
+            write_bit_to_row(data, x, pixel.data[0] & 0x1);
+            return;
+        case PixelFormat::RGB111: {
+            x *= 3;
+            write_bit_to_row(data, x, (pixel.data[0] >> 2) & 0x1);
+            write_bit_to_row(data, x + 1, (pixel.data[0] >> 1) & 0x1);
+            write_bit_to_row(data, x + 2, (pixel.data[0]) & 0x1);
+            return;
+        }
+        case PixelFormat::I8:
+            data[x] = pixel.data[0];
+            return;
+        case PixelFormat::I16: {
+            x *= 2;
+            data[x] = pixel.data[0];
+            data[x + 1] = pixel.data[1];
+            return;
+        }
+        case PixelFormat::RGB888:
+        case PixelFormat::BGR888: {
+            x *= 3;
+            data[x] = pixel.data[0];
+            data[x + 1] = pixel.data[1];
+            data[x + 2] = pixel.data[2];
+            return;
+        }
+        case PixelFormat::RGB161616:
+        case PixelFormat::BGR161616: {
+            x *= 6;
+            data[x] = pixel.data[0];
+            data[x + 1] = pixel.data[1];
+            data[x + 2] = pixel.data[2];
+            data[x + 3] = pixel.data[3];
+            data[x + 4] = pixel.data[4];
+            data[x + 5] = pixel.data[5];
+            return;
+        }
+        default:
+            throw SaneException("Unknown pixel format %d", static_cast<unsigned>(Format));
+    }
+}
 
 template<PixelFormat Format>
-std::uint16_t get_raw_channel_from_row(const std::uint8_t* data, std::size_t x, unsigned channel);
+inline std::uint16_t get_raw_channel_from_row(const std::uint8_t* data, std::size_t x,
+                                              unsigned channel)
+{
+    switch (Format) {
+        case PixelFormat::I1:
+            return read_bit_from_row(data, x);
+        case PixelFormat::RGB111:
+            return read_bit_from_row(data, x * 3 + channel);
+        case PixelFormat::I8:
+            return data[x];
+        case PixelFormat::I16: {
+            x *= 2;
+            return data[x] | (data[x + 1] << 8);
+        }
+        case PixelFormat::RGB888:
+        case PixelFormat::BGR888:
+            return data[x * 3 + channel];
+        case PixelFormat::RGB161616:
+        case PixelFormat::BGR161616:
+            return data[x * 6 + channel * 2] | (data[x * 6 + channel * 2 + 1]) << 8;
+        default:
+            throw SaneException("Unknown pixel format %d", static_cast<unsigned>(Format));
+    }
+}
+
 template<PixelFormat Format>
-void set_raw_channel_to_row(std::uint8_t* data, std::size_t x, unsigned channel,
-                            std::uint16_t pixel);
+inline void set_raw_channel_to_row(std::uint8_t* data, std::size_t x, unsigned channel,
+                                   std::uint16_t pixel)
+{
+    switch (Format) {
+        case PixelFormat::I1:
+            write_bit_to_row(data, x, pixel & 0x1);
+            return;
+        case PixelFormat::RGB111: {
+            write_bit_to_row(data, x * 3 + channel, pixel & 0x1);
+            return;
+        }
+        case PixelFormat::I8:
+            data[x] = pixel;
+            return;
+        case PixelFormat::I16: {
+            x *= 2;
+            data[x] = pixel;
+            data[x + 1] = pixel >> 8;
+            return;
+        }
+        case PixelFormat::RGB888:
+        case PixelFormat::BGR888: {
+            x *= 3;
+            data[x + channel] = pixel;
+            return;
+        }
+        case PixelFormat::RGB161616:
+        case PixelFormat::BGR161616: {
+            x *= 6;
+            data[x + channel * 2] = pixel;
+            data[x + channel * 2 + 1] = pixel >> 8;
+            return;
+        }
+        default:
+            throw SaneException("Unknown pixel format %d", static_cast<unsigned>(Format));
+    }
+}
+
+// Returns Kernel<F>::apply for the format F that is equal to the given runtime format. This
+// allows to select a loop that is specialized for the pixel format once instead of dispatching
+// on the format for each pixel. All Kernel<F>::apply functions must have the same signature,
+// which is exposed as Kernel<F>::Function.
+template<template<PixelFormat> class Kernel>
+typename Kernel<PixelFormat::I8>::Function select_pixel_format_kernel(PixelFormat format)
+{
+    switch (format) {
+        case PixelFormat::I1: return Kernel<PixelFormat::I1>::apply;
+        case PixelFormat::RGB111: return Kernel<PixelFormat::RGB111>::apply;
+        case PixelFormat::I8: return Kernel<PixelFormat::I8>::apply;
+        case PixelFormat::RGB888: return Kernel<PixelFormat::RGB888>::apply;
+        case PixelFormat::BGR888: return Kernel<PixelFormat::BGR888>::apply;
+        case PixelFormat::I16: return Kernel<PixelFormat::I16>::apply;
+        case PixelFormat::RGB161616: return Kernel<PixelFormat::RGB161616>::apply;
+        case PixelFormat::BGR161616: return Kernel<PixelFormat::BGR161616>::apply;
+        default:
+            throw SaneException("Unknown pixel format %d", static_cast<unsigned>(format));
+    }
+}
 
 } // namespace genesys
 
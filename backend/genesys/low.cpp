@@ -69,6 +69,7 @@
 #include <cstdio>
 #include <chrono>
 #include <cmath>
+#include <cstdlib>
 #include <vector>
 
 /* ------------------------------------------------------------------------ */
@@ -1188,6 +1189,18 @@ ImagePipelineStack build_image_pipeline(const Genesys_Device& dev, const ScanSes
         }
     }
 
+    // Consecutive per-sample stages are collected and then applied by a single node, so that the
+    // row data is processed in one pass. When image data is logged, each stage is applied on its
+    // own so that the intermediate images can be written out.
+    ImagePipelineSampleOps sample_ops;
+    auto flush_sample_ops = [&]()
+    {
+        if (!sample_ops.empty()) {
+            pipeline.push_node<ImagePipelineNodeSampleOps>(sample_ops);
+            sample_ops = ImagePipelineSampleOps{};
+        }
+    };
+
     if (depth == 16) {
         unsigned num_swaps = 0;
         if (has_flag(dev.model->flags, ModelFlag::SWAP_16BIT_DATA)) {
@@ -1197,23 +1210,26 @@ ImagePipelineStack build_image_pipeline(const Genesys_Device& dev, const ScanSes
         num_swaps++;
 #endif
         if (num_swaps % 2 != 0) {
-            pipeline.push_node<ImagePipelineNodeSwap16BitEndian>();
+            sample_ops.swap_16bit_endian = true;
 
             if (log_image_data) {
+                flush_sample_ops();
                 pipeline.push_node<ImagePipelineNodeDebug>(debug_prefix + "_2_after_swap.tiff");
             }
         }
     }
 
     if (has_flag(dev.model->flags, ModelFlag::INVERT_PIXEL_DATA)) {
-        pipeline.push_node<ImagePipelineNodeInvert>();
+        sample_ops.invert = true;
 
         if (log_image_data) {
+            flush_sample_ops();
             pipeline.push_node<ImagePipelineNodeDebug>(debug_prefix + "_3_after_invert.tiff");
         }
     }
 
     if (dev.model->is_cis && session.params.channels == 3) {
+        flush_sample_ops();
         pipeline.push_node<ImagePipelineNodeMergeMonoLines>(dev.model->line_mode_color_order);
 
         if (log_image_data) {
@@ -1221,19 +1237,22 @@ ImagePipelineStack build_image_pipeline(const Genesys_Device& dev, const ScanSes
         }
     }
 
+    // the pending sample operations don't change the pixel format
     if (pipeline.get_output_format() == PixelFormat::BGR888) {
-        pipeline.push_node<ImagePipelineNodeFormatConvert>(PixelFormat::RGB888);
+        sample_ops.dst_format = PixelFormat::RGB888;
     }
 
     if (pipeline.get_output_format() == PixelFormat::BGR161616) {
-        pipeline.push_node<ImagePipelineNodeFormatConvert>(PixelFormat::RGB161616);
+        sample_ops.dst_format = PixelFormat::RGB161616;
     }
 
     if (log_image_data) {
+        flush_sample_ops();
         pipeline.push_node<ImagePipelineNodeDebug>(debug_prefix + "_5_after_format.tiff");
     }
 
     if (session.max_color_shift_lines > 0 && session.params.channels == 3) {
+        flush_sample_ops();
         pipeline.push_node<ImagePipelineNodeComponentShiftLines>(
                     session.color_shift_lines_r,
                     session.color_shift_lines_g,
@@ -1247,6 +1266,7 @@ ImagePipelineStack build_image_pipeline(const Genesys_Device& dev, const ScanSes
     if (!session.stagger_x.empty()) {
         // FIXME: the image will be scaled to requested pixel count without regard to the reduction
         // of image size in this step.
+        flush_sample_ops();
         pipeline.push_node<ImagePipelineNodePixelShiftColumns>(session.stagger_x.shifts());
 
         if (log_image_data) {
@@ -1255,6 +1275,7 @@ ImagePipelineStack build_image_pipeline(const Genesys_Device& dev, const ScanSes
     }
 
     if (session.num_staggered_lines > 0) {
+        flush_sample_ops();
         pipeline.push_node<ImagePipelineNodePixelShiftLines>(session.stagger_y.shifts());
 
         if (log_image_data) {
@@ -1268,21 +1289,46 @@ ImagePipelineStack build_image_pipeline(const Genesys_Device& dev, const ScanSes
     {
         unsigned offset_pixels = session.params.startx + dev.calib_session.shading_pixel_offset;
         unsigned offset_bytes = offset_pixels * dev.calib_session.params.channels;
-        pipeline.push_node<ImagePipelineNodeCalibrate>(dev.dark_average_data,
-                                                       dev.white_average_data, offset_bytes);
+        sample_ops.calibrate = true;
+        sample_ops.calibration_bottom = dev.dark_average_data;
+        sample_ops.calibration_top = dev.white_average_data;
+        sample_ops.calibration_x_start = offset_bytes;
 
         if (log_image_data) {
+            flush_sample_ops();
             pipeline.push_node<ImagePipelineNodeDebug>(debug_prefix + "_9_after_calibrate.tiff");
         }
     }
 
-    if (pipeline.get_output_width() != session.params.get_requested_pixels()) {
-        pipeline.push_node<ImagePipelineNodeScaleRows>(session.params.get_requested_pixels());
+    flush_sample_ops();
+
+    auto output_width = pipeline.get_output_width();
+    auto requested_pixels = session.params.get_requested_pixels();
+    if (output_width != requested_pixels) {
+        if (get_pixel_format_depth(pipeline.get_output_format()) == 1) {
+            pipeline.push_node<ImagePipelineNodeScaleRows>(requested_pixels);
+        } else {
+            pipeline.push_node<ImagePipelineNodeResampleRows>(
+                        requested_pixels,
+                        get_default_resample_filter(output_width, requested_pixels));
+        }
     }
 
     return pipeline;
 }
 
+// Returns the number of chunks of scan data to read ahead on a separate thread as set by the
+// SANE_GENESYS_READ_AHEAD environment variable. Zero disables reading ahead.
+static std::size_t get_read_ahead_chunk_count()
+{
+    auto* setting = std::getenv("SANE_GENESYS_READ_AHEAD");
+    if (!setting) {
+        return 0;
+    }
+    auto setting_int = std::strtol(setting, nullptr, 10);
+    return setting_int > 0 ? setting_int : 0;
+}
+
 void setup_image_pipeline(Genesys_Device& dev, const ScanSession& session)
 {
     static unsigned s_pipeline_index = 0;
@@ -1290,14 +1336,32 @@ void setup_image_pipeline(Genesys_Device& dev, const ScanSession& session)
     s_pipeline_index++;
 
     dev.pipeline = build_image_pipeline(dev, session, s_pipeline_index, dbg_log_image_data());
+    dev.pipeline.set_buffer_pool(&dev.pipeline_buffer_pool);
+
+    auto row_bytes = dev.pipeline.get_output_row_bytes();
+
+    // Pull rows from the pipeline in blocks of roughly the same size as the USB reads, so that
+    // the per-row overhead of the pipeline nodes is amortized. Sheetfed scanners adjust the
+    // amount of remaining data when the document end is detected, so we don't read ahead there.
+    std::size_t block_rows = 1;
+    if (!dev.model->is_sheetfed) {
+        block_rows = std::max<std::size_t>(1, session.buffer_size_read / row_bytes);
+
+        // For the same reason, reading USB data on a separate thread is limited to flatbeds
+        auto read_ahead_chunks = get_read_ahead_chunk_count();
+        if (read_ahead_chunks > 0) {
+            dev.get_pipeline_source().enable_read_ahead(read_ahead_chunks);
+        }
+    }
 
-    auto read_from_pipeline = [&dev](std::size_t size, std::uint8_t* out_data)
+    auto read_from_pipeline = [&dev, row_bytes](std::size_t size, std::uint8_t* out_data)
     {
-        (void) size; // will be always equal to dev.pipeline.get_output_row_bytes()
-        return dev.pipeline.get_next_row_data(out_data);
+        // size will be always a multiple of dev.pipeline.get_output_row_bytes()
+        return dev.pipeline.get_next_rows(size / row_bytes, out_data, row_bytes);
     };
-    dev.pipeline_buffer = ImageBuffer{dev.pipeline.get_output_row_bytes(),
-                                       read_from_pipeline};
+    dev.pipeline_buffer = ImageBuffer{row_bytes * block_rows, read_from_pipeline,
+                                      &dev.pipeline_buffer_pool};
+    dev.pipeline_buffer.set_remaining_size(row_bytes * dev.pipeline.get_output_height());
 }
 
 std::uint8_t compute_frontend_gain_wolfson(float value, float target_value)
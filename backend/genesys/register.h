@@ -48,6 +48,7 @@
 #include "utilities.h"
 
 #include <algorithm>
+#include <array>
 #include <climits>
 #include <cstdint>
 #include <iostream>
@@ -340,6 +341,46 @@ inline std::ostream& operator<<(std::ostream& out, const Genesys_Register_Set& r
     return out;
 }
 
+// Tracks the values that were last written to the registers of the device, so that writes which
+// would not change the state of the device can be skipped.
+class RegisterShadow
+{
+public:
+    static constexpr unsigned MAX_ADDRESS = 0x200;
+
+    RegisterShadow() { clear(); }
+
+    // Returns true if the device is not known to already hold the given register value
+    bool is_changed(std::uint16_t address, std::uint8_t value) const
+    {
+        if (address >= MAX_ADDRESS) {
+            return true;
+        }
+        return values_[address] != value;
+    }
+
+    void set(std::uint16_t address, std::uint8_t value)
+    {
+        if (address < MAX_ADDRESS) {
+            values_[address] = value;
+        }
+    }
+
+    void invalidate(std::uint16_t address)
+    {
+        if (address < MAX_ADDRESS) {
+            values_[address] = UNKNOWN_VALUE;
+        }
+    }
+
+    void clear() { values_.fill(UNKNOWN_VALUE); }
+
+private:
+    static constexpr std::int16_t UNKNOWN_VALUE = -1;
+
+    std::array<std::int16_t, MAX_ADDRESS> values_;
+};
+
 template<class Value>
 struct RegisterSetting
 {
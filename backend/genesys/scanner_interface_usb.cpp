@@ -45,13 +45,22 @@
 
 #include "scanner_interface_usb.h"
 #include "low.h"
+#include <cstdlib>
 #include <thread>
 
 namespace genesys {
 
 ScannerInterfaceUsb::~ScannerInterfaceUsb() = default;
 
-ScannerInterfaceUsb::ScannerInterfaceUsb(Genesys_Device* dev) : dev_{dev} {}
+ScannerInterfaceUsb::ScannerInterfaceUsb(Genesys_Device* dev) :
+    ScannerInterfaceUsb(dev, std::unique_ptr<IUsbDevice>{new UsbDevice})
+{}
+
+ScannerInterfaceUsb::ScannerInterfaceUsb(Genesys_Device* dev,
+                                         std::unique_ptr<IUsbDevice> usb_dev) :
+    dev_{dev},
+    usb_dev_{std::move(usb_dev)}
+{}
 
 bool ScannerInterfaceUsb::is_mock() const
 {
@@ -77,7 +86,7 @@ std::uint8_t ScannerInterfaceUsb::read_register(std::uint16_t address)
             usb_value |= 0x100;
         }
 
-        usb_dev_.control_msg(REQUEST_TYPE_IN, REQUEST_BUFFER, usb_value, address16, 2, value2x8);
+        usb_dev_->control_msg(REQUEST_TYPE_IN, REQUEST_BUFFER, usb_value, address16, 2, value2x8);
 
         // check usb link status
         if (value2x8[1] != 0x55) {
@@ -96,11 +105,14 @@ std::uint8_t ScannerInterfaceUsb::read_register(std::uint16_t address)
 
         std::uint8_t address8 = address & 0xff;
 
-        usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_SET_REGISTER, INDEX,
-                             1, &address8);
-        usb_dev_.control_msg(REQUEST_TYPE_IN, REQUEST_REGISTER, VALUE_READ_REGISTER, INDEX,
-                             1, &value);
+        usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_SET_REGISTER, INDEX,
+                              1, &address8);
+        usb_dev_->control_msg(REQUEST_TYPE_IN, REQUEST_REGISTER, VALUE_READ_REGISTER, INDEX,
+                              1, &value);
     }
+
+    // the device may have changed the register by itself since it has been last written
+    register_shadow_.set(address, value);
     return value;
 }
 
@@ -109,6 +121,9 @@ void ScannerInterfaceUsb::write_register(std::uint16_t address, std::uint8_t val
     DBG_HELPER_ARGS(dbg, "address: 0x%04x, value: 0x%02x", static_cast<unsigned>(address),
                     static_cast<unsigned>(value));
 
+    // the register value is unknown if the write fails midway
+    register_shadow_.invalidate(address);
+
     if (dev_->model->asic_type == AsicType::GL847 ||
         dev_->model->asic_type == AsicType::GL845 ||
         dev_->model->asic_type == AsicType::GL846 ||
@@ -124,7 +139,7 @@ void ScannerInterfaceUsb::write_register(std::uint16_t address, std::uint8_t val
             usb_value |= 0x100;
         }
 
-        usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, usb_value, INDEX,
+        usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, usb_value, INDEX,
                                   2, buffer);
 
     } else {
@@ -134,22 +149,106 @@ void ScannerInterfaceUsb::write_register(std::uint16_t address, std::uint8_t val
 
         std::uint8_t address8 = address & 0xff;
 
-        usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_SET_REGISTER, INDEX,
-                             1, &address8);
+        usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_SET_REGISTER, INDEX,
+                              1, &address8);
 
-        usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_WRITE_REGISTER, INDEX,
-                             1, &value);
+        usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_WRITE_REGISTER, INDEX,
+                              1, &value);
 
     }
+    if (address == 0x0e) {
+        // soft reset restores the default register values
+        register_shadow_.clear();
+    } else {
+        register_shadow_.set(address, value);
+    }
+
     DBG(DBG_io, "%s (0x%02x, 0x%02x) completed\n", __func__, address, value);
 }
 
+// Returns true if writing to the register has effects beyond storing the value, for example
+// starting a command or selecting the target of a subsequent data transfer. Such registers must
+// be written even if the device already holds the value.
+static bool register_write_has_side_effects(std::uint16_t address)
+{
+    switch (address) {
+        case 0x01: // scan enable
+        case 0x0b: // DRAM and clock setup
+        case 0x0d: // clear line and motor counters
+        case 0x0e: // soft reset
+        case 0x0f: // start motor
+        case 0x29: // buffer address
+        case 0x2a:
+        case 0x2b:
+        case 0x3a: // frontend data
+        case 0x3b:
+        case 0x50: // frontend address
+        case 0x51:
+        case 0x5b: // gamma address
+        case 0x5c:
+        case 0x5d: // frontend data on GL124
+        case 0x5e:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Returns the maximum number of register address/value pairs that may be sent in a single
+// control message on the GL124, GL845, GL846 and GL847. The protocol is the same as on GL841,
+// but it has not been verified that these ASICs accept more than one pair at a time, thus this
+// is opt-in via the SANE_GENESYS_REGISTER_BATCH_SIZE environment variable.
+static std::size_t get_register_batch_size_gl84x()
+{
+    static const std::size_t batch_size = []()
+    {
+        auto* setting = std::getenv("SANE_GENESYS_REGISTER_BATCH_SIZE");
+        if (!setting) {
+            return std::size_t{1};
+        }
+        auto setting_int = std::strtol(setting, nullptr, 10);
+        return static_cast<std::size_t>(clamp<long>(setting_int, 1, 32));
+    }();
+    return batch_size;
+}
+
 void ScannerInterfaceUsb::write_registers(const Genesys_Register_Set& regs)
 {
     DBG_HELPER(dbg);
-    if (dev_->model->asic_type == AsicType::GL646 ||
-        dev_->model->asic_type == AsicType::GL841)
-    {
+
+    // only the registers whose value may differ from what the device holds are sent
+    std::vector<GenesysRegister> changed_regs;
+    changed_regs.reserve(regs.size());
+    for (const auto& r : regs) {
+        if (register_write_has_side_effects(r.address) ||
+            register_shadow_.is_changed(r.address, r.value))
+        {
+            changed_regs.push_back(r);
+        }
+    }
+
+    DBG(DBG_io, "%s (elems= %zu, changed = %zu)\n", __func__, regs.size(), changed_regs.size());
+
+    if (changed_regs.empty()) {
+        return;
+    }
+
+    try {
+        write_register_batch(changed_regs);
+    } catch (...) {
+        // we don't know which of the registers have been written
+        register_shadow_.clear();
+        throw;
+    }
+
+    DBG(DBG_io, "%s: wrote %zu registers\n", __func__, changed_regs.size());
+}
+
+void ScannerInterfaceUsb::write_register_batch(const std::vector<GenesysRegister>& regs)
+{
+    auto asic_type = dev_->model->asic_type;
+
+    if (asic_type == AsicType::GL646) {
         uint8_t outdata[8];
         std::vector<uint8_t> buffer;
         buffer.reserve(regs.size() * 2);
@@ -160,52 +259,94 @@ void ScannerInterfaceUsb::write_registers(const Genesys_Register_Set& regs)
             buffer.push_back(r.value);
         }
 
-        DBG(DBG_io, "%s (elems= %zu, size = %zu)\n", __func__, regs.size(), buffer.size());
-
-        if (dev_->model->asic_type == AsicType::GL646) {
-            outdata[0] = BULK_OUT;
-            outdata[1] = BULK_REGISTER;
-            outdata[2] = 0x00;
-            outdata[3] = 0x00;
-            outdata[4] = (buffer.size() & 0xff);
-            outdata[5] = ((buffer.size() >> 8) & 0xff);
-            outdata[6] = ((buffer.size() >> 16) & 0xff);
-            outdata[7] = ((buffer.size() >> 24) & 0xff);
-
-            usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, VALUE_BUFFER, INDEX,
-                                 sizeof(outdata), outdata);
+        outdata[0] = BULK_OUT;
+        outdata[1] = BULK_REGISTER;
+        outdata[2] = 0x00;
+        outdata[3] = 0x00;
+        outdata[4] = (buffer.size() & 0xff);
+        outdata[5] = ((buffer.size() >> 8) & 0xff);
+        outdata[6] = ((buffer.size() >> 16) & 0xff);
+        outdata[7] = ((buffer.size() >> 24) & 0xff);
 
-            size_t write_size = buffer.size();
+        usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, VALUE_BUFFER, INDEX,
+                              sizeof(outdata), outdata);
 
-            usb_dev_.bulk_write(buffer.data(), &write_size);
-        } else {
-            for (std::size_t i = 0; i < regs.size();) {
-                std::size_t c = regs.size() - i;
-                if (c > 32)  /*32 is max on GL841. checked that.*/
-                    c = 32;
+        size_t write_size = buffer.size();
 
-                usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, VALUE_SET_REGISTER,
-                                     INDEX, c * 2, buffer.data() + i * 2);
+        usb_dev_->bulk_write(buffer.data(), &write_size);
 
-                i += c;
+        for (const auto& r : regs) {
+            register_shadow_.set(r.address, r.value);
+            if (r.address == 0x0e) {
+                register_shadow_.clear();
             }
         }
-    } else {
+        return;
+    }
+
+    std::size_t max_batch_size = 1;
+    if (asic_type == AsicType::GL841) {
+        max_batch_size = 32; // 32 is max on GL841. checked that.
+    } else if (asic_type == AsicType::GL847 ||
+               asic_type == AsicType::GL845 ||
+               asic_type == AsicType::GL846 ||
+               asic_type == AsicType::GL124)
+    {
+        max_batch_size = get_register_batch_size_gl84x();
+    }
+
+    if (max_batch_size == 1) {
         for (const auto& r : regs) {
             write_register(r.address, r.value);
         }
+        return;
     }
 
-    DBG(DBG_io, "%s: wrote %zu registers\n", __func__, regs.size());
+    std::uint8_t buffer[64];
+
+    for (std::size_t i = 0; i < regs.size();) {
+        // registers above 0xff are selected by a flag in the request value, so all registers in
+        // a single message must have the same high address byte
+        std::uint16_t high_address = regs[i].address & 0xff00;
+        std::size_t count = 0;
+        while (i + count < regs.size() && count < max_batch_size &&
+               (regs[i + count].address & 0xff00) == high_address)
+        {
+            buffer[count * 2] = regs[i + count].address & 0xff;
+            buffer[count * 2 + 1] = regs[i + count].value;
+            count++;
+        }
+
+        if (high_address > 0x100) {
+            throw SaneException("Invalid register address 0x%04x", regs[i].address);
+        }
+
+        std::uint16_t usb_value = VALUE_SET_REGISTER;
+        if (high_address != 0) {
+            usb_value |= 0x100;
+        }
+
+        usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, usb_value, INDEX,
+                              count * 2, buffer);
+
+        for (std::size_t j = i; j < i + count; j++) {
+            register_shadow_.set(regs[j].address, regs[j].value);
+            if (regs[j].address == 0x0e) {
+                register_shadow_.clear();
+            }
+        }
+        i += count;
+    }
 }
 
 void ScannerInterfaceUsb::write_0x8c(std::uint8_t index, std::uint8_t value)
 {
     DBG_HELPER_ARGS(dbg, "0x%02x,0x%02x", index, value);
-    usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_BUF_ENDACCESS, index, 1, &value);
+    usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_BUF_ENDACCESS, index, 1,
+                          &value);
 }
 
-static void bulk_read_data_send_header(UsbDevice& usb_dev, AsicType asic_type, size_t size)
+static void bulk_read_data_send_header(IUsbDevice& usb_dev, AsicType asic_type, size_t size)
 {
     DBG_HELPER(dbg);
 
@@ -271,8 +412,8 @@ void ScannerInterfaceUsb::bulk_read_data(std::uint8_t addr, std::uint8_t* data,
         return;
 
     if (is_addr_used) {
-        usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_SET_REGISTER, 0x00,
-                             1, &addr);
+        usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_SET_REGISTER, 0x00,
+                              1, &addr);
     }
 
     std::size_t target_size = size;
@@ -280,7 +421,7 @@ void ScannerInterfaceUsb::bulk_read_data(std::uint8_t addr, std::uint8_t* data,
     std::size_t max_in_size = sanei_genesys_get_bulk_max_size(dev_->model->asic_type);
 
     if (!has_header_before_each_chunk) {
-        bulk_read_data_send_header(usb_dev_, dev_->model->asic_type, size);
+        bulk_read_data_send_header(*usb_dev_, dev_->model->asic_type, size);
     }
 
     // loop until computed data size is read
@@ -288,12 +429,12 @@ void ScannerInterfaceUsb::bulk_read_data(std::uint8_t addr, std::uint8_t* data,
         std::size_t block_size = std::min(target_size, max_in_size);
 
         if (has_header_before_each_chunk) {
-            bulk_read_data_send_header(usb_dev_, dev_->model->asic_type, block_size);
+            bulk_read_data_send_header(*usb_dev_, dev_->model->asic_type, block_size);
         }
 
         DBG(DBG_io2, "%s: trying to read %zu bytes of data\n", __func__, block_size);
 
-        usb_dev_.bulk_read(data, &block_size);
+        usb_dev_->bulk_read(data, &block_size);
 
         DBG(DBG_io2, "%s: read %zu bytes, %zu remaining\n", __func__, block_size, target_size - block_size);
 
@@ -310,7 +451,7 @@ void ScannerInterfaceUsb::bulk_write_data(std::uint8_t addr, std::uint8_t* data,
     std::size_t size;
     std::uint8_t outdata[8];
 
-    usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_SET_REGISTER, INDEX,
+    usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_REGISTER, VALUE_SET_REGISTER, INDEX,
                              1, &addr);
 
     std::size_t max_out_size = sanei_genesys_get_bulk_max_size(dev_->model->asic_type);
@@ -340,10 +481,10 @@ void ScannerInterfaceUsb::bulk_write_data(std::uint8_t addr, std::uint8_t* data,
         outdata[6] = ((size >> 16) & 0xff);
         outdata[7] = ((size >> 24) & 0xff);
 
-        usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, VALUE_BUFFER, 0x00,
-                             sizeof(outdata), outdata);
+        usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, VALUE_BUFFER, 0x00,
+                              sizeof(outdata), outdata);
 
-        usb_dev_.bulk_write(data, &size);
+        usb_dev_->bulk_write(data, &size);
 
         DBG(DBG_io2, "%s: wrote %zu bytes, %zu remaining\n", __func__, size, len - size);
 
@@ -423,7 +564,7 @@ void ScannerInterfaceUsb::write_ahb(std::uint32_t addr, std::uint32_t size, std:
     outdata[7] = ((size >> 24) & 0xff);
 
     // write addr and size for AHB
-    usb_dev_.control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, VALUE_BUFFER, 0x01, 8, outdata);
+    usb_dev_->control_msg(REQUEST_TYPE_OUT, REQUEST_BUFFER, VALUE_BUFFER, 0x01, 8, outdata);
 
     std::size_t max_out_size = sanei_genesys_get_bulk_max_size(dev_->model->asic_type);
 
@@ -432,7 +573,7 @@ void ScannerInterfaceUsb::write_ahb(std::uint32_t addr, std::uint32_t size, std:
     do {
         std::size_t block_size = std::min(size - written, max_out_size);
 
-        usb_dev_.bulk_write(data + written, &block_size);
+        usb_dev_->bulk_write(data + written, &block_size);
 
         written += block_size;
     } while (written < size);
@@ -475,7 +616,7 @@ void ScannerInterfaceUsb::write_fe_register(std::uint8_t address, std::uint16_t
 
 IUsbDevice& ScannerInterfaceUsb::get_usb_device()
 {
-    return usb_dev_;
+    return *usb_dev_;
 }
 
 void ScannerInterfaceUsb::sleep_us(unsigned microseconds)
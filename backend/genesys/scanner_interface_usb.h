@@ -45,7 +45,9 @@
 #define BACKEND_GENESYS_SCANNER_INTERFACE_USB_H
 
 #include "scanner_interface.h"
+#include "register.h"
 #include "usb_device.h"
+#include <memory>
 
 namespace genesys {
 
@@ -54,6 +56,9 @@ class ScannerInterfaceUsb : public ScannerInterface
 public:
     ScannerInterfaceUsb(Genesys_Device* dev);
 
+    // Uses the given USB device instead of a real one. This is useful only for tests.
+    ScannerInterfaceUsb(Genesys_Device* dev, std::unique_ptr<IUsbDevice> usb_dev);
+
     ~ScannerInterfaceUsb() override;
 
     bool is_mock() const override;
@@ -89,8 +94,11 @@ public:
     void test_checkpoint(const std::string& name) override;
 
 private:
+    void write_register_batch(const std::vector<GenesysRegister>& regs);
+
     Genesys_Device* dev_;
-    UsbDevice usb_dev_;
+    std::unique_ptr<IUsbDevice> usb_dev_;
+    RegisterShadow register_shadow_;
 };
 
 } // namespace genesys
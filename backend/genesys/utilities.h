@@ -49,6 +49,8 @@
 #include <cstdint>
 #include <iostream>
 #include <sstream>
+#include <system_error>
+#include <thread>
 #include <vector>
 
 
@@ -121,6 +123,109 @@ inline T clamp(const T& value, const T& lo, const T& hi)
     return value;
 }
 
+namespace percentile_detail {
+
+// The number of columns that are transposed into a contiguous buffer at a time
+constexpr std::size_t TILE_COLUMNS = 64;
+
+// The minimum number of elements that each thread should process
+constexpr std::size_t MIN_ELEMENTS_PER_THREAD = 1 << 17;
+
+constexpr unsigned MAX_THREAD_COUNT = 8;
+
+// The minimum number of elements in a column for which the histogram-based selection is faster
+// than std::nth_element
+constexpr std::size_t MIN_HISTOGRAM_SELECT_COUNT = 64;
+
+// Returns the element that would be at the given index if elems were sorted. The contents of
+// elems are reordered.
+template<class T>
+T select_nth(T* elems, std::size_t count, std::size_t index)
+{
+    std::nth_element(elems, elems + index, elems + count);
+    return elems[index];
+}
+
+// Same as above, but uses two counting passes over the high and low bytes of the values, which is
+// linear in the number of elements.
+inline std::uint16_t select_nth(std::uint16_t* elems, std::size_t count, std::size_t index)
+{
+    if (count < MIN_HISTOGRAM_SELECT_COUNT) {
+        std::nth_element(elems, elems + index, elems + count);
+        return elems[index];
+    }
+
+    unsigned histogram[256] = {};
+    for (std::size_t i = 0; i < count; ++i) {
+        histogram[elems[i] >> 8]++;
+    }
+
+    std::size_t remaining = index;
+    unsigned high = 0;
+    while (remaining >= histogram[high]) {
+        remaining -= histogram[high];
+        high++;
+    }
+
+    std::fill(histogram, histogram + 256, 0);
+    for (std::size_t i = 0; i < count; ++i) {
+        if ((elems[i] >> 8) == high) {
+            histogram[elems[i] & 0xff]++;
+        }
+    }
+
+    unsigned low = 0;
+    while (remaining >= histogram[low]) {
+        remaining -= histogram[low];
+        low++;
+    }
+
+    return static_cast<std::uint16_t>((high << 8) | low);
+}
+
+// Computes the results for columns [column_begin, column_end). The columns are transposed into
+// the tile buffer, which must hold TILE_COLUMNS * line_count elements, so that the data is read
+// sequentially.
+template<class T>
+void compute_columns(T* result, const T* data, T* tile, std::size_t line_count,
+                     std::size_t elements_per_line, std::size_t column_begin,
+                     std::size_t column_end, std::size_t select_index)
+{
+    for (std::size_t x0 = column_begin; x0 < column_end; x0 += TILE_COLUMNS) {
+        std::size_t width = std::min(TILE_COLUMNS, column_end - x0);
+
+        for (std::size_t iy = 0; iy < line_count; ++iy) {
+            const T* row = data + iy * elements_per_line + x0;
+            for (std::size_t ix = 0; ix < width; ++ix) {
+                tile[ix * line_count + iy] = row[ix];
+            }
+        }
+
+        for (std::size_t ix = 0; ix < width; ++ix) {
+            result[x0 + ix] = select_nth(tile + ix * line_count, line_count, select_index);
+        }
+    }
+}
+
+inline unsigned get_thread_count(std::size_t line_count, std::size_t elements_per_line)
+{
+    std::size_t max_threads = std::max<std::size_t>(
+                1, line_count * elements_per_line / MIN_ELEMENTS_PER_THREAD);
+    max_threads = std::min<std::size_t>(max_threads, elements_per_line / TILE_COLUMNS);
+    max_threads = std::min<std::size_t>(max_threads, MAX_THREAD_COUNT);
+
+    unsigned hw_threads = std::thread::hardware_concurrency();
+    if (hw_threads == 0) {
+        hw_threads = 1;
+    }
+    return static_cast<unsigned>(std::max<std::size_t>(1, std::min<std::size_t>(max_threads,
+                                                                                 hw_threads)));
+}
+
+} // namespace percentile_detail
+
+// Computes the given percentile of each column of the data. Within each column the element that
+// would be at position line_count * percentile if the column was sorted is selected.
 template<class T>
 void compute_array_percentile_approx(T* result, const T* data,
                                      std::size_t line_count, std::size_t elements_per_line,
@@ -135,22 +240,47 @@ void compute_array_percentile_approx(T* result, const T* data,
         return;
     }
 
-    std::vector<T> column_elems;
-    column_elems.resize(line_count, 0);
-
     std::size_t select_elem = std::min(static_cast<std::size_t>(line_count * percentile),
                                        line_count - 1);
 
-    auto select_it = column_elems.begin() + select_elem;
+    unsigned thread_count = percentile_detail::get_thread_count(line_count, elements_per_line);
 
-    for (std::size_t ix = 0; ix < elements_per_line; ++ix) {
-        for (std::size_t iy = 0; iy < line_count; ++iy) {
-            column_elems[iy] = data[iy * elements_per_line + ix];
+    std::size_t tile_size = percentile_detail::TILE_COLUMNS * line_count;
+    std::vector<T> tiles;
+    tiles.resize(tile_size * thread_count);
+
+    // split the columns into chunks consisting of whole tiles, one chunk per thread
+    std::size_t tile_count = (elements_per_line + percentile_detail::TILE_COLUMNS - 1) /
+            percentile_detail::TILE_COLUMNS;
+    std::size_t tiles_per_thread = (tile_count + thread_count - 1) / thread_count;
+    std::size_t columns_per_thread = tiles_per_thread * percentile_detail::TILE_COLUMNS;
+
+    auto compute_chunk = [=, &tiles](unsigned chunk, unsigned tile_index)
+    {
+        std::size_t column_begin = std::min(chunk * columns_per_thread, elements_per_line);
+        std::size_t column_end = std::min(column_begin + columns_per_thread, elements_per_line);
+        percentile_detail::compute_columns(result, data, tiles.data() + tile_index * tile_size,
+                                           line_count, elements_per_line,
+                                           column_begin, column_end, select_elem);
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    try {
+        for (unsigned i = 1; i < thread_count; ++i) {
+            threads.emplace_back(compute_chunk, i, i);
         }
+    } catch (const std::system_error&) {
+        // the chunks that didn't get a thread are computed on this thread below
+    }
 
-        std::nth_element(column_elems.begin(), select_it, column_elems.end());
+    for (unsigned i = static_cast<unsigned>(threads.size()) + 1; i < thread_count; ++i) {
+        compute_chunk(i, 0);
+    }
+    compute_chunk(0, 0);
 
-        *result++ = *select_it;
+    for (auto& thread : threads) {
+        thread.join();
     }
 }
 
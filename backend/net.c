@@ -86,6 +86,7 @@ static AvahiServiceBrowser *avahi_browser = NULL;
 #include "../include/sane/sanei.h"
 #include "../include/sane/sanei_net.h"
 #include "../include/sane/sanei_codec_bin.h"
+#include "../include/sane/sanei_lz.h"
 #include "net.h"
 
 #define BACKEND_NAME    net
@@ -122,6 +123,13 @@ static int client_big_endian; /* 1 == big endian; 0 == little endian */
 static int server_big_endian; /* 1 == big endian; 0 == little endian */
 static int depth; /* bits per pixel */
 static int connect_timeout = -1; /* timeout for connection to saned */
+static int option_cache = 0; /* keep option values on the client? */
+static int pipelining = 0; /* send requests before replies have arrived? */
+static int data_compression = 0; /* ask saned to compress the image data? */
+
+/* Upper limit of the reply data that is requested in one go while
+   pipelining, so that saned never blocks on a full socket buffer. */
+#define PIPELINE_MAX_REPLY_SIZE (32 * 1024)
 
 #ifndef NET_USES_AF_INDEP
 static int saned_port;
@@ -521,8 +529,8 @@ connect_dev (Net_Device * dev)
       status = SANE_STATUS_IO_ERROR;
       goto fail;
     }
-  if (SANE_VERSION_BUILD (version_code) != SANEI_NET_PROTOCOL_VERSION
-      && SANE_VERSION_BUILD (version_code) != 2)
+  if (SANE_VERSION_BUILD (version_code) < 2
+      || SANE_VERSION_BUILD (version_code) > SANEI_NET_PROTOCOL_VERSION)
     {
       DBG (1, "connect_dev: network protocol version mismatch: "
 	   "got %d, expected %d\n",
@@ -531,6 +539,33 @@ connect_dev (Net_Device * dev)
       goto fail;
     }
   dev->wire.version = SANE_VERSION_BUILD (version_code);
+
+  /* older servers drop requests that arrive while they are busy */
+  if (pipelining && dev->wire.version < 4)
+    DBG (2, "connect_dev: server doesn't support pipelining, "
+	 "requesting option values one by one\n");
+
+  /* older servers don't know the request and fall back to raw data */
+  dev->data_compression = SANE_NET_COMPRESSION_NONE;
+  if (data_compression && dev->wire.version >= 4)
+    {
+      SANE_Word method = SANE_NET_COMPRESSION_LZ;
+
+      DBG (2, "connect_dev: net_set_data_compression\n");
+      sanei_w_call (&dev->wire, SANE_NET_SET_DATA_COMPRESSION,
+		    (WireCodecFunc) sanei_w_word, &method,
+		    (WireCodecFunc) sanei_w_word, &dev->data_compression);
+      if (dev->wire.status != 0)
+	{
+	  DBG (1, "connect_dev: argument marshalling error (%s)\n",
+	       strerror (dev->wire.status));
+	  status = SANE_STATUS_IO_ERROR;
+	  goto fail;
+	}
+      DBG (2, "connect_dev: data compression %s\n",
+	   dev->data_compression == SANE_NET_COMPRESSION_LZ
+	   ? "enabled" : "refused by server");
+    }
   DBG (4, "connect_dev: done\n");
   return SANE_STATUS_GOOD;
 
@@ -542,12 +577,188 @@ fail:
 }
 
 
+/* Only the values of options that are set by software alone can be cached:
+   the backend is not allowed to change them without telling the frontend
+   by SANE_INFO_RELOAD_OPTIONS. */
+static SANE_Bool
+option_value_cacheable (Net_Scanner * s, SANE_Int option)
+{
+  const SANE_Option_Descriptor *desc = s->opt.desc[option];
+
+  return option_cache
+    && desc->type != SANE_TYPE_BUTTON && desc->type != SANE_TYPE_GROUP
+    && desc->size > 0
+    && SANE_OPTION_IS_ACTIVE (desc->cap)
+    && (desc->cap & SANE_CAP_SOFT_SELECT)
+    && !(desc->cap & (SANE_CAP_HARD_SELECT | SANE_CAP_AUTOMATIC));
+}
+
+static void
+invalidate_option_value (Net_Scanner * s, SANE_Int option)
+{
+  if (s->option_values && s->option_values[option])
+    {
+      free (s->option_values[option]);
+      s->option_values[option] = 0;
+    }
+}
+
+static void
+invalidate_option_values (Net_Scanner * s)
+{
+  int option_number;
+
+  if (!s->option_values)
+    return;
+
+  DBG (4, "invalidate_option_values: %p\n", (void *) s);
+  for (option_number = 0; option_number < s->local_opt.num_options;
+       option_number++)
+    invalidate_option_value (s, option_number);
+}
+
+/* Stores the value of an option. Strings may be shorter than the option
+   size, the rest of the cached value is cleared then. */
+static void
+cache_option_value (Net_Scanner * s, SANE_Int option, const void *value,
+		    size_t value_size)
+{
+  size_t size = s->opt.desc[option]->size;
+
+  if (!s->option_values)
+    {
+      s->option_values = calloc (s->local_opt.num_options, sizeof (void *));
+      if (!s->option_values)
+	return;
+    }
+
+  if (!s->option_values[option])
+    {
+      s->option_values[option] = malloc (size);
+      if (!s->option_values[option])
+	return;
+    }
+
+  if (value_size > size)
+    value_size = size;
+  memset (s->option_values[option], 0, size);
+  memcpy (s->option_values[option], value, value_size);
+}
+
+/* Fetches the values of all cacheable options that are not cached yet.
+   The requests are sent without waiting for the replies, so a batch of
+   values costs a single round trip to saned. This relies on saned keeping
+   requests that arrive while it is still busy with an earlier one. */
+static SANE_Status
+prefetch_option_values (Net_Scanner * s)
+{
+  Wire *w = &s->hw->wire;
+  SANE_Control_Option_Req req;
+  SANE_Control_Option_Reply reply;
+  SANE_Word procnum = SANE_NET_CONTROL_OPTION;
+  SANE_Int first, last, option_number, max_size;
+  size_t reply_size;
+  void *zero_value;
+
+  DBG (3, "prefetch_option_values: %p\n", (void *) s);
+
+  max_size = 0;
+  for (option_number = 0; option_number < s->opt.num_options;
+       option_number++)
+    if (option_value_cacheable (s, option_number)
+	&& s->opt.desc[option_number]->size > max_size)
+      max_size = s->opt.desc[option_number]->size;
+
+  if (max_size == 0)
+    return SANE_STATUS_GOOD;
+
+  /* the value of a GET_VALUE request is sent but ignored */
+  zero_value = calloc (1, max_size);
+  if (!zero_value)
+    return SANE_STATUS_NO_MEM;
+
+  for (first = 0; first < s->opt.num_options; first = last)
+    {
+      w->status = 0;
+      sanei_w_set_dir (w, WIRE_ENCODE);
+
+      reply_size = 0;
+      for (last = first; last < s->opt.num_options
+	   && reply_size < PIPELINE_MAX_REPLY_SIZE; last++)
+	{
+	  if (!option_value_cacheable (s, last)
+	      || (s->option_values && s->option_values[last]))
+	    continue;
+
+	  req.handle = s->handle;
+	  req.option = last;
+	  req.action = SANE_ACTION_GET_VALUE;
+	  req.value_type = s->opt.desc[last]->type;
+	  req.value_size = s->opt.desc[last]->size;
+	  req.value = zero_value;
+
+	  sanei_w_word (w, &procnum);
+	  sanei_w_control_option_req (w, &req);
+	  reply_size += s->opt.desc[last]->size;
+	}
+
+      if (reply_size == 0)
+	continue;
+
+      sanei_w_set_dir (w, WIRE_DECODE);
+      DBG (4, "prefetch_option_values: sent requests for options %d to %d\n",
+	   first, last - 1);
+
+      for (option_number = first; option_number < last; option_number++)
+	{
+	  if (!option_value_cacheable (s, option_number)
+	      || (s->option_values && s->option_values[option_number]))
+	    continue;
+
+	  sanei_w_control_option_reply (w, &reply);
+	  if (w->status)
+	    {
+	      DBG (1, "prefetch_option_values: failed to receive value of "
+		   "option %d (%s)\n", option_number, strerror (w->status));
+	      free (zero_value);
+	      return SANE_STATUS_IO_ERROR;
+	    }
+
+	  if (reply.resource_to_authorize)
+	    {
+	      /* saned waits for the authorization now, but the next request
+		 is already on its way: there's no way to recover. */
+	      DBG (1, "prefetch_option_values: option %d requires "
+		   "authorization, disable pipelining for this host\n",
+		   option_number);
+	      sanei_w_free (w, (WireCodecFunc) sanei_w_control_option_reply,
+			    &reply);
+	      free (zero_value);
+	      return SANE_STATUS_IO_ERROR;
+	    }
+
+	  if (reply.status == SANE_STATUS_GOOD
+	      && reply.value_size == s->opt.desc[option_number]->size)
+	    cache_option_value (s, option_number, reply.value,
+				reply.value_size);
+	  sanei_w_free (w, (WireCodecFunc) sanei_w_control_option_reply,
+			&reply);
+	}
+    }
+
+  free (zero_value);
+  DBG (3, "prefetch_option_values: done\n");
+  return SANE_STATUS_GOOD;
+}
+
 static SANE_Status
 fetch_options (Net_Scanner * s)
 {
   int option_number;
   DBG (3, "fetch_options: %p\n", (void *) s);
 
+  invalidate_option_values (s);
+
   if (s->opt.num_options)
     {
       DBG (2, "fetch_options: %d option descriptors cached... freeing\n",
@@ -1042,6 +1253,60 @@ sane_init (SANE_Int * version_code, SANE_Auth_Callback authorize)
 		  DBG (2, "sane_init: connect timeout set to %d seconds\n", connect_timeout);
 		}
 
+	      continue;
+	    }
+	  if (strstr(device_name, "option_cache") != NULL)
+	    {
+	      optval = strchr(device_name, '=');
+
+	      if (!optval)
+		continue;
+
+	      optval = sanei_config_skip_whitespace (++optval);
+	      if ((optval != NULL) && (*optval != '\0'))
+		{
+		  option_cache = (strcmp (optval, "yes") == 0);
+
+		  DBG (2, "sane_init: option cache %s\n",
+		       option_cache ? "enabled" : "disabled");
+		}
+
+	      continue;
+	    }
+	  if (strstr(device_name, "pipelining") != NULL)
+	    {
+	      optval = strchr(device_name, '=');
+
+	      if (!optval)
+		continue;
+
+	      optval = sanei_config_skip_whitespace (++optval);
+	      if ((optval != NULL) && (*optval != '\0'))
+		{
+		  pipelining = (strcmp (optval, "yes") == 0);
+
+		  DBG (2, "sane_init: pipelining %s\n",
+		       pipelining ? "enabled" : "disabled");
+		}
+
+	      continue;
+	    }
+	  if (strstr(device_name, "data_compression") != NULL)
+	    {
+	      optval = strchr(device_name, '=');
+
+	      if (!optval)
+		continue;
+
+	      optval = sanei_config_skip_whitespace (++optval);
+	      if ((optval != NULL) && (*optval != '\0'))
+		{
+		  data_compression = (strcmp (optval, "yes") == 0);
+
+		  DBG (2, "sane_init: data compression %s\n",
+		       data_compression ? "enabled" : "disabled");
+		}
+
 	      continue;
 	    }
 #if WITH_AVAHI
@@ -1668,6 +1933,13 @@ sane_close (SANE_Handle handle)
 	     "(%s)\n", sane_strstatus (s->hw->wire.status));
     }
 
+  if (s->option_values)
+    {
+      DBG (2, "sane_close: removing cached option values\n");
+      invalidate_option_values (s);
+      free (s->option_values);
+    }
+
   DBG (2, "sane_close: removing local option descriptors\n");
   for (option_number = 0; option_number < s->local_opt.num_options;
        option_number++)
@@ -1684,6 +1956,8 @@ sane_close (SANE_Handle handle)
       DBG (2, "sane_close: closing data pipe\n");
       close (s->data);
     }
+  free (s->record);
+  free (s->decoded);
   free (s);
   DBG (2, "sane_close: done\n");
 }
@@ -1770,6 +2044,28 @@ sane_control_option (SANE_Handle handle, SANE_Int option,
   if (action == SANE_ACTION_SET_AUTO)
     value_size = 0;
 
+  if (action == SANE_ACTION_GET_VALUE && option_value_cacheable (s, option))
+    {
+      /* there's no reliable way to pipeline requests while the data
+         connection is being served */
+      if (pipelining && s->hw->wire.version >= 4 && s->data < 0
+	  && !(s->option_values && s->option_values[option]))
+	{
+	  status = prefetch_option_values (s);
+	  if (status != SANE_STATUS_GOOD)
+	    return status;
+	}
+
+      if (s->option_values && s->option_values[option])
+	{
+	  DBG (3, "sane_control_option: using cached value\n");
+	  memcpy (value, s->option_values[option], value_size);
+	  if (info)
+	    *info = 0;
+	  return SANE_STATUS_GOOD;
+	}
+    }
+
   req.handle = s->handle;
   req.option = option;
   req.action = action;
@@ -1817,7 +2113,15 @@ sane_control_option (SANE_Handle handle, SANE_Int option,
 	    }
 
 	  if (reply.info & SANE_INFO_RELOAD_OPTIONS)
-	    s->options_valid = 0;
+	    {
+	      s->options_valid = 0;
+	      invalidate_option_values (s);
+	    }
+	  else if (action == SANE_ACTION_SET_AUTO)
+	    invalidate_option_value (s, option);
+	  else if (option_value_cacheable (s, option)
+		   && (SANE_Word) value_size == reply.value_size)
+	    cache_option_value (s, option, reply.value, reply.value_size);
 	}
       sanei_w_free (&s->hw->wire,
 		    (WireCodecFunc) sanei_w_control_option_reply, &reply);
@@ -1828,6 +2132,9 @@ sane_control_option (SANE_Handle handle, SANE_Int option,
 
   DBG (2, "sane_control_option: remote done (%s, info %x)\n", sane_strstatus (status), local_info);
 
+  if (status != SANE_STATUS_GOOD)
+    invalidate_option_value (s, option);
+
   if ((status == SANE_STATUS_GOOD) && (info == NULL) && (local_info & SANE_INFO_RELOAD_OPTIONS))
     {
       DBG (2, "sane_control_option: reloading options as frontend does not care\n");
@@ -1892,6 +2199,9 @@ sane_start (SANE_Handle handle)
 
   DBG (3, "sane_start\n");
 
+  /* backends may adjust their settings when a scan is started */
+  invalidate_option_values (s);
+
   hang_over = -1;
   left_over = -1;
 
@@ -2007,6 +2317,8 @@ sane_start (SANE_Handle handle)
   s->data = fd;
   s->reclen_buf_offset = 0;
   s->bytes_remaining = 0;
+  s->record_len = 0;
+  s->decoded_len = s->decoded_pos = 0;
   DBG (3, "sane_start: done (%s)\n", sane_strstatus (status));
   return status;
 }
@@ -2027,6 +2339,9 @@ sane_start (SANE_Handle handle)
 
   DBG (3, "sane_start\n");
 
+  /* backends may adjust their settings when a scan is started */
+  invalidate_option_values (s);
+
   hang_over = -1;
   left_over = -1;
 
@@ -2114,12 +2429,146 @@ sane_start (SANE_Handle handle)
   s->data = fd;
   s->reclen_buf_offset = 0;
   s->bytes_remaining = 0;
+  s->record_len = 0;
+  s->decoded_len = s->decoded_pos = 0;
   DBG (3, "sane_start: done (%s)\n", sane_strstatus (status));
   return status;
 }
 #endif /* NET_USES_AF_INDEP */
 
 
+static SANE_Word
+load_be32 (const SANE_Byte * p)
+{
+  return ((SANE_Word) p[0] << 24) | ((SANE_Word) p[1] << 16)
+    | ((SANE_Word) p[2] << 8) | (SANE_Word) p[3];
+}
+
+/* Grows a buffer to at least the given size. */
+static SANE_Status
+reserve_buffer (SANE_Byte ** buf, size_t * buf_size, size_t size)
+{
+  SANE_Byte *new_buf;
+
+  if (*buf_size >= size)
+    return SANE_STATUS_GOOD;
+
+  new_buf = realloc (*buf, size);
+  if (!new_buf)
+    return SANE_STATUS_NO_MEM;
+  *buf = new_buf;
+  *buf_size = size;
+  return SANE_STATUS_GOOD;
+}
+
+/* Uncompresses a complete record, see sanei_net.h for the format. */
+static SANE_Status
+decode_compressed_record (Net_Scanner * s)
+{
+  const SANE_Byte *body = s->record + SANE_NET_COMPRESSED_HEADER_SIZE;
+  size_t body_len = s->record_len - SANE_NET_COMPRESSED_HEADER_SIZE;
+  size_t raw_size = load_be32 (s->record + 2);
+  size_t row_size = load_be32 (s->record + 6);
+  size_t decoded_len = 0;
+
+  if (raw_size > SANE_NET_COMPRESSED_MAX_SIZE
+      || reserve_buffer (&s->decoded, &s->decoded_size, raw_size))
+    return SANE_STATUS_NO_MEM;
+
+  switch (s->record[0])
+    {
+    case SANE_NET_COMPRESSION_NONE:
+      decoded_len = body_len;
+      if (decoded_len != raw_size)
+	break;
+      memcpy (s->decoded, body, body_len);
+      break;
+
+    case SANE_NET_COMPRESSION_LZ:
+      if (sanei_lz_decompress (body, body_len, s->decoded, raw_size,
+			       &decoded_len) != SANE_STATUS_GOOD)
+	decoded_len = raw_size + 1;
+      break;
+
+    default:
+      DBG (1, "decode_compressed_record: unknown method %d\n", s->record[0]);
+      return SANE_STATUS_IO_ERROR;
+    }
+
+  if (decoded_len != raw_size)
+    {
+      DBG (1, "decode_compressed_record: corrupt record\n");
+      return SANE_STATUS_IO_ERROR;
+    }
+
+  switch (s->record[1])
+    {
+    case SANE_NET_FILTER_NONE:
+      break;
+
+    case SANE_NET_FILTER_UP:
+      sanei_lz_unfilter_up (s->decoded, raw_size, row_size);
+      break;
+
+    default:
+      DBG (1, "decode_compressed_record: unknown filter %d\n", s->record[1]);
+      return SANE_STATUS_IO_ERROR;
+    }
+
+  DBG (4, "decode_compressed_record: %lu bytes from %lu\n",
+       (u_long) raw_size, (u_long) s->record_len);
+  s->decoded_len = raw_size;
+  s->decoded_pos = 0;
+  return SANE_STATUS_GOOD;
+}
+
+/* Receives the rest of a compressed record and uncompresses it once it is
+   complete. Returns without data if it must be called again. */
+static SANE_Status
+read_compressed_record (Net_Scanner * s)
+{
+  SANE_Status status;
+  ssize_t nread;
+
+  if (s->bytes_remaining == 0)
+    return SANE_STATUS_GOOD;
+
+  if (s->record_len == 0)
+    {
+      size_t size = s->bytes_remaining;
+
+      if (size < SANE_NET_COMPRESSED_HEADER_SIZE
+	  || size > SANE_NET_COMPRESSED_HEADER_SIZE
+	  + sanei_lz_compress_bound (SANE_NET_COMPRESSED_MAX_SIZE))
+	{
+	  DBG (1, "read_compressed_record: invalid record length %lu\n",
+	       (u_long) size);
+	  return SANE_STATUS_IO_ERROR;
+	}
+      if (reserve_buffer (&s->record, &s->record_size, size))
+	return SANE_STATUS_NO_MEM;
+    }
+
+  while (s->bytes_remaining > 0)
+    {
+      nread = read (s->data, s->record + s->record_len, s->bytes_remaining);
+      if (nread < 0 && errno == EAGAIN)
+	return SANE_STATUS_GOOD;
+      if (nread <= 0)
+	{
+	  DBG (1, "read_compressed_record: read failed (%s)\n",
+	       nread < 0 ? strerror (errno) : "end of file");
+	  return SANE_STATUS_IO_ERROR;
+	}
+      s->record_len += nread;
+      s->bytes_remaining -= nread;
+    }
+
+  status = decode_compressed_record (s);
+  s->record_len = 0;
+  return status;
+}
+
 SANE_Status
 sane_read (SANE_Handle handle, SANE_Byte * data, SANE_Int max_length,
 	   SANE_Int * length)
@@ -2168,7 +2617,7 @@ sane_read (SANE_Handle handle, SANE_Byte * data, SANE_Int max_length,
       return SANE_STATUS_CANCELLED;
     }
 
-  if (s->bytes_remaining == 0)
+  if (s->bytes_remaining == 0 && s->decoded_pos == s->decoded_len)
     {
       /* boy, is this painful or what? */
 
@@ -2228,25 +2677,45 @@ sane_read (SANE_Handle handle, SANE_Byte * data, SANE_Int max_length,
 	}
     }
 
-  if (max_length > (SANE_Int) s->bytes_remaining)
-    max_length = s->bytes_remaining;
-
-  nread = read (s->data, data, max_length);
-
-  if (nread < 0)
+  if (s->hw->data_compression != SANE_NET_COMPRESSION_NONE)
     {
-      DBG (2, "sane_read: error code %s\n", strerror (errno));
-      if (errno == EAGAIN)
-	return SANE_STATUS_GOOD;
-      else
+      SANE_Status status = read_compressed_record (s);
+
+      if (status != SANE_STATUS_GOOD)
 	{
 	  DBG (1, "sane_read: cancelling scan\n");
 	  do_cancel (s);
-	  return SANE_STATUS_IO_ERROR;
+	  return status;
 	}
+
+      nread = s->decoded_len - s->decoded_pos;
+      if (nread > max_length)
+	nread = max_length;
+      memcpy (data, s->decoded + s->decoded_pos, nread);
+      s->decoded_pos += nread;
     }
+  else
+    {
+      if (max_length > (SANE_Int) s->bytes_remaining)
+	max_length = s->bytes_remaining;
+
+      nread = read (s->data, data, max_length);
+
+      if (nread < 0)
+	{
+	  DBG (2, "sane_read: error code %s\n", strerror (errno));
+	  if (errno == EAGAIN)
+	    return SANE_STATUS_GOOD;
+	  else
+	    {
+	      DBG (1, "sane_read: cancelling scan\n");
+	      do_cancel (s);
+	      return SANE_STATUS_IO_ERROR;
+	    }
+	}
 
-  s->bytes_remaining -= nread;
+      s->bytes_remaining -= nread;
+    }
 
   *length = nread;
   /* Check whether we are scanning with a depth of 16 bits/pixel and whether
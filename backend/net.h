@@ -62,6 +62,7 @@ typedef struct Net_Device
     int ctl;			/* socket descriptor (or -1) */
     Wire wire;
     int auth_active;
+    SANE_Word data_compression;	/* agreed on with saned */
   }
 Net_Device;
 
@@ -72,6 +73,7 @@ typedef struct Net_Scanner
 
     int options_valid;			/* are the options current? */
     SANE_Option_Descriptor_Array opt, local_opt;
+    void **option_values;		/* cached option values (or NULL) */
 
     SANE_Word handle;		/* remote handle (it's a word, not a ptr!) */
 
@@ -80,6 +82,15 @@ typedef struct Net_Scanner
     u_char reclen_buf[4];
     size_t bytes_remaining;	/* how many bytes left in this record? */
 
+    /* compressed data records: */
+    SANE_Byte *record;		/* record that is being received */
+    size_t record_size;		/* allocated size of record */
+    size_t record_len;		/* bytes of the record received so far */
+    SANE_Byte *decoded;		/* uncompressed data of the last record */
+    size_t decoded_size;	/* allocated size of decoded */
+    size_t decoded_len;		/* uncompressed size of the last record */
+    size_t decoded_pos;		/* bytes of decoded returned so far */
+
     /* device (host) info: */
     Net_Device *hw;
   }
@@ -75,6 +75,7 @@
 
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
 
 #include <sys/wait.h>
@@ -82,14 +83,28 @@
 #include <pwd.h>
 #include <grp.h>
 
+#ifdef HAVE_PTHREAD_CREATE
+# include <pthread.h>
+#endif
+
 #include "lgetopt.h"
 
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+
+#ifdef HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+# include <dirent.h>
+#endif
+
 #if defined(HAVE_SYS_POLL_H) && defined(HAVE_POLL)
 # include <sys/poll.h>
 #else
 /*
  * This replacement poll() using select() is only designed to cover
- * our needs in run_standalone(). It should probably be extended...
+ * our needs in run_standalone() and do_scan_buffered(). It should
+ * probably be extended...
  */
 struct pollfd
 {
@@ -100,6 +115,9 @@ struct pollfd
 
 #define POLLIN 0x0001
 #define POLLERR 0x0002
+#define POLLOUT 0x0004
+#define POLLHUP 0x0008
+#define POLLNVAL 0x0010
 
 int
 poll (struct pollfd *ufds, unsigned int nfds, int timeout);
@@ -110,6 +128,7 @@ poll (struct pollfd *ufds, unsigned int nfds, int timeout)
   struct pollfd *fdp;
 
   fd_set rfds;
+  fd_set wfds;
   fd_set efds;
   struct timeval tv;
   int maxfd = 0;
@@ -120,6 +139,7 @@ poll (struct pollfd *ufds, unsigned int nfds, int timeout)
   tv.tv_usec = (timeout - tv.tv_sec * 1000) * 1000;
 
   FD_ZERO (&rfds);
+  FD_ZERO (&wfds);
   FD_ZERO (&efds);
 
   for (i = 0, fdp = ufds; i < nfds; i++, fdp++)
@@ -129,6 +149,9 @@ poll (struct pollfd *ufds, unsigned int nfds, int timeout)
       if (fdp->events & POLLIN)
 	FD_SET (fdp->fd, &rfds);
 
+      if (fdp->events & POLLOUT)
+	FD_SET (fdp->fd, &wfds);
+
       FD_SET (fdp->fd, &efds);
 
       maxfd = (fdp->fd > maxfd) ? fdp->fd : maxfd;
@@ -136,7 +159,7 @@ poll (struct pollfd *ufds, unsigned int nfds, int timeout)
 
   maxfd++;
 
-  ret = select (maxfd, &rfds, NULL, &efds, &tv);
+  ret = select (maxfd, &rfds, &wfds, &efds, timeout < 0 ? NULL : &tv);
 
   if (ret < 0)
     return ret;
@@ -147,6 +170,10 @@ poll (struct pollfd *ufds, unsigned int nfds, int timeout)
 	if (FD_ISSET (fdp->fd, &rfds))
 	  fdp->revents |= POLLIN;
 
+      if (fdp->events & POLLOUT)
+	if (FD_ISSET (fdp->fd, &wfds))
+	  fdp->revents |= POLLOUT;
+
       if (FD_ISSET (fdp->fd, &efds))
 	fdp->revents |= POLLERR;
     }
@@ -155,6 +182,10 @@ poll (struct pollfd *ufds, unsigned int nfds, int timeout)
 }
 #endif /* HAVE_SYS_POLL_H && HAVE_POLL */
 
+#ifdef HAVE_SYS_UIO_H
+# include <sys/uio.h>
+#endif
+
 #if WITH_AVAHI
 # include <avahi-client/client.h>
 # include <avahi-client/publish.h>
@@ -184,6 +215,7 @@ static AvahiEntryGroup *avahi_group = NULL;
 #include "../include/sane/sane.h"
 #include "../include/sane/sanei.h"
 #include "../include/sane/sanei_net.h"
+#include "../include/sane/sanei_lz.h"
 #include "../include/sane/sanei_codec_bin.h"
 #include "../include/sane/sanei_config.h"
 
@@ -227,6 +259,14 @@ struct saned_child {
 };
 struct saned_child *children;
 int numchildren;
+/* number of children that serve a client connection */
+static int numclients;
+
+/* The device discovery cache is a file that the prober process writes and
+   the children for the client connections read, see probe_devices(). */
+#define DISCOVERY_HOTPLUG_DIR "/dev/bus/usb"
+static pid_t prober_pid = -1;
+static int discovery_fd = -1;
 
 #define SANED_CONFIG_FILE "saned.conf"
 #define SANED_PID_FILE    "/var/run/saned.pid"
@@ -254,6 +294,16 @@ static int run_mode;
 static int run_foreground;
 static int run_once;
 static int data_connect_timeout = 4000;
+/* size of the buffer for image data in bytes; zero selects the small
+   record-at-a-time buffer */
+static size_t data_buffer_size = 0;
+/* compression of the data connection that was agreed on with the client */
+static SANE_Word data_compression = SANE_NET_COMPRESSION_NONE;
+static int allow_data_compression = 1;
+/* seconds between probes for devices, zero disables the discovery cache */
+static int discovery_interval = 0;
+/* maximum number of simultaneous client connections, zero for no limit */
+static int max_connections = 0;
 static Handle *handle;
 static char *bind_addr;
 static union
@@ -299,6 +349,7 @@ static SANE_Bool log_to_syslog = SANE_TRUE;
 
 /* forward declarations: */
 static int process_request (Wire * w);
+static const SANE_Device **load_devices (void);
 
 #define SANED_RUN_INETD  0
 #define SANED_RUN_ALONE  1
@@ -1373,7 +1424,10 @@ init (Wire * w)
       return -1;
     }
 
+  /* old clients only accept versions they know about */
   w->version = SANEI_NET_PROTOCOL_VERSION;
+  if (SANE_VERSION_BUILD (req.version_code) < SANEI_NET_PROTOCOL_VERSION)
+    w->version = 3;
   if (req.username)
     default_username = strdup (req.username);
 
@@ -1384,8 +1438,7 @@ init (Wire * w)
       return -1;
     }
 
-  reply.version_code = SANE_VERSION_CODE (V_MAJOR, V_MINOR,
-					  SANEI_NET_PROTOCOL_VERSION);
+  reply.version_code = SANE_VERSION_CODE (V_MAJOR, V_MINOR, w->version);
 
   DBG (DBG_WARN, "init: access granted to %s@%s\n",
        default_username, remote_ip);
@@ -1647,6 +1700,684 @@ store_reclen (SANE_Byte * buf, size_t buf_size, int i, size_t reclen)
   return i;
 }
 
+/* Writes as much of the pending data in the ring buffer to the client as the
+   socket accepts in a single call. Returns the number of bytes written or -1
+   on error. */
+static ssize_t
+write_ring_data (int data_fd, SANE_Byte * buf, size_t buf_size,
+		 size_t writer, size_t bytes_in_buf)
+{
+  size_t first = bytes_in_buf;
+  ssize_t nwritten;
+
+  if (first > buf_size - writer)
+    first = buf_size - writer;
+
+#ifdef HAVE_SYS_UIO_H
+  {
+    struct iovec iov[2];
+    int iov_count = 1;
+
+    iov[0].iov_base = buf + writer;
+    iov[0].iov_len = first;
+    if (bytes_in_buf > first)
+      {
+	/* the data wraps around the end of the buffer */
+	iov[1].iov_base = buf;
+	iov[1].iov_len = bytes_in_buf - first;
+	iov_count = 2;
+      }
+    nwritten = writev (data_fd, iov, iov_count);
+  }
+#else
+  nwritten = write (data_fd, buf + writer, first);
+#endif
+
+  if (nwritten < 0 && (errno == EAGAIN || errno == EWOULDBLOCK
+		       || errno == EINTR))
+    return 0;
+  return nwritten;
+}
+
+/* Same as do_scan(), but uses a large ring buffer of data_buffer_size bytes.
+   Data is read from the backend directly into the buffer while earlier
+   records are still being sent, and all pending records are sent with a
+   single call. The format of the data stream is unchanged. */
+static void
+do_scan_buffered (Wire * w, int h, int data_fd)
+{
+  SANE_Handle be_handle = handle[h].handle;
+  struct pollfd fds[3];
+  SANE_Byte *buf;
+  size_t buf_size = data_buffer_size;
+  size_t reader = 0, writer = 0, bytes_in_buf = 0;
+  int be_fd = -1, status_dirty = 0;
+  SANE_Status status;
+  int flags;
+
+  DBG (3, "do_scan_buffered: start, buffer size %lu\n",
+       (unsigned long) buf_size);
+
+  buf = malloc (buf_size);
+  if (!buf)
+    {
+      DBG (DBG_ERR, "do_scan_buffered: not enough memory for buffer\n");
+      handle[h].docancel = 1;
+      sane_cancel (handle[h].handle);
+      handle[h].docancel = 0;
+      handle[h].scanning = 0;
+      return;
+    }
+
+  /* we don't want to wait for the client while the scanner has data */
+  flags = fcntl (data_fd, F_GETFL, 0);
+  if (flags >= 0)
+    fcntl (data_fd, F_SETFL, flags | O_NONBLOCK);
+
+  sane_set_io_mode (be_handle, SANE_TRUE);
+  if (sane_get_select_fd (be_handle, &be_fd) != SANE_STATUS_GOOD)
+    be_fd = -1;
+
+  status = SANE_STATUS_GOOD;
+  do
+    {
+      size_t space = buf_size - bytes_in_buf;
+      int want_read = status == SANE_STATUS_GOOD && space > 4;
+      int nfds = 0, wire_index, data_index = -1, be_index = -1;
+      int timeout = -1;
+
+      fds[nfds].fd = w->io.fd;
+      fds[nfds].events = POLLIN;
+      wire_index = nfds++;
+
+      if (bytes_in_buf > 0)
+	{
+	  fds[nfds].fd = data_fd;
+	  fds[nfds].events = POLLOUT;
+	  data_index = nfds++;
+	}
+
+      if (want_read)
+	{
+	  if (be_fd >= 0)
+	    {
+	      fds[nfds].fd = be_fd;
+	      fds[nfds].events = POLLIN;
+	      be_index = nfds++;
+	    }
+	  else
+	    timeout = 0;
+	}
+
+      if (poll (fds, nfds, timeout) < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  if (be_fd >= 0 && errno == EBADF)
+	    {
+	      /* see do_scan() */
+	      be_fd = -1;
+	      if (status == SANE_STATUS_GOOD)
+		status_dirty = 1;
+	      status = SANE_STATUS_EOF;
+	      DBG (DBG_INFO, "do_scan_buffered: select_fd was closed --> EOF\n");
+	      continue;
+	    }
+	  status = SANE_STATUS_IO_ERROR;
+	  DBG (DBG_ERR, "do_scan_buffered: poll failed (%s)\n",
+	       strerror (errno));
+	  break;
+	}
+
+      if (be_index >= 0 && (fds[be_index].revents & POLLNVAL))
+	{
+	  /* the backend has closed its select fd at the end of the data */
+	  be_fd = -1;
+	  if (status == SANE_STATUS_GOOD)
+	    status_dirty = 1;
+	  status = SANE_STATUS_EOF;
+	  DBG (DBG_INFO, "do_scan_buffered: select_fd was closed --> EOF\n");
+	}
+      else if (want_read
+	       && (be_index < 0 || (fds[be_index].revents & (POLLIN | POLLHUP))))
+	{
+	  /* read into the contiguous free space after the record header */
+	  size_t data_start = (reader + 4) % buf_size;
+	  size_t nbytes = space - 4;
+	  SANE_Int length = 0;
+
+	  if (nbytes > buf_size - data_start)
+	    nbytes = buf_size - data_start;
+	  if (nbytes > 0x7fffffff)
+	    nbytes = 0x7fffffff;
+
+	  status = sane_read (be_handle, buf + data_start, nbytes, &length);
+	  DBG (DBG_INFO, "do_scan_buffered: read %d of %lu bytes from scanner\n",
+	       length, (unsigned long) nbytes);
+
+	  reset_watchdog ();
+
+	  if (status != SANE_STATUS_GOOD)
+	    {
+	      status_dirty = 1;
+	      DBG (DBG_MSG, "do_scan_buffered: status = `%s'\n",
+		   sane_strstatus (status));
+	    }
+	  else if (length > 0)
+	    {
+	      store_reclen (buf, buf_size, reader, length);
+	      reader = (data_start + length) % buf_size;
+	      bytes_in_buf += length + 4;
+	    }
+	}
+
+      if (status_dirty && buf_size - bytes_in_buf >= 5)
+	{
+	  status_dirty = 0;
+	  reader = store_reclen (buf, buf_size, reader, 0xffffffff);
+	  buf[reader] = status;
+	  reader = (reader + 1) % buf_size;
+	  bytes_in_buf += 5;
+	  DBG (DBG_MSG, "do_scan_buffered: statuscode `%s' was added to buffer\n",
+	       sane_strstatus (status));
+	}
+
+      if (data_index >= 0 && (fds[data_index].revents & (POLLOUT | POLLERR | POLLHUP)))
+	{
+	  ssize_t nwritten = write_ring_data (data_fd, buf, buf_size, writer,
+					      bytes_in_buf);
+	  DBG (DBG_INFO, "do_scan_buffered: wrote %ld of %lu bytes to client\n",
+	       (long) nwritten, (unsigned long) bytes_in_buf);
+	  if (nwritten < 0)
+	    {
+	      DBG (DBG_ERR, "do_scan_buffered: write failed (%s)\n",
+		   strerror (errno));
+	      status = SANE_STATUS_CANCELLED;
+	      handle[h].docancel = 1;
+	      break;
+	    }
+	  bytes_in_buf -= nwritten;
+	  writer = (writer + nwritten) % buf_size;
+	}
+
+      if (fds[wire_index].revents & POLLIN)
+	{
+	  DBG (DBG_MSG,
+	       "do_scan_buffered: processing RPC request on fd %d\n", w->io.fd);
+	  if (process_request (w) < 0)
+	    handle[h].docancel = 1;
+
+	  if (handle[h].docancel)
+	    break;
+	}
+    }
+  while (status == SANE_STATUS_GOOD || bytes_in_buf > 0 || status_dirty);
+  DBG (DBG_MSG, "do_scan_buffered: done, status=%s\n", sane_strstatus (status));
+
+  free (buf);
+
+  if (handle[h].docancel)
+    sane_cancel (handle[h].handle);
+
+  handle[h].docancel = 0;
+  handle[h].scanning = 0;
+}
+
+#define COMPRESSED_CHUNK_SIZE	(256 * 1024)
+#define COMPRESSED_QUEUE_LENGTH	4
+/* a partly filled chunk is sent when the sender is idle and it has at
+   least this size (or one row of image data, if that is larger) */
+#define COMPRESSED_MIN_FLUSH	(16 * 1024)
+
+/* State of the sender of compressed data records. The chunks form a queue:
+   the scanning loop fills the chunk after the queued ones, the sender
+   compresses and sends the first queued chunk. */
+typedef struct
+{
+  int data_fd;
+  size_t row_size;
+  SANE_Byte *chunks[COMPRESSED_QUEUE_LENGTH];
+  size_t sizes[COMPRESSED_QUEUE_LENGTH];
+  int first, count;		/* queued chunks */
+  int done;			/* no more chunks will be queued */
+  int cancelled;		/* stop sending */
+  int failed;			/* writing to the client failed */
+  int finished;			/* the sender has stopped */
+  SANE_Status status;		/* sent after the last chunk */
+  SANE_Byte *filtered;
+  SANE_Byte *record;
+  int threaded;
+#ifdef HAVE_PTHREAD_CREATE
+  int wake_fds[2];		/* written by the sender when a chunk is free
+				   again or it has stopped */
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+#endif
+}
+Compressor;
+
+static void
+store_be32 (SANE_Byte * p, SANE_Word value)
+{
+  p[0] = (value >> 24) & 0xff;
+  p[1] = (value >> 16) & 0xff;
+  p[2] = (value >> 8) & 0xff;
+  p[3] = value & 0xff;
+}
+
+/* Writes all data to the blocking data connection. Returns 0 on errors. */
+static int
+write_all (int data_fd, const SANE_Byte * data, size_t size)
+{
+  while (size > 0)
+    {
+      ssize_t nwritten = write (data_fd, data, size);
+
+      if (nwritten < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  if (errno == EAGAIN || errno == EWOULDBLOCK)
+	    {
+	      struct pollfd fds;
+
+	      fds.fd = data_fd;
+	      fds.events = POLLOUT;
+	      poll (&fds, 1, -1);
+	      continue;
+	    }
+	  DBG (DBG_ERR, "write_all: write failed (%s)\n", strerror (errno));
+	  return 0;
+	}
+      data += nwritten;
+      size -= nwritten;
+    }
+  return 1;
+}
+
+/* Filters and compresses a chunk and sends it as one data record. Data that
+   doesn't get smaller is sent uncompressed. Returns 0 on errors. */
+static int
+send_compressed_chunk (Compressor * c, const SANE_Byte * data, size_t size)
+{
+  SANE_Byte *header = c->record + 4;
+  SANE_Byte *body = header + SANE_NET_COMPRESSED_HEADER_SIZE;
+  size_t compressed_size;
+
+  sanei_lz_filter_up (data, c->filtered, size, c->row_size);
+  compressed_size = sanei_lz_compress (c->filtered, size, body, size);
+
+  store_be32 (header + 2, size);
+  if (compressed_size > 0)
+    {
+      header[0] = SANE_NET_COMPRESSION_LZ;
+      header[1] = c->row_size ? SANE_NET_FILTER_UP : SANE_NET_FILTER_NONE;
+      store_be32 (header + 6, c->row_size);
+      store_be32 (c->record,
+		  SANE_NET_COMPRESSED_HEADER_SIZE + compressed_size);
+      DBG (DBG_INFO, "send_compressed_chunk: %lu bytes compressed to %lu\n",
+	   (unsigned long) size, (unsigned long) compressed_size);
+      return write_all (c->data_fd, c->record,
+			4 + SANE_NET_COMPRESSED_HEADER_SIZE + compressed_size);
+    }
+
+  header[0] = SANE_NET_COMPRESSION_NONE;
+  header[1] = SANE_NET_FILTER_NONE;
+  store_be32 (header + 6, 0);
+  store_be32 (c->record, SANE_NET_COMPRESSED_HEADER_SIZE + size);
+  DBG (DBG_INFO, "send_compressed_chunk: %lu bytes sent uncompressed\n",
+       (unsigned long) size);
+  return write_all (c->data_fd, c->record, 4 + SANE_NET_COMPRESSED_HEADER_SIZE)
+    && write_all (c->data_fd, data, size);
+}
+
+static int
+send_status_record (Compressor * c)
+{
+  SANE_Byte record[5];
+
+  store_be32 (record, 0xffffffff);
+  record[4] = c->status;
+  DBG (DBG_MSG, "send_status_record: statuscode `%s'\n",
+       sane_strstatus (c->status));
+  return write_all (c->data_fd, record, sizeof (record));
+}
+
+#ifdef HAVE_PTHREAD_CREATE
+/* Wakes up the scanning loop waiting in poll (). */
+static void
+compressor_wake (Compressor * c)
+{
+  SANE_Byte byte = 0;
+
+  /* if the pipe is full, a wake up is pending already */
+  while (write (c->wake_fds[1], &byte, 1) < 0 && errno == EINTR);
+}
+
+static void *
+compressor_thread (void *arg)
+{
+  Compressor *c = arg;
+  sigset_t set;
+  int ok = 1;
+
+  /* a client that went away shows up as write error */
+  sigemptyset (&set);
+  sigaddset (&set, SIGPIPE);
+  pthread_sigmask (SIG_BLOCK, &set, NULL);
+
+  pthread_mutex_lock (&c->mutex);
+  for (;;)
+    {
+      int index;
+
+      while (c->count == 0 && !c->done && !c->cancelled)
+	pthread_cond_wait (&c->cond, &c->mutex);
+      if (c->cancelled || c->count == 0)
+	break;
+
+      index = c->first;
+      pthread_mutex_unlock (&c->mutex);
+      ok = send_compressed_chunk (c, c->chunks[index], c->sizes[index]);
+      pthread_mutex_lock (&c->mutex);
+
+      if (!ok)
+	break;
+      c->first = (c->first + 1) % COMPRESSED_QUEUE_LENGTH;
+      c->count--;
+      compressor_wake (c);
+    }
+
+  c->failed = !ok;
+  c->finished = 1;
+  compressor_wake (c);
+  pthread_mutex_unlock (&c->mutex);
+  return NULL;
+}
+#endif /* HAVE_PTHREAD_CREATE */
+
+static void
+compressor_lock (Compressor * c)
+{
+#ifdef HAVE_PTHREAD_CREATE
+  if (c->threaded)
+    pthread_mutex_lock (&c->mutex);
+#else
+  (void) c;
+#endif
+}
+
+static void
+compressor_unlock (Compressor * c)
+{
+#ifdef HAVE_PTHREAD_CREATE
+  if (c->threaded)
+    {
+      pthread_cond_signal (&c->cond);
+      pthread_mutex_unlock (&c->mutex);
+    }
+#else
+  (void) c;
+#endif
+}
+
+/* Queues the chunk after the queued ones, or sends it right away without
+   a thread. */
+static void
+compressor_push (Compressor * c, size_t size)
+{
+  int index;
+
+  if (!c->threaded)
+    {
+      if (!c->failed && !send_compressed_chunk (c, c->chunks[0], size))
+	c->failed = c->finished = 1;
+      return;
+    }
+
+  compressor_lock (c);
+  index = (c->first + c->count) % COMPRESSED_QUEUE_LENGTH;
+  c->sizes[index] = size;
+  c->count++;
+  compressor_unlock (c);
+}
+
+static void
+compressor_finish (Compressor * c, SANE_Status status)
+{
+  compressor_lock (c);
+  c->status = status;
+  c->done = 1;
+  if (!c->threaded)
+    c->finished = 1;
+  compressor_unlock (c);
+}
+
+/* Same as do_scan(), but sends the data in compressed records, see
+   sanei_net.h. The data is compressed and sent by a separate thread, so
+   that the backend can be read in the meantime. */
+static void
+do_scan_compressed (Wire * w, int h, int data_fd)
+{
+  SANE_Handle be_handle = handle[h].handle;
+  SANE_Parameters params;
+  struct pollfd fds[3];
+  Compressor c;
+  size_t fill = 0, min_flush = COMPRESSED_MIN_FLUSH;
+  int be_fd = -1, i, flags;
+  SANE_Status status;
+
+  DBG (3, "do_scan_compressed: start\n");
+
+  memset (&c, 0, sizeof (c));
+  c.data_fd = data_fd;
+  if (sane_get_parameters (be_handle, &params) == SANE_STATUS_GOOD
+      && params.bytes_per_line > 0
+      && params.bytes_per_line <= COMPRESSED_CHUNK_SIZE / 2)
+    {
+      c.row_size = params.bytes_per_line;
+      if (c.row_size > min_flush)
+	min_flush = c.row_size;
+    }
+
+  c.filtered = malloc (COMPRESSED_CHUNK_SIZE);
+  c.record = malloc (4 + SANE_NET_COMPRESSED_HEADER_SIZE
+		     + sanei_lz_compress_bound (COMPRESSED_CHUNK_SIZE));
+  for (i = 0; i < COMPRESSED_QUEUE_LENGTH; i++)
+    c.chunks[i] = malloc (COMPRESSED_CHUNK_SIZE);
+  for (i = 0; i < COMPRESSED_QUEUE_LENGTH && c.chunks[i]; i++);
+  if (!c.filtered || !c.record || i < COMPRESSED_QUEUE_LENGTH)
+    {
+      DBG (DBG_ERR, "do_scan_compressed: not enough memory for buffers\n");
+      handle[h].docancel = 1;
+      c.finished = 1;
+    }
+
+  /* the sender waits for the client, the loop below for the scanner */
+  flags = fcntl (data_fd, F_GETFL, 0);
+  if (flags >= 0)
+    fcntl (data_fd, F_SETFL, flags & ~O_NONBLOCK);
+
+#ifdef HAVE_PTHREAD_CREATE
+  if (!c.finished && pipe (c.wake_fds) == 0)
+    {
+      fcntl (c.wake_fds[0], F_SETFL, O_NONBLOCK);
+      fcntl (c.wake_fds[1], F_SETFL, O_NONBLOCK);
+      pthread_mutex_init (&c.mutex, NULL);
+      pthread_cond_init (&c.cond, NULL);
+      c.threaded = pthread_create (&c.thread, NULL, compressor_thread, &c) == 0;
+      if (!c.threaded)
+	{
+	  pthread_cond_destroy (&c.cond);
+	  pthread_mutex_destroy (&c.mutex);
+	  close (c.wake_fds[0]);
+	  close (c.wake_fds[1]);
+	}
+    }
+  if (!c.finished && !c.threaded)
+    DBG (DBG_WARN, "do_scan_compressed: could not create thread, "
+	 "compressing inline\n");
+#endif
+
+  sane_set_io_mode (be_handle, SANE_TRUE);
+  if (sane_get_select_fd (be_handle, &be_fd) != SANE_STATUS_GOOD)
+    be_fd = -1;
+
+  status = SANE_STATUS_GOOD;
+  while (!handle[h].docancel)
+    {
+      int finished, idle, want_read, nfds = 0, be_index = -1, timeout = -1;
+#ifdef HAVE_PTHREAD_CREATE
+      int wake_index = -1;
+#endif
+      SANE_Byte *chunk;
+
+      compressor_lock (&c);
+      chunk = c.chunks[(c.first + c.count) % COMPRESSED_QUEUE_LENGTH];
+      finished = c.finished;
+      idle = c.count == 0;
+      want_read = status == SANE_STATUS_GOOD
+	&& c.count < COMPRESSED_QUEUE_LENGTH;
+      compressor_unlock (&c);
+      if (finished)
+	break;
+
+      fds[nfds].fd = w->io.fd;
+      fds[nfds].events = POLLIN;
+      nfds++;
+
+      if (want_read && be_fd >= 0)
+	{
+	  fds[nfds].fd = be_fd;
+	  fds[nfds].events = POLLIN;
+	  be_index = nfds++;
+	}
+      else if (want_read)
+	timeout = 0;
+
+#ifdef HAVE_PTHREAD_CREATE
+      /* the sender tells when it has room for more data or is idle */
+      if (c.threaded)
+	{
+	  fds[nfds].fd = c.wake_fds[0];
+	  fds[nfds].events = POLLIN;
+	  wake_index = nfds++;
+	}
+#endif
+
+      if (poll (fds, nfds, timeout) < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  if (be_fd >= 0 && errno == EBADF)
+	    {
+	      /* see do_scan() */
+	      be_fd = -1;
+	      status = SANE_STATUS_EOF;
+	      DBG (DBG_INFO, "do_scan_compressed: select_fd was closed --> EOF\n");
+	    }
+	  else
+	    {
+	      DBG (DBG_ERR, "do_scan_compressed: poll failed (%s)\n",
+		   strerror (errno));
+	      handle[h].docancel = 1;
+	      break;
+	    }
+	}
+      else if (be_index >= 0 && (fds[be_index].revents & POLLNVAL))
+	{
+	  be_fd = -1;
+	  status = SANE_STATUS_EOF;
+	  DBG (DBG_INFO, "do_scan_compressed: select_fd was closed --> EOF\n");
+	}
+      else if (want_read
+	       && (be_index < 0 || (fds[be_index].revents & (POLLIN | POLLHUP))))
+	{
+	  SANE_Int length = 0;
+
+	  status = sane_read (be_handle, chunk + fill,
+			      COMPRESSED_CHUNK_SIZE - fill, &length);
+	  DBG (DBG_INFO, "do_scan_compressed: read %d bytes from scanner\n",
+	       length);
+
+	  reset_watchdog ();
+
+	  if (status == SANE_STATUS_GOOD)
+	    fill += length;
+	  else
+	    DBG (DBG_MSG, "do_scan_compressed: status = `%s'\n",
+		 sane_strstatus (status));
+	}
+
+      if (fill > 0 && (fill == COMPRESSED_CHUNK_SIZE
+		       || status != SANE_STATUS_GOOD
+		       || (idle && fill >= min_flush)))
+	{
+	  compressor_push (&c, fill);
+	  fill = 0;
+	}
+      if (status != SANE_STATUS_GOOD && !c.done)
+	compressor_finish (&c, status);
+
+#ifdef HAVE_PTHREAD_CREATE
+      if (wake_index >= 0 && (fds[wake_index].revents & POLLIN))
+	{
+	  SANE_Byte drain[16];
+
+	  while (read (c.wake_fds[0], drain, sizeof (drain)) > 0);
+	}
+#endif
+
+      if (fds[0].revents & POLLIN)
+	{
+	  DBG (DBG_MSG,
+	       "do_scan_compressed: processing RPC request on fd %d\n",
+	       w->io.fd);
+	  if (process_request (w) < 0)
+	    handle[h].docancel = 1;
+	}
+    }
+
+  if (c.failed)
+    handle[h].docancel = 1;
+  DBG (DBG_MSG, "do_scan_compressed: done, status=%s%s\n",
+       sane_strstatus (status), handle[h].docancel ? " (cancelled)" : "");
+
+#ifdef HAVE_PTHREAD_CREATE
+  if (c.threaded)
+    {
+      pthread_mutex_lock (&c.mutex);
+      c.cancelled = handle[h].docancel;
+      pthread_cond_signal (&c.cond);
+      pthread_mutex_unlock (&c.mutex);
+      /* wake up a sender that is blocked in write () */
+      if (handle[h].docancel)
+	shutdown (data_fd, SHUT_RDWR);
+      pthread_join (c.thread, NULL);
+      pthread_cond_destroy (&c.cond);
+      pthread_mutex_destroy (&c.mutex);
+      close (c.wake_fds[0]);
+      close (c.wake_fds[1]);
+    }
+#endif
+
+  /* the status goes last, when the scan has really ended */
+  if (!handle[h].docancel && !c.failed && c.done)
+    send_status_record (&c);
+
+  for (i = 0; i < COMPRESSED_QUEUE_LENGTH; i++)
+    free (c.chunks[i]);
+  free (c.record);
+  free (c.filtered);
+
+  if (handle[h].docancel)
+    sane_cancel (handle[h].handle);
+
+  handle[h].docancel = 0;
+  handle[h].scanning = 0;
+}
+
 static void
 do_scan (Wire * w, int h, int data_fd)
 {
@@ -1660,6 +2391,17 @@ do_scan (Wire * w, int h, int data_fd)
   SANE_Int length;
   size_t nbytes;
 
+  if (data_compression == SANE_NET_COMPRESSION_LZ)
+    {
+      do_scan_compressed (w, h, data_fd);
+      return;
+    }
+  if (data_buffer_size > 0)
+    {
+      do_scan_buffered (w, h, data_fd);
+      return;
+    }
+
   DBG (3, "do_scan: start\n");
 
   FD_ZERO (&rd_mask);
@@ -1846,9 +2588,13 @@ process_request (Wire * w)
       {
 	SANE_Get_Devices_Reply reply;
 
-	reply.status =
-	  sane_get_devices ((const SANE_Device ***) &reply.device_list,
-			    SANE_TRUE);
+	reply.device_list = (SANE_Device **) load_devices ();
+	if (reply.device_list)
+	  reply.status = SANE_STATUS_GOOD;
+	else
+	  reply.status =
+	    sane_get_devices ((const SANE_Device ***) &reply.device_list,
+			      SANE_TRUE);
 	sanei_w_reply (w, (WireCodecFunc) sanei_w_get_devices_reply, &reply);
       }
       break;
@@ -2257,6 +3003,30 @@ process_request (Wire * w)
       }
       break;
 
+    case SANE_NET_SET_DATA_COMPRESSION:
+      {
+	SANE_Word method;
+
+	sanei_w_word (w, &method);
+	if (w->status)
+	  {
+	    DBG (DBG_ERR,
+		 "process_request: bad status %d after decoding method\n",
+		 w->status);
+	    return -1;
+	  }
+
+	/* the reply tells the client which method is used */
+	data_compression = SANE_NET_COMPRESSION_NONE;
+	if (method == SANE_NET_COMPRESSION_LZ && allow_data_compression
+	    && w->version >= 4)
+	  data_compression = SANE_NET_COMPRESSION_LZ;
+	DBG (DBG_MSG, "process_request: data compression %d (requested %d)\n",
+	     data_compression, method);
+	sanei_w_reply (w, (WireCodecFunc) sanei_w_word, &data_compression);
+      }
+      break;
+
     case SANE_NET_EXIT:
       return -1;
       break;
@@ -2295,7 +3065,15 @@ wait_child (pid_t pid, int *status, int options)
     }
 #endif /* WITH_AVAHI */
 
-  for (c = children; (c != NULL) && (c->next != NULL); p = c, c = c->next)
+  if ((prober_pid > 0) && (ret == prober_pid))
+    {
+      DBG (DBG_WARN, "wait_child: device prober exited\n");
+      prober_pid = -1;
+      numchildren--;
+      return ret;
+    }
+
+  for (c = children; c != NULL; p = c, c = c->next)
     {
       if (c->pid == ret)
 	{
@@ -2307,6 +3085,7 @@ wait_child (pid_t pid, int *status, int options)
 	  free(c);
 
 	  numchildren--;
+	  numclients--;
 
 	  break;
 	}
@@ -2332,11 +3111,291 @@ add_child (pid_t pid)
   c->next = children;
 
   children = c;
+  numclients++;
 
   return 0;
 }
 
 
+/* Writes the device list to the discovery cache. The file starts with a
+   line with the time of the probe and the number of devices, followed by
+   the name, vendor, model and type of each device as zero terminated
+   strings. */
+static void
+store_devices (const SANE_Device ** device_list)
+{
+  struct flock lock;
+  size_t size = 64;
+  char *buf, *p;
+  int i, count;
+
+  for (count = 0; device_list[count]; count++)
+    size += strlen (device_list[count]->name)
+      + strlen (device_list[count]->vendor)
+      + strlen (device_list[count]->model)
+      + strlen (device_list[count]->type) + 4;
+
+  buf = malloc (size);
+  if (!buf)
+    {
+      DBG (DBG_ERR, "store_devices: out of memory\n");
+      return;
+    }
+
+  p = buf + sprintf (buf, "%ld %d\n", (long) time (NULL), count);
+  for (i = 0; i < count; i++)
+    {
+      const char *field[4];
+      int j;
+
+      field[0] = device_list[i]->name;
+      field[1] = device_list[i]->vendor;
+      field[2] = device_list[i]->model;
+      field[3] = device_list[i]->type;
+      for (j = 0; j < 4; j++)
+	{
+	  strcpy (p, field[j]);
+	  p += strlen (field[j]) + 1;
+	}
+    }
+
+  memset (&lock, 0, sizeof (lock));
+  lock.l_type = F_WRLCK;
+  lock.l_whence = SEEK_SET;
+  if (fcntl (discovery_fd, F_SETLKW, &lock) < 0)
+    DBG (DBG_ERR, "store_devices: cannot lock cache: %s\n", strerror (errno));
+  else
+    {
+      if (ftruncate (discovery_fd, 0) < 0
+	  || pwrite (discovery_fd, buf, p - buf, 0) != p - buf)
+	DBG (DBG_ERR, "store_devices: cannot write cache: %s\n",
+	     strerror (errno));
+      lock.l_type = F_UNLCK;
+      fcntl (discovery_fd, F_SETLK, &lock);
+    }
+
+  DBG (DBG_INFO, "store_devices: %d devices\n", count);
+  free (buf);
+}
+
+/* Returns the device list from the discovery cache, or NULL if there is
+   none or it is outdated. The list is valid until the next call. */
+static const SANE_Device **
+load_devices (void)
+{
+  static char *buf;
+  static SANE_Device *devices;
+  static const SANE_Device **device_list;
+  struct flock lock;
+  struct stat st;
+  ssize_t size = -1;
+  long updated;
+  char *p, *end;
+  int i, count;
+
+  free (buf);
+  free (devices);
+  free (device_list);
+  buf = NULL;
+  devices = NULL;
+  device_list = NULL;
+
+  if (discovery_fd < 0)
+    return NULL;
+
+  memset (&lock, 0, sizeof (lock));
+  lock.l_type = F_RDLCK;
+  lock.l_whence = SEEK_SET;
+  if (fcntl (discovery_fd, F_SETLKW, &lock) < 0)
+    return NULL;
+  if (fstat (discovery_fd, &st) == 0 && st.st_size > 0
+      && (buf = malloc (st.st_size + 1)) != NULL)
+    size = pread (discovery_fd, buf, st.st_size, 0);
+  lock.l_type = F_UNLCK;
+  fcntl (discovery_fd, F_SETLK, &lock);
+
+  if (size <= 0)
+    return NULL;
+  buf[size] = '\0';
+  end = buf + size;
+
+  /* the prober should have updated it twice in this time */
+  if (sscanf (buf, "%ld %d", &updated, &count) != 2 || count < 0
+      || count > size || (long) time (NULL) - updated > 2L * discovery_interval + 60)
+    {
+      DBG (DBG_MSG, "load_devices: no current device list in cache\n");
+      return NULL;
+    }
+
+  devices = calloc (count + 1, sizeof (SANE_Device));
+  device_list = calloc (count + 1, sizeof (SANE_Device *));
+  if (!devices || !device_list)
+    return NULL;
+
+  p = strchr (buf, '\n');
+  if (!p)
+    {
+      DBG (DBG_ERR, "load_devices: cache is truncated\n");
+      return NULL;
+    }
+  p++;
+  for (i = 0; i < count; i++)
+    {
+      const char **field[4];
+      int j;
+
+      field[0] = &devices[i].name;
+      field[1] = &devices[i].vendor;
+      field[2] = &devices[i].model;
+      field[3] = &devices[i].type;
+      for (j = 0; j < 4; j++)
+	{
+	  if (p >= end)
+	    {
+	      DBG (DBG_ERR, "load_devices: cache is truncated\n");
+	      return NULL;
+	    }
+	  *field[j] = p;
+	  p += strlen (p) + 1;
+	}
+      device_list[i] = &devices[i];
+    }
+
+  DBG (DBG_MSG, "load_devices: %d devices from cache\n", count);
+  return device_list;
+}
+
+static void
+probe_devices (void)
+{
+  const SANE_Device **device_list;
+  SANE_Int version_code;
+  SANE_Status status;
+
+  status = sane_init (&version_code, NULL);
+  if (status == SANE_STATUS_GOOD)
+    {
+      /* like SANE_NET_GET_DEVICES, only local devices are shared */
+      status = sane_get_devices (&device_list, SANE_TRUE);
+      if (status == SANE_STATUS_GOOD)
+	store_devices (device_list);
+    }
+  if (status != SANE_STATUS_GOOD)
+    DBG (DBG_ERR, "probe_devices: failed to get devices (%s)\n",
+	 sane_strstatus (status));
+  sane_exit ();
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+/* Watches the USB device nodes, so that devices that are plugged in show
+   up without waiting for the next probe. */
+static int
+watch_hotplug (void)
+{
+  char path[PATH_MAX];
+  struct dirent *entry;
+  DIR *dir;
+  int fd;
+
+  fd = inotify_init ();
+  if (fd < 0)
+    return -1;
+
+  if (inotify_add_watch (fd, DISCOVERY_HOTPLUG_DIR, IN_CREATE | IN_DELETE) < 0)
+    {
+      DBG (DBG_DBG, "watch_hotplug: cannot watch %s: %s\n",
+	   DISCOVERY_HOTPLUG_DIR, strerror (errno));
+      close (fd);
+      return -1;
+    }
+
+  /* one directory for each bus */
+  dir = opendir (DISCOVERY_HOTPLUG_DIR);
+  if (dir)
+    {
+      while ((entry = readdir (dir)) != NULL)
+	{
+	  if (entry->d_name[0] == '.')
+	    continue;
+	  snprintf (path, sizeof (path), "%s/%s", DISCOVERY_HOTPLUG_DIR,
+		    entry->d_name);
+	  inotify_add_watch (fd, path, IN_CREATE | IN_DELETE);
+	}
+      closedir (dir);
+    }
+  return fd;
+}
+#endif /* HAVE_SYS_INOTIFY_H */
+
+/* Spawns the process that keeps the discovery cache up to date, so that the
+   children don't need to probe all backends for each client. */
+static void
+saned_prober (struct pollfd *fds, int nfds)
+{
+  struct pollfd *fdp = NULL;
+  struct pollfd hotplug;
+  pid_t parent = getpid ();
+  int waited, ret;
+
+  prober_pid = fork ();
+
+  if (prober_pid > 0)
+    {
+      numchildren++;
+      return;
+    }
+  else if (prober_pid < 0)
+    {
+      DBG (DBG_ERR, "saned_prober: could not spawn prober process: %s\n", strerror (errno));
+      return;
+    }
+
+  signal (SIGINT, NULL);
+  signal (SIGTERM, NULL);
+
+  /* Close network fds */
+  for (fdp = fds; nfds > 0; nfds--, fdp++)
+    close (fdp->fd);
+
+  free(fds);
+
+  hotplug.fd = -1;
+  while (getppid () == parent)
+    {
+      probe_devices ();
+
+#ifdef HAVE_SYS_INOTIFY_H
+      if (hotplug.fd < 0)
+	hotplug.fd = watch_hotplug ();
+#endif /* HAVE_SYS_INOTIFY_H */
+      hotplug.events = POLLIN;
+
+      /* wait in steps of a second, so that the prober doesn't outlive
+         saned by up to a whole interval */
+      ret = 0;
+      for (waited = 0; waited < discovery_interval && ret <= 0
+	   && getppid () == parent; waited++)
+	{
+	  hotplug.revents = 0;
+	  ret = poll (&hotplug, (hotplug.fd >= 0) ? 1 : 0, 1000);
+	}
+
+      if (ret > 0)
+	{
+	  DBG (DBG_MSG, "saned_prober: hotplug event\n");
+
+	  /* let the device settle, then start over with fresh watches,
+	     which also covers new buses */
+	  sleep (1);
+	  close (hotplug.fd);
+	  hotplug.fd = -1;
+	}
+    }
+
+  exit (EXIT_SUCCESS);
+}
+
+
 static void
 handle_connection (int fd)
 {
@@ -2401,7 +3460,8 @@ handle_client (int fd)
 	closelog();
 
       for (i = 3; i < fd; i++)
-	close(i);
+	if (i != discovery_fd)
+	  close(i);
 
       if (log_to_syslog)
 	openlog ("saned", LOG_PID | LOG_CONS, LOG_DAEMON);
@@ -2433,6 +3493,9 @@ bail_out (int error)
     kill (avahi_pid, SIGTERM);
 #endif /* WITH_AVAHI */
 
+  if (prober_pid > 0)
+    kill (prober_pid, SIGTERM);
+
   while (numchildren > 0)
     wait_child (-1, NULL, 0);
 
@@ -2820,6 +3883,76 @@ read_config (void)
                 DBG (DBG_INFO, "read_config: data connect timeout: %d\n", data_connect_timeout);
               }
             }
+            else if(strstr(config_line, "data_buffer_size") != NULL)
+            {
+              optval = sanei_config_skip_whitespace (++optval);
+              if ((optval != NULL) && (*optval != '\0'))
+              {
+                val = strtol (optval, &endval, 10);
+                if (optval == endval)
+                {
+                  DBG (DBG_ERR, "read_config: invalid value for data_buffer_size\n");
+                  continue;
+                }
+                else if ((val < 0) || (val > 65536))
+                {
+                  DBG (DBG_ERR, "read_config: data_buffer_size is invalid\n");
+                  continue;
+                }
+                data_buffer_size = (size_t) val * 1024;
+                DBG (DBG_INFO, "read_config: data buffer size: %ld KiB\n", val);
+              }
+            }
+            else if(strstr(config_line, "discovery_interval") != NULL)
+            {
+              optval = sanei_config_skip_whitespace (++optval);
+              if ((optval != NULL) && (*optval != '\0'))
+              {
+                val = strtol (optval, &endval, 10);
+                if (optval == endval)
+                {
+                  DBG (DBG_ERR, "read_config: invalid value for discovery_interval\n");
+                  continue;
+                }
+                else if ((val < 0) || (val > 86400))
+                {
+                  DBG (DBG_ERR, "read_config: discovery_interval is invalid\n");
+                  continue;
+                }
+                discovery_interval = val;
+                DBG (DBG_INFO, "read_config: discovery interval: %d s\n", discovery_interval);
+              }
+            }
+            else if(strstr(config_line, "max_connections") != NULL)
+            {
+              optval = sanei_config_skip_whitespace (++optval);
+              if ((optval != NULL) && (*optval != '\0'))
+              {
+                val = strtol (optval, &endval, 10);
+                if (optval == endval)
+                {
+                  DBG (DBG_ERR, "read_config: invalid value for max_connections\n");
+                  continue;
+                }
+                else if ((val < 0) || (val > 65535))
+                {
+                  DBG (DBG_ERR, "read_config: max_connections is invalid\n");
+                  continue;
+                }
+                max_connections = val;
+                DBG (DBG_INFO, "read_config: max connections: %d\n", max_connections);
+              }
+            }
+            else if(strstr(config_line, "data_compression") != NULL)
+            {
+              optval = sanei_config_skip_whitespace (++optval);
+              if ((optval != NULL) && (*optval != '\0'))
+              {
+                allow_data_compression = strncmp (optval, "no", 2) != 0;
+                DBG (DBG_INFO, "read_config: data compression %s\n",
+                     allow_data_compression ? "allowed" : "refused");
+              }
+            }
         }
       fclose (fp);
       DBG (DBG_INFO, "read_config: done reading config\n");
@@ -3156,6 +4289,113 @@ runas_user (char *user)
 }
 
 
+#ifdef HAVE_SYS_EPOLL_H
+static int listen_epfd = -1;
+#endif /* HAVE_SYS_EPOLL_H */
+static int listen_accepting;
+
+/* Prepares waiting for connections on the listening sockets. Must be called
+   again after they were bound anew. */
+static void
+listen_watch (struct pollfd *fds, int nfds)
+{
+  int i;
+
+  for (i = 0; i < nfds; i++)
+    fds[i].events = POLLIN;
+  listen_accepting = 1;
+
+#ifdef HAVE_SYS_EPOLL_H
+  if (listen_epfd >= 0)
+    close (listen_epfd);
+
+  listen_epfd = epoll_create (nfds > 0 ? nfds : 1);
+  if (listen_epfd < 0)
+    {
+      DBG (DBG_ERR, "listen_watch: epoll_create failed: %s\n", strerror (errno));
+      return;
+    }
+
+  for (i = 0; i < nfds; i++)
+    {
+      struct epoll_event ev;
+
+      memset (&ev, 0, sizeof (ev));
+      ev.events = EPOLLIN;
+      ev.data.u32 = i;
+      if (epoll_ctl (listen_epfd, EPOLL_CTL_ADD, fds[i].fd, &ev) < 0)
+	{
+	  DBG (DBG_ERR, "listen_watch: epoll_ctl failed: %s\n", strerror (errno));
+	  close (listen_epfd);
+	  listen_epfd = -1;
+	  return;
+	}
+    }
+#endif /* HAVE_SYS_EPOLL_H */
+}
+
+/* Waits for connections like poll(), but stops accepting them while
+   max_connections clients are connected. */
+static int
+listen_wait (struct pollfd *fds, int nfds, int timeout)
+{
+  int accepting = (max_connections <= 0) || (numclients < max_connections);
+  int i;
+
+  if (accepting != listen_accepting)
+    {
+      if (accepting)
+	DBG (DBG_MSG, "listen_wait: accepting connections again\n");
+      else
+	DBG (DBG_WARN, "listen_wait: %d clients connected, not accepting more\n",
+	     numclients);
+
+      for (i = 0; i < nfds; i++)
+	{
+	  fds[i].events = accepting ? POLLIN : 0;
+#ifdef HAVE_SYS_EPOLL_H
+	  if (listen_epfd >= 0)
+	    {
+	      struct epoll_event ev;
+
+	      memset (&ev, 0, sizeof (ev));
+	      ev.events = accepting ? EPOLLIN : 0;
+	      ev.data.u32 = i;
+	      epoll_ctl (listen_epfd, EPOLL_CTL_MOD, fds[i].fd, &ev);
+	    }
+#endif /* HAVE_SYS_EPOLL_H */
+	}
+      listen_accepting = accepting;
+    }
+
+#ifdef HAVE_SYS_EPOLL_H
+  if (listen_epfd >= 0)
+    {
+      struct epoll_event events[16];
+      int ret;
+
+      for (i = 0; i < nfds; i++)
+	fds[i].revents = 0;
+
+      ret = epoll_wait (listen_epfd, events, 16, timeout);
+      for (i = 0; i < ret; i++)
+	{
+	  struct pollfd *fdp = &fds[events[i].data.u32];
+
+	  if (events[i].events & EPOLLIN)
+	    fdp->revents |= POLLIN;
+	  if (events[i].events & EPOLLERR)
+	    fdp->revents |= POLLERR;
+	  if (events[i].events & EPOLLHUP)
+	    fdp->revents |= POLLHUP;
+	}
+      return ret;
+    }
+#endif /* HAVE_SYS_EPOLL_H */
+
+  return poll (fds, nfds, timeout);
+}
+
 static void
 run_standalone (char *user)
 {
@@ -3228,11 +4468,28 @@ run_standalone (char *user)
   /* NOT REACHED (Avahi process) */
 #endif /* WITH_AVAHI */
 
+  if (discovery_interval > 0)
+    {
+      FILE *cache = tmpfile ();
+
+      if (cache)
+	{
+	  DBG (DBG_INFO, "run_standalone: spawning device prober process\n");
+	  discovery_fd = fileno (cache);
+	  saned_prober (fds, nfds);
+	}
+      else
+	DBG (DBG_ERR, "run_standalone: cannot create discovery cache: %s\n",
+	     strerror (errno));
+    }
+
+  listen_watch (fds, nfds);
+
   DBG (DBG_MSG, "run_standalone: waiting for control connection\n");
 
   while (1)
     {
-      ret = poll (fds, nfds, 500);
+      ret = listen_wait (fds, nfds, 500);
       if (ret < 0)
 	{
 	  if (errno == EINTR)
@@ -3266,6 +4523,7 @@ run_standalone (char *user)
 
 	      /* Reopen sockets */
 	      do_bindings (&nfds, &fds);
+	      listen_watch (fds, nfds);
 
 	      break;
 	    }
@@ -43,6 +43,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#ifdef HAVE_PTHREAD_CREATE
+#include <pthread.h>
+#endif
+
 #ifdef HAVE_LIBPNG
 #include <png.h>
 #endif
@@ -84,6 +88,7 @@ Image;
 #define OPTION_BATCH_INCREMENT	1006
 #define OPTION_BATCH_PROMPT    1007
 #define OPTION_BATCH_PRINT     1008
+#define OPTION_READ_AHEAD      1009
 
 #define BATCH_COUNT_UNLIMITED -1
 
@@ -111,6 +116,7 @@ static struct option basic_options[] = {
   {"accept-md5-only", no_argument, NULL, OPTION_MD5},
   {"icc-profile", required_argument, NULL, 'i'},
   {"dont-scan", no_argument, NULL, 'n'},
+  {"read-ahead", optional_argument, NULL, OPTION_READ_AHEAD},
   {0, 0, NULL, 0}
 };
 
@@ -157,6 +163,7 @@ static SANE_Word br_x = 0;
 static SANE_Word br_y = 0;
 static SANE_Byte *buffer;
 static size_t buffer_size;
+static size_t read_ahead_size = 0;	/* 0: call sane_read() directly */
 
 
 static void
@@ -1306,6 +1313,217 @@ advance (Image * image)
   return image->data;
 }
 
+/* With --read-ahead a reader thread does nothing but call sane_read() into
+   a ring buffer, so the backend keeps streaming while the main thread
+   converts, encodes and writes what has already arrived.  */
+typedef struct
+{
+  SANE_Byte *data;
+  size_t size;			/* capacity of the ring */
+  size_t head;			/* next byte handed to the main thread */
+  size_t fill;			/* bytes queued */
+  size_t high_water;		/* largest fill seen in this frame */
+  unsigned long stalls;		/* times the reader found the ring full */
+  int running;			/* a reader thread serves this frame */
+  int done;			/* the reader has stopped */
+  int stop;			/* the main thread gave up on the frame */
+  SANE_Status status;		/* status that ended the frame */
+#ifdef HAVE_PTHREAD_CREATE
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+#endif
+}
+ReadAhead;
+
+static ReadAhead read_ahead;
+
+#ifdef HAVE_PTHREAD_CREATE
+static void *
+read_ahead_reader (void *arg)
+{
+  SANE_Status status = SANE_STATUS_GOOD;
+  SANE_Int len;
+  size_t tail, room;
+
+  (void) arg;
+
+  pthread_mutex_lock (&read_ahead.mutex);
+  while (status == SANE_STATUS_GOOD && !read_ahead.stop)
+    {
+      if (read_ahead.fill == read_ahead.size)
+	{
+	  ++read_ahead.stalls;
+	  while (read_ahead.fill == read_ahead.size && !read_ahead.stop)
+	    pthread_cond_wait (&read_ahead.cond, &read_ahead.mutex);
+	  if (read_ahead.stop)
+	    break;
+	}
+
+      /* read into the free space behind the queued data, but never more
+         than --buffer-size at once so the main thread gets going early */
+      tail = (read_ahead.head + read_ahead.fill) % read_ahead.size;
+      room = read_ahead.size - read_ahead.fill;
+      if (room > read_ahead.size - tail)
+	room = read_ahead.size - tail;
+      if (room > buffer_size)
+	room = buffer_size;
+      pthread_mutex_unlock (&read_ahead.mutex);
+
+      len = 0;
+      status = sane_read (device, read_ahead.data + tail, room, &len);
+
+      pthread_mutex_lock (&read_ahead.mutex);
+      if (len > 0)
+	{
+	  read_ahead.fill += len;
+	  if (read_ahead.fill > read_ahead.high_water)
+	    read_ahead.high_water = read_ahead.fill;
+	}
+      pthread_cond_broadcast (&read_ahead.cond);
+    }
+  read_ahead.status = status;
+  read_ahead.done = 1;
+  pthread_cond_broadcast (&read_ahead.cond);
+  pthread_mutex_unlock (&read_ahead.mutex);
+
+  return NULL;
+}
+#endif
+
+/* start reading the current frame in the background, if requested */
+static void
+read_ahead_start (void)
+{
+  if (!read_ahead_size)
+    return;
+#ifdef HAVE_PTHREAD_CREATE
+  if (!read_ahead.data)
+    {
+      read_ahead.data = malloc (read_ahead_size);
+      if (!read_ahead.data)
+	{
+	  fprintf (stderr, "%s: can't allocate read-ahead buffer (%lu bytes),"
+		   " reading directly\n", prog_name,
+		   (unsigned long) read_ahead_size);
+	  read_ahead_size = 0;
+	  return;
+	}
+      read_ahead.size = read_ahead_size;
+      pthread_mutex_init (&read_ahead.mutex, NULL);
+      pthread_cond_init (&read_ahead.cond, NULL);
+    }
+
+  read_ahead.head = 0;
+  read_ahead.fill = 0;
+  read_ahead.high_water = 0;
+  read_ahead.stalls = 0;
+  read_ahead.done = 0;
+  read_ahead.stop = 0;
+  read_ahead.status = SANE_STATUS_GOOD;
+  if (pthread_create (&read_ahead.thread, NULL, read_ahead_reader, NULL))
+    {
+      fprintf (stderr, "%s: can't start read-ahead thread, reading directly\n",
+	       prog_name);
+      return;
+    }
+  read_ahead.running = 1;
+#else
+  fprintf (stderr, "%s: read-ahead needs thread support, reading directly\n",
+	   prog_name);
+  read_ahead_size = 0;
+#endif
+}
+
+/* percentage of the read-ahead buffer that is queued right now */
+static double
+read_ahead_depth (void)
+{
+  double depth = 0.0;
+
+#ifdef HAVE_PTHREAD_CREATE
+  if (read_ahead.running)
+    {
+      pthread_mutex_lock (&read_ahead.mutex);
+      depth = (read_ahead.fill * 100.) / (double) read_ahead.size;
+      pthread_mutex_unlock (&read_ahead.mutex);
+    }
+#endif
+  return depth;
+}
+
+/* like sane_read(), but takes the data from the read-ahead buffer when a
+   reader thread is running; its final status comes with a length of 0 */
+static SANE_Status
+read_data (SANE_Byte * data, SANE_Int max_length, SANE_Int * length)
+{
+#ifdef HAVE_PTHREAD_CREATE
+  if (read_ahead.running)
+    {
+      size_t n;
+
+      pthread_mutex_lock (&read_ahead.mutex);
+      while (read_ahead.fill == 0 && !read_ahead.done)
+	pthread_cond_wait (&read_ahead.cond, &read_ahead.mutex);
+      n = read_ahead.fill;
+      pthread_mutex_unlock (&read_ahead.mutex);
+
+      if (n == 0)
+	{
+	  *length = 0;
+	  return read_ahead.status;
+	}
+
+      /* the queued bytes belong to us until fill is lowered again */
+      if (n > read_ahead.size - read_ahead.head)
+	n = read_ahead.size - read_ahead.head;
+      if (n > (size_t) max_length)
+	n = max_length;
+      memcpy (data, read_ahead.data + read_ahead.head, n);
+
+      pthread_mutex_lock (&read_ahead.mutex);
+      read_ahead.head = (read_ahead.head + n) % read_ahead.size;
+      read_ahead.fill -= n;
+      pthread_cond_broadcast (&read_ahead.cond);
+      pthread_mutex_unlock (&read_ahead.mutex);
+
+      *length = n;
+      return SANE_STATUS_GOOD;
+    }
+#endif
+  return sane_read (device, data, max_length, length);
+}
+
+/* wait for the reader thread of the current frame; if the frame is given
+   up early, cancel the scan so a pending sane_read() returns */
+static void
+read_ahead_stop (void)
+{
+#ifdef HAVE_PTHREAD_CREATE
+  int cancel;
+
+  if (!read_ahead.running)
+    return;
+
+  pthread_mutex_lock (&read_ahead.mutex);
+  cancel = !read_ahead.done;
+  read_ahead.stop = 1;
+  pthread_cond_broadcast (&read_ahead.cond);
+  pthread_mutex_unlock (&read_ahead.mutex);
+
+  if (cancel)
+    sane_cancel (device);
+  pthread_join (read_ahead.thread, NULL);
+  read_ahead.running = 0;
+
+  if (verbose)
+    fprintf (stderr, "%s: read-ahead high-water mark %lu of %lu bytes, "
+	     "reader stalled %lu times on a full buffer\n", prog_name,
+	     (unsigned long) read_ahead.high_water,
+	     (unsigned long) read_ahead.size, read_ahead.stalls);
+#endif
+}
+
 static SANE_Status
 scan_it (FILE *ofp)
 {
@@ -1482,15 +1700,25 @@ scan_it (FILE *ofp)
       hundred_percent = ((uint64_t)parm.bytes_per_line) * parm.lines
 	* ((parm.format == SANE_FRAME_RGB || parm.format == SANE_FRAME_GRAY) ? 1:3);
 
+      read_ahead_start ();
       while (1)
 	{
 	  double progr;
-	  status = sane_read (device, buffer, buffer_size, &len);
+	  status = read_data (buffer, buffer_size, &len);
 	  total_bytes += (SANE_Word) len;
           progr = ((total_bytes * 100.) / (double) hundred_percent);
           if (progr > 100.)
 	    progr = 100.;
-          if (progress)
+          if (progress && read_ahead.running)
+            {
+              if (parm.lines >= 0)
+                fprintf(stderr, "Progress: %3.1f%% (read-ahead %3.1f%% full)\r",
+                        progr, read_ahead_depth ());
+              else
+                fprintf(stderr, "Progress: (unknown) (read-ahead %3.1f%% full)\r",
+                        read_ahead_depth ());
+            }
+          else if (progress)
             {
               if (parm.lines >= 0)
                 fprintf(stderr, "Progress: %3.1f%%\r", progr);
@@ -1507,6 +1735,7 @@ scan_it (FILE *ofp)
 		{
 		  fprintf (stderr, "%s: sane_read: %s\n",
 			   prog_name, sane_strstatus (status));
+		  read_ahead_stop ();
 		  return status;
 		}
 	      break;
@@ -1677,6 +1906,7 @@ scan_it (FILE *ofp)
 		  min = buffer[i];
 	    }
 	}
+      read_ahead_stop ();
       first_frame = 0;
     }
   while (!parm.last_frame);
@@ -1742,6 +1972,7 @@ scan_it (FILE *ofp)
   fflush( ofp );
 
 cleanup:
+  read_ahead_stop ();
 #ifdef HAVE_LIBPNG
   if(output_format == OUTPUT_PNG) {
     png_destroy_write_struct(&png_ptr, &info_ptr);
@@ -2096,6 +2327,12 @@ main (int argc, char **argv)
 	case OPTION_BATCH_PRINT:
 	  batch_print = 1;
 	  break;
+	case OPTION_READ_AHEAD:
+	  if (optarg)
+	    read_ahead_size = 1024 * atoi (optarg);
+	  else
+	    read_ahead_size = (16 * 1024 * 1024);
+	  break;
 	case OPTION_BATCH_PROMPT:
 	  batch_prompt = 1;
 	  break;
@@ -2316,7 +2553,10 @@ Parameters are separated by a blank from single-character options (e.g.\n\
 -I, --inactive-options     show (normally hidden) inactive backend options\n\
 -h, --help                 display this help message and exit\n\
 -v, --verbose              give even more status messages\n\
--B, --buffer-size=#        change input buffer size (in kB, default 32)\n");
+-B, --buffer-size=#        change input buffer size (in kB, default 32)\n\
+    --read-ahead[=#]       read from the device in a separate thread into a\n\
+                           buffer of # kB (default 16384) while converting\n\
+                           and writing the image\n");
       printf ("\
 -V, --version              print version information\n");
     }
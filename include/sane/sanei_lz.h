@@ -0,0 +1,133 @@
+/* sane - Scanner Access Now Easy.
+
+   This file is part of the SANE package.
+
+   SANE is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   SANE is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+   License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with sane; see the file COPYING.  If not, write to the Free
+   Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   As a special exception, the authors of SANE give permission for
+   additional uses of the libraries contained in this release of SANE.
+
+   The exception is that, if you link a SANE library with other files
+   to produce an executable, this does not by itself cause the
+   resulting executable to be covered by the GNU General Public
+   License.  Your use of that executable is in no way restricted on
+   account of linking the SANE library code into it.
+
+   This exception does not, however, invalidate any other reasons why
+   the executable file might be covered by the GNU General Public
+   License.
+
+   If you submit changes to SANE to the maintainers to be included in
+   a subsequent release, you agree by submitting the changes that
+   those changes may be distributed with this exception intact.
+
+   If you write modifications of your own for SANE, it is your choice
+   whether to permit this exception to apply to your modifications.
+   If you do not wish that, delete this exception notice.
+*/
+
+/** @file sanei_lz.h
+ * Fast lossless compression of image data
+ *
+ * This is a byte oriented LZ77 block codec that is fast enough to compress
+ * scanner data on the fly, e.g. for sending it over the network. It's
+ * meant to be combined with the "up" filter, which replaces each byte by
+ * its difference to the byte one row above, as in PNG.
+ *
+ * A compressed block is a sequence of
+ * - a token byte: the upper 4 bits hold the number of literals, the lower
+ *   4 bits the length of the match minus 4. A value of 15 means that more
+ *   length bytes follow, which are added up until a byte is not 255.
+ * - the literal bytes.
+ * - the offset of the match as 16 bit little endian value, counted back
+ *   from the current position. The last sequence of a block has literals
+ *   only and ends right after them.
+ */
+
+#ifndef SANEI_LZ_H
+#define SANEI_LZ_H
+
+#include <stddef.h>
+
+#include <sane/sane.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum size of the compressed data of a block
+ *
+ * @param size size of the uncompressed data
+ *
+ * @return size that is sufficient for compressing any data of the given size
+ */
+extern size_t sanei_lz_compress_bound (size_t size);
+
+/** Compress a block of data
+ *
+ * @param src data to compress
+ * @param size size of the data to compress
+ * @param dst buffer for the compressed data
+ * @param dst_size size of the buffer
+ *
+ * @return size of the compressed data or 0 if it doesn't fit into the buffer
+ */
+extern size_t sanei_lz_compress (const SANE_Byte * src, size_t size,
+				 SANE_Byte * dst, size_t dst_size);
+
+/** Decompress a block of data
+ *
+ * @param src compressed data
+ * @param size size of the compressed data
+ * @param dst buffer for the uncompressed data
+ * @param dst_size size of the buffer
+ * @param out_size returns the size of the uncompressed data
+ *
+ * @return
+ * - SANE_STATUS_GOOD - success
+ * - SANE_STATUS_INVAL - the data is corrupt or doesn't fit into the buffer
+ */
+extern SANE_Status sanei_lz_decompress (const SANE_Byte * src, size_t size,
+					SANE_Byte * dst, size_t dst_size,
+					size_t * out_size);
+
+/** Apply the "up" filter
+ *
+ * Each byte is replaced by its difference to the byte @a row_size bytes
+ * before it. The first row is copied unchanged. The data doesn't need to
+ * start at the beginning of a row.
+ *
+ * @param src data to filter
+ * @param dst buffer of @a size bytes for the filtered data
+ * @param size size of the data
+ * @param row_size number of bytes per row
+ */
+extern void sanei_lz_filter_up (const SANE_Byte * src, SANE_Byte * dst,
+				size_t size, size_t row_size);
+
+/** Undo the "up" filter in place
+ *
+ * @param data filtered data
+ * @param size size of the data
+ * @param row_size number of bytes per row
+ */
+extern void sanei_lz_unfilter_up (SANE_Byte * data, size_t size,
+				  size_t row_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SANEI_LZ_H */
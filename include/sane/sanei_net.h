@@ -20,7 +20,11 @@
 #include <sane/sane.h>
 #include <sane/sanei_wire.h>
 
-#define SANEI_NET_PROTOCOL_VERSION	3
+/* Version 4 adds SANE_NET_SET_DATA_COMPRESSION, and servers of this
+   version keep requests that arrive before the reply to an earlier one
+   has been sent, so clients may pipeline them. Clients of older versions
+   are answered with version 3. */
+#define SANEI_NET_PROTOCOL_VERSION	4
 
 typedef enum
   {
@@ -41,10 +45,42 @@ typedef enum
     SANE_NET_START,
     SANE_NET_CANCEL,
     SANE_NET_AUTHORIZE,
-    SANE_NET_EXIT
+    SANE_NET_EXIT,
+    SANE_NET_SET_DATA_COMPRESSION	/* since protocol version 4 */
   }
 SANE_Net_Procedure_Number;
 
+/* Compression of the data connection. The client asks for a method with
+   SANE_NET_SET_DATA_COMPRESSION and saned replies with the method it is
+   going to use for all following scans.
+
+   With SANE_NET_COMPRESSION_LZ each data record starts with a header of
+   SANE_NET_COMPRESSED_HEADER_SIZE bytes:
+   - 1 byte: method of the record (SANE_NET_COMPRESSION_NONE if the data
+     didn't compress)
+   - 1 byte: filter that was applied before the compression
+   - 4 bytes: size of the uncompressed data (big endian)
+   - 4 bytes: bytes per row for the filter (big endian)
+   The records with the status at the end of the data are unchanged. */
+typedef enum
+  {
+    SANE_NET_COMPRESSION_NONE = 0,
+    SANE_NET_COMPRESSION_LZ		/* see sanei_lz.h */
+  }
+SANE_Net_Compression;
+
+typedef enum
+  {
+    SANE_NET_FILTER_NONE = 0,
+    SANE_NET_FILTER_UP
+  }
+SANE_Net_Filter;
+
+#define SANE_NET_COMPRESSED_HEADER_SIZE	10
+
+/* upper limit of the uncompressed size of a record */
+#define SANE_NET_COMPRESSED_MAX_SIZE	(4 * 1024 * 1024)
+
 typedef struct
   {
     SANE_Word version_code;
@@ -399,6 +399,72 @@ extern SANE_Status sanei_usb_reset (SANE_Int dn);
 extern SANE_Status
 sanei_usb_read_bulk (SANE_Int dn, SANE_Byte * buffer, size_t * size);
 
+/** Start a stream of bulk transfer reads.
+ *
+ * Keeps up to transfer_count reads of transfer_size bytes queued on the
+ * bulk-in endpoint, so that the device can send data while the caller
+ * processes the data that has already been received. At most total_size
+ * bytes are requested from the device. The data is retrieved in order with
+ * sanei_usb_read_bulk_stream(). A transfer that returns less data than
+ * requested ends the stream.
+ *
+ * Only one stream may be active on a device and no other bulk-in reads may be
+ * done while it is active. If asynchronous transfers are not supported by the
+ * access method or in replay mode, the data is read with synchronous reads of
+ * transfer_size bytes, and a short read ends the stream as well. In record
+ * mode each transfer is recorded as a separate bulk read, so a recorded
+ * stream is replayed with the same reads.
+ *
+ * @param dn device number
+ * @param transfer_count number of reads to keep queued
+ * @param transfer_size size of each read
+ * @param total_size total number of bytes to read
+ *
+ * @return
+ * - SANE_STATUS_GOOD - on success
+ * - SANE_STATUS_NO_MEM - if the buffers could not be allocated
+ * - SANE_STATUS_IO_ERROR - if the reads could not be queued
+ * - SANE_STATUS_INVAL - on every other error
+ */
+extern SANE_Status
+sanei_usb_start_bulk_stream (SANE_Int dn, SANE_Int transfer_count,
+			     size_t transfer_size, size_t total_size);
+
+/** Read data from a stream of bulk transfer reads.
+ *
+ * Read up to size bytes of the stream started with
+ * sanei_usb_start_bulk_stream() to buffer, waiting for the queued reads to
+ * complete as needed. After the read, size contains the number of bytes
+ * actually read, which is less than requested only at the end of the stream
+ * or before an error.
+ *
+ * @param dn device number
+ * @param buffer buffer to store read data in
+ * @param size size of the data
+ *
+ * @return
+ * - SANE_STATUS_GOOD - on success
+ * - SANE_STATUS_EOF - if the stream has ended
+ * - SANE_STATUS_IO_ERROR - if an error occurred during a read
+ * - SANE_STATUS_INVAL - on every other error
+ */
+extern SANE_Status
+sanei_usb_read_bulk_stream (SANE_Int dn, SANE_Byte * buffer, size_t * size);
+
+/** Stop a stream of bulk transfer reads.
+ *
+ * Cancels the reads that are still queued and frees the buffers. Data that
+ * has not been retrieved is discarded. Closing the device stops the stream
+ * too.
+ *
+ * @param dn device number
+ */
+extern void sanei_usb_stop_bulk_stream (SANE_Int dn);
+
+/** Check if sanei_usb_start_bulk_stream() and related functions are available.
+ */
+#define HAVE_SANEI_USB_BULK_STREAM
+
 /** Initiate a bulk transfer write.
  *
  * Write up to size bytes from buffer to the device. After the write size
@@ -58,6 +58,8 @@ WireDirection;
 struct Wire;
 
 typedef void (*WireCodecFunc) (struct Wire *w, void *val_ptr);
+typedef void (*WireArrayCodecFunc) (struct Wire *w, void *val_ptr,
+				    size_t count);
 typedef ssize_t (*WireReadFunc) (int fd, void * buf, size_t len);
 typedef ssize_t (*WireWriteFunc) (int fd, const void * buf, size_t len);
 
@@ -73,6 +75,9 @@ typedef struct Wire
 	WireCodecFunc w_char;
 	WireCodecFunc w_word;
 	WireCodecFunc w_string;
+	/* optional: transfer whole arrays of bytes or words at once */
+	WireArrayCodecFunc w_byte_array;
+	WireArrayCodecFunc w_word_array;
       }
     codec;
     struct
@@ -83,6 +88,13 @@ typedef struct Wire
 	char *end;
       }
     buffer;
+    struct
+      {
+	size_t size;
+	char *data;
+      }
+    unread;		/* received but not yet decoded data that is kept
+			   while the direction of the wire is changed */
     struct
       {
 	int fd;
@@ -335,6 +335,117 @@ ascii_w_word (Wire *w, void *v)
     }
 }
 
+/* Longest encoded word: "-2147483648\n" */
+#define MAX_WORD_TEXT 12
+
+/* Returns the number of elements that can be encoded with a single
+   sanei_w_space() call if each of them takes at most max_text bytes. */
+static size_t
+ascii_chunk_count (Wire *w, size_t max_text, size_t count)
+{
+  size_t chunk = (w->buffer.end - w->buffer.curr) / max_text;
+
+  if (chunk == 0)
+    chunk = w->buffer.size / max_text;
+  return chunk < count ? chunk : count;
+}
+
+static void
+ascii_w_byte_array (Wire *w, void *v, size_t count)
+{
+  SANE_Byte *b = v;
+  size_t i, n;
+  char *p;
+
+  switch (w->direction)
+    {
+    case WIRE_ENCODE:
+      while (count > 0)
+	{
+	  n = ascii_chunk_count (w, 3, count);
+	  sanei_w_space (w, n * 3);
+	  if (w->status)
+	    return;
+
+	  p = w->buffer.curr;
+	  for (i = 0; i < n; ++i)
+	    {
+	      *p++ = hexdigit[(b[i] >> 4) & 0x0f];
+	      *p++ = hexdigit[(b[i] >> 0) & 0x0f];
+	      *p++ = '\n';
+	    }
+	  w->buffer.curr = p;
+	  b += n;
+	  count -= n;
+	}
+      break;
+
+    case WIRE_DECODE:
+      /* the encoded length is not known in advance */
+      for (i = 0; i < count && w->status == 0; ++i)
+	ascii_w_byte (w, b + i);
+      break;
+
+    case WIRE_FREE:
+      break;
+    }
+}
+
+static void
+ascii_w_word_array (Wire *w, void *v, size_t count)
+{
+  SANE_Word *word = v;
+  size_t i, n;
+  unsigned int val;
+  char buf[16];
+  char *p;
+  int j;
+
+  switch (w->direction)
+    {
+    case WIRE_ENCODE:
+      while (count > 0)
+	{
+	  n = ascii_chunk_count (w, MAX_WORD_TEXT, count);
+	  sanei_w_space (w, n * MAX_WORD_TEXT);
+	  if (w->status)
+	    return;
+
+	  p = w->buffer.curr;
+	  for (i = 0; i < n; ++i)
+	    {
+	      val = word[i] < 0 ? 0u - (unsigned int) word[i] : (unsigned int) word[i];
+	      j = sizeof (buf);
+	      do
+		{
+		  buf[--j] = '0' + (val % 10);
+		  val /= 10;
+		}
+	      while (val);
+	      if (word[i] < 0)
+		buf[--j] = '-';
+
+	      memcpy (p, buf + j, sizeof (buf) - j);
+	      p += sizeof (buf) - j;
+	      *p++ = '\n';
+	    }
+	  w->buffer.curr = p;
+	  word += n;
+	  count -= n;
+	}
+      break;
+
+    case WIRE_DECODE:
+      /* the encoded length is not known in advance */
+      for (i = 0; i < count && w->status == 0; ++i)
+	ascii_w_word (w, word + i);
+      break;
+
+    case WIRE_FREE:
+      break;
+    }
+}
+
 void
 sanei_codec_ascii_init (Wire *w)
 {
@@ -342,4 +453,6 @@ sanei_codec_ascii_init (Wire *w)
   w->codec.w_char = ascii_w_char;
   w->codec.w_word = ascii_w_word;
   w->codec.w_string = ascii_w_string;
+  w->codec.w_byte_array = ascii_w_byte_array;
+  w->codec.w_word_array = ascii_w_word_array;
 }
@@ -129,6 +129,92 @@ bin_w_word (Wire *w, void *v)
     }
 }
 
+/* Returns the number of elements of the given size that can be transferred
+   with a single sanei_w_space() call: whatever fits into the remaining
+   buffer or, if that is exhausted, a full buffer. */
+static size_t
+bin_chunk_count (Wire *w, size_t element_size, size_t count)
+{
+  size_t chunk = (w->buffer.end - w->buffer.curr) / element_size;
+
+  if (chunk == 0)
+    chunk = w->buffer.size / element_size;
+  return chunk < count ? chunk : count;
+}
+
+static void
+bin_w_byte_array (Wire *w, void *v, size_t count)
+{
+  SANE_Byte *b = v;
+  size_t n;
+
+  if (w->direction == WIRE_FREE)
+    return;
+
+  while (count > 0)
+    {
+      n = bin_chunk_count (w, 1, count);
+      sanei_w_space (w, n);
+      if (w->status)
+	return;
+
+      if (w->direction == WIRE_ENCODE)
+	memcpy (w->buffer.curr, b, n);
+      else
+	memcpy (b, w->buffer.curr, n);
+
+      w->buffer.curr += n;
+      b += n;
+      count -= n;
+    }
+}
+
+static void
+bin_w_word_array (Wire *w, void *v, size_t count)
+{
+  SANE_Word *word = v;
+  unsigned char *p;
+  size_t i, n;
+  SANE_Word val;
+
+  if (w->direction == WIRE_FREE)
+    return;
+
+  while (count > 0)
+    {
+      n = bin_chunk_count (w, 4, count);
+      sanei_w_space (w, n * 4);
+      if (w->status)
+	return;
+
+      p = (unsigned char *) w->buffer.curr;
+      if (w->direction == WIRE_ENCODE)
+	{
+	  for (i = 0; i < n; ++i, p += 4)
+	    {
+	      val = word[i];
+	      /* store in bigendian byte-order: */
+	      p[0] = (val >> 24) & 0xff;
+	      p[1] = (val >> 16) & 0xff;
+	      p[2] = (val >>  8) & 0xff;
+	      p[3] = (val >>  0) & 0xff;
+	    }
+	}
+      else
+	{
+	  for (i = 0; i < n; ++i, p += 4)
+	    word[i] = (SANE_Word) (  ((unsigned int) p[0] << 24)
+				   | ((unsigned int) p[1] << 16)
+				   | ((unsigned int) p[2] <<  8)
+				   | ((unsigned int) p[3] <<  0));
+	}
+
+      w->buffer.curr += n * 4;
+      word += n;
+      count -= n;
+    }
+}
+
 void
 sanei_codec_bin_init (Wire *w)
 {
@@ -136,4 +222,6 @@ sanei_codec_bin_init (Wire *w)
   w->codec.w_char = bin_w_byte;
   w->codec.w_word = bin_w_word;
   w->codec.w_string = bin_w_string;
+  w->codec.w_byte_array = bin_w_byte_array;
+  w->codec.w_word_array = bin_w_word_array;
 }
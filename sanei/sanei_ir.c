@@ -27,12 +27,22 @@
  * licensed under the GNU General Public License version 2 or later.
 */
 
+#include "../include/sane/config.h"
+
 #include <stdlib.h>
 #include <string.h>
 #include <float.h>
 #include <limits.h>
 #include <math.h>
 
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_PTHREAD_CREATE
+#include <pthread.h>
+#endif
+
 #define BACKEND_NAME sanei_ir	/* name of this module for debugging */
 
 #include "../include/sane/sane.h"
@@ -55,6 +65,114 @@ sanei_ir_init (void)
 }
 
 
+/* The filters work on whole film frames of several hundred megapixels.
+ * Those which handle rows (or columns) independently split the image
+ * into bands, one per processor, and run them in parallel.
+ */
+#define IR_MAX_BANDS	16	/* most threads used */
+#define IR_BAND_MIN	64	/* fewer rows or columns are not worth a thread */
+
+typedef struct ir_band ir_band;
+
+struct ir_band
+{
+  SANE_Status (*work) (ir_band * band);
+  void *arg;			/* shared by all bands */
+  int first, last;		/* rows or columns of this band */
+  unsigned int seed;		/* for random choices within the band */
+  int imin, imax;		/* value range found in the band */
+  SANE_Status status;
+};
+
+static void *
+ir_band_run (void *arg)
+{
+  ir_band *band = arg;
+
+  band->status = band->work (band);
+  return NULL;
+}
+
+/* Split rows or columns [0,count) into bands and call work for each,
+ * returns the number of bands, which is at most IR_MAX_BANDS
+ */
+static int
+ir_run_bands (SANE_Status (*work) (ir_band * band), void *arg, int count,
+              ir_band * bands)
+{
+  int num_bands = 1;
+  int i;
+#ifdef HAVE_PTHREAD_CREATE
+  pthread_t tids[IR_MAX_BANDS];
+  int started[IR_MAX_BANDS];
+
+  num_bands = count / IR_BAND_MIN;
+#if defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_ONLN)
+  {
+    long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    if (cpus > 0 && num_bands > cpus)
+      num_bands = cpus;
+  }
+#endif
+  if (num_bands > IR_MAX_BANDS)
+    num_bands = IR_MAX_BANDS;
+  if (num_bands < 1)
+    num_bands = 1;
+#endif
+
+  for (i = 0; i < num_bands; i++)
+    {
+      bands[i].work = work;
+      bands[i].arg = arg;
+      bands[i].first = (int) ((int64_t) count * i / num_bands);
+      bands[i].last = (int) ((int64_t) count * (i + 1) / num_bands);
+      bands[i].seed = rand ();
+      bands[i].status = SANE_STATUS_GOOD;
+    }
+
+#ifdef HAVE_PTHREAD_CREATE
+  for (i = 1; i < num_bands; i++)
+    started[i] = !pthread_create (&tids[i], NULL, ir_band_run, &bands[i]);
+#endif
+
+  ir_band_run (&bands[0]);
+
+  for (i = 1; i < num_bands; i++)
+    {
+#ifdef HAVE_PTHREAD_CREATE
+      if (started[i])
+        pthread_join (tids[i], NULL);
+      else
+#endif
+        ir_band_run (&bands[i]);
+    }
+
+  return num_bands;
+}
+
+/* First error of all bands
+ */
+static SANE_Status
+ir_bands_status (ir_band * bands, int num_bands)
+{
+  int i;
+
+  for (i = 0; i < num_bands; i++)
+    if (bands[i].status != SANE_STATUS_GOOD)
+      return bands[i].status;
+  return SANE_STATUS_GOOD;
+}
+
+/* Random bit for ties, a cheap generator of the band's own
+ */
+static int
+ir_random_bit (unsigned int *seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  return (*seed >> 16) & 1;
+}
+
+
 /* Create a normalized histogram of a grayscale image, internal
  */
 double *
@@ -512,6 +630,52 @@ sanei_ir_ln_table (int len, double **lut_ln)
 }
 
 
+typedef struct
+{
+  const SANE_Uint *red_data;
+  SANE_Uint *ir_data;
+  const int *red_part;		/* a * ln (red) per red value */
+  int cols;
+  int scale;			/* second pass, scale into ired */
+  int imin;
+  double rfac;
+} ir_spectral_args;
+
+/* Either find the range of ired - a * ln (red) in a band of rows,
+ * or scale it back into the ired image
+ */
+static SANE_Status
+ir_spectral_rows (ir_band * band)
+{
+  ir_spectral_args *args = band->arg;
+  const SANE_Uint *rptr = args->red_data + (size_t) band->first * args->cols;
+  SANE_Uint *iptr = args->ir_data + (size_t) band->first * args->cols;
+  const int *red_part = args->red_part;
+  size_t i, itop = (size_t) (band->last - band->first) * args->cols;
+  int ival, imin = INT_MAX, imax = INT_MIN;
+
+  if (args->scale)
+    {
+      for (i = 0; i < itop; i++)
+        iptr[i] = (double) (iptr[i] - red_part[rptr[i]] - args->imin)
+          * args->rfac;
+      return SANE_STATUS_GOOD;
+    }
+
+  for (i = 0; i < itop; i++)
+    {
+      ival = iptr[i] - red_part[rptr[i]];
+      if (ival > imax)
+        imax = ival;
+      if (ival < imin)
+        imin = ival;
+    }
+  band->imin = imin;
+  band->imax = imax;
+  return SANE_STATUS_GOOD;
+}
+
+
 /* Reduce red spectral overlap from an infrared image plane
  */
 SANE_Status
@@ -519,33 +683,34 @@ sanei_ir_spectral_clean (const SANE_Parameters * params, double *lut_ln,
 			const SANE_Uint *red_data,
 			SANE_Uint *ir_data)
 {
-  const SANE_Uint *rptr;
-  SANE_Uint *iptr;
   SANE_Int depth;
   double *llut;
   double rval, rsum, rrsum;
   double risum, rfac, radd;
   double *norm_histo;
   int64_t isum;
-  int *calc_buf, *calc_ptr;
+  int *calc_buf;
   int ival, imin, imax;
   int itop, len, ssize;
   int thresh_low, thresh;
   int irand, i;
+  ir_spectral_args args;
+  ir_band bands[IR_MAX_BANDS];
+  int num_bands;
   SANE_Status status;
 
   DBG (10, "sanei_ir_spectral_clean\n");
 
   itop = params->pixels_per_line * params->lines;
-  calc_buf = malloc (itop * sizeof (int));		/* could save this */
+  depth = params->depth;
+  len = 1 << depth;
+  calc_buf = malloc (len * sizeof (int));	/* red part per red value */
   if (!calc_buf)
     {
       DBG (5, "sanei_ir_spectral_clean: no buffer\n");
       return SANE_STATUS_NO_MEM;
     }
 
-  depth = params->depth;
-  len = 1 << depth;
   if (lut_ln)
     llut = lut_ln;
   else
@@ -618,27 +783,31 @@ sanei_ir_spectral_clean (const SANE_Parameters * params, double *lut_ln,
             ssize, rfac, radd);
 
   /* now calculate ired' = ired - a  * ln (red) */
+  for (i = 0; i < len; i++)
+    calc_buf[i] = (int) (rfac * llut[i] + 0.5);
+
+  args.red_data = red_data;
+  args.ir_data = ir_data;
+  args.red_part = calc_buf;
+  args.cols = params->pixels_per_line;
+  args.scale = 0;
+  num_bands = ir_run_bands (ir_spectral_rows, &args, params->lines, bands);
+
   imin = INT_MAX;
   imax = INT_MIN;
-  rptr = red_data;
-  iptr = ir_data;
-  calc_ptr = calc_buf;
-    for (i = itop; i > 0; i--)
-      {
-	ival = *iptr++ - (int) (rfac * llut[*rptr++] + 0.5);
-	if (ival > imax)
-	  imax = ival;
-	if (ival < imin)
-	  imin = ival;
-	*calc_ptr++ = ival;
-      }
+  for (i = 0; i < num_bands; i++)
+    {
+      if (bands[i].imax > imax)
+        imax = bands[i].imax;
+      if (bands[i].imin < imin)
+        imin = bands[i].imin;
+    }
 
   /* scale the result back into the ired image */
-  calc_ptr = calc_buf;
-  iptr = ir_data;
-  rfac = (double) (len - 1) / (double) (imax - imin);
-    for (i = itop; i > 0; i--)
-      *iptr++ = (double) (*calc_ptr++ - imin) * rfac;
+  args.imin = imin;
+  args.rfac = (double) (len - 1) / (double) (imax - imin);
+  args.scale = 1;
+  ir_run_bands (ir_spectral_rows, &args, params->lines, bands);
 
   if (!lut_ln)
     free (llut);
@@ -648,34 +817,79 @@ sanei_ir_spectral_clean (const SANE_Parameters * params, double *lut_ln,
 }
 
 
-/* Hopefully fast mean filter
- * JV: what does this do? Remove local mean?
+/* Integer division by d as a multiplication by its reciprocal, rounded
+ * up, which is exact for numerators below 2^31 (Granlund, Montgomery)
  */
-SANE_Status
-sanei_ir_filter_mean (const SANE_Parameters * params,
-		      const SANE_Uint *in_img, SANE_Uint *out_img,
-		      int win_rows, int win_cols)
+static void
+ir_reciprocal (unsigned int d, uint64_t * mul, int *shift)
+{
+  int l = 0;
+
+  while (((uint64_t) 1 << l) < d)
+    l++;
+  *shift = 31 + l;
+  *mul = (((uint64_t) 1 << *shift) + d - 1) / d;
+}
+
+typedef struct
+{
+  const SANE_Uint *in_img;
+  SANE_Uint *out_img;
+  int num_cols, num_rows;
+  int win_rows, win_cols;
+} ir_mean_args;
+
+/* Add a row to the column sums and subtract another, either may be
+ * missing. The pointers never overlap, and the columns go in groups of
+ * IR_VECTOR, which lets the compiler use vector instructions even
+ * without loop vectorization enabled.
+ */
+#define IR_VECTOR	8
+
+static void
+ir_update_sums (int *restrict sum, const SANE_Uint *restrict add,
+                const SANE_Uint *restrict sub, int num_cols)
 {
-  const SANE_Uint *src;
+  int j = 0, k;
+
+  if (add && sub)
+    {
+      for (; j + IR_VECTOR <= num_cols; j += IR_VECTOR)
+        for (k = 0; k < IR_VECTOR; k++)
+          sum[j + k] += add[j + k] - sub[j + k];
+      for (; j < num_cols; j++)
+        sum[j] += add[j] - sub[j];
+    }
+  else if (sub)
+    for (; j < num_cols; j++)
+      sum[j] -= sub[j];
+  else if (add)
+    for (; j < num_cols; j++)
+      sum[j] += add[j];
+}
+
+/* Mean filter for a band of rows
+ */
+static SANE_Status
+ir_filter_mean_rows (ir_band * band)
+{
+  ir_mean_args *args = band->arg;
+  const SANE_Uint *src, *sub;
   SANE_Uint *dest;
   int num_cols, num_rows;
-  int itop, iadd, isub;
+  int win_cols;
   int ndiv, the_sum;
   int nrow, ncol;
   int hwr, hwc;
+  int first, top;
+  uint64_t mul;
+  int shift;
   int *sum;
   int i, j;
 
-  DBG (10, "sanei_ir_filter_mean, window: %d x%d\n", win_rows, win_cols);
-
-  if (((win_rows & 1) == 0) || ((win_cols & 1) == 0))
-    {
-      DBG (5, "sanei_ir_filter_mean: window even sized\n");
-      return SANE_STATUS_INVAL;
-    }
-
-  num_cols = params->pixels_per_line;
-  num_rows = params->lines;
+  num_cols = args->num_cols;
+  num_rows = args->num_rows;
+  win_cols = args->win_cols;
 
   sum = malloc (num_cols * sizeof (int));
   if (!sum)
@@ -683,48 +897,41 @@ sanei_ir_filter_mean (const SANE_Parameters * params,
       DBG (5, "sanei_ir_filter_mean: no buffer for sums\n");
       return SANE_STATUS_NO_MEM;
     }
-  dest = out_img;
+  dest = args->out_img + (size_t) band->first * num_cols;
 
-  hwr = win_rows / 2;		/* half window sizes */
+  hwr = args->win_rows / 2;	/* half window sizes */
   hwc = win_cols / 2;
 
-  /* pre-pre calculation */
-  for (j = 0; j < num_cols; j++)
-    {
-        sum[j] = 0;
-	src = in_img + j;
-	for (i = 0; i < hwr; i++)
-	  {
-	    sum[j] += *src;
-	    src += num_cols;
-	  }
-    }
-
-  itop = num_rows * num_cols;
-  iadd = hwr * num_cols;
-  isub = (hwr - win_rows) * num_cols;
-  nrow = hwr;
-
-      for (i = 0; i < num_rows; i++)
+  /* pre-pre calculation, up to the row above the band's first window */
+  first = band->first - hwr - 1;
+  if (first < 0)
+    first = 0;
+  top = band->first + hwr;
+  if (top > num_rows)
+    top = num_rows;
+  nrow = top - first;
+  memset (sum, 0, num_cols * sizeof (int));
+  for (i = first; i < top; i++)
+    ir_update_sums (sum, args->in_img + (size_t) i * num_cols, NULL,
+                    num_cols);
+
+      for (i = band->first; i < band->last; i++)
 	{
-	  /* update row sums if possible */
-	  if (isub >= 0)	/* subtract old row */
+	  /* update row sums if possible, in one loop if both are */
+	  src = NULL;
+	  sub = NULL;
+	  if (i - hwr - 1 >= 0)	/* subtract old row */
 	    {
 	      nrow--;
-	      src = in_img + isub;
-	      for (j = 0; j < num_cols; j++)
-		sum[j] -= *src++;
+	      sub = args->in_img + (size_t) (i - hwr - 1) * num_cols;
 	    }
-	  isub += num_cols;
-
-	  if (iadd < itop)	/* add new row */
+	  if (i + hwr < num_rows)	/* add new row */
 	    {
 	      nrow++;
-	      src = in_img + iadd;
-	      for (j = 0; j < num_cols; j++)
-		sum[j] += *src++;
+	      src = args->in_img + (size_t) (i + hwr) * num_cols;
 	    }
-	  iadd += num_cols;
+
+	  ir_update_sums (sum, src, sub, num_cols);
 
 	  /* now we do the image columns using only the precalculated sums */
 
@@ -742,12 +949,13 @@ sanei_ir_filter_mean (const SANE_Parameters * params,
 	    }
 
 	  ndiv = ncol * nrow;
+	  ir_reciprocal (ndiv, &mul, &shift);
 	  /* in the middle, real index hwc + 1 higher */
 	  for (j = 0; j < num_cols - win_cols; j++)
 	    {
 	      the_sum -= sum[j];
 	      the_sum += sum[j + win_cols];
-	      *dest++ = the_sum / ndiv;
+	      *dest++ = ((uint64_t) the_sum * mul) >> shift;
 	    }
 
 	  /* at the right margin, real index hwc + 1 higher */
@@ -763,6 +971,93 @@ sanei_ir_filter_mean (const SANE_Parameters * params,
 }
 
 
+/* Hopefully fast mean filter
+ * JV: what does this do? Remove local mean?
+ */
+SANE_Status
+sanei_ir_filter_mean (const SANE_Parameters * params,
+		      const SANE_Uint *in_img, SANE_Uint *out_img,
+		      int win_rows, int win_cols)
+{
+  ir_mean_args args;
+  ir_band bands[IR_MAX_BANDS];
+  int num_bands;
+
+  DBG (10, "sanei_ir_filter_mean, window: %d x%d\n", win_rows, win_cols);
+
+  if (((win_rows & 1) == 0) || ((win_cols & 1) == 0))
+    {
+      DBG (5, "sanei_ir_filter_mean: window even sized\n");
+      return SANE_STATUS_INVAL;
+    }
+
+  args.in_img = in_img;
+  args.out_img = out_img;
+  args.num_cols = params->pixels_per_line;
+  args.num_rows = params->lines;
+  args.win_rows = win_rows;
+  args.win_cols = win_cols;
+
+  num_bands = ir_run_bands (ir_filter_mean_rows, &args, params->lines, bands);
+  return ir_bands_status (bands, num_bands);
+}
+
+
+typedef struct
+{
+  const SANE_Uint *in_img;
+  SANE_Uint *delta_ij;
+  const SANE_Uint *mad_ij;
+  SANE_Uint *out_ij;
+  const int *thresholds;	/* for mad values below b_val */
+  int a_val, b_val;
+  int cols;
+} ir_madmean_args;
+
+/* Differences to the local mean for a band of rows, in place
+ */
+static SANE_Status
+ir_madmean_delta (ir_band * band)
+{
+  ir_madmean_args *args = band->arg;
+  size_t start = (size_t) band->first * args->cols;
+  size_t i, itop = (size_t) (band->last - band->first) * args->cols;
+  const SANE_Uint *in_ptr = args->in_img + start;
+  SANE_Uint *delta_ptr = args->delta_ij + start;
+
+  for (i = 0; i < itop; i++)
+    delta_ptr[i] = abs (in_ptr[i] - delta_ptr[i]);
+  return SANE_STATUS_GOOD;
+}
+
+/* Noise map for a band of rows
+ */
+static SANE_Status
+ir_madmean_noise (ir_band * band)
+{
+  ir_madmean_args *args = band->arg;
+  size_t start = (size_t) band->first * args->cols;
+  size_t i, itop = (size_t) (band->last - band->first) * args->cols;
+  const SANE_Uint *mad_ptr = args->mad_ij + start;
+  const SANE_Uint *delta_ptr = args->delta_ij + start;
+  SANE_Uint *dest8 = args->out_ij + start;
+  int threshold, ival;
+
+  for (i = 0; i < itop; i++)
+    {
+      /* by calculating the threshold */
+      ival = mad_ptr[i];
+      if (ival >= args->b_val)	/* outlier */
+	threshold = args->a_val;
+      else
+	threshold = args->thresholds[ival];
+      /* above threshold is noise, indicated by 0 */
+      dest8[i] = delta_ptr[i] >= threshold ? 0 : 255;
+    }
+  return SANE_STATUS_GOOD;
+}
+
+
 /* Find noise by adaptive thresholding
  */
 SANE_Status
@@ -771,16 +1066,18 @@ sanei_ir_filter_madmean (const SANE_Parameters * params,
 			 SANE_Uint ** out_img, int win_size,
 			 int a_val, int b_val)
 {
-  SANE_Uint *delta_ij, *delta_ptr;
+  SANE_Uint *delta_ij;
   SANE_Uint *mad_ij;
-  const SANE_Uint *mad_ptr;
-  SANE_Uint *out_ij, *dest8;
+  SANE_Uint *out_ij;
+  int *thresholds;
   double ab_term;
   int num_rows, num_cols;
-  int threshold, itop;
+  int itop;
   size_t size;
-  int ival, i;
+  int i;
   int depth;
+  ir_madmean_args args;
+  ir_band bands[IR_MAX_BANDS];
   SANE_Status ret = SANE_STATUS_NO_MEM;
 
   DBG (10, "sanei_ir_filter_madmean\n");
@@ -798,20 +1095,24 @@ sanei_ir_filter_madmean (const SANE_Parameters * params,
   out_ij = malloc (size);
   delta_ij = malloc (size);
   mad_ij = malloc (size);
+  thresholds = malloc ((b_val > 0 ? b_val : 1) * sizeof (int));
 
-  if (out_ij && delta_ij && mad_ij)
+  if (out_ij && delta_ij && mad_ij && thresholds)
     {
+      args.in_img = in_img;
+      args.delta_ij = delta_ij;
+      args.mad_ij = mad_ij;
+      args.out_ij = out_ij;
+      args.thresholds = thresholds;
+      args.a_val = a_val;
+      args.b_val = b_val;
+      args.cols = num_cols;
+
       /* get the differences to the local mean */
-      mad_ptr = in_img;
-      if (sanei_ir_filter_mean (params, mad_ptr, delta_ij, win_size, win_size)
+      if (sanei_ir_filter_mean (params, in_img, delta_ij, win_size, win_size)
 	  == SANE_STATUS_GOOD)
 	{
-	  delta_ptr = delta_ij;
-	    for (i = 0; i < itop; i++)
-	      {
-		ival = *mad_ptr++ - *delta_ptr;
-		*delta_ptr++ = abs (ival);
-	      }
+	  ir_run_bands (ir_madmean_delta, &args, num_rows, bands);
 	  /* make the second filtering window a bit larger */
 	  win_size = MAD_WIN2_SIZE(win_size);
 	  /* and get the local mean differences */
@@ -819,26 +1120,14 @@ sanei_ir_filter_madmean (const SANE_Parameters * params,
 	      (params, delta_ij, mad_ij, win_size,
 	       win_size) == SANE_STATUS_GOOD)
 	    {
-	      mad_ptr = mad_ij;
-	      delta_ptr = delta_ij;
-	      dest8 = out_ij;
-	      /* construct the noise map */
+	      /* the threshold for each mad value below b_val */
 	      ab_term = (b_val - a_val) / (double) b_val;
-		for (i = 0; i < itop; i++)
-		  {
-		    /* by calculating the threshold */
-		    ival = *mad_ptr++;
-		    if (ival >= b_val)	/* outlier */
-		      threshold = a_val;
-		    else
-		      threshold = a_val + (double) ival *ab_term;
-		    /* above threshold is noise, indicated by 0 */
-		    if (*delta_ptr++ >= threshold)
-		      *dest8++ = 0;
-		    else
-		      *dest8++ = 255;
-		  }
+	      for (i = 0; i < b_val; i++)
+		thresholds[i] = a_val + (double) i *ab_term;
+	      /* construct the noise map */
+	      ir_run_bands (ir_madmean_noise, &args, num_rows, bands);
 	      *out_img = out_ij;
+	      out_ij = NULL;
 	      ret = SANE_STATUS_GOOD;
 	    }
 	}
@@ -846,6 +1135,8 @@ sanei_ir_filter_madmean (const SANE_Parameters * params,
   else
     DBG (5, "sanei_ir_filter_madmean: Cannot allocate buffers\n");
 
+  free (out_ij);
+  free (thresholds);
   free (mad_ij);
   free (delta_ij);
   return ret;
@@ -878,109 +1169,148 @@ sanei_ir_add_threshold (const SANE_Parameters * params,
 }
 
 
+typedef struct
+{
+  const SANE_Uint *mask_img;
+  unsigned int *dist_map;
+  unsigned int *idx_map;
+  unsigned int erode;
+  int rows, cols;
+} ir_dist_args;
+
+/* Distances to the closest clean pixel within the same column,
+ * for a band of columns
+ */
+static SANE_Status
+ir_manhattan_cols (ir_band * band)
+{
+  ir_dist_args *args = band->arg;
+  const SANE_Uint *mask;
+  unsigned int *index, *manhattan;
+  unsigned int far = args->cols + args->rows;
+  int rows = args->rows, cols = args->cols;
+  int first = band->first, last = band->last;
+  int i, j;
+
+  /* traverse from top to bottom, a row of the band at a time */
+  for (i = 0; i < rows; i++)
+    {
+      mask = args->mask_img + (size_t) i * cols;
+      manhattan = args->dist_map + (size_t) i * cols;
+      index = args->idx_map + (size_t) i * cols;
+      for (j = first; j < last; j++)
+	{
+	  /* take original, distance = 0, index stays the same */
+	  index[j] = (size_t) i * cols + j;
+	  if (mask[j] == args->erode)
+	    manhattan[j] = 0;
+	  /* or one further away than pixel to the top */
+	  else if (i > 0 && manhattan[j - cols] + 1 < far)
+	    {
+	      manhattan[j] = manhattan[j - cols] + 1;
+	      index[j] = index[j - cols];
+	    }
+	  /* or maximal distance to clean pixel */
+	  else
+	    manhattan[j] = far;
+	}
+    }
+
+  /* traverse from bottom to top */
+  for (i = rows - 2; i >= 0; i--)
+    {
+      manhattan = args->dist_map + (size_t) i * cols;
+      index = args->idx_map + (size_t) i * cols;
+      for (j = first; j < last; j++)
+	{
+	  /* either what we had on the first pass
+	     or one more than the pixel to the bottom */
+	  if (manhattan[j + cols] + 1 < manhattan[j])
+	    {
+	      manhattan[j] = manhattan[j + cols] + 1;
+	      index[j] = index[j + cols];
+	    }
+	  else if (manhattan[j + cols] + 1 == manhattan[j])
+	    if (ir_random_bit (&band->seed))	/* chose index */
+	      index[j] = index[j + cols];
+	}
+    }
+  return SANE_STATUS_GOOD;
+}
+
+/* Combine the column distances along each row, for a band of rows
+ */
+static SANE_Status
+ir_manhattan_rows (ir_band * band)
+{
+  ir_dist_args *args = band->arg;
+  unsigned int *index, *manhattan;
+  int cols = args->cols;
+  int i, j;
+
+  for (i = band->first; i < band->last; i++)
+    {
+      manhattan = args->dist_map + (size_t) i * cols;
+      index = args->idx_map + (size_t) i * cols;
+
+      /* from left to right, one further away than pixel to the left */
+      for (j = 1; j < cols; j++)
+	{
+	  if (manhattan[j - 1] + 1 < manhattan[j])
+	    {
+	      manhattan[j] = manhattan[j - 1] + 1;
+	      index[j] = index[j - 1];
+	    }
+	  else if (manhattan[j - 1] + 1 == manhattan[j])
+	    if (ir_random_bit (&band->seed))
+	      index[j] = index[j - 1];
+	}
+
+      /* from right to left, or one more than pixel to the right */
+      for (j = cols - 2; j >= 0; j--)
+	{
+	  if (manhattan[j + 1] + 1 < manhattan[j])
+	    {
+	      manhattan[j] = manhattan[j + 1] + 1;
+	      index[j] = index[j + 1];
+	    }
+	  else if (manhattan[j + 1] + 1 == manhattan[j])
+	    if (ir_random_bit (&band->seed))
+	      index[j] = index[j + 1];
+	}
+    }
+  return SANE_STATUS_GOOD;
+}
+
 /* Calculate minimal Manhattan distances for an image mask
+ *
+ * The distance is separable: first the closest clean pixel within
+ * each column, then the closest of those along each row. Both passes
+ * work on bands of columns or rows in parallel. Of several pixels
+ * equally close one is chosen at random.
  */
 void
 sanei_ir_manhattan_dist (const SANE_Parameters * params,
 			const SANE_Uint * mask_img, unsigned int *dist_map,
 			unsigned int *idx_map, unsigned int erode)
 {
-  const SANE_Uint *mask;
-  unsigned int *index, *manhattan;
-  int rows, cols, itop;
-  int i, j;
+  ir_dist_args args;
+  ir_band bands[IR_MAX_BANDS];
 
   DBG (10, "sanei_ir_manhattan_dist\n");
 
   if (erode != 0)
     erode = 255;
 
-  /* initialize maps */
-  cols = params->pixels_per_line;
-  rows = params->lines;
-  itop = rows * cols;
-  mask = mask_img;
-  manhattan = dist_map;
-  index = idx_map;
-  for (i = 0; i < itop; i++)
-    {
-      *manhattan++ = *mask++;
-      *index++ = i;
-    }
-
-  /* traverse from top left to bottom right */
-  manhattan = dist_map;
-  index = idx_map;
-  for (i = 0; i < rows; i++)
-    for (j = 0; j < cols; j++)
-      {
-	if (*manhattan == erode)
-	  {
-	    /* take original, distance = 0, index stays the same */
-	    *manhattan = 0;
-	  }
-	else
-	  {
-	    /* assume maximal distance to clean pixel */
-	    *manhattan = cols + rows;
-	    /* or one further away than pixel to the top */
-	    if (i > 0)
-	      if (manhattan[-cols] + 1 < *manhattan)
-		{
-		  *manhattan = manhattan[-cols] + 1;
-		  *index = index[-cols];	/* index follows */
-		}
-	    /* or one further away than pixel to the left */
-	    if (j > 0)
-	      {
-		if (manhattan[-1] + 1 < *manhattan)
-		  {
-		    *manhattan = manhattan[-1] + 1;
-		    *index = index[-1];	/* index follows */
-		  }
-		if (manhattan[-1] + 1 == *manhattan)
-		  if (rand () % 2 == 0)	/* chose index */
-		    *index = index[-1];
-	      }
-	  }
-	manhattan++;
-	index++;
-      }
+  args.mask_img = mask_img;
+  args.dist_map = dist_map;
+  args.idx_map = idx_map;
+  args.erode = erode;
+  args.rows = params->lines;
+  args.cols = params->pixels_per_line;
 
-  /* traverse from bottom right to top left */
-  manhattan = dist_map + itop - 1;
-  index = idx_map + itop - 1;
-  for (i = rows - 1; i >= 0; i--)
-    for (j = cols - 1; j >= 0; j--)
-      {
-	if (i < rows - 1)
-	  {
-	    /* either what we had on the first pass
-	       or one more than the pixel to the bottm */
-	    if (manhattan[+cols] + 1 < *manhattan)
-	      {
-		*manhattan = manhattan[+cols] + 1;
-		*index = index[+cols];	/* index follows */
-	      }
-	    if (manhattan[+cols] + 1 == *manhattan)
-	      if (rand () % 2 == 0)	/* chose index */
-		*index = index[+cols];
-	  }
-	if (j < cols - 1)
-	  {
-	    /* or one more than pixel to the right */
-	    if (manhattan[1] + 1 < *manhattan)
-	      {
-		*manhattan = manhattan[1] + 1;
-		*index = index[1];	/* index follows */
-	      }
-	    if (manhattan[1] + 1 == *manhattan)
-	      if (rand () % 2 == 0)	/* chose index */
-		*index = index[1];
-	  }
-	manhattan--;
-	index--;
-      }
+  ir_run_bands (ir_manhattan_cols, &args, args.cols, bands);
+  ir_run_bands (ir_manhattan_rows, &args, args.rows, bands);
 }
 
 
@@ -1111,6 +1441,39 @@ sanei_ir_find_crop (const SANE_Parameters * params,
 }
 
 
+typedef struct
+{
+  const unsigned int *dist_map;
+  const unsigned int *idx_map;
+  SANE_Uint *color;
+  const SANE_Uint *plane;	/* smoothened pixels, or NULL */
+  int dist_max;
+  int cols;
+} ir_replace_args;
+
+/* Replace the dirty pixels in a band of rows, either by the closest
+ * clean ones, which are never replaced themselves, or by the smoothened
+ * pixels
+ */
+static SANE_Status
+ir_dilate_replace (ir_band * band)
+{
+  ir_replace_args *args = band->arg;
+  size_t i = (size_t) band->first * args->cols;
+  size_t itop = (size_t) band->last * args->cols;
+  SANE_Uint *color = args->color;
+  unsigned int dist;
+
+  for (; i < itop; i++)
+    {
+      dist = args->dist_map[i];
+      if ((dist != 0) && (dist <= (unsigned int) args->dist_max))
+	color[i] = args->plane ? args->plane[i] : color[args->idx_map[i]];
+    }
+  return SANE_STATUS_GOOD;
+}
+
+
 /* Dilate clean image parts into dirty ones and smooth
  */
 SANE_Status
@@ -1123,11 +1486,12 @@ sanei_ir_dilate_mean (const SANE_Parameters * params,
 {
   SANE_Uint *color;
   SANE_Uint *plane;
-  unsigned int *dist_map, *manhattan;
-  unsigned int *idx_map, *index;
-  int dist;
+  unsigned int *dist_map;
+  unsigned int *idx_map;
   int rows, cols;
-  int k, i, itop;
+  int k, itop;
+  ir_replace_args args;
+  ir_band bands[IR_MAX_BANDS];
   SANE_Status ret = SANE_STATUS_NO_MEM;
 
   DBG (10, "sanei_ir_dilate_mean(): dist max = %d, expand = %d, win size = %d, smooth = %d, inner = %d\n",
@@ -1155,18 +1519,17 @@ sanei_ir_dilate_mean (const SANE_Parameters * params,
         sanei_ir_find_crop (params, dist_map, inner, crop);
 
       /* replace dirty pixels */
+      args.dist_map = dist_map;
+      args.idx_map = idx_map;
+      args.dist_max = dist_max;
+      args.cols = cols;
       for (k = 0; k < 3; k++)
 	{
-	  manhattan = dist_map;
-	  index = idx_map;
 	  color = in_img[k];
 	  /* first replacement */
-	    for (i = 0; i < itop; i++)
-	      {
-		dist = *manhattan++;
-		if ((dist != 0) && (dist <= dist_max))
-		  color[i] = color[index[i]];
-	      }
+	  args.color = color;
+	  args.plane = NULL;
+	  ir_run_bands (ir_dilate_replace, &args, rows, bands);
           /* adapt pixels to their new surround and
            * smooth the whole image or the replaced pixels only */
 	  ret =
@@ -1188,13 +1551,8 @@ sanei_ir_dilate_mean (const SANE_Parameters * params,
               {
                 /* replace with smoothened pixels only */
                 DBG (10, "sanei_ir_dilate_mean(): smoothing replaced pixels only\n");
-                manhattan = dist_map;
-                  for (i = 0; i < itop; i++)
-                    {
-                      dist = *manhattan++;
-                      if ((dist != 0) && (dist <= dist_max))
-                        color[i] = plane[i];
-                    }
+                args.plane = plane;
+                ir_run_bands (ir_dilate_replace, &args, rows, bands);
               }
       }
     }
@@ -0,0 +1,275 @@
+/* sane - Scanner Access Now Easy.
+
+   This file is part of the SANE package.
+
+   SANE is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   SANE is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+   License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with sane; see the file COPYING.  If not, write to the Free
+   Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   As a special exception, the authors of SANE give permission for
+   additional uses of the libraries contained in this release of SANE.
+
+   The exception is that, if you link a SANE library with other files
+   to produce an executable, this does not by itself cause the
+   resulting executable to be covered by the GNU General Public
+   License.  Your use of that executable is in no way restricted on
+   account of linking the SANE library code into it.
+
+   This exception does not, however, invalidate any other reasons why
+   the executable file might be covered by the GNU General Public
+   License.
+
+   If you submit changes to SANE to the maintainers to be included in
+   a subsequent release, you agree by submitting the changes that
+   those changes may be distributed with this exception intact.
+
+   If you write modifications of your own for SANE, it is your choice
+   whether to permit this exception to apply to your modifications.
+   If you do not wish that, delete this exception notice.
+
+   Fast lossless compression of image data, see sanei_lz.h for the
+   format. */
+
+#include "../include/sane/config.h"
+
+#include <string.h>
+
+#include "../include/sane/sane.h"
+#include "../include/sane/sanei_lz.h"
+
+#define MIN_MATCH 4
+#define MAX_OFFSET 0xffff
+#define HASH_BITS 14
+#define HASH_SIZE (1 << HASH_BITS)
+
+static unsigned int
+read32 (const SANE_Byte * p)
+{
+  return (unsigned int) p[0] | ((unsigned int) p[1] << 8)
+    | ((unsigned int) p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+static unsigned int
+hash32 (unsigned int value)
+{
+  return ((value * 2654435761u) & 0xffffffffu) >> (32 - HASH_BITS);
+}
+
+/* Number of extra bytes needed to store a length that exceeds its 4 bits
+   in the token. */
+static size_t
+length_size (size_t length)
+{
+  return length < 15 ? 0 : (length - 15) / 255 + 1;
+}
+
+static SANE_Byte *
+write_length (SANE_Byte * op, size_t length)
+{
+  if (length < 15)
+    return op;
+
+  length -= 15;
+  while (length >= 255)
+    {
+      *op++ = 255;
+      length -= 255;
+    }
+  *op++ = (SANE_Byte) length;
+  return op;
+}
+
+/* Writes a sequence of literals and an optional match. Returns NULL if it
+   doesn't fit into the buffer. */
+static SANE_Byte *
+write_sequence (SANE_Byte * op, SANE_Byte * op_end,
+		const SANE_Byte * literals, size_t literal_length,
+		size_t offset, size_t match_length)
+{
+  size_t match_code = match_length ? match_length - MIN_MATCH : 0;
+  size_t needed = 1 + length_size (literal_length) + literal_length;
+  SANE_Byte *token = op;
+
+  if (match_length)
+    needed += 2 + length_size (match_code);
+  if (needed > (size_t) (op_end - op))
+    return NULL;
+
+  *token = (SANE_Byte) (((literal_length < 15 ? literal_length : 15) << 4)
+			| (match_code < 15 ? match_code : 15));
+  op = write_length (op + 1, literal_length);
+  memcpy (op, literals, literal_length);
+  op += literal_length;
+
+  if (match_length)
+    {
+      *op++ = (SANE_Byte) (offset & 0xff);
+      *op++ = (SANE_Byte) (offset >> 8);
+      op = write_length (op, match_code);
+    }
+  return op;
+}
+
+size_t
+sanei_lz_compress_bound (size_t size)
+{
+  return size + size / 255 + 16;
+}
+
+size_t
+sanei_lz_compress (const SANE_Byte * src, size_t size,
+		   SANE_Byte * dst, size_t dst_size)
+{
+  /* positions of recent 4 byte sequences, plus 1 so that 0 is empty */
+  unsigned int table[HASH_SIZE];
+  SANE_Byte *op = dst;
+  SANE_Byte *op_end = dst + dst_size;
+  size_t ip = 0, anchor = 0;
+
+  memset (table, 0, sizeof (table));
+
+  while (size >= MIN_MATCH && ip <= size - MIN_MATCH)
+    {
+      unsigned int sequence = read32 (src + ip);
+      unsigned int h = hash32 (sequence);
+      size_t ref = table[h];
+      size_t length;
+
+      table[h] = ip + 1;
+      if (ref == 0 || ip + 1 - ref > MAX_OFFSET
+	  || read32 (src + ref - 1) != sequence)
+	{
+	  /* skip faster through data that doesn't compress */
+	  ip += 1 + ((ip - anchor) >> 6);
+	  continue;
+	}
+      ref--;
+
+      length = MIN_MATCH;
+      while (ip + length < size && src[ref + length] == src[ip + length])
+	length++;
+
+      op = write_sequence (op, op_end, src + anchor, ip - anchor,
+			   ip - ref, length);
+      if (!op)
+	return 0;
+
+      ip += length;
+      anchor = ip;
+    }
+
+  op = write_sequence (op, op_end, src + anchor, size - anchor, 0, 0);
+  if (!op)
+    return 0;
+  return op - dst;
+}
+
+static SANE_Status
+read_length (const SANE_Byte * src, size_t size, size_t * ip, size_t * length)
+{
+  SANE_Byte b;
+
+  do
+    {
+      if (*ip >= size)
+	return SANE_STATUS_INVAL;
+      b = src[(*ip)++];
+      *length += b;
+    }
+  while (b == 255);
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+sanei_lz_decompress (const SANE_Byte * src, size_t size,
+		     SANE_Byte * dst, size_t dst_size, size_t * out_size)
+{
+  size_t ip = 0, op = 0;
+
+  while (ip < size)
+    {
+      SANE_Byte token = src[ip++];
+      size_t length = token >> 4;
+      size_t offset;
+
+      if (length == 15 && read_length (src, size, &ip, &length))
+	return SANE_STATUS_INVAL;
+      if (length > size - ip || length > dst_size - op)
+	return SANE_STATUS_INVAL;
+      memcpy (dst + op, src + ip, length);
+      ip += length;
+      op += length;
+
+      /* the last sequence has no match */
+      if (ip == size)
+	break;
+
+      if (size - ip < 2)
+	return SANE_STATUS_INVAL;
+      offset = src[ip] | (src[ip + 1] << 8);
+      ip += 2;
+      if (offset == 0 || offset > op)
+	return SANE_STATUS_INVAL;
+
+      length = token & 15;
+      if (length == 15 && read_length (src, size, &ip, &length))
+	return SANE_STATUS_INVAL;
+      length += MIN_MATCH;
+      if (length > dst_size - op)
+	return SANE_STATUS_INVAL;
+
+      if (offset >= length)
+	{
+	  memcpy (dst + op, dst + op - offset, length);
+	  op += length;
+	}
+      else
+	{
+	  /* the match overlaps the data it produces */
+	  while (length--)
+	    {
+	      dst[op] = dst[op - offset];
+	      op++;
+	    }
+	}
+    }
+
+  *out_size = op;
+  return SANE_STATUS_GOOD;
+}
+
+void
+sanei_lz_filter_up (const SANE_Byte * src, SANE_Byte * dst, size_t size,
+		    size_t row_size)
+{
+  size_t i;
+
+  if (row_size == 0 || row_size > size)
+    row_size = size;
+
+  memcpy (dst, src, row_size);
+  for (i = row_size; i < size; i++)
+    dst[i] = (SANE_Byte) (src[i] - src[i - row_size]);
+}
+
+void
+sanei_lz_unfilter_up (SANE_Byte * data, size_t size, size_t row_size)
+{
+  size_t i;
+
+  if (row_size == 0)
+    return;
+
+  for (i = row_size; i < size; i++)
+    data[i] = (SANE_Byte) (data[i] + data[i - row_size]);
+}
@@ -50,6 +50,14 @@
 #include <errno.h>
 #include <math.h>
 
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_PTHREAD_CREATE
+#include <pthread.h>
+#endif
+
 #define BACKEND_NAME sanei_magic      /* name of this module for debugging */
 
 #include "../include/sane/sane.h"
@@ -69,7 +77,27 @@ static SANE_Status getTopEdge (int width, int height, int resolution,
 static SANE_Status getLeftEdge (int width, int height, int * top, int * bot,
  double slope, int * finXInter, int * finYInter);
 
-static SANE_Status getLine (int height, int width, int * buff,
+/* getTopEdge searches LINE_GRIDS grids of slope and offset bins at
+ * once, shifted by half a bin against each other */
+#define LINE_GRIDS 4
+
+/* most threads used by countLines, and least columns for each */
+#define LINE_THREADS 4
+#define LINE_THREAD_WIDTH 256
+
+struct lineBins {
+  int slopes;
+  int offsets;
+  double minSlope[LINE_GRIDS];
+  double maxSlope[LINE_GRIDS];
+  int minOffset[LINE_GRIDS];
+  int maxOffset[LINE_GRIDS];
+};
+
+static SANE_Status countLines (int width, int * buff,
+  struct lineBins * bins, int * counts);
+
+static SANE_Status getLine (int * lines,
   int slopes, double minSlope, double maxSlope,
   int offsets, int minOffset, int maxOffset,
   double * finSlope, int * finOffset, int * finDensity);
@@ -80,7 +108,164 @@ sanei_magic_init( void )
   DBG_INIT();
 }
 
-/* find small spots and replace them with image background color */
+/* Summed-area table over a band of image lines. Table row t holds,
+ * for every x, the sum of the values of all pixels above line t and
+ * left of column x, so any rectangle inside the band sums with four
+ * lookups. Only the last 'rows' table rows are kept, in a ring, and
+ * the band slides down the image as lines are added. The value of a
+ * pixel is its 'darkness': one for a black lineart pixel, or 255 minus
+ * the sample, summed over all channels. Sums are unsigned and wrap,
+ * which is harmless as long as each rectangle's sum fits. */
+struct sumTable {
+  unsigned int * sums;
+  int width;   /* entries per table row, one more than pixels */
+  int rows;    /* table rows kept */
+  int lines;   /* image line the next added line becomes */
+};
+
+static SANE_Status
+sumTableInit (struct sumTable * st, int pixels, int rows, int first)
+{
+  st->width = pixels + 1;
+  st->rows = rows;
+  st->lines = first;
+
+  st->sums = calloc((size_t)st->width * rows, sizeof(unsigned int));
+  if(!st->sums){
+    DBG (5, "sumTableInit: no sums\n");
+    return SANE_STATUS_NO_MEM;
+  }
+
+  return SANE_STATUS_GOOD;
+}
+
+/* add the next image line to the bottom of the band */
+static void
+sumTableAdd (struct sumTable * st, SANE_Parameters * params,
+  SANE_Byte * line)
+{
+  unsigned int * prev = st->sums + (size_t)(st->lines % st->rows) * st->width;
+  unsigned int * curr = st->sums + (size_t)((st->lines+1) % st->rows) * st->width;
+  unsigned int rowsum = 0;
+  int x;
+
+  curr[0] = 0;
+
+  if(params->depth == 1){
+    for(x=0; x<params->pixels_per_line; x++){
+
+      /* bytes of white add nothing */
+      if(line[x/8])
+        rowsum += line[x/8] >> (7-(x%8)) & 1;
+      curr[x+1] = prev[x+1] + rowsum;
+    }
+  }
+  else if(params->format == SANE_FRAME_RGB){
+    for(x=0; x<params->pixels_per_line; x++){
+      rowsum += 255*3 - line[x*3] - line[x*3+1] - line[x*3+2];
+      curr[x+1] = prev[x+1] + rowsum;
+    }
+  }
+  else{
+    for(x=0; x<params->pixels_per_line; x++){
+      rowsum += 255 - line[x];
+      curr[x+1] = prev[x+1] + rowsum;
+    }
+  }
+
+  st->lines++;
+}
+
+/* sum of lines [top,bot) and columns [left,right), bot can be at most
+ * the number of lines added, and top no more than rows-1 above it */
+static unsigned int
+sumTableRect (struct sumTable * st, int top, int left, int bot, int right)
+{
+  unsigned int * t = st->sums + (size_t)(top % st->rows) * st->width;
+  unsigned int * b = st->sums + (size_t)(bot % st->rows) * st->width;
+
+  return b[right] - b[left] - t[right] + t[left];
+}
+
+/* Test the ring of pixels around the diam*diam window at win against
+ * a threshold derived from the darkest pixel in the window, thresh. If
+ * none is darker, overwrite the window with their average color.
+ * Returns 1 if that changed the window. If given, same() is asked
+ * first whether the window holds nothing but that color already. */
+static int
+despeckWindow (SANE_Byte * win, int bw, int Bpp, int diam, int thresh,
+  int (*same)(int * outer, void * arg), void * arg)
+{
+  int outer[] = {0,0,0};
+  int changed = 0;
+  int k,l,n;
+
+  /* convert darkest pixel into a brighter threshold */
+  thresh = (thresh + 255*Bpp + 255*Bpp)/3;
+
+  /* loop over rows and columns around window */
+  for(k=-1; k<diam+1; k++){
+
+    /* only the sides of the window, except above and below it */
+    int step = (k == -1 || k == diam) ? 1 : diam+1;
+
+    for(l=-1; l<diam+1; l+=step){
+      SANE_Byte * ptr = win + k*bw + l*Bpp;
+      int tmp = 0;
+
+      for(n=0; n<Bpp; n++){
+        tmp += ptr[n];
+        outer[n] += ptr[n];
+      }
+      if(tmp < thresh)
+        return 0;
+    }
+  }
+
+  /* no hits, replacement color */
+  for(n=0; n<Bpp; n++){
+    outer[n] /= (4*diam + 4);
+  }
+
+  if(same && same(outer, arg))
+    return 0;
+
+  /* overwrite with avg surrounding color */
+  for(k=0; k<diam; k++){
+    for(l=0; l<diam*Bpp; l+=Bpp){
+      for(n=0; n<Bpp; n++){
+        changed |= win[k*bw + l + n] != outer[n];
+        win[k*bw + l + n] = outer[n];
+      }
+    }
+  }
+
+  return changed;
+}
+
+/* what a clean gray window is known to hold, from the tables */
+struct despeckGray {
+  int darkest;
+  unsigned int darkness;
+  int pixels;
+};
+
+static int
+despeckGraySame (int * outer, void * arg)
+{
+  struct despeckGray * g = arg;
+
+  return g->darkest == outer[0]
+    && g->darkness == (unsigned int)(255 - outer[0]) * g->pixels;
+}
+
+/* find small spots and replace them with image background color
+ *
+ * The windows are tested in place, one after the other, so earlier
+ * replacements can change what later windows see. Window sums and
+ * minimums come from tables of the image as it was scanned, which are
+ * only trusted where no pixel has been replaced near the window. The
+ * rest are recomputed from the buffer. */
 SANE_Status
 sanei_magic_despeck (SANE_Parameters * params, SANE_Byte * buffer,
   SANE_Int diam)
@@ -91,181 +276,244 @@ sanei_magic_despeck (SANE_Parameters * params, SANE_Byte * buffer,
   int pw = params->pixels_per_line;
   int bw = params->bytes_per_line;
   int h  = params->lines;
-  int bt = bw*h;
+  int Bpp = params->format == SANE_FRAME_RGB ? 3 : 1;
+
+  /* a single pixel window is cheaper to read directly */
+  int tables = diam > 1;
+
+  struct sumTable sums = {NULL, 0, 0, 0};
+
+  /* per column, last line replaced so far, and a count of the columns
+   * replaced near the current line */
+  int * dirty = NULL;
+  int * dirtyCount = NULL;
+
+  /* darkest pixels of the last diam lines, first in each column and
+   * then in runs of diam columns, forwards and backwards */
+  unsigned short * band = NULL;
+  unsigned short * colMin = NULL;
+  unsigned short * fwdMin = NULL;
+  unsigned short * revMin = NULL;
 
   int i,j,k,l,n;
 
   DBG (10, "sanei_magic_despeck: start\n");
 
-  if(params->format == SANE_FRAME_RGB){
+  if(params->format != SANE_FRAME_RGB
+    && !(params->format == SANE_FRAME_GRAY && params->depth == 8)
+    && !(params->format == SANE_FRAME_GRAY && params->depth == 1)
+  ){
+    DBG (5, "sanei_magic_despeck: unsupported format/depth\n");
+    ret = SANE_STATUS_INVAL;
+    goto cleanup;
+  }
+
+  /* nothing fits in the window */
+  if(diam < 1 || pw-1-diam <= 1 || h-1-diam <= 1){
+    goto cleanup;
+  }
 
-    for(i=bw; i<bt-bw-(bw*diam); i+=bw){
-      for(j=1; j<pw-1-diam; j++){
+  dirty = malloc(pw * sizeof(int));
+  dirtyCount = malloc((pw+1) * sizeof(int));
+  if(!dirty || !dirtyCount){
+    DBG (5, "sanei_magic_despeck: no dirty\n");
+    ret = SANE_STATUS_NO_MEM;
+    goto cleanup;
+  }
 
-        int thresh = 255*3;
-        int outer[] = {0,0,0};
-        int hits = 0;
+  for(j=0; j<pw; j++){
+    dirty[j] = -2;
+  }
+  dirtyCount[0] = 0;
 
-        /* loop over rows and columns in window */
-        /* find darkest pixel */
-        for(k=0; k<diam; k++){
-          for(l=0; l<diam; l++){
-            int tmp = 0;
+  /* sums over the window and its ring, starting at the first ring line */
+  if(tables && params->format == SANE_FRAME_GRAY){
+    ret = sumTableInit(&sums, pw, diam+3, 0);
+    if(ret){
+      goto cleanup;
+    }
+    for(i=0; i<diam+1; i++){
+      sumTableAdd(&sums, params, buffer + i*bw);
+    }
+  }
 
-            for(n=0; n<3; n++){
-              tmp += buffer[i + j*3 + k*bw + l*3 + n];
-            }
+  /* the darkest pixels */
+  if(tables && params->depth == 8){
+    band = malloc((size_t)pw * diam * sizeof(unsigned short));
+    colMin = malloc(pw * sizeof(unsigned short));
+    fwdMin = malloc(pw * sizeof(unsigned short));
+    revMin = malloc(pw * sizeof(unsigned short));
+    if(!band || !colMin || !fwdMin || !revMin){
+      DBG (5, "sanei_magic_despeck: no band\n");
+      ret = SANE_STATUS_NO_MEM;
+      goto cleanup;
+    }
+  }
 
-            if(tmp < thresh)
-              thresh = tmp;
-          }
-        }
+  for(i=1; i<h-1-diam; i++){
 
-        /* convert darkest pixel into a brighter threshold */
-        thresh = (thresh + 255*3 + 255*3)/3;
+    /* last column replaced on this line */
+    int rowDirty = -2;
 
-        /*loop over rows and columns around window */
-        for(k=-1; k<diam+1; k++){
-          for(l=-1; l<diam+1; l++){
+    /* columns replaced at or below the ring above this line */
+    for(j=0; tables && j<pw; j++){
+      dirtyCount[j+1] = dirtyCount[j] + (dirty[j] >= i-1);
+    }
 
-            int tmp[3];
+    /* the lines below the ring have not been touched yet */
+    if(sums.sums){
+      sumTableAdd(&sums, params, buffer + (i+diam)*bw);
+    }
 
-            /* dont count pixels in the window */
-            if(k != -1 && k != diam && l != -1 && l != diam)
-              continue;
+    if(band){
+      for(l = (i == 1 ? 1 : i+diam-1); l < i+diam; l++){
+        unsigned short * dst = band + (size_t)(l % diam) * pw;
+        SANE_Byte * src = buffer + l*bw;
 
-            for(n=0; n<3; n++){
-              tmp[n] = buffer[i + j*3 + k*bw + l*3 + n];
-              outer[n] += tmp[n];
-            }
-            if(tmp[0]+tmp[1]+tmp[2] < thresh){
-              hits++;
-              break;
-            }
+        for(j=0; j<pw; j++){
+          dst[j] = 0;
+          for(n=0; n<Bpp; n++){
+            dst[j] += src[j*Bpp + n];
           }
         }
+      }
 
-        /*no hits, overwrite with avg surrounding color*/
-        if(!hits){
-
-          /* per channel replacement color */
-          for(n=0; n<3; n++){
-            outer[n] /= (4*diam + 4);
-          }
+      memcpy(colMin, band, pw * sizeof(unsigned short));
+      for(k=1; k<diam; k++){
+        unsigned short * src = band + (size_t)k * pw;
 
-          for(k=0; k<diam; k++){
-            for(l=0; l<diam; l++){
-              for(n=0; n<3; n++){
-                buffer[i + j*3 + k*bw + l*3 + n] = outer[n];
-              }
-            }
-          }
+        for(j=0; j<pw; j++){
+          if(src[j] < colMin[j])
+            colMin[j] = src[j];
         }
       }
+
+      for(j=0; j<pw; j++){
+        fwdMin[j] = colMin[j];
+        if(j % diam && fwdMin[j-1] < fwdMin[j])
+          fwdMin[j] = fwdMin[j-1];
+      }
+      for(j=pw-1; j>=0; j--){
+        revMin[j] = colMin[j];
+        if(j % diam != diam-1 && j < pw-1 && revMin[j+1] < revMin[j])
+          revMin[j] = revMin[j+1];
+      }
     }
-  }
 
-  else if(params->format == SANE_FRAME_GRAY && params->depth == 8){
-    for(i=bw; i<bt-bw-(bw*diam); i+=bw){
-      for(j=1; j<pw-1-diam; j++){
+    for(j=1; j<pw-1-diam; j++){
 
-        int thresh = 255;
-        int outer = 0;
-        int hits = 0;
+      SANE_Byte * win = buffer + i*bw + j*Bpp;
+      int clean = tables && rowDirty < j-1
+        && dirtyCount[j+diam+1] == dirtyCount[j-1];
+      int changed = 0;
 
-        for(k=0; k<diam; k++){
-          for(l=0; l<diam; l++){
-            if(buffer[i + j + k*bw + l] < thresh)
-              thresh = buffer[i + j + k*bw + l];
-          }
-        }
+      if(params->depth == 1){
 
-        /* convert darkest pixel into a brighter threshold */
-        thresh = (thresh + 255 + 255)/3;
+        int curr = 0;
+        int hits = 0;
 
-        /*loop over rows and columns around window */
-        for(k=-1; k<diam+1; k++){
-          for(l=-1; l<diam+1; l++){
+        if(clean){
+          curr = sumTableRect(&sums, i, j, i+diam, j+diam);
+          if(!curr)
+            continue;
 
-            int tmp = 0;
+          hits = sumTableRect(&sums, i-1, j-1, i+diam+1, j+diam+1) - curr;
+        }
+        else{
+          for(k=0; k<diam; k++){
+            for(l=0; l<diam; l++){
+              curr += buffer[i*bw + k*bw + (j+l)/8] >> (7-(j+l)%8) & 1;
+            }
+          }
 
-            /* dont count pixels in the window */
-            if(k != -1 && k != diam && l != -1 && l != diam)
-              continue;
+          if(!curr)
+            continue;
 
-            tmp = buffer[i + j + k*bw + l];
+          /*loop over rows and columns around window */
+          for(k=-1; k<diam+1 && !hits; k++){
+            int step = (k == -1 || k == diam) ? 1 : diam+1;
 
-            if(tmp < thresh){
-              hits++;
-              break;
+            for(l=-1; l<diam+1; l+=step){
+              hits += buffer[i*bw + k*bw + (j+l)/8] >> (7-(j+l)%8) & 1;
             }
-
-            outer += tmp;
           }
         }
 
-        /*no hits, overwrite with avg surrounding color*/
+        /*no hits, overwrite with white*/
         if(!hits){
-          /* replacement color */
-          outer /= (4*diam + 4);
-
           for(k=0; k<diam; k++){
             for(l=0; l<diam; l++){
-              buffer[i + j + k*bw + l] = outer;
+              buffer[i*bw + k*bw + (j+l)/8] &= ~(1 << (7-(j+l)%8));
             }
           }
+          changed = 1;
         }
       }
-    }
-  }
 
-  else if(params->format == SANE_FRAME_GRAY && params->depth == 1){
-    for(i=bw; i<bt-bw-(bw*diam); i+=bw){
-      for(j=1; j<pw-1-diam; j++){
+      else{
 
-        int curr = 0;
-        int hits = 0;
+        int thresh = 255*Bpp;
 
-        for(k=0; k<diam; k++){
-          for(l=0; l<diam; l++){
-            curr += buffer[i + k*bw + (j+l)/8] >> (7-(j+l)%8) & 1;
-          }
+        if(clean){
+          thresh = revMin[j] < fwdMin[j+diam-1]
+            ? revMin[j] : fwdMin[j+diam-1];
         }
+        else{
+          /* loop over rows and columns in window */
+          /* find darkest pixel */
+          for(k=0; k<diam; k++){
+            for(l=0; l<diam*Bpp; l+=Bpp){
+              int tmp = 0;
 
-        if(!curr)
-          continue;
+              for(n=0; n<Bpp; n++){
+                tmp += win[k*bw + l + n];
+              }
 
-        /*loop over rows and columns around window */
-        for(k=-1; k<diam+1; k++){
-          for(l=-1; l<diam+1; l++){
+              if(tmp < thresh)
+                thresh = tmp;
+            }
+          }
+        }
 
-            /* dont count pixels in the window */
-            if(k != -1 && k != diam && l != -1 && l != diam)
-              continue;
+        if(clean && Bpp == 1){
+          struct despeckGray g;
 
-            hits += buffer[i + k*bw + (j+l)/8] >> (7-(j+l)%8) & 1;
+          g.darkest = thresh;
+          g.darkness = sumTableRect(&sums, i, j, i+diam, j+diam);
+          g.pixels = diam*diam;
 
-            if(hits)
-              break;
-          }
+          changed = despeckWindow(win, bw, Bpp, diam, thresh,
+            despeckGraySame, &g);
+        }
+        else{
+          changed = despeckWindow(win, bw, Bpp, diam, thresh, NULL, NULL);
         }
+      }
 
-        /*no hits, overwrite with white*/
-        if(!hits){
-          for(k=0; k<diam; k++){
-            for(l=0; l<diam; l++){
-              buffer[i + k*bw + (j+l)/8] &= ~(1 << (7-(j+l)%8));
-            }
-          }
+      if(tables && changed){
+        for(l=j; l<j+diam; l++){
+          dirty[l] = i+diam-1;
         }
+        rowDirty = j+diam-1;
       }
     }
   }
 
-  else{
-    DBG (5, "sanei_magic_despeck: unsupported format/depth\n");
-    ret = SANE_STATUS_INVAL;
-  }
+  cleanup:
+  if(sums.sums)
+    free(sums.sums);
+  if(dirty)
+    free(dirty);
+  if(dirtyCount)
+    free(dirtyCount);
+  if(band)
+    free(band);
+  if(colMin)
+    free(colMin);
+  if(fwdMin)
+    free(fwdMin);
+  if(revMin)
+    free(revMin);
 
   DBG (10, "sanei_magic_despeck: finish\n");
   return ret;
@@ -599,6 +847,132 @@ sanei_magic_findSkew(SANE_Parameters * params, SANE_Byte * buffer,
   return ret;
 }
 
+/* sanei_magic_rotate walks each output row with fixed point source
+ * coordinates, 32 fractional bits, instead of multiplying per pixel.
+ * The stepped value drifts away from the double the plain formula
+ * gives, so it is re-anchored every ROTATE_ANCHOR pixels, and when it
+ * is too close to an integer to be truncated safely, the double is
+ * computed instead. The output is the same as doing every pixel in
+ * double. The part of the row that maps inside the source image is
+ * found up front, so the inner loops need no bounds checks. */
+#define ROTATE_FRAC_BITS 32
+#define ROTATE_FRAC_MASK ((1LL << ROTATE_FRAC_BITS) - 1)
+#define ROTATE_ANCHOR 256
+/* far more than the drift over ROTATE_ANCHOR steps */
+#define ROTATE_NEAR (1LL << (ROTATE_FRAC_BITS - 22))
+
+/* one source coordinate of an output row, for pixel j it is
+ * center + sign * (int)((shift - j) * scale + base) */
+struct rotateAxis {
+  double scale;
+  double base;
+  int shift;
+  int center;
+  int sign;
+};
+
+static long long
+rotateToFixed (double value)
+{
+  return (long long) floor (value * (double)(1LL << ROTATE_FRAC_BITS) + 0.5);
+}
+
+/* same as the (int) cast of the value, truncating towards zero,
+ * negative values are rounded up before the shift to avoid a branch */
+static int
+rotateTrunc (long long value)
+{
+  long long roundUp = (value >> 63) & ROTATE_FRAC_MASK;
+
+  return (int)((value + roundUp) >> ROTATE_FRAC_BITS);
+}
+
+static double
+rotateValue (const struct rotateAxis * axis, int j)
+{
+  return (axis->shift - j) * axis->scale + axis->base;
+}
+
+static int
+rotateExact (const struct rotateAxis * axis, int j)
+{
+  return axis->center + axis->sign * (int)rotateValue(axis, j);
+}
+
+/* a stepped value this close to an integer may truncate to the wrong
+ * side of it, so the source coordinate is recomputed with rotateExact */
+static int
+rotateNear (long long off)
+{
+  return ((off + ROTATE_NEAR) & ROTATE_FRAC_MASK) < 2 * ROTATE_NEAR;
+}
+
+/* The source coordinate is monotonic in j, so binary search for the
+ * first pixel in [lo,hi) at which it crosses value, upwards or
+ * downwards. */
+static int
+rotateSearch (const struct rotateAxis * axis, int lo, int hi,
+  int value, int up)
+{
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    int src = rotateExact(axis, mid);
+
+    if (up ? src >= value : src < value)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+}
+
+/* narrow [*spanFirst,*spanLast) to the pixels whose source coordinate
+ * is inside [0,limit) */
+static void
+rotateSpan (const struct rotateAxis * axis, int limit,
+  int * spanFirst, int * spanLast)
+{
+  int last = *spanLast;
+  int up = axis->sign * axis->scale <= 0;
+
+  if (up) {
+    *spanFirst = rotateSearch(axis, *spanFirst, last, 0, 1);
+    *spanLast = rotateSearch(axis, *spanFirst, last, limit, 1);
+  }
+  else {
+    *spanFirst = rotateSearch(axis, *spanFirst, last, limit, 0);
+    *spanLast = rotateSearch(axis, *spanFirst, last, 0, 0);
+  }
+}
+
+/* set up both axes of output row i, and find its span */
+static void
+rotateRow (double slopeCos, double slopeSin, int centerX, int centerY,
+  int i, int pwidth, int height, struct rotateAxis * axisX,
+  struct rotateAxis * axisY, int * spanFirst, int * spanLast)
+{
+  int shiftY = centerY - i;
+
+  axisX->scale = slopeCos;
+  axisX->base = shiftY * slopeSin;
+  axisX->shift = centerX;
+  axisX->center = centerX;
+  axisX->sign = -1;
+
+  axisY->scale = slopeSin;
+  axisY->base = -shiftY * slopeCos;
+  axisY->shift = centerX;
+  axisY->center = centerY;
+  axisY->sign = 1;
+
+  *spanFirst = 0;
+  *spanLast = pwidth;
+  rotateSpan(axisX, pwidth, spanFirst, spanLast);
+  rotateSpan(axisY, height, spanFirst, spanLast);
+  if (*spanFirst >= *spanLast)
+    *spanFirst = *spanLast = pwidth;
+}
+
 /* function to do a simple rotation by a given slope, around
  * a given point. The point can be outside of image to get
  * proper edge alignment. Unused areas filled with bg color
@@ -614,22 +988,28 @@ sanei_magic_rotate (SANE_Parameters * params, SANE_Byte * buffer,
   double slopeSin = sin(slopeRad);
   double slopeCos = cos(slopeRad);
 
+  /* source coordinate steps for one pixel to the right */
+  long long stepX = rotateToFixed(slopeCos);
+  long long stepY = rotateToFixed(slopeSin);
+
   int pwidth = params->pixels_per_line;
   int bwidth = params->bytes_per_line;
   int height = params->lines;
   int depth = 1;
 
-  unsigned char * outbuf;
-  int i, j, k;
+  unsigned char * inbuf;
+  int i, j;
 
   DBG(10,"sanei_magic_rotate: start: %d %d\n",centerX,centerY);
 
-  outbuf = malloc(bwidth*height);
-  if(!outbuf){
-    DBG(15,"sanei_magic_rotate: no outbuf\n");
+  /* the rotated image is written over the original, read from a copy */
+  inbuf = malloc(bwidth*height);
+  if(!inbuf){
+    DBG(15,"sanei_magic_rotate: no inbuf\n");
     ret = SANE_STATUS_NO_MEM;
     goto cleanup;
   }
+  memcpy(inbuf,buffer,bwidth*height);
 
   if(params->format == SANE_FRAME_RGB ||
     (params->format == SANE_FRAME_GRAY && params->depth == 8)
@@ -638,26 +1018,63 @@ sanei_magic_rotate (SANE_Parameters * params, SANE_Byte * buffer,
     if(params->format == SANE_FRAME_RGB)
       depth = 3;
 
-    memset(outbuf,bg_color,bwidth*height);
+    /* padding at the end of each line */
+    if(bwidth > pwidth*depth){
+      for (i=0; i<height; i++) {
+        memset(buffer+i*bwidth+pwidth*depth,bg_color,bwidth-pwidth*depth);
+      }
+    }
 
     for (i=0; i<height; i++) {
-      int shiftY = centerY - i;
+      struct rotateAxis axisX, axisY;
+      unsigned char * line = buffer + i*bwidth;
+      int spanFirst, spanLast;
 
-      for (j=0; j<pwidth; j++) {
-        int shiftX = centerX - j;
-        int sourceX, sourceY;
+      rotateRow(slopeCos, slopeSin, centerX, centerY, i, pwidth, height,
+        &axisX, &axisY, &spanFirst, &spanLast);
 
-        sourceX = centerX - (int)(shiftX * slopeCos + shiftY * slopeSin);
-        if (sourceX < 0 || sourceX >= pwidth)
-          continue;
+      memset(line, bg_color, spanFirst*depth);
+      memset(line+spanLast*depth, bg_color, (pwidth-spanLast)*depth);
 
-        sourceY = centerY + (int)(-shiftY * slopeCos + shiftX * slopeSin);
-        if (sourceY < 0 || sourceY >= height)
-          continue;
+      for (j=spanFirst; j<spanLast; ) {
+        long long offX = rotateToFixed(rotateValue(&axisX, j));
+        long long offY = rotateToFixed(rotateValue(&axisY, j));
+        int anchorEnd = j + ROTATE_ANCHOR;
 
-        for (k=0; k<depth; k++) {
-          outbuf[i*bwidth+j*depth+k]
-            = buffer[sourceY*bwidth+sourceX*depth+k];
+        if (anchorEnd > spanLast)
+          anchorEnd = spanLast;
+
+        /* separate loops, so the pixel copy is not made a library call */
+        if (depth == 1) {
+          for (; j<anchorEnd; j++, offX-=stepX, offY-=stepY) {
+            int sourceX = centerX - rotateTrunc(offX);
+            int sourceY = centerY + rotateTrunc(offY);
+
+            if (rotateNear(offX))
+              sourceX = rotateExact(&axisX, j);
+            if (rotateNear(offY))
+              sourceY = rotateExact(&axisY, j);
+
+            line[j] = inbuf[sourceY*bwidth + sourceX];
+          }
+        }
+        else {
+          for (; j<anchorEnd; j++, offX-=stepX, offY-=stepY) {
+            int sourceX = centerX - rotateTrunc(offX);
+            int sourceY = centerY + rotateTrunc(offY);
+            unsigned char * in;
+            unsigned char * out = line + j*3;
+
+            if (rotateNear(offX))
+              sourceX = rotateExact(&axisX, j);
+            if (rotateNear(offY))
+              sourceY = rotateExact(&axisY, j);
+
+            in = inbuf + sourceY*bwidth + sourceX*3;
+            out[0] = in[0];
+            out[1] = in[1];
+            out[2] = in[2];
+          }
         }
       }
     }
@@ -665,33 +1082,66 @@ sanei_magic_rotate (SANE_Parameters * params, SANE_Byte * buffer,
 
   else if(params->format == SANE_FRAME_GRAY && params->depth == 1){
 
+    int pbytes = (pwidth+7)/8;
+    unsigned int bg_bit;
+
     if(bg_color)
       bg_color = 0xff;
+    bg_bit = bg_color & 1;
 
-    memset(outbuf,bg_color,bwidth*height);
+    if(bwidth > pbytes){
+      for (i=0; i<height; i++) {
+        memset(buffer+i*bwidth+pbytes,bg_color,bwidth-pbytes);
+      }
+    }
 
+    /* whole output bytes are built up in a register, then stored */
     for (i=0; i<height; i++) {
-      int shiftY = centerY - i;
+      struct rotateAxis axisX, axisY;
+      unsigned char * out = buffer + i*bwidth;
+      unsigned int bits = 0;
+      long long offX = 0;
+      long long offY = 0;
+      int spanFirst, spanLast;
+
+      rotateRow(slopeCos, slopeSin, centerX, centerY, i, pwidth, height,
+        &axisX, &axisY, &spanFirst, &spanLast);
 
       for (j=0; j<pwidth; j++) {
-        int shiftX = centerX - j;
-        int sourceX, sourceY;
+        unsigned int bit = bg_bit;
 
-        sourceX = centerX - (int)(shiftX * slopeCos + shiftY * slopeSin);
-        if (sourceX < 0 || sourceX >= pwidth)
-          continue;
+        if (j >= spanFirst && j < spanLast) {
+          unsigned int sourceX;
+          int sourceY;
 
-        sourceY = centerY + (int)(-shiftY * slopeCos + shiftX * slopeSin);
-        if (sourceY < 0 || sourceY >= height)
-          continue;
+          if ((j - spanFirst) % ROTATE_ANCHOR == 0) {
+            offX = rotateToFixed(rotateValue(&axisX, j));
+            offY = rotateToFixed(rotateValue(&axisY, j));
+          }
 
-        /* wipe out old bit */
-        outbuf[i*bwidth + j/8] &= ~(1 << (7-(j%8)));
+          sourceX = centerX - rotateTrunc(offX);
+          sourceY = centerY + rotateTrunc(offY);
+          if (rotateNear(offX))
+            sourceX = rotateExact(&axisX, j);
+          if (rotateNear(offY))
+            sourceY = rotateExact(&axisY, j);
+          offX -= stepX;
+          offY -= stepY;
 
-        /* fill in new bit */
-        outbuf[i*bwidth + j/8] |=
-          ((buffer[sourceY*bwidth + sourceX/8]
-          >> (7-(sourceX%8))) & 1) << (7-(j%8));
+          bit = (inbuf[sourceY*bwidth + sourceX/8] >> (7-sourceX%8)) & 1;
+        }
+
+        bits = (bits << 1) | bit;
+        if (j%8 == 7) {
+          *out++ = bits;
+          bits = 0;
+        }
+      }
+
+      /* partial last byte, pad with background */
+      if (pwidth%8) {
+        int pad = 8 - pwidth%8;
+        *out = (bits << pad) | (bg_color & ((1 << pad) - 1));
       }
     }
   }
@@ -701,12 +1151,10 @@ sanei_magic_rotate (SANE_Parameters * params, SANE_Byte * buffer,
     goto cleanup;
   }
 
-  memcpy(buffer,outbuf,bwidth*height);
-
   cleanup:
 
-  if(outbuf)
-    free(outbuf);
+  if(inbuf)
+    free(inbuf);
 
   DBG(10,"sanei_magic_rotate: finish\n");
 
@@ -789,7 +1237,8 @@ SANE_Status
 sanei_magic_isBlank2 (SANE_Parameters * params, SANE_Byte * buffer,
   int dpiX, int dpiY, double thresh)
 {
-  int xb,yb,x,y;
+  SANE_Status ret = SANE_STATUS_NO_DOCS;
+  int xb,yb,y;
 
   /* .25 inch, rounded down to 8 pixel */
   int xquarter = dpiX/4/8*8;
@@ -800,90 +1249,67 @@ sanei_magic_isBlank2 (SANE_Parameters * params, SANE_Byte * buffer,
   int xblocks  = (params->pixels_per_line-xhalf)/xhalf;
   int yblocks  = (params->lines-yhalf)/yhalf;
 
+  /* darkness of the pixels in one row of blocks */
+  struct sumTable sums = {NULL, 0, 0, 0};
+  double maxsum = blockpix;
+
   /*convert thresh from percent (0-100) to 0-1 range*/
   thresh /= 100;
 
   DBG (10, "sanei_magic_isBlank2: start %d %d %f %d\n",xhalf,yhalf,thresh,blockpix);
 
-  if(params->depth == 8 &&
-    (params->format == SANE_FRAME_RGB || params->format == SANE_FRAME_GRAY)
-  ){
-
-    int Bpp = params->format == SANE_FRAME_RGB ? 3 : 1;
+  /* the darkest any block can be */
+  if(params->format == SANE_FRAME_RGB && params->depth == 8){
+    maxsum *= 3 * 255;
+  }
+  else if(params->format == SANE_FRAME_GRAY && params->depth == 8){
+    maxsum *= 255;
+  }
+  else if(params->format != SANE_FRAME_GRAY || params->depth != 1){
+    DBG (5, "sanei_magic_isBlank2: unsupported format/depth\n");
+    return SANE_STATUS_INVAL;
+  }
 
-    for(yb=0; yb<yblocks; yb++){
-      for(xb=0; xb<xblocks; xb++){
+  /* skip the top 1/4 inch */
+  ret = sumTableInit(&sums, params->pixels_per_line, yhalf+1, yquarter);
+  if(ret){
+    return ret;
+  }
+  ret = SANE_STATUS_NO_DOCS;
 
-        /*count dark pix in this block*/
-        double blocksum = 0;
+  for(yb=0; yb<yblocks && ret == SANE_STATUS_NO_DOCS; yb++){
 
-        for(y=0; y<yhalf; y++){
+    int top = yquarter + yb*yhalf;
 
-          /* skip the top and left 1/4 inch */
-          int offset = (yquarter + yb*yhalf + y) * params->bytes_per_line
-            + (xquarter + xb*xhalf) * Bpp;
-          SANE_Byte * ptr = buffer + offset;
+    for(y=top; y<top+yhalf; y++){
+      sumTableAdd(&sums, params, buffer + y*params->bytes_per_line);
+    }
 
-          /*count darkness of pix in this row*/
-          int rowsum = 0;
+    for(xb=0; xb<xblocks; xb++){
 
-          for(x=0; x<xhalf*Bpp; x++){
-            rowsum += 255 - ptr[x];
-          }
+      /* skip the left 1/4 inch */
+      int left = xquarter + xb*xhalf;
 
-          blocksum += (double)rowsum/(xhalf*Bpp)/255;
-        }
+      /*count darkness of pix in this block*/
+      double density = sumTableRect(&sums, top, left, top+yhalf, left+xhalf)
+        / maxsum;
 
-        /* block was darker than thresh, keep image */
-        if(blocksum/yhalf > thresh){
-          DBG (15, "sanei_magic_isBlank2: not blank %f %d %d\n", blocksum/yhalf, yb, xb);
-          return SANE_STATUS_GOOD;
-        }
-        DBG (20, "sanei_magic_isBlank2: block blank %f %d %d\n", blocksum/yhalf, yb, xb);
+      /* block was darker than thresh, keep image */
+      if(density > thresh){
+        DBG (15, "sanei_magic_isBlank2: not blank %f %d %d\n", density, yb, xb);
+        ret = SANE_STATUS_GOOD;
+        break;
       }
+      DBG (20, "sanei_magic_isBlank2: block blank %f %d %d\n", density, yb, xb);
     }
   }
-  else if(params->format == SANE_FRAME_GRAY && params->depth == 1){
-
-    for(yb=0; yb<yblocks; yb++){
-      for(xb=0; xb<xblocks; xb++){
-
-        /*count dark pix in this block*/
-        double blocksum = 0;
-
-        for(y=0; y<yhalf; y++){
-
-          /* skip the top and left 1/4 inch */
-          int offset = (yquarter + yb*yhalf + y) * params->bytes_per_line
-            + (xquarter + xb*xhalf) / 8;
-          SANE_Byte * ptr = buffer + offset;
-
-          /*count darkness of pix in this row*/
-          int rowsum = 0;
 
-          for(x=0; x<xhalf; x++){
-            rowsum += ptr[x/8] >> (7-(x%8)) & 1;
-          }
-
-          blocksum += (double)rowsum/xhalf;
-        }
+  free(sums.sums);
 
-        /* block was darker than thresh, keep image */
-        if(blocksum/yhalf > thresh){
-          DBG (15, "sanei_magic_isBlank2: not blank %f %d %d\n", blocksum/yhalf, yb, xb);
-          return SANE_STATUS_GOOD;
-        }
-        DBG (20, "sanei_magic_isBlank2: block blank %f %d %d\n", blocksum/yhalf, yb, xb);
-      }
-    }
+  if(ret == SANE_STATUS_NO_DOCS){
+    DBG (10, "sanei_magic_isBlank2: returning blank\n");
   }
-  else{
-    DBG (5, "sanei_magic_isBlank2: unsupported format/depth\n");
-    return SANE_STATUS_INVAL;
-  }
-
-  DBG (10, "sanei_magic_isBlank2: returning blank\n");
-  return SANE_STATUS_NO_DOCS;
+  return ret;
 }
 
 SANE_Status
@@ -1283,11 +1709,24 @@ getTopEdge(int width, int height, int resolution,
   int topOffset = 0;
   int topDensity = 0;
 
+  int * counts = NULL;
+  int binCount = slopes * offsets;
+
   int i,j;
   int pass = 0;
 
   DBG(10,"getTopEdge: start\n");
 
+  /*silence compiler*/
+  height = height;
+
+  /* line counts for all grids */
+  counts = calloc(LINE_GRIDS * binCount, sizeof(int));
+  if(!counts){
+    DBG(5,"getTopEdge: cant load counts\n");
+    return SANE_STATUS_NO_MEM;
+  }
+
   while(pass++ < 7){
     double sStep = (maxSlope-minSlope)/slopes;
     int oStep = (maxOffset-minOffset)/offsets;
@@ -1297,20 +1736,44 @@ getTopEdge(int width, int height, int resolution,
     int density = 0;
     int go = 0;
 
+    struct lineBins bins;
+
     topSlope = 0;
     topOffset = 0;
     topDensity = 0;
 
     /* find lines 4 times with slightly moved params,
      * to bypass binning errors, highest density wins */
+    bins.slopes = slopes;
+    bins.offsets = offsets;
     for(i=0;i<2;i++){
       double sStep2 = sStep*i/2;
       for(j=0;j<2;j++){
         int oStep2 = oStep*j/2;
-        ret = getLine(height,width,buff,slopes,minSlope+sStep2,maxSlope+sStep2,offsets,minOffset+oStep2,maxOffset+oStep2,&slope,&offset,&density);
+        bins.minSlope[i*2+j] = minSlope+sStep2;
+        bins.maxSlope[i*2+j] = maxSlope+sStep2;
+        bins.minOffset[i*2+j] = minOffset+oStep2;
+        bins.maxOffset[i*2+j] = maxOffset+oStep2;
+      }
+    }
+
+    ret = countLines(width,buff,&bins,counts);
+    if(ret){
+      DBG(5,"getTopEdge: countLines error %d\n",ret);
+      goto cleanup;
+    }
+
+    for(i=0;i<2;i++){
+      for(j=0;j<2;j++){
+        int grid = i*2+j;
+
+        ret = getLine(counts+grid*binCount,
+          slopes,bins.minSlope[grid],bins.maxSlope[grid],
+          offsets,bins.minOffset[grid],bins.maxOffset[grid],
+          &slope,&offset,&density);
         if(ret){
           DBG(5,"getTopEdge: getLine error %d\n",ret);
-          return ret;
+          goto cleanup;
         }
         DBG(15,"getTopEdge: %d %d %+0.4f %d %d\n",i,j,slope,offset,density);
 
@@ -1369,29 +1832,185 @@ getTopEdge(int width, int height, int resolution,
     *finSlope = 0;
   }
 
+  cleanup:
+  free(counts);
+
   DBG(10,"getTopEdge: finish\n");
 
-  return 0;
+  return ret;
 }
 
+/* One share of the work of countLines: the pairs of transitions which
+ * start at the columns first, first+stride, ... */
+struct lineCount {
+  struct lineBins * bins;
+  int * buff;
+  int width;
+  int first;
+  int stride;
+  int * counts;
+};
+
 /* Loop thru a transition array, and use a simplified Hough transform
- * to divide likely edges into a 2-d array of bins. Then weight each
- * bin based on its angle and offset. Return the 'best' bin. */
+ * to divide likely edges into each grid of bins. Each pair of
+ * transitions is visited once for all grids. */
+static void *
+countLinesShare (void * arg)
+{
+  struct lineCount * share = arg;
+  struct lineBins * bins = share->bins;
+  int * buff = share->buff;
+  int width = share->width;
+  int hWidth = width/2;
+  int slopes = bins->slopes;
+  int offsets = bins->offsets;
+  int binCount = slopes * offsets;
+
+  /* the grids are only shifted upwards */
+  double lowSlope = bins->minSlope[0];
+  double highSlope = bins->maxSlope[LINE_GRIDS-1];
+
+  int i, j, grid;
+
+  for(i=share->first;i<width;i+=share->stride){
+    for(j=i+1;j<width && j<i+width/3;j++){
+
+      /*FIXME: check for invalid (min/max) values?*/
+      int rise = buff[j] - buff[i];
+      int run = j-i;
+      double slope = (double)rise/run;
+
+      if(slope >= highSlope || slope < lowSlope)
+        continue;
+
+      for(grid=0;grid<LINE_GRIDS;grid++){
+        double minSlope = bins->minSlope[grid];
+        double maxSlope = bins->maxSlope[grid];
+        int minOffset = bins->minOffset[grid];
+        int maxOffset = bins->maxOffset[grid];
+        int offset, sIndex, oIndex;
+
+        if(slope >= maxSlope || slope < minSlope)
+          continue;
+
+        /* offset in center of width, not y intercept! */
+        offset = slope * hWidth + buff[i] - slope * i;
+        if(offset >= maxOffset || offset < minOffset)
+          continue;
+
+        sIndex = (slope - minSlope) * slopes/(maxSlope-minSlope);
+        if(sIndex >= slopes)
+          continue;
+
+        oIndex = (offset - minOffset) * offsets/(maxOffset-minOffset);
+        if(oIndex >= offsets)
+          continue;
+
+        share->counts[grid*binCount + sIndex*offsets + oIndex]++;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/* Count the lines thru pairs of transitions into counts, one array of
+ * slopes*offsets bins per grid. Wide arrays are split between threads,
+ * each counting into its own arrays, which are added up afterwards.
+ * The sums are the same as with a single thread. */
 static SANE_Status
-getLine (int height, int width, int * buff,
+countLines (int width, int * buff, struct lineBins * bins, int * counts)
+{
+  SANE_Status ret = SANE_STATUS_GOOD;
+
+  struct lineCount shares[LINE_THREADS];
+  int binCount = LINE_GRIDS * bins->slopes * bins->offsets;
+  int threads = 1;
+  int i, j;
+
+#ifdef HAVE_PTHREAD_CREATE
+  pthread_t tids[LINE_THREADS];
+  int started[LINE_THREADS];
+
+  threads = width/LINE_THREAD_WIDTH;
+#if defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_ONLN)
+  {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if(cpus > 0 && threads > cpus)
+      threads = cpus;
+  }
+#endif
+  if(threads > LINE_THREADS)
+    threads = LINE_THREADS;
+  if(threads < 1)
+    threads = 1;
+#endif
+
+  DBG(10,"countLines: start %d\n",threads);
+
+  memset(counts,0,binCount*sizeof(int));
+
+  /* interleave the columns, the pairs get fewer towards the right */
+  for(i=0;i<threads;i++){
+    shares[i].bins = bins;
+    shares[i].buff = buff;
+    shares[i].width = width;
+    shares[i].first = i;
+    shares[i].stride = threads;
+    shares[i].counts = counts;
+
+    if(i){
+      shares[i].counts = calloc(binCount,sizeof(int));
+      if(!shares[i].counts){
+        DBG(5,"countLines: cant load counts %d\n",i);
+        threads = i;
+        ret = SANE_STATUS_NO_MEM;
+        goto cleanup;
+      }
+    }
+  }
+
+#ifdef HAVE_PTHREAD_CREATE
+  for(i=1;i<threads;i++){
+    started[i] = !pthread_create(&tids[i],NULL,countLinesShare,&shares[i]);
+  }
+#endif
+
+  countLinesShare(&shares[0]);
+
+  for(i=1;i<threads;i++){
+#ifdef HAVE_PTHREAD_CREATE
+    if(started[i])
+      pthread_join(tids[i],NULL);
+    else
+#endif
+      countLinesShare(&shares[i]);
+
+    for(j=0;j<binCount;j++)
+      counts[j] += shares[i].counts[j];
+  }
+
+  cleanup:
+  for(i=1;i<threads;i++){
+    free(shares[i].counts);
+  }
+
+  DBG(10,"countLines: finish\n");
+
+  return ret;
+}
+
+/* Weight each bin of a grid filled by countLines based on its angle
+ * and offset. Return the 'best' bin. */
+static SANE_Status
+getLine (int * lines,
   int slopes, double minSlope, double maxSlope,
   int offsets, int minOffset, int maxOffset,
   double * finSlope, int * finOffset, int * finDensity)
 {
   SANE_Status ret = 0;
 
-  int ** lines = NULL;
   int i, j;
-  int rise, run;
-  double slope;
-  int offset;
-  int sIndex, oIndex;
-  int hWidth = width/2;
 
   double * slopeCenter = NULL;
   int * slopeScale = NULL;
@@ -1407,9 +2026,6 @@ getLine (int height, int width, int * buff,
   DBG(10,"getLine: start %+0.4f %+0.4f %d %d\n",
     minSlope,maxSlope,minOffset,maxOffset);
 
-  /*silence compiler*/
-  height = height;
-
   if(absMaxSlope < absMinSlope)
     absMaxSlope = absMinSlope;
 
@@ -1474,55 +2090,11 @@ getLine (int height, int width, int * buff,
     offsetScale[j] = 101 - fabs(offsetCenter[j])*100/absMaxOffset;
   }
 
-  /* build 2-d array of 'density', divided into slope and offset ranges */
-  lines = calloc(slopes, sizeof(int *));
-  if(!lines){
-    DBG(5,"getLine: cant load lines\n");
-    ret = SANE_STATUS_NO_MEM;
-    goto cleanup;
-  }
-
-  for(i=0;i<slopes;i++){
-    if(!(lines[i] = calloc(offsets, sizeof(int)))){
-      DBG(5,"getLine: cant load lines %d\n",i);
-      ret = SANE_STATUS_NO_MEM;
-      goto cleanup;
-    }
-  }
-
-  for(i=0;i<width;i++){
-    for(j=i+1;j<width && j<i+width/3;j++){
-
-      /*FIXME: check for invalid (min/max) values?*/
-      rise = buff[j] - buff[i];
-      run = j-i;
-
-      slope = (double)rise/run;
-      if(slope >= maxSlope || slope < minSlope)
-        continue;
-
-      /* offset in center of width, not y intercept! */
-      offset = slope * hWidth + buff[i] - slope * i;
-      if(offset >= maxOffset || offset < minOffset)
-        continue;
-
-      sIndex = (slope - minSlope) * slopes/(maxSlope-minSlope);
-      if(sIndex >= slopes)
-        continue;
-
-      oIndex = (offset - minOffset) * offsets/(maxOffset-minOffset);
-      if(oIndex >= offsets)
-        continue;
-
-      lines[sIndex][oIndex]++;
-    }
-  }
-
   /* go thru array, and find most dense line (highest number) */
   for(i=0;i<slopes;i++){
     for(j=0;j<offsets;j++){
-      if(lines[i][j] > maxDensity)
-        maxDensity = lines[i][j];
+      if(lines[i*offsets+j] > maxDensity)
+        maxDensity = lines[i*offsets+j];
     }
   }
 
@@ -1536,9 +2108,10 @@ getLine (int height, int width, int * buff,
    * prefered (smaller absolute value) slope and offset */
   for(i=0;i<slopes;i++){
     for(j=0;j<offsets;j++){
-      lines[i][j] = (float)lines[i][j] / maxDensity * slopeScale[i] * offsetScale[j];
-      if(lines[i][j] > *finDensity){
-        *finDensity = lines[i][j];
+      int * line = &lines[i*offsets+j];
+      *line = (float)*line / maxDensity * slopeScale[i] * offsetScale[j];
+      if(*line > *finDensity){
+        *finDensity = *line;
         *finSlope = slopeCenter[i];
         *finOffset = offsetCenter[j];
       }
@@ -1561,7 +2134,7 @@ getLine (int height, int width, int * buff,
     for(i=0;i<slopes;i++){
       fprintf(stderr,"slope: %02d %+02.2f %03d:",i,slopeCenter[i],slopeScale[i]);
       for(j=0;j<offsets;j++){
-        fprintf(stderr,"% 5d",lines[i][j]);
+        fprintf(stderr,"% 5d",lines[i*offsets+j]);
       }
       fprintf(stderr,"\n");
     }
@@ -1569,12 +2142,6 @@ getLine (int height, int width, int * buff,
 
   /* dont forget to cleanup */
   cleanup:
-  for(i=0;i<slopes;i++){
-    if(lines[i])
-      free(lines[i]);
-  }
-  if(lines)
-    free(lines);
   if(slopeCenter)
     free(slopeCenter);
   if(slopeScale)
@@ -1683,7 +2250,7 @@ sanei_magic_getTransY (
 {
   int * buff;
 
-  int i, j, k;
+  int i, j, k, l;
   int winLen = 9;
 
   int width = params->pixels_per_line;
@@ -1714,74 +2281,135 @@ sanei_magic_getTransY (
     buff[i] = lastLine;
 
   /* load the buff array with y value for first color change from edge
-   * gray/color uses a different algo from binary/halftone */
+   * gray/color uses a different algo from binary/halftone.
+   * The image is read a line at a time, for all columns which have not
+   * found their transition yet, rather than a column at a time. */
   if(params->format == SANE_FRAME_RGB ||
     (params->format == SANE_FRAME_GRAY && params->depth == 8)
   ){
 
+    int * near = NULL;
+    int * far = NULL;
+    int * cols = NULL;
+    int count = width;
+    SANE_Byte * first;
+
     if(params->format == SANE_FRAME_RGB)
       depth = 3;
 
-    /* loop over all columns, find first transition */
-    for(i=0; i<width; i++){
-
-      int near = 0;
-      int far = 0;
+    near = calloc(width,sizeof(int));
+    far = calloc(width,sizeof(int));
+    cols = calloc(width,sizeof(int));
+    if(!near || !far || !cols){
+      DBG (5, "sanei_magic_getTransY: no windows\n");
+      free(near);
+      free(far);
+      free(cols);
+      free(buff);
+      return NULL;
+    }
 
-      /* load the near and far windows with repeated copy of first pixel */
+    /* load the near and far windows with repeated copy of first pixel */
+    first = buffer + firstLine*width*depth;
+    for(i=0; i<width; i++){
       for(k=0; k<depth; k++){
-        near += buffer[(firstLine*width+i) * depth + k];
+        near[i] += first[i*depth + k];
       }
-      near *= winLen;
-      far = near;
+      near[i] *= winLen;
+      far[i] = near[i];
+      cols[i] = i;
+    }
 
-      /* move windows, check delta */
-      for(j=firstLine+direction; j!=lastLine; j+=direction){
+    /* move windows, check delta */
+    for(j=firstLine+direction; j!=lastLine && count; j+=direction){
 
-        int farLine = j-winLen*2*direction;
-        int nearLine = j-winLen*direction;
+      int farLine = j-winLen*2*direction;
+      int nearLine = j-winLen*direction;
+      SANE_Byte * farRow, * nearRow, * row;
+      int left = 0;
 
-        if(farLine < 0 || farLine >= height){
-          farLine = firstLine;
-        }
-        if(nearLine < 0 || nearLine >= height){
-          nearLine = firstLine;
-        }
+      if(farLine < 0 || farLine >= height){
+        farLine = firstLine;
+      }
+      if(nearLine < 0 || nearLine >= height){
+        nearLine = firstLine;
+      }
+
+      farRow = buffer + farLine*width*depth;
+      nearRow = buffer + nearLine*width*depth;
+      row = buffer + j*width*depth;
+
+      for(l=0; l<count; l++){
+        int col = cols[l];
+        int pos = col*depth;
 
         for(k=0; k<depth; k++){
-          far -= buffer[(farLine*width+i)*depth+k];
-          far += buffer[(nearLine*width+i)*depth+k];
+          far[col] -= farRow[pos+k];
+          far[col] += nearRow[pos+k];
 
-          near -= buffer[(nearLine*width+i)*depth+k];
-          near += buffer[(j*width+i)*depth+k];
+          near[col] -= nearRow[pos+k];
+          near[col] += row[pos+k];
         }
 
         /* significant transition */
-        if(abs(near - far) > 50*winLen*depth - near*40/255){
-          buff[i] = j;
-          break;
+        if(abs(near[col] - far[col])
+          > 50*winLen*depth - near[col]*40/255){
+          buff[col] = j;
+          continue;
         }
+
+        /* keep looking in this column */
+        cols[left++] = col;
       }
+      count = left;
     }
+
+    free(near);
+    free(far);
+    free(cols);
   }
 
   else if(params->format == SANE_FRAME_GRAY && params->depth == 1){
 
-    int near = 0;
+    int * near = calloc(width,sizeof(int));
+    int * cols = calloc(width,sizeof(int));
+    int count = width;
 
+    if(!near || !cols){
+      DBG (5, "sanei_magic_getTransY: no windows\n");
+      free(near);
+      free(cols);
+      free(buff);
+      return NULL;
+    }
+
+    /* load the near window with first pixel */
     for(i=0; i<width; i++){
+      near[i] = buffer[(firstLine*width+i)/8] >> (7-(i%8)) & 1;
+      cols[i] = i;
+    }
 
-      /* load the near window with first pixel */
-      near = buffer[(firstLine*width+i)/8] >> (7-(i%8)) & 1;
+    /* move */
+    for(j=firstLine+direction; j!=lastLine && count; j+=direction){
 
-      /* move */
-      for(j=firstLine+direction; j!=lastLine; j+=direction){
-        if((buffer[(j*width+i)/8] >> (7-(i%8)) & 1) != near){
-          buff[i] = j;
-          break;
+      int left = 0;
+
+      for(l=0; l<count; l++){
+        int col = cols[l];
+
+        if((buffer[(j*width+col)/8] >> (7-(col%8)) & 1) != near[col]){
+          buff[col] = j;
+          continue;
         }
+
+        /* keep looking in this column */
+        cols[left++] = col;
       }
+      count = left;
     }
+
+    free(near);
+    free(cols);
   }
 
   /* some other format? */
@@ -68,6 +68,11 @@
 
 #if WITH_USB_RECORD_REPLAY
 #include <libxml/tree.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 #endif
 
 #ifdef HAVE_RESMGR
@@ -177,6 +182,43 @@ static device_list_type devices[MAX_DEVICES];
  * total number of detected devices in devices array */
 static int device_number=0;
 
+/**
+ * state of a single transfer of an asynchronous bulk read stream */
+typedef struct
+{
+  SANE_Byte *buffer;
+  size_t size;			/* number of bytes requested from the device */
+  size_t length;		/* number of bytes received */
+  size_t offset;		/* number of bytes already returned to the caller */
+  int pending;			/* submitted, but not yet returned to the caller */
+  int completed;		/* set when the transfer has finished */
+  int received;			/* whether the result has been checked */
+#ifdef HAVE_LIBUSB
+  struct libusb_transfer *lu_transfer;
+#endif /* HAVE_LIBUSB */
+}
+bulk_stream_transfer_type;
+
+/**
+ * state of an asynchronous bulk read stream, see sanei_usb_start_bulk_stream() */
+typedef struct
+{
+  SANE_Bool active;
+  SANE_Bool async;		/* whether the transfers are submitted asynchronously */
+  SANE_Bool ended;		/* whether no more transfers will be submitted */
+  SANE_Status status;		/* error to return once the data is consumed */
+  int transfer_count;
+  size_t transfer_size;
+  size_t remaining_size;	/* number of bytes not yet requested from the device */
+  int head;			/* index of the transfer returned to the caller next */
+  bulk_stream_transfer_type *transfers;
+}
+bulk_stream_type;
+
+/**
+ * per-device bulk read streams, using the functions' parameters dn as index */
+static bulk_stream_type bulk_streams[MAX_DEVICES];
+
 /**
  * count number of time sanei_usb has been initialized */
 static int initialized=0;
@@ -208,6 +250,13 @@ static xmlNode* testing_append_commands_node = NULL;
 static SANE_String testing_xml_path = NULL;
 static xmlDoc* testing_xml_doc = NULL;
 static xmlNode* testing_xml_next_tx_node = NULL;
+
+// Raw transaction payloads of the capture, if the capture refers to a data
+// file. Transactions refer to their payload by data_offset and data_size
+// attributes instead of containing hex data.
+static const char* testing_data_file_contents = NULL;
+static size_t testing_data_file_size = 0;
+static int testing_data_file_is_mapped = 0;
 #endif // WITH_USB_RECORD_REPLAY
 
 #if defined(HAVE_LIBUSB_LEGACY) || defined(HAVE_LIBUSB)
@@ -581,6 +630,19 @@ static int sanei_xml_get_prop_uint(xmlNode* node, const char* name)
   return attr_uint;
 }
 
+// returns 0 if attribute is not found
+static int sanei_xml_get_prop_size(xmlNode* node, const char* name,
+                                   size_t* value)
+{
+  char* attr = sanei_xml_get_prop(node, name);
+  if (attr == NULL)
+    return 0;
+
+  *value = strtoull(attr, NULL, 0);
+  xmlFree(attr);
+  return 1;
+}
+
 static void sanei_xml_print_seq_if_any(xmlNode* node, const char* parent_fun)
 {
   char* attr = sanei_xml_get_prop(node, "seq");
@@ -752,16 +814,55 @@ static char* sanei_xml_get_hex_data_slow_path(xmlNode* node, xmlChar* content, x
   return ret_data;
 }
 
+// Returns the payload of the transaction from the data file. The caller is
+// responsible for freeing the returned value
+static char* sanei_xml_get_data_file_data(xmlNode* node, size_t offset,
+                                          size_t* size)
+{
+  if (offset > testing_data_file_size ||
+      *size > testing_data_file_size - offset)
+    {
+      FAIL_TEST_TX(__func__, node, "data is outside the data file\n");
+      *size = 0;
+      return NULL;
+    }
+
+  char* ret_data = malloc(*size + 1);
+  if (ret_data == NULL)
+    {
+      FAIL_TEST_TX(__func__, node, "could not allocate %lu bytes\n", *size);
+      *size = 0;
+      return NULL;
+    }
+  memcpy(ret_data, testing_data_file_contents + offset, *size);
+  return ret_data;
+}
+
 // Parses hex data in XML text node in the format of '00 11 ab 3f', etc. to
 // binary string. The size is returned as *size. The caller is responsible for
-// freeing the returned value
+// freeing the returned value. Returns NULL if the data can't be retrieved, in
+// which case the transaction has failed
 static char* sanei_xml_get_hex_data(xmlNode* node, size_t* size)
 {
+  size_t data_offset = 0;
+  if (sanei_xml_get_prop_size(node, "data_offset", &data_offset) &&
+      sanei_xml_get_prop_size(node, "data_size", size))
+    {
+      return sanei_xml_get_data_file_data(node, data_offset, size);
+    }
+
   xmlChar* content = xmlNodeGetContent(node);
 
   // let's overallocate to simplify the implementation. We expect the string
   // to be deallocated soon anyway
   char* ret_data = malloc(strlen((const char*)content) / 2 + 2);
+  if (ret_data == NULL)
+    {
+      FAIL_TEST_TX(__func__, node, "could not allocate memory for the data\n");
+      xmlFree(content);
+      *size = 0;
+      return NULL;
+    }
   char* cur_ret_data = ret_data;
 
   xmlChar* cur_content = content;
@@ -805,6 +906,19 @@ static char* sanei_xml_get_hex_data(xmlNode* node, size_t* size)
   return ret_data;
 }
 
+// Returns the size of the data of the transaction without decoding it when
+// possible
+static size_t sanei_xml_get_data_size(xmlNode* node)
+{
+  size_t size = 0;
+  if (sanei_xml_get_prop_size(node, "data_size", &size))
+    return size;
+
+  char* data = sanei_xml_get_hex_data(node, &size);
+  free(data);
+  return size;
+}
+
 // caller is responsible for freeing the returned pointer
 static char* sanei_binary_to_hex_data(const char* data, size_t size,
                                       size_t* out_size)
@@ -1133,6 +1247,88 @@ static void sanei_usb_add_endpoint(device_list_type* device,
                                    SANE_Int ep_address,
                                    SANE_Int ep_direction);
 
+// Loads the data file that is referred to by the capture. Relative paths are
+// relative to the directory of the capture.
+static SANE_Status sanei_usb_testing_load_data_file(const char* data_file)
+{
+  char* path = NULL;
+  const char* slash = strrchr(testing_xml_path, '/');
+
+  if (data_file[0] == '/' || slash == NULL)
+    {
+      path = strdup(data_file);
+    }
+  else
+    {
+      size_t dir_length = slash - testing_xml_path + 1;
+      path = malloc(dir_length + strlen(data_file) + 1);
+      memcpy(path, testing_xml_path, dir_length);
+      strcpy(path + dir_length, data_file);
+    }
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    {
+      DBG(1, "%s: could not open data file %s: %s\n", __func__, path,
+          strerror(errno));
+      free(path);
+      return SANE_STATUS_INVAL;
+    }
+  free(path);
+
+  struct stat st;
+  if (fstat(fd, &st) < 0)
+    {
+      DBG(1, "%s: could not stat data file: %s\n", __func__, strerror(errno));
+      close(fd);
+      return SANE_STATUS_INVAL;
+    }
+
+  testing_data_file_size = st.st_size;
+  if (testing_data_file_size == 0)
+    {
+      close(fd);
+      return SANE_STATUS_GOOD;
+    }
+
+#ifdef HAVE_MMAP
+  void* map = mmap(NULL, testing_data_file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map != MAP_FAILED)
+    {
+      close(fd);
+      testing_data_file_contents = map;
+      testing_data_file_is_mapped = 1;
+      return SANE_STATUS_GOOD;
+    }
+  DBG(3, "%s: could not map data file, reading it instead\n", __func__);
+#endif
+
+  char* contents = malloc(testing_data_file_size);
+  size_t read_size = 0;
+  while (contents != NULL && read_size < testing_data_file_size)
+    {
+      ssize_t ret = read(fd, contents + read_size,
+                         testing_data_file_size - read_size);
+      if (ret <= 0)
+        {
+          DBG(1, "%s: could not read data file\n", __func__);
+          free(contents);
+          contents = NULL;
+          break;
+        }
+      read_size += ret;
+    }
+  close(fd);
+
+  if (contents == NULL)
+    {
+      testing_data_file_size = 0;
+      return SANE_STATUS_INVAL;
+    }
+  testing_data_file_contents = contents;
+  return SANE_STATUS_GOOD;
+}
+
 static SANE_Status sanei_usb_testing_init()
 {
   DBG_INIT();
@@ -1153,6 +1349,15 @@ static SANE_Status sanei_usb_testing_init()
       return SANE_STATUS_INVAL;
     }
 
+  char* data_file = sanei_xml_get_prop(el_root, "data_file");
+  if (data_file != NULL)
+    {
+      SANE_Status status = sanei_usb_testing_load_data_file(data_file);
+      xmlFree(data_file);
+      if (status != SANE_STATUS_GOOD)
+        return status;
+    }
+
   xmlNode* el_description =
       sanei_xml_find_first_child_with_name(el_root, "description");
   if (el_description == NULL)
@@ -1306,6 +1511,13 @@ static void sanei_usb_testing_exit()
   free(testing_xml_path);
   xmlCleanupParser();
 
+#ifdef HAVE_MMAP
+  if (testing_data_file_is_mapped)
+    munmap((void*) testing_data_file_contents, testing_data_file_size);
+  else
+#endif
+    free((void*) testing_data_file_contents);
+
   // reset testing-related all data to initial values
   testing_development_mode = 0;
   testing_already_opened = 0;
@@ -1317,6 +1529,9 @@ static void sanei_usb_testing_exit()
   testing_xml_path = NULL;
   testing_xml_doc = NULL;
   testing_xml_next_tx_node = NULL;
+  testing_data_file_contents = NULL;
+  testing_data_file_size = 0;
+  testing_data_file_is_mapped = 0;
 }
 #else // WITH_USB_RECORD_REPLAY
 SANE_Status sanei_usb_testing_enable_replay(SANE_String_Const path,
@@ -2999,6 +3214,8 @@ sanei_usb_close (SANE_Int dn)
 	   dn);
       return;
     }
+  sanei_usb_stop_bulk_stream (dn);
+
   if (testing_mode == sanei_usb_testing_mode_replay)
     {
       DBG (1, "sanei_usb_close: closing fake USB device\n");
@@ -3193,10 +3410,7 @@ static int sanei_usb_replay_next_read_bulk_packet_size(SANE_Int dn)
                               devices[dn].bulk_in_ep & 0x0f))
     return -1;
 
-  size_t got_size = 0;
-  char* got_data = sanei_xml_get_hex_data(node, &got_size);
-  free(got_data);
-  return got_size;
+  return sanei_xml_get_data_size(node);
 }
 
 static void sanei_usb_record_read_bulk(xmlNode* node, SANE_Int dn,
@@ -3302,6 +3516,8 @@ static int sanei_usb_replay_read_bulk(SANE_Int dn, SANE_Byte* buffer,
 
       size_t got_size = 0;
       char* got_data = sanei_xml_get_hex_data(node, &got_size);
+      if (got_data == NULL)
+        return -1;
 
       if (got_size > wanted_size)
         {
@@ -3503,6 +3719,448 @@ sanei_usb_read_bulk (SANE_Int dn, SANE_Byte * buffer, size_t * size)
   return SANE_STATUS_GOOD;
 }
 
+static void
+sanei_usb_free_bulk_stream (bulk_stream_type * stream)
+{
+  int i, in_flight = 0;
+
+  if (stream->transfers)
+    {
+      for (i = 0; i < stream->transfer_count; i++)
+	{
+	  bulk_stream_transfer_type *transfer = &stream->transfers[i];
+#ifdef HAVE_LIBUSB
+	  if (transfer->lu_transfer)
+	    {
+	      /* libusb still owns a transfer that never completed and its
+	         callback writes to the transfer state, so keep both */
+	      if (transfer->pending && !transfer->completed)
+		{
+		  in_flight++;
+		  continue;
+		}
+	      libusb_free_transfer (transfer->lu_transfer);
+	    }
+#endif /* HAVE_LIBUSB */
+	  free (transfer->buffer);
+	}
+      if (in_flight)
+	DBG (1, "sanei_usb_free_bulk_stream: leaking %d transfers still "
+	     "owned by libusb\n", in_flight);
+      else
+	free (stream->transfers);
+    }
+  memset (stream, 0, sizeof (*stream));
+}
+
+#ifdef HAVE_LIBUSB
+static void LIBUSB_CALL
+sanei_usb_bulk_stream_callback (struct libusb_transfer *lu_transfer)
+{
+  bulk_stream_transfer_type *transfer = lu_transfer->user_data;
+  transfer->completed = 1;
+}
+
+static SANE_Status
+sanei_usb_submit_bulk_stream_transfer (SANE_Int dn,
+				       bulk_stream_transfer_type * transfer)
+{
+  bulk_stream_type *stream = &bulk_streams[dn];
+  size_t size = stream->transfer_size;
+  int ret;
+
+  if (size > stream->remaining_size)
+    size = stream->remaining_size;
+
+  libusb_fill_bulk_transfer (transfer->lu_transfer, devices[dn].lu_handle,
+			     devices[dn].bulk_in_ep, transfer->buffer,
+			     (int) size, sanei_usb_bulk_stream_callback,
+			     transfer, libusb_timeout);
+  transfer->size = size;
+  transfer->length = 0;
+  transfer->offset = 0;
+  transfer->completed = 0;
+  transfer->received = 0;
+
+  ret = libusb_submit_transfer (transfer->lu_transfer);
+  if (ret < 0)
+    {
+      DBG (1, "sanei_usb_submit_bulk_stream_transfer: submit failed: %s\n",
+	   sanei_libusb_strerror (ret));
+      return SANE_STATUS_IO_ERROR;
+    }
+
+  transfer->pending = 1;
+  stream->remaining_size -= size;
+  return SANE_STATUS_GOOD;
+}
+
+/* Waits until libusb has finished the transfer. If handling events fails,
+   the transfer is left not completed and libusb may still write to it. */
+static void
+sanei_usb_wait_bulk_stream_transfer (bulk_stream_transfer_type * transfer)
+{
+  int ret;
+
+  while (!transfer->completed)
+    {
+      ret = libusb_handle_events_completed (sanei_usb_ctx,
+					    &transfer->completed);
+      if (ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED)
+	{
+	  DBG (1, "sanei_usb_wait_bulk_stream_transfer: handling events "
+	       "failed: %s\n", sanei_libusb_strerror (ret));
+	  break;
+	}
+    }
+}
+
+/* Cancels all submitted transfers and waits until libusb releases them.
+   Transfers that libusb didn't release stay pending. Returns the number of
+   bytes that were received but will never be returned to the caller. */
+static size_t
+sanei_usb_cancel_bulk_stream (SANE_Int dn)
+{
+  bulk_stream_type *stream = &bulk_streams[dn];
+  size_t discarded = 0;
+  int i;
+
+  for (i = 0; i < stream->transfer_count; i++)
+    {
+      bulk_stream_transfer_type *transfer = &stream->transfers[i];
+      if (transfer->pending && !transfer->completed)
+	libusb_cancel_transfer (transfer->lu_transfer);
+    }
+
+  for (i = 0; i < stream->transfer_count; i++)
+    {
+      bulk_stream_transfer_type *transfer = &stream->transfers[i];
+      if (!transfer->pending)
+	continue;
+      if (!transfer->completed)
+	sanei_usb_wait_bulk_stream_transfer (transfer);
+      if (!transfer->completed)
+	continue;
+      if (!transfer->received &&
+	  transfer->lu_transfer->status == LIBUSB_TRANSFER_COMPLETED)
+	discarded += transfer->lu_transfer->actual_length;
+      transfer->pending = 0;
+    }
+  stream->ended = SANE_TRUE;
+  return discarded;
+}
+
+/* Waits for the transfer at the head of the stream and checks its result.
+   Returns SANE_STATUS_GOOD if data has been received. */
+static SANE_Status
+sanei_usb_complete_bulk_stream_transfer (SANE_Int dn,
+					 bulk_stream_transfer_type * transfer)
+{
+  struct libusb_transfer *lu_transfer = transfer->lu_transfer;
+  size_t discarded;
+
+  sanei_usb_wait_bulk_stream_transfer (transfer);
+
+  if (!transfer->completed ||
+      lu_transfer->status != LIBUSB_TRANSFER_COMPLETED)
+    {
+      DBG (1, "sanei_usb_complete_bulk_stream_transfer: transfer failed "
+	   "(status %d, still got %d bytes)\n",
+	   transfer->completed ? (int) lu_transfer->status : -1,
+	   lu_transfer->actual_length);
+#if WITH_USB_RECORD_REPLAY
+      if (testing_mode == sanei_usb_testing_mode_record)
+	sanei_usb_record_read_bulk (NULL, dn, transfer->buffer,
+				    transfer->size, -1);
+#endif
+      sanei_usb_cancel_bulk_stream (dn);
+      if (testing_mode == sanei_usb_testing_mode_disabled)
+	libusb_clear_halt (devices[dn].lu_handle, devices[dn].bulk_in_ep);
+      return SANE_STATUS_IO_ERROR;
+    }
+
+  transfer->length = lu_transfer->actual_length;
+  transfer->received = 1;
+#if WITH_USB_RECORD_REPLAY
+  if (testing_mode == sanei_usb_testing_mode_record)
+    sanei_usb_record_read_bulk (NULL, dn, transfer->buffer, transfer->size,
+				transfer->length);
+#endif
+  if (debug_level > 10)
+    print_buffer (transfer->buffer, transfer->length);
+
+  if (transfer->length < transfer->size)
+    {
+      /* a short transfer ends the data stream of the device */
+      DBG (3, "sanei_usb_complete_bulk_stream_transfer: short transfer "
+	   "(%lu of %lu bytes), ending the stream\n",
+	   (unsigned long) transfer->length, (unsigned long) transfer->size);
+      discarded = sanei_usb_cancel_bulk_stream (dn);
+      if (discarded > 0)
+	DBG (1, "sanei_usb_complete_bulk_stream_transfer: discarding %lu "
+	     "bytes received after the short transfer\n",
+	     (unsigned long) discarded);
+      transfer->pending = 1;
+    }
+  return SANE_STATUS_GOOD;
+}
+#endif /* HAVE_LIBUSB */
+
+/* Fills the transfer with a synchronous read. This is used when asynchronous
+   transfers are not available and in replay mode. As in asynchronous mode,
+   a short read ends the stream, so a recorded stream is replayed with the
+   same number of reads. */
+static SANE_Status
+sanei_usb_read_bulk_stream_transfer_sync (SANE_Int dn,
+					  bulk_stream_transfer_type * transfer)
+{
+  bulk_stream_type *stream = &bulk_streams[dn];
+  SANE_Status status;
+  size_t size = stream->transfer_size;
+
+  if (size > stream->remaining_size)
+    size = stream->remaining_size;
+
+  transfer->size = size;
+  status = sanei_usb_read_bulk (dn, transfer->buffer, &size);
+  if (status != SANE_STATUS_GOOD)
+    {
+      stream->ended = SANE_TRUE;
+      return status;
+    }
+
+  if (size < transfer->size)
+    {
+      DBG (3, "sanei_usb_read_bulk_stream_transfer_sync: short read "
+	   "(%lu of %lu bytes), ending the stream\n",
+	   (unsigned long) size, (unsigned long) transfer->size);
+      stream->ended = SANE_TRUE;
+    }
+
+  stream->remaining_size -= size;
+  transfer->length = size;
+  transfer->offset = 0;
+  transfer->completed = 1;
+  transfer->received = 1;
+  transfer->pending = 1;
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+sanei_usb_start_bulk_stream (SANE_Int dn, SANE_Int transfer_count,
+			     size_t transfer_size, size_t total_size)
+{
+  bulk_stream_type *stream;
+  int i;
+
+  if (dn >= device_number || dn < 0)
+    {
+      DBG (1, "sanei_usb_start_bulk_stream: dn >= device number || dn < 0\n");
+      return SANE_STATUS_INVAL;
+    }
+  if (transfer_count <= 0 || transfer_size == 0)
+    {
+      DBG (1, "sanei_usb_start_bulk_stream: invalid transfer count or size\n");
+      return SANE_STATUS_INVAL;
+    }
+
+  stream = &bulk_streams[dn];
+  if (stream->active)
+    {
+      DBG (1, "sanei_usb_start_bulk_stream: a stream is already active\n");
+      return SANE_STATUS_INVAL;
+    }
+
+  DBG (5, "sanei_usb_start_bulk_stream: %d transfers of %lu bytes, "
+       "%lu bytes in total\n", transfer_count, (unsigned long) transfer_size,
+       (unsigned long) total_size);
+
+  stream->async = SANE_FALSE;
+#ifdef HAVE_LIBUSB
+  if (testing_mode != sanei_usb_testing_mode_replay &&
+      devices[dn].method == sanei_usb_method_libusb)
+    {
+      if (!devices[dn].bulk_in_ep)
+	{
+	  DBG (1, "sanei_usb_start_bulk_stream: can't read without a bulk-in "
+	       "endpoint\n");
+	  return SANE_STATUS_INVAL;
+	}
+      stream->async = SANE_TRUE;
+    }
+#endif /* HAVE_LIBUSB */
+
+  /* without asynchronous transfers each transfer is read when needed */
+  if (!stream->async)
+    transfer_count = 1;
+
+  stream->transfer_count = transfer_count;
+  stream->transfer_size = transfer_size;
+  stream->remaining_size = total_size;
+  stream->status = SANE_STATUS_GOOD;
+  stream->ended = SANE_FALSE;
+  stream->head = 0;
+  stream->transfers = calloc (transfer_count, sizeof (*stream->transfers));
+  if (!stream->transfers)
+    {
+      sanei_usb_free_bulk_stream (stream);
+      return SANE_STATUS_NO_MEM;
+    }
+
+  for (i = 0; i < transfer_count; i++)
+    {
+      bulk_stream_transfer_type *transfer = &stream->transfers[i];
+      transfer->buffer = malloc (transfer_size);
+      if (!transfer->buffer)
+	{
+	  sanei_usb_free_bulk_stream (stream);
+	  return SANE_STATUS_NO_MEM;
+	}
+#ifdef HAVE_LIBUSB
+      if (stream->async)
+	{
+	  transfer->lu_transfer = libusb_alloc_transfer (0);
+	  if (!transfer->lu_transfer)
+	    {
+	      sanei_usb_free_bulk_stream (stream);
+	      return SANE_STATUS_NO_MEM;
+	    }
+	}
+#endif /* HAVE_LIBUSB */
+    }
+
+  stream->active = SANE_TRUE;
+
+#ifdef HAVE_LIBUSB
+  if (stream->async)
+    {
+      for (i = 0; i < transfer_count && stream->remaining_size > 0; i++)
+	{
+	  SANE_Status status =
+	    sanei_usb_submit_bulk_stream_transfer (dn, &stream->transfers[i]);
+	  if (status != SANE_STATUS_GOOD)
+	    {
+	      sanei_usb_stop_bulk_stream (dn);
+	      return status;
+	    }
+	}
+    }
+#endif /* HAVE_LIBUSB */
+
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+sanei_usb_read_bulk_stream (SANE_Int dn, SANE_Byte * buffer, size_t * size)
+{
+  bulk_stream_type *stream;
+  size_t copied = 0;
+
+  if (!size)
+    {
+      DBG (1, "sanei_usb_read_bulk_stream: size == NULL\n");
+      return SANE_STATUS_INVAL;
+    }
+  if (dn >= device_number || dn < 0)
+    {
+      DBG (1, "sanei_usb_read_bulk_stream: dn >= device number || dn < 0\n");
+      return SANE_STATUS_INVAL;
+    }
+
+  stream = &bulk_streams[dn];
+  if (!stream->active)
+    {
+      DBG (1, "sanei_usb_read_bulk_stream: no stream has been started\n");
+      return SANE_STATUS_INVAL;
+    }
+
+  while (copied < *size && stream->status == SANE_STATUS_GOOD)
+    {
+      bulk_stream_transfer_type *transfer = &stream->transfers[stream->head];
+      size_t count;
+
+      if (!transfer->pending)
+	{
+	  /* in asynchronous mode all remaining transfers are always
+	     submitted, thus the stream has ended */
+	  if (stream->async || stream->ended || stream->remaining_size == 0)
+	    break;
+
+	  stream->status = sanei_usb_read_bulk_stream_transfer_sync (dn,
+								      transfer);
+	  if (stream->status == SANE_STATUS_EOF)
+	    stream->status = SANE_STATUS_GOOD;
+	  continue;
+	}
+
+#ifdef HAVE_LIBUSB
+      if (!transfer->received)
+	{
+	  stream->status = sanei_usb_complete_bulk_stream_transfer (dn,
+								     transfer);
+	  if (stream->status != SANE_STATUS_GOOD)
+	    break;
+	}
+#endif /* HAVE_LIBUSB */
+
+      count = transfer->length - transfer->offset;
+      if (count > *size - copied)
+	count = *size - copied;
+      memcpy (buffer + copied, transfer->buffer + transfer->offset, count);
+      copied += count;
+      transfer->offset += count;
+
+      if (transfer->offset == transfer->length)
+	{
+	  transfer->pending = 0;
+#ifdef HAVE_LIBUSB
+	  if (stream->async && !stream->ended && stream->remaining_size > 0)
+	    {
+	      stream->status = sanei_usb_submit_bulk_stream_transfer (dn,
+								       transfer);
+	      if (stream->status != SANE_STATUS_GOOD)
+		sanei_usb_cancel_bulk_stream (dn);
+	    }
+#endif /* HAVE_LIBUSB */
+	  stream->head = (stream->head + 1) % stream->transfer_count;
+	}
+    }
+
+  DBG (5, "sanei_usb_read_bulk_stream: wanted %lu bytes, got %lu bytes\n",
+       (unsigned long) *size, (unsigned long) copied);
+
+  *size = copied;
+  if (copied > 0)
+    return SANE_STATUS_GOOD;
+  if (stream->status != SANE_STATUS_GOOD)
+    return stream->status;
+  return SANE_STATUS_EOF;
+}
+
+void
+sanei_usb_stop_bulk_stream (SANE_Int dn)
+{
+  bulk_stream_type *stream;
+
+  if (dn >= device_number || dn < 0)
+    {
+      DBG (1, "sanei_usb_stop_bulk_stream: dn >= device number || dn < 0\n");
+      return;
+    }
+
+  stream = &bulk_streams[dn];
+  if (!stream->active)
+    return;
+
+  DBG (5, "sanei_usb_stop_bulk_stream: stopping stream of device %d\n", dn);
+
+#ifdef HAVE_LIBUSB
+  if (stream->async)
+    sanei_usb_cancel_bulk_stream (dn);
+#endif /* HAVE_LIBUSB */
+  sanei_usb_free_bulk_stream (stream);
+}
+
 #if WITH_USB_RECORD_REPLAY
 static int sanei_usb_record_write_bulk(xmlNode* node, SANE_Int dn,
                                        const SANE_Byte* buffer,
@@ -3554,10 +4212,7 @@ static int sanei_usb_replay_next_write_bulk_packet_size(SANE_Int dn)
                               devices[dn].bulk_out_ep & 0x0f))
     return -1;
 
-  size_t got_size = 0;
-  char* got_data = sanei_xml_get_hex_data(node, &got_size);
-  free(got_data);
-  return got_size;
+  return sanei_xml_get_data_size(node);
 }
 
 static int sanei_usb_replay_write_bulk(SANE_Int dn, const SANE_Byte* buffer,
@@ -3609,6 +4264,8 @@ static int sanei_usb_replay_write_bulk(SANE_Int dn, const SANE_Byte* buffer,
 
       size_t wrote_size = 0;
       char* wrote_data = sanei_xml_get_hex_data(node, &wrote_size);
+      if (wrote_data == NULL)
+        return -1;
 
       if (wrote_size > wanted_size)
         {
@@ -3955,6 +4612,8 @@ sanei_usb_replay_control_msg(SANE_Int dn, SANE_Int rtype, SANE_Int req,
 
   size_t tx_data_size = 0;
   char* tx_data = sanei_xml_get_hex_data(node, &tx_data_size);
+  if (tx_data == NULL)
+    return SANE_STATUS_IO_ERROR;
 
   if (direction_is_in)
     {
@@ -4246,6 +4905,8 @@ static int sanei_usb_replay_read_int(SANE_Int dn, SANE_Byte* buffer,
 
   size_t tx_data_size = 0;
   char* tx_data = sanei_xml_get_hex_data(node, &tx_data_size);
+  if (tx_data == NULL)
+    return -1;
 
   if (tx_data_size > wanted_size)
     {
@@ -155,6 +155,31 @@ sanei_w_void (Wire * w, void __sane_unused__ * v)
   DBG (3, "sanei_w_void: wire %d (void debug output)\n", w->io.fd);
 }
 
+/* Returns the codec function that transfers a whole array of elements at
+   once or NULL if the elements need to be transferred one by one. */
+static WireArrayCodecFunc
+get_array_codec (Wire * w, WireCodecFunc w_element, size_t element_size)
+{
+  if (element_size == sizeof (SANE_Word)
+      && (w_element == (WireCodecFunc) sanei_w_word
+	  || w_element == w->codec.w_word))
+    return w->codec.w_word_array;
+
+  if (element_size == sizeof (SANE_Byte)
+      && (w_element == (WireCodecFunc) sanei_w_byte
+	  || w_element == w->codec.w_byte))
+    return w->codec.w_byte_array;
+
+  /* characters are only plain bytes if the codec says so */
+  if (element_size == sizeof (SANE_Char)
+      && w->codec.w_char == w->codec.w_byte
+      && (w_element == (WireCodecFunc) sanei_w_char
+	  || w_element == w->codec.w_char))
+    return w->codec.w_byte_array;
+
+  return 0;
+}
+
 void
 sanei_w_array (Wire * w, SANE_Word * len_ptr, void **v,
 	       WireCodecFunc w_element, size_t element_size)
@@ -162,6 +187,7 @@ sanei_w_array (Wire * w, SANE_Word * len_ptr, void **v,
   SANE_Word len;
   char *val;
   int i;
+  WireArrayCodecFunc w_array;
 
   DBG (3, "sanei_w_array: wire %d, elements of size %lu\n", w->io.fd,
        (u_long) element_size);
@@ -233,6 +259,20 @@ sanei_w_array (Wire * w, SANE_Word * len_ptr, void **v,
     }
 
   val = *v;
+  w_array = get_array_codec (w, w_element, element_size);
+  if (w_array && len > 0)
+    {
+      DBG (4, "sanei_w_array: transferring array elements in bulk\n");
+      (*w_array) (w, val, len);
+      if (w->status)
+	{
+	  DBG (1, "sanei_w_array: bad status: %d\n", w->status);
+	  return;
+	}
+      DBG (4, "sanei_w_array: done\n");
+      return;
+    }
+
   DBG (4, "sanei_w_array: transferring array elements\n");
   for (i = 0; i < len; ++i)
     {
@@ -578,6 +618,62 @@ flush (Wire * w)
   DBG (4, "flush: wire flushed\n");
 }
 
+/* Keeps data that has been received but not decoded yet, e.g. further
+   requests that a client sent without waiting for the reply to the
+   current one. The data is put back into the buffer when the wire is
+   switched to decoding again. */
+static void
+save_unread (Wire * w)
+{
+  size_t size = w->buffer.end - w->buffer.curr;
+  char *data;
+
+  if (w->status != 0)
+    {
+      DBG (1, "sanei_w_set_dir: WARNING: will delete %lu bytes from buffer\n",
+	   (u_long) size);
+      return;
+    }
+
+  data = realloc (w->unread.data, w->unread.size + size);
+  if (data == 0)
+    {
+      DBG (1, "sanei_w_set_dir: not enough memory to keep %lu bytes\n",
+	   (u_long) size);
+      w->status = ENOMEM;
+      return;
+    }
+  memcpy (data + w->unread.size, w->buffer.curr, size);
+  w->unread.data = data;
+  w->unread.size += size;
+  DBG (4, "sanei_w_set_dir: keeping %lu undecoded bytes\n", (u_long) size);
+}
+
+static void
+restore_unread (Wire * w)
+{
+  if (w->unread.size == 0)
+    return;
+
+  if (w->status != 0 || w->unread.size > w->buffer.size)
+    {
+      DBG (1, "sanei_w_set_dir: WARNING: will delete %lu bytes from buffer\n",
+	   (u_long) w->unread.size);
+      free (w->unread.data);
+      w->unread.data = 0;
+      w->unread.size = 0;
+      return;
+    }
+
+  DBG (4, "sanei_w_set_dir: restoring %lu undecoded bytes\n",
+       (u_long) w->unread.size);
+  memcpy (w->buffer.start, w->unread.data, w->unread.size);
+  w->buffer.end = w->buffer.start + w->unread.size;
+  free (w->unread.data);
+  w->unread.data = 0;
+  w->unread.size = 0;
+}
+
 void
 sanei_w_set_dir (Wire * w, WireDirection dir)
 {
@@ -585,12 +681,13 @@ sanei_w_set_dir (Wire * w, WireDirection dir)
        w->direction == WIRE_ENCODE ? "ENCODE" :
        (w->direction == WIRE_DECODE ? "DECODE" : "FREE"));
   if (w->direction == WIRE_DECODE && w->buffer.curr != w->buffer.end)
-    DBG (1, "sanei_w_set_dir: WARNING: will delete %lu bytes from buffer\n",
-	 (u_long) (w->buffer.end - w->buffer.curr));
+    save_unread (w);
   flush (w);
   w->direction = dir;
   DBG (4, "sanei_w_set_dir: direction changed\n");
   flush (w);
+  if (dir == WIRE_DECODE)
+    restore_unread (w);
   DBG (3, "sanei_w_set_dir: wire %d, new direction WIRE_%s\n", w->io.fd,
        dir == WIRE_ENCODE ? "ENCODE" :
        (dir == WIRE_DECODE ? "DECODE" : "FREE"));
@@ -672,6 +769,10 @@ sanei_w_init (Wire * w, void (*codec_init_func) (Wire *))
 
   w->buffer.curr = w->buffer.start;
   w->buffer.end = w->buffer.start + w->buffer.size;
+  w->unread.size = 0;
+  w->unread.data = 0;
+  w->codec.w_byte_array = 0;
+  w->codec.w_word_array = 0;
   if (codec_init_func != 0)
     {
       DBG (4, "sanei_w_init: initializing codec\n");
@@ -692,5 +793,8 @@ sanei_w_exit (Wire * w)
     }
   w->buffer.start = 0;
   w->buffer.size = 0;
+  free (w->unread.data);
+  w->unread.data = 0;
+  w->unread.size = 0;
   DBG (4, "sanei_w_exit: done\n");
 }
@@ -29,6 +29,7 @@ void test_calibration_parsing();
 void test_image();
 void test_image_pipeline();
 void test_motor();
+void test_registers();
 void test_row_buffer();
 void test_utilities();
 
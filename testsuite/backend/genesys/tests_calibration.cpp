@@ -123,9 +123,97 @@ void test_calibration_roundtrip()
     ASSERT_TRUE(str.eof());
 }
 
+Genesys_Calibration_Cache create_fake_calibration_entry(unsigned xres)
+{
+    auto calib = create_fake_calibration_entry();
+    calib.params.xres = xres;
+    return calib;
+}
+
+std::vector<unsigned> get_calibration_store_xres(const CalibrationStore& store)
+{
+    std::vector<unsigned> result;
+    for (const auto& entry : store) {
+        result.push_back(entry.params.xres);
+    }
+    return result;
+}
+
+void test_calibration_store()
+{
+    CalibrationStore store;
+    store.set_max_size(3);
+    ASSERT_TRUE(store.empty());
+
+    store.insert(create_fake_calibration_entry(100));
+    store.insert(create_fake_calibration_entry(200));
+    store.insert(create_fake_calibration_entry(300));
+    ASSERT_EQ(get_calibration_store_xres(store), std::vector<unsigned>({300, 200, 100}));
+
+    auto key = CalibrationKey{create_fake_calibration_entry(200).params};
+    ASSERT_TRUE(store.find(key) != nullptr);
+    ASSERT_EQ(store.find(key)->params.xres, 200u);
+
+    // changing any of the key parameters results in a different entry
+    auto other_key = key;
+    other_key.startx++;
+    ASSERT_TRUE(store.find(other_key) == nullptr);
+
+    // entries with the same key are replaced
+    auto replacement = create_fake_calibration_entry(100);
+    replacement.average_size = 123;
+    store.insert(replacement);
+    ASSERT_EQ(get_calibration_store_xres(store), std::vector<unsigned>({100, 300, 200}));
+    ASSERT_EQ(store.size(), 3u);
+
+    // the least recently used entry is evicted
+    store.mark_used(key);
+    ASSERT_EQ(get_calibration_store_xres(store), std::vector<unsigned>({200, 100, 300}));
+    store.insert(create_fake_calibration_entry(400));
+    ASSERT_EQ(get_calibration_store_xres(store), std::vector<unsigned>({400, 200, 100}));
+    ASSERT_TRUE(store.find(CalibrationKey{create_fake_calibration_entry(300).params}) == nullptr);
+
+    store.set_max_size(2);
+    ASSERT_EQ(get_calibration_store_xres(store), std::vector<unsigned>({400, 200}));
+
+    // the order of use is preserved when serializing
+    CalibrationStore deserialized;
+    std::stringstream str;
+    serialize(static_cast<std::ostream&>(str), store);
+    serialize(static_cast<std::istream&>(str), deserialized);
+    ASSERT_TRUE(store == deserialized);
+    ASSERT_TRUE(deserialized.find(key) != nullptr);
+
+    store.clear();
+    ASSERT_TRUE(store.empty());
+    ASSERT_TRUE(store.find(key) == nullptr);
+    ASSERT_EQ(store.max_size(), 2u);
+}
+
+void test_calibration_resolutions()
+{
+    std::vector<unsigned> supported = { 1200, 600, 300, 150 };
+
+    // an empty or blank list selects all supported resolutions
+    ASSERT_EQ(parse_calibration_resolutions("", supported), supported);
+    ASSERT_EQ(parse_calibration_resolutions(" , ,\t", supported), supported);
+
+    // duplicates are dropped and the order is kept
+    ASSERT_EQ(parse_calibration_resolutions("300, 600,300 ,,150", supported),
+              std::vector<unsigned>({300, 600, 150}));
+
+    // unsupported and malformed entries are rejected
+    ASSERT_RAISES(parse_calibration_resolutions("300,400", supported), SaneException);
+    ASSERT_RAISES(parse_calibration_resolutions("0", supported), SaneException);
+    ASSERT_RAISES(parse_calibration_resolutions("300dpi", supported), SaneException);
+    ASSERT_RAISES(parse_calibration_resolutions("-300", supported), SaneException);
+}
+
 void test_calibration_parsing()
 {
     test_calibration_roundtrip();
+    test_calibration_store();
+    test_calibration_resolutions();
 }
 
 } // namespace genesys
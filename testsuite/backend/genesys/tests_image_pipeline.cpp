@@ -28,7 +28,13 @@
 
 #include "../../../backend/genesys/image_pipeline.h"
 
+#include <chrono>
+#include <cmath>
 #include <numeric>
+#include <random>
+#include <thread>
+
+#include <poll.h>
 
 namespace genesys {
 
@@ -169,6 +175,199 @@ void test_image_buffer_capped_remaining_bytes()
     ASSERT_EQ(requests, expected);
 }
 
+void test_read_ahead_buffer()
+{
+    using Data = std::vector<std::uint8_t>;
+
+    Data in_data(50);
+    std::iota(in_data.begin(), in_data.end(), 0);
+
+    std::size_t curr_index = 0;
+    std::vector<std::size_t> requests;
+
+    // the callback is called from the reader thread, so don't assert there
+    auto producer = [&](std::size_t size, std::uint8_t* out_data)
+    {
+        requests.push_back(size);
+        std::copy(in_data.begin() + curr_index, in_data.begin() + curr_index + size, out_data);
+        curr_index += size;
+        return true;
+    };
+
+    auto is_select_fd_readable = [](const ReadAheadBuffer& buffer)
+    {
+        pollfd fd = { buffer.get_select_fd(), POLLIN, 0 };
+        return poll(&fd, 1, 0) == 1;
+    };
+
+    // the buffer can hold all data, so the reader thread will finish on its own
+    ReadAheadBuffer buffer{16, in_data.size(), 4, producer};
+    ASSERT_FALSE(is_select_fd_readable(buffer));
+    ASSERT_EQ(buffer.available(), 0u);
+
+    buffer.start();
+    while (!buffer.finished()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_TRUE(is_select_fd_readable(buffer));
+    ASSERT_EQ(buffer.available(), 50u);
+
+    Data out_data(50, 0);
+    ASSERT_TRUE(buffer.get_data(20, out_data.data()));
+    ASSERT_EQ(buffer.available(), 30u);
+    ASSERT_TRUE(buffer.get_data(30, out_data.data() + 20));
+    ASSERT_EQ(buffer.available(), 0u);
+    ASSERT_EQ(out_data, in_data);
+
+    // the select fd stays readable after the end of data so that reads don't wait forever
+    ASSERT_TRUE(is_select_fd_readable(buffer));
+    ASSERT_FALSE(buffer.get_data(1, out_data.data()));
+
+    std::vector<std::size_t> expected = { 16, 16, 16, 2 };
+    ASSERT_EQ(requests, expected);
+}
+
+void test_image_buffer_pool()
+{
+    ImageBufferPool pool;
+    pool.set_max_buffer_count(2);
+
+    auto b100 = pool.acquire(100);
+    auto b200 = pool.acquire(200);
+    ASSERT_EQ(b100.size(), 100u);
+    ASSERT_EQ(b200.size(), 200u);
+    ASSERT_EQ(pool.buffer_count(), 0u);
+
+    const auto* b100_data = b100.data();
+    const auto* b200_data = b200.data();
+    pool.release(std::move(b200));
+    pool.release(std::move(b100));
+    ASSERT_EQ(pool.buffer_count(), 2u);
+
+    // the smallest buffer that is large enough is reused
+    auto b150 = pool.acquire(150);
+    ASSERT_EQ(b150.size(), 150u);
+    ASSERT_TRUE(b150.data() == b200_data);
+    auto b50 = pool.acquire(50);
+    ASSERT_TRUE(b50.data() == b100_data);
+    ASSERT_EQ(pool.buffer_count(), 0u);
+
+    // the smallest buffer is freed when the pool is full
+    pool.release(std::move(b50));
+    pool.release(std::move(b150));
+    pool.release(std::vector<std::uint8_t>(300));
+    ASSERT_EQ(pool.buffer_count(), 2u);
+    auto b160 = pool.acquire(160);
+    ASSERT_TRUE(b160.data() == b200_data);
+
+    // buffers more than twice as large as needed are not handed out
+    auto b10 = pool.acquire(10);
+    ASSERT_EQ(pool.buffer_count(), 1u);
+
+    pool.clear();
+    ASSERT_EQ(pool.buffer_count(), 0u);
+    ASSERT_EQ(pool.byte_count(), 0u);
+}
+
+void test_image_buffer_pool_limits()
+{
+    ImageBufferPool pool;
+    pool.set_max_bytes(1000);
+
+    // the largest buffers are freed when the pool holds too many bytes
+    pool.release(std::vector<std::uint8_t>(300));
+    pool.release(std::vector<std::uint8_t>(400));
+    pool.release(std::vector<std::uint8_t>(500));
+    ASSERT_EQ(pool.buffer_count(), 2u);
+    ASSERT_EQ(pool.byte_count(), 700u);
+    pool.release(std::vector<std::uint8_t>(2000));
+    ASSERT_EQ(pool.byte_count(), 700u);
+
+    // only the buffers released since the previous call are kept
+    pool.evict_unused();
+    ASSERT_EQ(pool.buffer_count(), 2u);
+    auto b350 = pool.acquire(350);
+    ASSERT_EQ(pool.byte_count(), 300u);
+    pool.release(std::move(b350));
+    pool.evict_unused();
+    ASSERT_EQ(pool.buffer_count(), 1u);
+    ASSERT_EQ(pool.byte_count(), 400u);
+}
+
+void test_node_buffer_pool_reuse()
+{
+    using Data = std::vector<std::uint8_t>;
+
+    Data in_data = {
+        0x10, 0x20, 0x30, 0x11, 0x21, 0x31, 0x12, 0x22, 0x32, 0x13, 0x23, 0x33,
+        0x14, 0x24, 0x34, 0x15, 0x25, 0x35, 0x16, 0x26, 0x36, 0x17, 0x27, 0x37,
+        0x18, 0x28, 0x38, 0x19, 0x29, 0x39, 0x1a, 0x2a, 0x3a, 0x1b, 0x2b, 0x3b,
+        0x1c, 0x2c, 0x3c, 0x1d, 0x2d, 0x3d, 0x1e, 0x2e, 0x3e, 0x1f, 0x2f, 0x3f,
+    };
+
+    Data expected_data = {
+        0x30, 0x20, 0x10, 0x39, 0x29, 0x19, 0x32, 0x22, 0x12, 0x3b, 0x2b, 0x1b,
+        0x34, 0x24, 0x14, 0x3d, 0x2d, 0x1d, 0x36, 0x26, 0x16, 0x3f, 0x2f, 0x1f,
+    };
+
+    ImageBufferPool pool;
+
+    for (unsigned i = 0; i < 2; ++i) {
+        ImagePipelineStack stack;
+        stack.set_buffer_pool(&pool);
+        stack.push_first_node<ImagePipelineNodeArraySource>(4, 4, PixelFormat::RGB888, in_data);
+        stack.push_node<ImagePipelineNodeFormatConvert>(PixelFormat::BGR888);
+        stack.push_node<ImagePipelineNodePixelShiftLines>(std::vector<std::size_t>{0, 2});
+
+        // the buffers are acquired on the first read
+        ASSERT_EQ(pool.buffer_count(), i == 0 ? 0u : 2u);
+
+        Data out_data(24, 0);
+        ASSERT_TRUE(stack.get_next_rows(1, out_data.data(), 12));
+        ASSERT_EQ(pool.buffer_count(), 0u);
+        ASSERT_TRUE(stack.get_next_rows(1, out_data.data() + 12, 12));
+        ASSERT_EQ(out_data, expected_data);
+
+        stack.clear();
+        ASSERT_EQ(pool.buffer_count(), 2u);
+    }
+}
+
+void test_stack_get_all_data_in_blocks()
+{
+    using Data = std::vector<std::uint8_t>;
+
+    std::size_t width = 4;
+    std::size_t height = ImagePipelineStack::BLOCK_ROWS * 3 + 5;
+    std::size_t row_bytes = width * 3;
+
+    Data in_data(row_bytes * height);
+    for (std::size_t i = 0; i < in_data.size(); ++i) {
+        in_data[i] = static_cast<std::uint8_t>(i % 251);
+    }
+
+    Data expected_data(in_data.size());
+    for (std::size_t i = 0; i < in_data.size(); i += 3) {
+        expected_data[i] = in_data[i + 2];
+        expected_data[i + 1] = in_data[i + 1];
+        expected_data[i + 2] = in_data[i];
+    }
+
+    ImageBufferPool pool;
+    ImagePipelineStack stack;
+    stack.set_buffer_pool(&pool);
+    stack.push_first_node<ImagePipelineNodeArraySource>(width, height, PixelFormat::RGB888,
+                                                        in_data);
+    stack.push_node<ImagePipelineNodeFormatConvert>(PixelFormat::BGR888);
+
+    ASSERT_EQ(stack.get_all_data(), expected_data);
+
+    // the intermediate buffer only ever held one block of rows
+    stack.clear();
+    ASSERT_EQ(pool.buffer_count(), 1u);
+    ASSERT_TRUE(pool.acquire(1).capacity() <= ImagePipelineStack::BLOCK_ROWS * row_bytes);
+}
+
 void test_node_buffered_callable_source()
 {
     using Data = std::vector<std::uint8_t>;
@@ -213,6 +412,144 @@ void test_node_buffered_callable_source()
     ASSERT_EQ(curr_index, 12u);
 }
 
+void test_node_buffered_callable_source_multiple_rows()
+{
+    using Data = std::vector<std::uint8_t>;
+
+    Data in_data = {
+        0, 1, 2, 3,
+        4, 5, 6, 7,
+        8, 9, 10, 11
+    };
+
+    std::size_t chunk_size = 3;
+    std::size_t curr_index = 0;
+
+    auto data_source_cb = [&](std::size_t size, std::uint8_t* out_data)
+    {
+        ASSERT_EQ(size, chunk_size);
+        std::copy(in_data.begin() + curr_index,
+                  in_data.begin() + curr_index + chunk_size, out_data);
+        curr_index += chunk_size;
+        return true;
+    };
+
+    ImagePipelineStack stack;
+    stack.push_first_node<ImagePipelineNodeBufferedCallableSource>(4, 3, PixelFormat::I8,
+                                                                   chunk_size, data_source_cb);
+
+    Data out_data;
+    out_data.resize(10, 0xff);
+
+    // the rows are written with a stride of 5 bytes
+    ASSERT_TRUE(stack.get_next_rows(2, out_data.data(), 5));
+    ASSERT_EQ(out_data, Data({0, 1, 2, 3, 0xff, 4, 5, 6, 7, 0xff}));
+    ASSERT_EQ(curr_index, 9u);
+
+    ASSERT_TRUE(stack.get_next_rows(1, out_data.data(), 5));
+    ASSERT_EQ(out_data, Data({8, 9, 10, 11, 0xff, 4, 5, 6, 7, 0xff}));
+    ASSERT_EQ(curr_index, 12u);
+    ASSERT_FALSE(stack.eof());
+
+    ASSERT_FALSE(stack.get_next_rows(1, out_data.data(), 5));
+    ASSERT_TRUE(stack.eof());
+}
+
+void test_node_buffered_callable_source_read_ahead()
+{
+    using Data = std::vector<std::uint8_t>;
+
+    std::size_t width = 4;
+    std::size_t height = 25;
+
+    Data in_data(width * height);
+    std::iota(in_data.begin(), in_data.end(), 0);
+
+    // not a multiple of the row size
+    std::size_t chunk_size = 10;
+    std::size_t curr_index = 0;
+    std::vector<std::size_t> read_sizes;
+
+    // the callback is called from the reader thread, so don't assert there
+    auto data_source_cb = [&](std::size_t size, std::uint8_t* out_data)
+    {
+        read_sizes.push_back(size);
+        std::copy(in_data.begin() + curr_index, in_data.begin() + curr_index + size, out_data);
+        curr_index += size;
+        return true;
+    };
+
+    ImagePipelineStack stack;
+    auto& source = stack.push_first_node<ImagePipelineNodeBufferedCallableSource>(
+                width, height, PixelFormat::I8, chunk_size, data_source_cb);
+    source.enable_read_ahead(3);
+
+    Data out_data(width * height, 0xff);
+    ASSERT_TRUE(stack.get_next_rows(1, out_data.data(), width));
+    ASSERT_TRUE(stack.get_next_rows(7, out_data.data() + width, width));
+    ASSERT_TRUE(stack.get_next_rows(17, out_data.data() + width * 8, width));
+    ASSERT_EQ(out_data, in_data);
+    ASSERT_FALSE(stack.eof());
+
+    ASSERT_FALSE(stack.get_next_rows(1, out_data.data(), width));
+    ASSERT_TRUE(stack.eof());
+
+    source.stop_read_ahead();
+    ASSERT_EQ(read_sizes, std::vector<std::size_t>(10, chunk_size));
+}
+
+void test_node_buffered_callable_source_read_ahead_stop()
+{
+    using Data = std::vector<std::uint8_t>;
+
+    auto data_source_cb = [&](std::size_t size, std::uint8_t* out_data)
+    {
+        std::fill(out_data, out_data + size, 0x12);
+        return true;
+    };
+
+    ImagePipelineStack stack;
+    auto& source = stack.push_first_node<ImagePipelineNodeBufferedCallableSource>(
+                4, 100, PixelFormat::I8, 8, data_source_cb);
+    source.enable_read_ahead(2);
+
+    Data out_data(4 * 3, 0);
+    ASSERT_TRUE(stack.get_next_rows(3, out_data.data(), 4));
+    ASSERT_EQ(out_data, Data(4 * 3, 0x12));
+
+    source.stop_read_ahead();
+    ASSERT_FALSE(stack.get_next_rows(1, out_data.data(), 4));
+    ASSERT_TRUE(stack.eof());
+}
+
+void test_node_buffered_callable_source_read_ahead_exception()
+{
+    using Data = std::vector<std::uint8_t>;
+
+    std::size_t curr_chunk = 0;
+
+    auto data_source_cb = [&](std::size_t size, std::uint8_t* out_data)
+    {
+        if (curr_chunk++ == 2) {
+            throw SaneException(SANE_STATUS_IO_ERROR);
+        }
+        std::fill(out_data, out_data + size, 0x12);
+        return true;
+    };
+
+    ImagePipelineStack stack;
+    auto& source = stack.push_first_node<ImagePipelineNodeBufferedCallableSource>(
+                4, 10, PixelFormat::I8, 4, data_source_cb);
+    source.enable_read_ahead(4);
+
+    // data read before the failure is still returned
+    Data out_data(4 * 2, 0);
+    ASSERT_TRUE(stack.get_next_rows(2, out_data.data(), 4));
+    ASSERT_EQ(out_data, Data(4 * 2, 0x12));
+
+    ASSERT_RAISES(stack.get_next_rows(1, out_data.data(), 4), SaneException);
+}
+
 void test_node_format_convert()
 {
     using Data = std::vector<std::uint8_t>;
@@ -636,6 +973,48 @@ void test_node_pixel_shift_lines_4lines()
     ASSERT_EQ(out_data, expected_data);
 }
 
+void test_node_pixel_shift_lines_multiple_rows()
+{
+    using Data = std::vector<std::uint8_t>;
+
+    Data in_data = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b,
+        0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b,
+        0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b,
+        0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b,
+        0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x4b,
+        0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x5b,
+        0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b,
+        0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x7b,
+        0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b,
+    };
+
+    ImagePipelineStack stack;
+    stack.push_first_node<ImagePipelineNodeArraySource>(12, 9, PixelFormat::I8,
+                                                        std::move(in_data));
+    stack.push_node<ImagePipelineNodePixelShiftLines>(std::vector<std::size_t>{0, 2, 1, 3});
+
+    ASSERT_EQ(stack.get_output_height(), 6u);
+
+    // read blocks of varying sizes, the result must be the same as if read row by row
+    Data out_data;
+    out_data.resize(6 * 12);
+    ASSERT_TRUE(stack.get_next_row_data(out_data.data()));
+    ASSERT_TRUE(stack.get_next_rows(3, out_data.data() + 12, 12));
+    ASSERT_TRUE(stack.get_next_rows(2, out_data.data() + 4 * 12, 12));
+
+    Data expected_data = {
+        0x00, 0x21, 0x12, 0x33, 0x04, 0x25, 0x16, 0x37, 0x08, 0x29, 0x1a, 0x3b,
+        0x10, 0x31, 0x22, 0x43, 0x14, 0x35, 0x26, 0x47, 0x18, 0x39, 0x2a, 0x4b,
+        0x20, 0x41, 0x32, 0x53, 0x24, 0x45, 0x36, 0x57, 0x28, 0x49, 0x3a, 0x5b,
+        0x30, 0x51, 0x42, 0x63, 0x34, 0x55, 0x46, 0x67, 0x38, 0x59, 0x4a, 0x6b,
+        0x40, 0x61, 0x52, 0x73, 0x44, 0x65, 0x56, 0x77, 0x48, 0x69, 0x5a, 0x7b,
+        0x50, 0x71, 0x62, 0x83, 0x54, 0x75, 0x66, 0x87, 0x58, 0x79, 0x6a, 0x8b,
+    };
+
+    ASSERT_EQ(out_data, expected_data);
+}
+
 void test_node_pixel_shift_columns_compute_max_width()
 {
     ASSERT_EQ(compute_pixel_shift_extra_width(12, {0, 1, 2, 3}), 0u);
@@ -851,6 +1230,95 @@ void test_node_pixel_shift_columns_group_switch_pixel_large_offsets_not_multiple
     ASSERT_EQ(out_data, expected_data);
 }
 
+void test_compute_resample_weights()
+{
+    // 2:1 area averaging
+    auto weights = compute_resample_weights(4, 2, ResampleFilter::BOX);
+    ASSERT_EQ(weights.size(), 2u);
+    ASSERT_EQ(weights.first, (std::vector<std::size_t>{ 0, 2 }));
+    ASSERT_EQ(weights.weights, (std::vector<std::uint32_t>{ 8192, 8192, 8192, 8192 }));
+
+    // 3:2 area averaging, the middle source pixel is split between the destination pixels
+    weights = compute_resample_weights(3, 2, ResampleFilter::BOX);
+    ASSERT_EQ(weights.first, (std::vector<std::size_t>{ 0, 1 }));
+    ASSERT_EQ(weights.weights, (std::vector<std::uint32_t>{ 10923, 5461, 5461, 10923 }));
+
+    // 1:2 bilinear interpolation, the source pixels are clamped at the edges
+    weights = compute_resample_weights(2, 4, ResampleFilter::BILINEAR);
+    ASSERT_EQ(weights.first, (std::vector<std::size_t>{ 0, 0, 0, 1 }));
+    ASSERT_EQ(weights.weights, (std::vector<std::uint32_t>{ 16384, 12288, 4096, 4096, 12288,
+                                                            16384 }));
+
+    // the weights of each destination position sum to one for arbitrary ratios
+    for (auto filter : { ResampleFilter::BOX, ResampleFilter::BILINEAR }) {
+        for (std::size_t src_size : { 1, 7, 100, 2551 }) {
+            for (std::size_t dst_size : { 1, 3, 99, 1275, 5100 }) {
+                weights = compute_resample_weights(src_size, dst_size, filter);
+                ASSERT_EQ(weights.size(), dst_size);
+                bool valid = true;
+                for (std::size_t i = 0; i < dst_size; ++i) {
+                    const auto* w = weights.get_weights(i);
+                    auto sum = std::accumulate(w, w + weights.tap_count(i), 0u);
+                    valid &= sum == ResampleWeights::WEIGHT_ONE;
+                    valid &= weights.first[i] + weights.tap_count(i) <= src_size;
+                }
+                ASSERT_TRUE(valid);
+            }
+        }
+    }
+}
+
+void test_node_resample_rows_box_rgb888()
+{
+    using Data = std::vector<std::uint8_t>;
+
+    Data in_data = {
+        0x10, 0x20, 0x30, 0x30, 0x40, 0x50, 0x50, 0x60, 0x70, 0x70, 0x80, 0x90,
+        0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff,
+    };
+
+    ImagePipelineStack stack;
+    stack.push_first_node<ImagePipelineNodeArraySource>(4, 2, PixelFormat::RGB888,
+                                                        std::move(in_data));
+    stack.push_node<ImagePipelineNodeResampleRows>(2, ResampleFilter::BOX);
+
+    ASSERT_EQ(stack.get_output_width(), 2u);
+    ASSERT_EQ(stack.get_output_height(), 2u);
+    ASSERT_EQ(stack.get_output_format(), PixelFormat::RGB888);
+
+    auto out_data = stack.get_all_data();
+
+    // point sampling would give either black or white for the second row
+    Data expected_data = {
+        0x20, 0x30, 0x40, 0x60, 0x70, 0x80,
+        0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    };
+
+    ASSERT_EQ(out_data, expected_data);
+}
+
+void test_node_resample_rows_bilinear_i16()
+{
+    using Data = std::vector<std::uint8_t>;
+
+    Data in_data = {
+        0x00, 0x10, 0x00, 0x50,
+    };
+
+    ImagePipelineStack stack;
+    stack.push_first_node<ImagePipelineNodeArraySource>(2, 1, PixelFormat::I16,
+                                                        std::move(in_data));
+    stack.push_node<ImagePipelineNodeResampleRows>(4, ResampleFilter::BILINEAR);
+
+    auto out_data = stack.get_all_data();
+
+    Data expected_data = {
+        0x00, 0x10, 0x00, 0x20, 0x00, 0x40, 0x00, 0x50,
+    };
+
+    ASSERT_EQ(out_data, expected_data);
+}
+
 void test_node_calibrate_8bit()
 {
     using Data = std::vector<std::uint8_t>;
@@ -923,6 +1391,156 @@ void test_node_calibrate_16bit()
     ASSERT_EQ(out_data, expected_data);
 }
 
+void test_node_calibrate_simd_bit_exact(unsigned depth)
+{
+    using Data = std::vector<std::uint8_t>;
+
+    // odd width so that the vectorized kernels need to process a tail of samples
+    std::size_t width = 101;
+    std::size_t height = 3;
+    std::size_t x_start = 5;
+    std::size_t samples = width * 3;
+    std::size_t bytes_per_sample = depth / 8;
+    std::int32_t max_value = depth == 16 ? 65535 : 255;
+    auto format = depth == 16 ? PixelFormat::RGB161616 : PixelFormat::RGB888;
+
+    std::minstd_rand random{42};
+    std::vector<std::uint16_t> bottom;
+    std::vector<std::uint16_t> top;
+
+    // calibration data covers only a part of the row
+    for (std::size_t i = 0; i < samples + x_start - 7; ++i) {
+        std::uint16_t b = random() % 0x8000;
+        bottom.push_back(b);
+        top.push_back(b + 1 + random() % (0x10000 - b - 1));
+    }
+
+    Data in_data;
+    for (std::size_t i = 0; i < samples * height; ++i) {
+        std::int32_t value = random() % (max_value + 1);
+        if (i % 16 == 0) {
+            value = 0;
+        } else if (i % 16 == 1) {
+            value = max_value;
+        }
+        for (std::size_t b = 0; b < bytes_per_sample; ++b) {
+            in_data.push_back((value >> (8 * b)) & 0xff);
+        }
+    }
+
+    // the original scalar implementation
+    Data expected_data = in_data;
+    for (std::size_t y = 0; y < height; ++y) {
+        for (std::size_t i = 0; i < samples && i + x_start < bottom.size(); ++i) {
+            std::uint8_t* sample = expected_data.data() + (y * samples + i) * bytes_per_sample;
+
+            std::int32_t value = sample[0];
+            if (depth == 16) {
+                value |= sample[1] << 8;
+            }
+            float offset = bottom[i + x_start] / 65535.0f;
+            float multiplier = 65535.0f / (top[i + x_start] - bottom[i + x_start]);
+
+            float value_f = static_cast<float>(value) / max_value;
+            value_f = (value_f - offset) * multiplier;
+            value_f = std::round(value_f * max_value);
+            value = clamp<std::int32_t>(static_cast<std::int32_t>(value_f), 0, max_value);
+
+            sample[0] = value & 0xff;
+            if (depth == 16) {
+                sample[1] = (value >> 8) & 0xff;
+            }
+        }
+    }
+
+    for (auto simd_level : { SimdLevel::NONE, SimdLevel::SSE2, SimdLevel::AVX2 }) {
+        ImagePipelineStack stack;
+        stack.push_first_node<ImagePipelineNodeArraySource>(width, height, format, Data(in_data));
+        stack.push_node<ImagePipelineNodeCalibrate>(bottom, top, x_start, simd_level);
+
+        ASSERT_EQ(stack.get_all_data(), expected_data);
+    }
+}
+
+void test_node_calibrate_simd_bit_exact()
+{
+    test_node_calibrate_simd_bit_exact(8);
+    test_node_calibrate_simd_bit_exact(16);
+}
+
+void test_node_sample_ops_matches_separate_nodes(PixelFormat format)
+{
+    using Data = std::vector<std::uint8_t>;
+
+    // the row is wider than a tile and is not a multiple of the tile width
+    std::size_t width = ImagePipelineNodeSampleOps::TILE_PIXELS * 2 + 37;
+    std::size_t height = 3;
+    std::size_t x_start = 4;
+    auto depth = get_pixel_format_depth(format);
+    auto channels = get_pixel_channels(format);
+    std::size_t samples = width * channels;
+
+    std::minstd_rand random{42};
+    std::vector<std::uint16_t> bottom;
+    std::vector<std::uint16_t> top;
+
+    // calibration data covers only a part of the row
+    for (std::size_t i = 0; i < samples + x_start - 11; ++i) {
+        std::uint16_t b = random() % 0x8000;
+        bottom.push_back(b);
+        top.push_back(b + 1 + random() % (0x10000 - b - 1));
+    }
+
+    Data in_data(get_pixel_row_bytes(format, width) * height);
+    for (auto& value : in_data) {
+        value = random() % 256;
+    }
+
+    auto dst_format = format;
+    if (format == PixelFormat::BGR888) {
+        dst_format = PixelFormat::RGB888;
+    } else if (format == PixelFormat::BGR161616) {
+        dst_format = PixelFormat::RGB161616;
+    }
+    bool calibrate = depth != 1;
+
+    ImagePipelineStack expected_stack;
+    expected_stack.push_first_node<ImagePipelineNodeArraySource>(width, height, format, in_data);
+    expected_stack.push_node<ImagePipelineNodeSwap16BitEndian>();
+    expected_stack.push_node<ImagePipelineNodeInvert>();
+    expected_stack.push_node<ImagePipelineNodeFormatConvert>(dst_format);
+    if (calibrate) {
+        expected_stack.push_node<ImagePipelineNodeCalibrate>(bottom, top, x_start);
+    }
+    auto expected_data = expected_stack.get_all_data();
+
+    ImagePipelineSampleOps ops;
+    ops.swap_16bit_endian = true;
+    ops.invert = true;
+    ops.dst_format = dst_format;
+    ops.calibrate = calibrate;
+    ops.calibration_bottom = bottom;
+    ops.calibration_top = top;
+    ops.calibration_x_start = x_start;
+
+    ImagePipelineStack stack;
+    stack.push_first_node<ImagePipelineNodeArraySource>(width, height, format, in_data);
+    stack.push_node<ImagePipelineNodeSampleOps>(ops);
+
+    ASSERT_EQ(stack.get_output_format(), dst_format);
+    ASSERT_EQ(stack.get_all_data(), expected_data);
+}
+
+void test_node_sample_ops_matches_separate_nodes()
+{
+    for (auto format : { PixelFormat::I1, PixelFormat::I8, PixelFormat::I16,
+                         PixelFormat::RGB888, PixelFormat::BGR888,
+                         PixelFormat::RGB161616, PixelFormat::BGR161616 })
+    {
+        test_node_sample_ops_matches_separate_nodes(format);
+    }
+}
+
 void test_image_pipeline()
 {
     test_image_buffer_exact_reads();
@@ -930,7 +1548,16 @@ void test_image_pipeline()
     test_image_buffer_larger_reads();
     test_image_buffer_uncapped_remaining_bytes();
     test_image_buffer_capped_remaining_bytes();
+    test_read_ahead_buffer();
+    test_image_buffer_pool();
+    test_image_buffer_pool_limits();
+    test_node_buffer_pool_reuse();
+    test_stack_get_all_data_in_blocks();
     test_node_buffered_callable_source();
+    test_node_buffered_callable_source_multiple_rows();
+    test_node_buffered_callable_source_read_ahead();
+    test_node_buffered_callable_source_read_ahead_stop();
+    test_node_buffered_callable_source_read_ahead_exception();
     test_node_format_convert();
     test_node_desegment_1_line();
     test_node_deinterleave_lines_i8();
@@ -949,9 +1576,15 @@ void test_image_pipeline()
     test_node_pixel_shift_columns_group_switch_pixel_large_offsets_not_multiple();
     test_node_pixel_shift_lines_2lines();
     test_node_pixel_shift_lines_4lines();
+    test_node_pixel_shift_lines_multiple_rows();
     test_node_pixel_shift_columns_compute_max_width();
+    test_compute_resample_weights();
+    test_node_resample_rows_box_rgb888();
+    test_node_resample_rows_bilinear_i16();
     test_node_calibrate_8bit();
     test_node_calibrate_16bit();
+    test_node_calibrate_simd_bit_exact();
+    test_node_sample_ops_matches_separate_nodes();
 }
 
 } // namespace genesys
@@ -0,0 +1,195 @@
+/* sane - Scanner Access Now Easy.
+
+   Copyright (C) 2019 Povilas Kanapickas <povilas@radix.lt>
+
+   This file is part of the SANE package.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+   MA 02111-1307, USA.
+*/
+
+#define DEBUG_DECLARE_ONLY
+
+#include "tests.h"
+#include "minigtest.h"
+#include "tests_printers.h"
+
+#include "../../../backend/genesys/low.h"
+#include "../../../backend/genesys/register.h"
+#include "../../../backend/genesys/scanner_interface_usb.h"
+
+#include <array>
+
+namespace genesys {
+
+// Simulates the register access protocol of the GL841 and records the addresses of the
+// registers that are written to the device.
+class RegisterUsbDevice : public IUsbDevice
+{
+public:
+    bool is_open() const override { return true; }
+
+    const std::string& name() const override { return name_; }
+
+    void open(const char* dev_name) override { (void) dev_name; }
+
+    void clear_halt() override {}
+    void reset() override {}
+    void close() override {}
+
+    std::uint16_t get_vendor_id() override { return 0; }
+    std::uint16_t get_product_id() override { return 0; }
+    std::uint16_t get_bcd_device() override { return 0; }
+
+    void control_msg(int rtype, int reg, int value, int index, int length,
+                     std::uint8_t* data) override
+    {
+        (void) index;
+        if (rtype == REQUEST_TYPE_OUT && reg == REQUEST_REGISTER && value == VALUE_SET_REGISTER) {
+            selected_ = data[0];
+        } else if (rtype == REQUEST_TYPE_IN && reg == REQUEST_REGISTER &&
+                   value == VALUE_READ_REGISTER)
+        {
+            data[0] = registers[selected_];
+        } else if (rtype == REQUEST_TYPE_OUT && reg == REQUEST_REGISTER &&
+                   value == VALUE_WRITE_REGISTER)
+        {
+            write(selected_, data[0]);
+        } else if (rtype == REQUEST_TYPE_OUT && reg == REQUEST_BUFFER &&
+                   value == VALUE_SET_REGISTER)
+        {
+            for (int i = 0; i + 1 < length; i += 2) {
+                write(data[i], data[i + 1]);
+            }
+        } else {
+            throw SaneException("Unexpected control message");
+        }
+    }
+
+    void bulk_read(std::uint8_t* buffer, std::size_t* size) override
+    {
+        (void) buffer;
+        (void) size;
+        throw SaneException("Unexpected bulk read");
+    }
+
+    void bulk_write(const std::uint8_t* buffer, std::size_t* size) override
+    {
+        (void) buffer;
+        (void) size;
+        throw SaneException("Unexpected bulk write");
+    }
+
+    std::array<std::uint8_t, 256> registers = {};
+    std::vector<unsigned> written;
+
+private:
+    void write(std::uint8_t address, std::uint8_t value)
+    {
+        registers[address] = value;
+        written.push_back(address);
+    }
+
+    std::string name_;
+    std::uint8_t selected_ = 0;
+};
+
+void test_register_shadow()
+{
+    RegisterShadow shadow;
+
+    ASSERT_TRUE(shadow.is_changed(0x10, 0x00));
+    ASSERT_TRUE(shadow.is_changed(0x10, 0xff));
+
+    shadow.set(0x10, 0x5a);
+    shadow.set(0x110, 0x12);
+    ASSERT_FALSE(shadow.is_changed(0x10, 0x5a));
+    ASSERT_TRUE(shadow.is_changed(0x10, 0x5b));
+    ASSERT_FALSE(shadow.is_changed(0x110, 0x12));
+
+    shadow.invalidate(0x10);
+    ASSERT_TRUE(shadow.is_changed(0x10, 0x5a));
+    ASSERT_FALSE(shadow.is_changed(0x110, 0x12));
+
+    // addresses outside the tracked range are always considered changed
+    shadow.set(RegisterShadow::MAX_ADDRESS, 0x01);
+    ASSERT_TRUE(shadow.is_changed(RegisterShadow::MAX_ADDRESS, 0x01));
+
+    shadow.clear();
+    ASSERT_TRUE(shadow.is_changed(0x110, 0x12));
+}
+
+void test_register_write_skips_unchanged()
+{
+    using Addresses = std::vector<unsigned>;
+
+    Genesys_Model model;
+    model.asic_type = AsicType::GL841;
+    Genesys_Device dev;
+    dev.model = &model;
+
+    auto* usb_dev = new RegisterUsbDevice;
+    ScannerInterfaceUsb iface{&dev, std::unique_ptr<IUsbDevice>{usb_dev}};
+
+    Genesys_Register_Set regs;
+    regs.init_reg(0x0f, 0x01);
+    regs.init_reg(0x10, 0x11);
+    regs.init_reg(0x11, 0x22);
+    regs.init_reg(0x12, 0x33);
+
+    // nothing is known about the device at first
+    iface.write_registers(regs);
+    ASSERT_EQ(usb_dev->written, Addresses({0x0f, 0x10, 0x11, 0x12}));
+    ASSERT_EQ(usb_dev->registers[0x11], 0x22);
+
+    // only the changed registers and the ones with side effects are written
+    usb_dev->written.clear();
+    iface.write_registers(regs);
+    ASSERT_EQ(usb_dev->written, Addresses({0x0f}));
+
+    usb_dev->written.clear();
+    regs.set8(0x11, 0x23);
+    iface.write_registers(regs);
+    ASSERT_EQ(usb_dev->written, Addresses({0x0f, 0x11}));
+    ASSERT_EQ(usb_dev->registers[0x11], 0x23);
+
+    // a value read back from the device replaces the shadowed one
+    usb_dev->registers[0x12] = 0x44;
+    ASSERT_EQ(iface.read_register(0x12), 0x44);
+    usb_dev->written.clear();
+    iface.write_registers(regs);
+    ASSERT_EQ(usb_dev->written, Addresses({0x0f, 0x12}));
+    ASSERT_EQ(usb_dev->registers[0x12], 0x33);
+
+    // so is a value written by a single register write
+    usb_dev->written.clear();
+    iface.write_register(0x10, 0x55);
+    iface.write_registers(regs);
+    ASSERT_EQ(usb_dev->written, Addresses({0x10, 0x0f, 0x10}));
+
+    // a soft reset makes all register values unknown
+    usb_dev->written.clear();
+    iface.write_register(0x0e, 0x00);
+    iface.write_registers(regs);
+    ASSERT_EQ(usb_dev->written, Addresses({0x0e, 0x0f, 0x10, 0x11, 0x12}));
+}
+
+void test_registers()
+{
+    test_register_shadow();
+    test_register_write_skips_unchanged();
+}
+
+} // namespace genesys
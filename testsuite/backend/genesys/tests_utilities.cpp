@@ -100,11 +100,91 @@ void test_utilities_compute_array_percentile_approx_multiple_lines()
     ASSERT_EQ(result, expected);
 }
 
+// The straightforward implementation that compute_array_percentile_approx must match
+template<class T>
+std::vector<T> compute_array_percentile_reference(const std::vector<T>& data,
+                                                  std::size_t line_count,
+                                                  std::size_t elements_per_line,
+                                                  float percentile)
+{
+    std::vector<T> result;
+    std::vector<T> column_elems(line_count);
+    std::size_t select_elem = std::min(static_cast<std::size_t>(line_count * percentile),
+                                       line_count - 1);
+    for (std::size_t ix = 0; ix < elements_per_line; ++ix) {
+        for (std::size_t iy = 0; iy < line_count; ++iy) {
+            column_elems[iy] = data[iy * elements_per_line + ix];
+        }
+        std::nth_element(column_elems.begin(), column_elems.begin() + select_elem,
+                         column_elems.end());
+        result.push_back(column_elems[select_elem]);
+    }
+    return result;
+}
+
+template<class T>
+std::vector<T> generate_percentile_test_data(std::size_t size, unsigned value_mask)
+{
+    std::vector<T> data(size);
+    std::uint32_t state = 12345;
+    for (auto& value : data) {
+        state = state * 1103515245 + 12345;
+        value = static_cast<T>((state >> 8) & value_mask);
+    }
+    return data;
+}
+
+void test_utilities_compute_array_percentile_approx_matches_reference()
+{
+    struct Size {
+        std::size_t line_count;
+        std::size_t elements_per_line;
+    };
+
+    // small columns use nth_element, large columns the histogram selection; the large sizes are
+    // split across threads
+    Size sizes[] = { {2, 7}, {10, 130}, {63, 200}, {64, 200}, {200, 1000}, {40, 15300} };
+    float percentiles[] = { 0.0f, 0.25f, 0.5f, 1.0f };
+
+    for (auto size : sizes) {
+        std::size_t count = size.line_count * size.elements_per_line;
+        auto data16 = generate_percentile_test_data<std::uint16_t>(count, 0xffff);
+        // many equal values exercise the duplicate handling of the histogram selection
+        auto data16_narrow = generate_percentile_test_data<std::uint16_t>(count, 0x0303);
+        auto data8 = generate_percentile_test_data<std::uint8_t>(count, 0xff);
+
+        for (auto percentile : percentiles) {
+            std::vector<std::uint16_t> result16(size.elements_per_line);
+            compute_array_percentile_approx(result16.data(), data16.data(), size.line_count,
+                                            size.elements_per_line, percentile);
+            ASSERT_EQ(result16, compute_array_percentile_reference(data16, size.line_count,
+                                                                   size.elements_per_line,
+                                                                   percentile));
+
+            compute_array_percentile_approx(result16.data(), data16_narrow.data(),
+                                            size.line_count, size.elements_per_line,
+                                            percentile);
+            ASSERT_EQ(result16, compute_array_percentile_reference(data16_narrow,
+                                                                   size.line_count,
+                                                                   size.elements_per_line,
+                                                                   percentile));
+
+            std::vector<std::uint8_t> result8(size.elements_per_line);
+            compute_array_percentile_approx(result8.data(), data8.data(), size.line_count,
+                                            size.elements_per_line, percentile);
+            ASSERT_EQ(result8, compute_array_percentile_reference(data8, size.line_count,
+                                                                  size.elements_per_line,
+                                                                  percentile));
+        }
+    }
+}
+
 void test_utilities()
 {
     test_utilities_compute_array_percentile_approx_empty();
     test_utilities_compute_array_percentile_approx_single_line();
     test_utilities_compute_array_percentile_approx_multiple_lines();
+    test_utilities_compute_array_percentile_approx_matches_reference();
 }
 
 } // namespace genesys
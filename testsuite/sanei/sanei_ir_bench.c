@@ -0,0 +1,123 @@
+/* Times the infrared dust removal chain of sanei_ir, as pieusb runs it,
+ * on a synthetic film frame.
+ *
+ * usage: sanei_ir_bench [width height]
+ */
+#include "../../include/sane/config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+/* sane includes for the sanei functions called */
+#include "../../include/sane/sane.h"
+#include "../../include/sane/sanei_ir.h"
+
+static double
+now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void
+report (const char *stage, double *start)
+{
+  double end = now ();
+
+  printf ("%-22s %8.1f ms\n", stage, end - *start);
+  *start = end;
+}
+
+int
+main (int argc, char **argv)
+{
+  SANE_Parameters params;
+  SANE_Uint *planes[4];
+  SANE_Uint *mask;
+  double *norm_histo;
+  int thresh, width = 6000, height = 4000;
+  size_t i, size;
+  double start, total;
+  int k;
+
+  if (argc == 3)
+    {
+      width = atoi (argv[1]);
+      height = atoi (argv[2]);
+    }
+  if (width < 64 || height < 64)
+    {
+      fprintf (stderr, "usage: %s [width height]\n", argv[0]);
+      return 1;
+    }
+
+  memset (&params, 0, sizeof (params));
+  params.format = SANE_FRAME_GRAY;
+  params.depth = 16;
+  params.pixels_per_line = width;
+  params.lines = height;
+  params.bytes_per_line = width * 2;
+  size = (size_t) width * height;
+
+  /* grainy colors, an infrared plane with some red in it and dust */
+  srand (1);
+  for (k = 0; k < 4; k++)
+    {
+      planes[k] = malloc (size * sizeof (SANE_Uint));
+      if (!planes[k])
+	{
+	  fprintf (stderr, "no memory for %d x %d\n", width, height);
+	  return 1;
+	}
+    }
+  for (i = 0; i < size; i++)
+    {
+      for (k = 0; k < 3; k++)
+	planes[k][i] = 20000 + rand () % 20000;
+      planes[3][i] = 50000 + rand () % 4000 - planes[0][i] / 16;
+      if (rand () % 2000 == 0)
+	planes[3][i] = rand () % 8000;
+    }
+
+  sanei_ir_init ();
+  printf ("%d x %d pixels, 16 bit\n", width, height);
+  total = start = now ();
+
+  if (sanei_ir_spectral_clean (&params, NULL, planes[0], planes[3])
+      != SANE_STATUS_GOOD)
+    return 1;
+  report ("spectral_clean", &start);
+
+  if (sanei_ir_create_norm_histogram (&params, planes[3], &norm_histo)
+      != SANE_STATUS_GOOD
+      || sanei_ir_threshold_otsu (&params, norm_histo, &thresh)
+      != SANE_STATUS_GOOD)
+    return 1;
+  free (norm_histo);
+  report ("threshold_otsu", &start);
+
+  if (sanei_ir_filter_madmean (&params, planes[3], &mask, 17, 20, 100)
+      != SANE_STATUS_GOOD)
+    return 1;
+  report ("filter_madmean", &start);
+
+  sanei_ir_add_threshold (&params, planes[3], mask, thresh);
+  report ("add_threshold", &start);
+
+  if (sanei_ir_dilate_mean (&params, planes, mask, 500, 2, 5, SANE_FALSE,
+			    0, NULL) != SANE_STATUS_GOOD)
+    return 1;
+  report ("dilate_mean", &start);
+
+  start = total;
+  report ("total", &start);
+
+  free (mask);
+  for (k = 0; k < 4; k++)
+    free (planes[k]);
+  return 0;
+}
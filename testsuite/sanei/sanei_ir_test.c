@@ -0,0 +1,202 @@
+#include "../../include/sane/config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* sane includes for the sanei functions called */
+#include "../../include/sane/sane.h"
+#include "../../include/sane/sanei_ir.h"
+
+#define WIDTH 301
+#define HEIGHT 187
+#define SIZE (WIDTH * HEIGHT)
+
+static SANE_Uint image[SIZE];
+static SANE_Uint filtered[SIZE];
+static SANE_Uint mask[SIZE];
+static unsigned int dist[SIZE];
+static unsigned int idx[SIZE];
+
+static void
+set_params (SANE_Parameters * params, int depth)
+{
+  memset (params, 0, sizeof (*params));
+  params->format = SANE_FRAME_GRAY;
+  params->depth = depth;
+  params->pixels_per_line = WIDTH;
+  params->lines = HEIGHT;
+  params->bytes_per_line = WIDTH * 2;
+}
+
+/* light film grain with a few dark specks of dust */
+static void
+fill_image (int depth)
+{
+  int i;
+
+  srand (1);
+  for (i = 0; i < SIZE; i++)
+    {
+      image[i] = (3 << (depth - 2)) + rand () % (1 << (depth - 4));
+      if (rand () % 400 == 0)
+	image[i] = rand () % (1 << (depth - 3));
+    }
+}
+
+/* straightforward mean over the part of the window inside the image */
+static int
+reference_mean (int row, int col, int win_rows, int win_cols)
+{
+  int sum = 0, n = 0;
+  int i, j;
+
+  for (i = row - win_rows / 2; i <= row + win_rows / 2; i++)
+    for (j = col - win_cols / 2; j <= col + win_cols / 2; j++)
+      if (i >= 0 && i < HEIGHT && j >= 0 && j < WIDTH)
+	{
+	  sum += image[i * WIDTH + j];
+	  n++;
+	}
+  return sum / n;
+}
+
+static void
+filter_mean (int depth)
+{
+  static const int windows[][2] = { {1, 1}, {3, 3}, {9, 5}, {1, 21}, {33, 33} };
+  SANE_Parameters params;
+  SANE_Status status;
+  unsigned int i;
+  int j;
+
+  set_params (&params, depth);
+  fill_image (depth);
+
+  for (i = 0; i < sizeof (windows) / sizeof (windows[0]); i++)
+    {
+      status = sanei_ir_filter_mean (&params, image, filtered,
+				     windows[i][0], windows[i][1]);
+
+      /* check results */
+      assert (status == SANE_STATUS_GOOD);
+      for (j = 0; j < SIZE; j++)
+	assert (filtered[j] == reference_mean (j / WIDTH, j % WIDTH,
+					       windows[i][0], windows[i][1]));
+    }
+
+  status = sanei_ir_filter_mean (&params, image, filtered, 4, 3);
+  assert (status == SANE_STATUS_INVAL);
+}
+
+static void
+filter_madmean (void)
+{
+  SANE_Parameters params;
+  SANE_Status status;
+  SANE_Uint *noise;
+  int i;
+
+  set_params (&params, 16);
+  fill_image (16);
+
+  status = sanei_ir_filter_madmean (&params, image, &noise, 7, 20, 100);
+
+  /* check results, the dust is dirty, hardly any grain is */
+  assert (status == SANE_STATUS_GOOD);
+  for (i = 0; i < SIZE; i++)
+    {
+      assert (noise[i] == 0 || noise[i] == 255);
+      if (image[i] < 1 << 13)
+	assert (noise[i] == 0);
+    }
+  free (noise);
+}
+
+/* distance of each pixel to the closest one that is not (or is) dirty,
+ * and the index of such a pixel */
+static void
+manhattan_dist (void)
+{
+  SANE_Parameters params;
+  int erode, i, j, k;
+
+  set_params (&params, 16);
+  srand (2);
+  for (i = 0; i < SIZE; i++)
+    mask[i] = rand () % 50 ? 255 : 0;
+
+  for (erode = 0; erode < 2; erode++)
+    {
+      sanei_ir_manhattan_dist (&params, mask, dist, idx, erode);
+
+      /* a sample of the pixels is enough */
+      for (i = 0; i < SIZE; i += 13)
+	{
+	  unsigned int best = WIDTH + HEIGHT;
+
+	  /* check results against a search of the whole image */
+	  for (k = 0; k < SIZE; k++)
+	    if (mask[k] == (erode ? 255 : 0))
+	      {
+		unsigned int d = abs (k % WIDTH - i % WIDTH)
+		  + abs (k / WIDTH - i / WIDTH);
+		if (d < best)
+		  best = d;
+	      }
+	  assert (dist[i] == best);
+
+	  j = idx[i];
+	  assert (mask[j] == (erode ? 255 : 0));
+	  assert ((unsigned int) (abs (j % WIDTH - i % WIDTH)
+				  + abs (j / WIDTH - i / WIDTH)) == best);
+	}
+    }
+}
+
+static void
+dilate (void)
+{
+  SANE_Parameters params;
+  int by, i;
+
+  set_params (&params, 16);
+
+  for (by = -2; by <= 2; by += 4)
+    {
+      srand (3);
+      for (i = 0; i < SIZE; i++)
+	mask[i] = rand () % 200 ? 255 : 0;
+      memcpy (filtered, mask, sizeof (mask));
+
+      sanei_ir_dilate (&params, mask, dist, idx, by);
+
+      /* check results, dirt grows by 2, or clean areas do */
+      sanei_ir_manhattan_dist (&params, filtered, dist, idx, by < 0);
+      for (i = 0; i < SIZE; i++)
+	assert (mask[i] == (dist[i] <= 2 ? 0 : 255));
+    }
+}
+
+/**
+ * run the test suite for sanei_ir related tests
+ */
+static void
+sanei_ir_suite (void)
+{
+  sanei_ir_init ();
+
+  filter_mean (8);
+  filter_mean (16);
+  filter_madmean ();
+  manhattan_dist ();
+  dilate ();
+}
+
+
+int
+main (void)
+{
+  sanei_ir_suite ();
+  return 0;
+}
@@ -0,0 +1,201 @@
+#include "../../include/sane/config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* sane includes for the sanei functions called */
+#include "../../include/sane/sane.h"
+#include "../../include/sane/sanei_lz.h"
+
+#define ROW_SIZE 300
+#define ROWS 200
+#define DATA_SIZE (ROW_SIZE * ROWS)
+
+static SANE_Byte data[DATA_SIZE];
+static SANE_Byte filtered[DATA_SIZE];
+static SANE_Byte compressed[DATA_SIZE + DATA_SIZE / 255 + 16];
+static SANE_Byte decompressed[DATA_SIZE];
+
+/* compresses and decompresses data, returns the compressed size */
+static size_t
+roundtrip (const SANE_Byte * src, size_t size)
+{
+  size_t compressed_size, decompressed_size = 0;
+  SANE_Status status;
+
+  assert (sanei_lz_compress_bound (size) <= sizeof (compressed));
+  compressed_size = sanei_lz_compress (src, size, compressed,
+				       sanei_lz_compress_bound (size));
+  assert (compressed_size > 0);
+
+  status = sanei_lz_decompress (compressed, compressed_size, decompressed,
+				sizeof (decompressed), &decompressed_size);
+
+  /* check results */
+  assert (status == SANE_STATUS_GOOD);
+  assert (decompressed_size == size);
+  assert (memcmp (src, decompressed, size) == 0);
+  return compressed_size;
+}
+
+static void
+small_sizes (void)
+{
+  size_t size;
+
+  for (size = 0; size < 40; size++)
+    {
+      memset (data, 'a', size);
+      roundtrip (data, size);
+    }
+}
+
+static void
+random_data (void)
+{
+  size_t i;
+
+  srand (1);
+  for (i = 0; i < DATA_SIZE; i++)
+    data[i] = rand () & 0xff;
+
+  /* random data doesn't compress, but must not grow beyond the bound */
+  roundtrip (data, DATA_SIZE);
+}
+
+static void
+constant_data (void)
+{
+  size_t compressed_size;
+
+  memset (data, 0xff, DATA_SIZE);
+  compressed_size = roundtrip (data, DATA_SIZE);
+
+  /* check results */
+  assert (compressed_size < DATA_SIZE / 100);
+}
+
+static void
+repeated_pattern (void)
+{
+  size_t i;
+
+  /* matches that overlap the data they produce */
+  for (i = 0; i < DATA_SIZE; i++)
+    data[i] = "abc"[i % 3];
+  roundtrip (data, DATA_SIZE);
+
+  /* a long period */
+  for (i = 0; i < DATA_SIZE; i++)
+    data[i] = (i % 1000) * 7 & 0xff;
+  roundtrip (data, DATA_SIZE);
+}
+
+static void
+gradient_with_filter (void)
+{
+  size_t i, plain_size, filtered_size;
+
+  /* a gradient that changes slightly from row to row */
+  for (i = 0; i < DATA_SIZE; i++)
+    data[i] = (SANE_Byte) ((i % ROW_SIZE) * 3 + (i / ROW_SIZE) / 3);
+
+  plain_size = roundtrip (data, DATA_SIZE);
+
+  sanei_lz_filter_up (data, filtered, DATA_SIZE, ROW_SIZE);
+  filtered_size = roundtrip (filtered, DATA_SIZE);
+
+  /* check results */
+  assert (filtered_size < plain_size);
+
+  sanei_lz_unfilter_up (decompressed, DATA_SIZE, ROW_SIZE);
+  assert (memcmp (decompressed, data, DATA_SIZE) == 0);
+}
+
+static void
+filter_partial_rows (void)
+{
+  size_t i;
+
+  for (i = 0; i < DATA_SIZE; i++)
+    data[i] = (SANE_Byte) (i * 13);
+
+  /* the data doesn't need to start or end at a row boundary */
+  sanei_lz_filter_up (data + 17, filtered, 1000, ROW_SIZE);
+  sanei_lz_unfilter_up (filtered, 1000, ROW_SIZE);
+  assert (memcmp (filtered, data + 17, 1000) == 0);
+
+  /* a row size of 0 disables the filter */
+  sanei_lz_filter_up (data, filtered, 1000, 0);
+  assert (memcmp (filtered, data, 1000) == 0);
+}
+
+static void
+buffer_too_small (void)
+{
+  size_t i;
+
+  srand (2);
+  for (i = 0; i < DATA_SIZE; i++)
+    data[i] = rand () & 0xff;
+
+  /* check results */
+  assert (sanei_lz_compress (data, DATA_SIZE, compressed, DATA_SIZE / 2)
+	  == 0);
+}
+
+static void
+corrupt_data (void)
+{
+  size_t compressed_size, decompressed_size;
+  SANE_Status status;
+
+  memset (data, 0x55, 1000);
+  compressed_size = sanei_lz_compress (data, 1000, compressed,
+				       sizeof (compressed));
+  assert (compressed_size > 3);
+
+  /* output buffer too small */
+  status = sanei_lz_decompress (compressed, compressed_size, decompressed,
+				999, &decompressed_size);
+  assert (status == SANE_STATUS_INVAL);
+
+  /* input truncated within the offset of a match */
+  status = sanei_lz_decompress (compressed, 3, decompressed,
+				sizeof (decompressed), &decompressed_size);
+  assert (status == SANE_STATUS_INVAL);
+
+  /* match before the start of the data */
+  compressed[0] = 0x10;
+  compressed[1] = 'x';
+  compressed[2] = 2;
+  compressed[3] = 0;
+  status = sanei_lz_decompress (compressed, 4, decompressed,
+				sizeof (decompressed), &decompressed_size);
+  assert (status == SANE_STATUS_INVAL);
+}
+
+/**
+ * run the test suite for sanei_lz related tests
+ */
+static void
+sanei_lz_suite (void)
+{
+  small_sizes ();
+  random_data ();
+  constant_data ();
+  repeated_pattern ();
+  gradient_with_filter ();
+  filter_partial_rows ();
+  buffer_too_small ();
+  corrupt_data ();
+}
+
+
+int
+main (void)
+{
+  sanei_lz_suite ();
+  return 0;
+}
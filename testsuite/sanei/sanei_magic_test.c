@@ -0,0 +1,404 @@
+#include "../../include/sane/config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+/* sane includes for the sanei functions called */
+#include "../../include/sane/sane.h"
+#include "../../include/sane/sanei_magic.h"
+
+#define WIDTH 203
+#define HEIGHT 151
+#define MAX_SIZE (WIDTH * 3 * HEIGHT + HEIGHT)
+
+/* a letter size page at 100 dpi */
+#define PAGE_DPI 100
+#define PAGE_WIDTH 850
+#define PAGE_HEIGHT 1100
+
+static SANE_Byte image[MAX_SIZE];
+static SANE_Byte expected[MAX_SIZE];
+static SANE_Byte page[PAGE_WIDTH * PAGE_HEIGHT];
+
+static void
+set_params (SANE_Parameters * params, SANE_Frame format, int depth)
+{
+  memset (params, 0, sizeof (*params));
+  params->format = format;
+  params->depth = depth;
+  params->pixels_per_line = WIDTH;
+  params->lines = HEIGHT;
+
+  /* leave some padding at the end of each line */
+  if (depth == 1)
+    params->bytes_per_line = (WIDTH + 7) / 8 + 1;
+  else if (format == SANE_FRAME_RGB)
+    params->bytes_per_line = WIDTH * 3 + 1;
+  else
+    params->bytes_per_line = WIDTH + 1;
+}
+
+static void
+fill_image (SANE_Parameters * params, unsigned int seed)
+{
+  int i;
+
+  srand (seed);
+  for (i = 0; i < params->bytes_per_line * params->lines; i++)
+    image[i] = rand () & 0xff;
+}
+
+/* straightforward rotation with the mapping sanei_magic_rotate uses,
+ * from src into dst */
+static void
+reference_rotate (SANE_Parameters * params, const SANE_Byte * src,
+		  SANE_Byte * dst, int centerX, int centerY, double slope,
+		  int bg_color)
+{
+  double slopeRad = -atan (slope);
+  double slopeSin = sin (slopeRad);
+  double slopeCos = cos (slopeRad);
+  int bwidth = params->bytes_per_line;
+  int depth = params->format == SANE_FRAME_RGB ? 3 : 1;
+  int i, j, k;
+
+  if (params->depth == 1 && bg_color)
+    bg_color = 0xff;
+  memset (dst, bg_color, (size_t) bwidth * params->lines);
+
+  for (i = 0; i < params->lines; i++)
+    {
+      int shiftY = centerY - i;
+
+      for (j = 0; j < params->pixels_per_line; j++)
+	{
+	  int shiftX = centerX - j;
+	  int sourceX, sourceY;
+
+	  sourceX = centerX - (int) (shiftX * slopeCos + shiftY * slopeSin);
+	  if (sourceX < 0 || sourceX >= params->pixels_per_line)
+	    continue;
+
+	  sourceY = centerY + (int) (-shiftY * slopeCos + shiftX * slopeSin);
+	  if (sourceY < 0 || sourceY >= params->lines)
+	    continue;
+
+	  if (params->depth == 1)
+	    {
+	      int bit = (src[sourceY * bwidth + sourceX / 8]
+			 >> (7 - sourceX % 8)) & 1;
+
+	      dst[i * bwidth + j / 8] &= ~(1 << (7 - j % 8));
+	      dst[i * bwidth + j / 8] |= bit << (7 - j % 8);
+	    }
+	  else
+	    for (k = 0; k < depth; k++)
+	      dst[i * bwidth + j * depth + k]
+		= src[sourceY * bwidth + sourceX * depth + k];
+	}
+    }
+}
+
+static void
+check_rotate (SANE_Frame format, int depth)
+{
+  static const double slopes[] = { 0, 0.004, -0.02, 0.1, -0.35, 1, -4 };
+  SANE_Parameters params;
+  SANE_Status status;
+  unsigned int i;
+
+  set_params (&params, format, depth);
+
+  for (i = 0; i < sizeof (slopes) / sizeof (slopes[0]); i++)
+    {
+      int centerX = WIDTH / 2 + (int) i * 7 - 20;
+      int centerY = HEIGHT / 2 - (int) i * 5;
+      int bg_color = i % 2 ? 0xff : 0;
+
+      fill_image (&params, i);
+      reference_rotate (&params, image, expected, centerX, centerY,
+			slopes[i], bg_color);
+
+      status = sanei_magic_rotate (&params, image, centerX, centerY,
+				   slopes[i], bg_color);
+
+      /* check results */
+      assert (status == SANE_STATUS_GOOD);
+      assert (memcmp (image, expected,
+		      params.bytes_per_line * params.lines) == 0);
+    }
+}
+
+/* on a full page the rows are long enough for any drift of the source
+ * coordinates stepped along them to show, these slopes and centers
+ * all caught such drift */
+static void
+rotate_page (SANE_Frame format, int depth)
+{
+  static const struct
+  {
+    double slope;
+    int centerX, centerY;
+  } rotations[] = {
+    { 0.0799, 1014, 1990 },
+    { -0.00468, 1316, 3482 },
+    { 0.03092, 320, 2736 },
+    { -0.09428, 2782, 1742 },
+    { 0.0589, -163, 2188 }
+  };
+  SANE_Parameters params;
+  SANE_Status status;
+  SANE_Byte *buffer, *reference;
+  size_t size;
+  unsigned int i;
+
+  /* a letter size page at 300 dpi */
+  memset (&params, 0, sizeof (params));
+  params.format = format;
+  params.depth = depth;
+  params.pixels_per_line = 2550;
+  params.lines = 3300;
+  if (depth == 1)
+    params.bytes_per_line = (2550 + 7) / 8;
+  else if (format == SANE_FRAME_RGB)
+    params.bytes_per_line = 2550 * 3;
+  else
+    params.bytes_per_line = 2550;
+
+  size = (size_t) params.bytes_per_line * params.lines;
+  buffer = malloc (size);
+  reference = malloc (size);
+  assert (buffer != NULL && reference != NULL);
+
+  for (i = 0; i < sizeof (rotations) / sizeof (rotations[0]); i++)
+    {
+      size_t k;
+
+      srand (i);
+      for (k = 0; k < size; k++)
+	buffer[k] = rand () & 0xff;
+      reference_rotate (&params, buffer, reference, rotations[i].centerX,
+			rotations[i].centerY, rotations[i].slope, 0xff);
+
+      status = sanei_magic_rotate (&params, buffer, rotations[i].centerX,
+				   rotations[i].centerY, rotations[i].slope,
+				   0xff);
+
+      /* check results */
+      assert (status == SANE_STATUS_GOOD);
+      assert (memcmp (buffer, reference, size) == 0);
+    }
+
+  free (buffer);
+  free (reference);
+}
+
+static void
+rotate_unsupported (void)
+{
+  SANE_Parameters params;
+  SANE_Status status;
+
+  set_params (&params, SANE_FRAME_GRAY, 16);
+  status = sanei_magic_rotate (&params, image, 10, 10, 0.1, 0);
+
+  /* check results */
+  assert (status == SANE_STATUS_INVAL);
+}
+
+/* state of page_noise () */
+static unsigned int noise_state;
+
+/* returns a pseudo random number below 20, the same on all platforms */
+static int
+page_noise (void)
+{
+  noise_state = noise_state * 1103515245 + 12345;
+  return (noise_state >> 16) % 20;
+}
+
+/* draws a light sheet of paper, turned by angle around its top left
+ * corner, on a dark background */
+static void
+draw_page (SANE_Parameters * params, double angle, int left, int top)
+{
+  double c = cos (angle);
+  double s = sin (angle);
+  int x, y;
+
+  memset (params, 0, sizeof (*params));
+  params->format = SANE_FRAME_GRAY;
+  params->depth = 8;
+  params->pixels_per_line = PAGE_WIDTH;
+  params->bytes_per_line = PAGE_WIDTH;
+  params->lines = PAGE_HEIGHT;
+
+  noise_state = 3;
+  for (y = 0; y < PAGE_HEIGHT; y++)
+    for (x = 0; x < PAGE_WIDTH; x++)
+      {
+	double u = (x - left) * c + (y - top) * s;
+	double v = -(x - left) * s + (y - top) * c;
+	int on_page = u >= 0 && u < PAGE_WIDTH * 0.8
+	  && v >= 0 && v < PAGE_HEIGHT * 0.85;
+
+	page[y * PAGE_WIDTH + x] = on_page ? 220 + page_noise ()
+	  : 20 + page_noise ();
+      }
+}
+
+static void
+find_skew (void)
+{
+  static const double angles[] = { -0.06, -0.02, 0.01, 0.04 };
+  SANE_Parameters params;
+  SANE_Status status;
+  int centerX, centerY;
+  double slope;
+  unsigned int i;
+
+  for (i = 0; i < sizeof (angles) / sizeof (angles[0]); i++)
+    {
+      draw_page (&params, angles[i], 80, 60);
+      status = sanei_magic_findSkew (&params, page, PAGE_DPI, PAGE_DPI,
+				     &centerX, &centerY, &slope);
+
+      /* check results, the top edge falls to the right by tan(angle) */
+      assert (status == SANE_STATUS_GOOD);
+      assert (fabs (slope - tan (angles[i])) < 0.004);
+    }
+
+  /* a straight page has no skew to correct */
+  draw_page (&params, 0, 80, 60);
+  status = sanei_magic_findSkew (&params, page, PAGE_DPI, PAGE_DPI,
+				 &centerX, &centerY, &slope);
+  assert (status == SANE_STATUS_UNSUPPORTED);
+
+  /* pages on which a search of only some of the columns in the first
+   * passes ends up with another edge: every pass must use all of them */
+  draw_page (&params, 0.0062, 80, 60);
+  status = sanei_magic_findSkew (&params, page, PAGE_DPI, PAGE_DPI,
+				 &centerX, &centerY, &slope);
+  assert (status == SANE_STATUS_UNSUPPORTED);
+
+  draw_page (&params, -0.01, 80, 30);
+  status = sanei_magic_findSkew (&params, page, PAGE_DPI, PAGE_DPI,
+				 &centerX, &centerY, &slope);
+  assert (status == SANE_STATUS_GOOD);
+  assert (fabs (slope - -0.008266) < 0.00005);
+}
+
+static void
+find_edges (void)
+{
+  SANE_Parameters params;
+  SANE_Status status;
+  int top, bot, left, right;
+
+  draw_page (&params, 0, 80, 60);
+  status = sanei_magic_findEdges (&params, page, PAGE_DPI, PAGE_DPI,
+				  &top, &bot, &left, &right);
+
+  /* check results, the transitions are found within a few pixels */
+  assert (status == SANE_STATUS_GOOD);
+  assert (abs (top - 60) <= 10);
+  assert (abs (bot - (60 + (int) (PAGE_HEIGHT * 0.85))) <= 10);
+  assert (abs (left - 80) <= 10);
+  assert (abs (right - (80 + (int) (PAGE_WIDTH * 0.8))) <= 10);
+}
+
+/* marks a square of dark pixels on a white image */
+static void
+draw_spot (SANE_Parameters * params, SANE_Byte * buffer, int left, int top,
+	   int size)
+{
+  int bwidth = params->bytes_per_line;
+  int depth = params->format == SANE_FRAME_RGB ? 3 : 1;
+  int x, y;
+
+  for (y = top; y < top + size; y++)
+    for (x = left; x < left + size; x++)
+      {
+	if (params->depth == 1)
+	  buffer[y * bwidth + x / 8] |= 1 << (7 - x % 8);
+	else
+	  memset (buffer + y * bwidth + x * depth, 0x10, depth);
+      }
+}
+
+static void
+despeck_spots (SANE_Frame format, int depth)
+{
+  SANE_Parameters params;
+  SANE_Status status;
+  int size;
+
+  set_params (&params, format, depth);
+  size = params.bytes_per_line * params.lines;
+
+  /* the small spot goes, the one larger than the window stays */
+  memset (expected, depth == 1 ? 0 : 0xff, size);
+  draw_spot (&params, expected, 60, 60, 5);
+  memcpy (image, expected, size);
+  draw_spot (&params, image, 20, 30, 2);
+  draw_spot (&params, image, 150, 100, 1);
+
+  status = sanei_magic_despeck (&params, image, 3);
+
+  /* check results */
+  assert (status == SANE_STATUS_GOOD);
+  assert (memcmp (image, expected, size) == 0);
+}
+
+static void
+blank_page (void)
+{
+  SANE_Parameters params;
+  SANE_Status status;
+  int y;
+
+  /* light gray paper, with 6% density */
+  draw_page (&params, 0, 0, 0);
+  memset (page, 0xf0, sizeof (page));
+  status = sanei_magic_isBlank2 (&params, page, PAGE_DPI, PAGE_DPI, 10);
+  assert (status == SANE_STATUS_NO_DOCS);
+
+  /* a dark mark in one of the lower right blocks */
+  for (y = 1000; y < 1010; y++)
+    memset (page + y * PAGE_WIDTH + 700, 0, 40);
+  status = sanei_magic_isBlank2 (&params, page, PAGE_DPI, PAGE_DPI, 10);
+  assert (status == SANE_STATUS_GOOD);
+}
+
+/**
+ * run the test suite for sanei_magic related tests
+ */
+static void
+sanei_magic_suite (void)
+{
+  sanei_magic_init ();
+
+  check_rotate (SANE_FRAME_GRAY, 8);
+  check_rotate (SANE_FRAME_RGB, 8);
+  check_rotate (SANE_FRAME_GRAY, 1);
+  rotate_page (SANE_FRAME_GRAY, 8);
+  rotate_page (SANE_FRAME_RGB, 8);
+  rotate_page (SANE_FRAME_GRAY, 1);
+  rotate_unsupported ();
+  find_skew ();
+  find_edges ();
+  despeck_spots (SANE_FRAME_GRAY, 8);
+  despeck_spots (SANE_FRAME_RGB, 8);
+  despeck_spots (SANE_FRAME_GRAY, 1);
+  blank_page ();
+}
+
+
+int
+main (void)
+{
+  sanei_magic_suite ();
+  return 0;
+}
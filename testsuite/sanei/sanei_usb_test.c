@@ -826,6 +826,331 @@ test_attach (void)
   return 1;
 }
 
+#if WITH_USB_RECORD_REPLAY
+/**
+ * capture file used by the replay tests
+ */
+#define REPLAY_CAPTURE "sanei_usb_test_replay.xml"
+
+/** byte of the replayed data at the given offset of the stream
+ */
+static SANE_Byte
+replay_byte (size_t offset)
+{
+  return (SANE_Byte) ((offset * 7 + 3) & 0xff);
+}
+
+/** write a capture with a sequence of bulk-in reads
+ * @param sizes sizes of the recorded reads, terminated by 0
+ * @return 1 on success, else 0
+ */
+static int
+write_replay_capture (const size_t * sizes)
+{
+  FILE *f;
+  size_t offset = 0, i;
+  int seq;
+
+  f = fopen (REPLAY_CAPTURE, "w");
+  if (f == NULL)
+    {
+      printf ("ERROR: couldn't create %s\n", REPLAY_CAPTURE);
+      return 0;
+    }
+  fprintf (f, "<?xml version=\"1.0\"?>\n"
+	   "<device_capture backend=\"test\">\n"
+	   "  <description id_vendor=\"0x1234\" id_product=\"0x5678\">\n"
+	   "    <configurations>\n"
+	   "      <configuration number=\"1\">\n"
+	   "        <interface number=\"0\">\n"
+	   "          <endpoint transfer_type=\"BULK\" number=\"1\" "
+	   "direction=\"IN\" address=\"0x81\"/>\n"
+	   "        </interface>\n"
+	   "      </configuration>\n"
+	   "    </configurations>\n"
+	   "  </description>\n"
+	   "  <transactions>\n");
+  for (seq = 0; sizes[seq] != 0; seq++)
+    {
+      fprintf (f, "    <bulk_tx time_usec=\"0\" seq=\"%d\" "
+	       "endpoint_number=\"1\" direction=\"IN\">", seq + 1);
+      for (i = 0; i < sizes[seq]; i++, offset++)
+	fprintf (f, i ? " %02x" : "%02x", replay_byte (offset));
+      fprintf (f, "</bulk_tx>\n");
+    }
+  fprintf (f, "  </transactions>\n</device_capture>\n");
+  fclose (f);
+  return 1;
+}
+
+/** start replaying a capture
+ * @param path capture to replay
+ * @param dn opened device number
+ * @return 1 on success, else 0
+ */
+static int
+open_replay (const char *path, SANE_Int * dn)
+{
+  if (sanei_usb_testing_enable_replay (path, 0) != SANE_STATUS_GOOD)
+    {
+      printf ("ERROR: couldn't load %s\n", path);
+      return 0;
+    }
+  sanei_usb_init ();
+  if (sanei_usb_open (path, dn) != SANE_STATUS_GOOD)
+    {
+      printf ("ERROR: couldn't open the replayed device\n");
+      return 0;
+    }
+  return 1;
+}
+
+/** stop replaying and restore the normal mode of sanei_usb
+ * @param dn opened device number
+ */
+static void
+close_replay (SANE_Int dn)
+{
+  sanei_usb_close (dn);
+  sanei_usb_exit ();
+  testing_mode = sanei_usb_testing_mode_disabled;
+}
+
+/** read from the stream until it ends
+ * @param dn opened device number
+ * @param offset stream offset of the first byte that is expected
+ * @param chunk number of bytes to ask for at once
+ * @param total set to the number of bytes read
+ * @return status of the last read, SANE_STATUS_INVAL if the data is wrong
+ */
+static SANE_Status
+read_replay_stream (SANE_Int dn, size_t offset, size_t chunk, size_t * total)
+{
+  SANE_Byte buffer[256];
+  SANE_Status status;
+  size_t size, i;
+
+  *total = 0;
+  do
+    {
+      size = chunk;
+      status = sanei_usb_read_bulk_stream (dn, buffer, &size);
+      for (i = 0; i < size; i++)
+	if (buffer[i] != replay_byte (offset + *total + i))
+	  {
+	    printf ("ERROR: wrong data at stream offset %lu\n",
+		    (unsigned long) (*total + i));
+	    return SANE_STATUS_INVAL;
+	  }
+      *total += size;
+    }
+  while (status == SANE_STATUS_GOOD);
+  return status;
+}
+
+/** test replaying a stream that spans several transfers
+ * @return 1 on success, else 0
+ */
+static int
+test_replay_stream_read (void)
+{
+  static const size_t sizes[] = { 64, 64, 32, 0 };
+  SANE_Status status;
+  SANE_Int dn;
+  size_t total = 0;
+
+  if (!write_replay_capture (sizes) || !open_replay (REPLAY_CAPTURE, &dn))
+    return 0;
+
+  status = sanei_usb_start_bulk_stream (dn, 4, 64, 160);
+  if (status == SANE_STATUS_GOOD)
+    status = read_replay_stream (dn, 0, 50, &total);
+  sanei_usb_stop_bulk_stream (dn);
+  close_replay (dn);
+  unlink (REPLAY_CAPTURE);
+
+  if (status != SANE_STATUS_EOF || total != 160)
+    {
+      printf ("ERROR: expected 160 bytes and EOF, "
+	      "got %lu bytes and status %d\n", (unsigned long) total, status);
+      return 0;
+    }
+  return 1;
+}
+
+/** test that a short read ends a replayed stream without asking for
+ * another read, like it does for asynchronous transfers while recording
+ * @return 1 on success, else 0
+ */
+static int
+test_replay_stream_short (void)
+{
+  static const size_t sizes[] = { 64, 20, 0 };
+  SANE_Status status;
+  SANE_Int dn;
+  size_t total = 0;
+  int failed;
+
+  if (!write_replay_capture (sizes) || !open_replay (REPLAY_CAPTURE, &dn))
+    return 0;
+
+  status = sanei_usb_start_bulk_stream (dn, 4, 64, 1000);
+  if (status == SANE_STATUS_GOOD)
+    status = read_replay_stream (dn, 0, 256, &total);
+  failed = testing_known_commands_input_failed;
+  sanei_usb_stop_bulk_stream (dn);
+  close_replay (dn);
+  unlink (REPLAY_CAPTURE);
+
+  if (status != SANE_STATUS_EOF || total != 84 || failed)
+    {
+      printf ("ERROR: expected 84 bytes and EOF after the short read, "
+	      "got %lu bytes and status %d\n", (unsigned long) total,
+	      status);
+      return 0;
+    }
+  return 1;
+}
+
+/** test stopping a replayed stream before all data has been read
+ * @return 1 on success, else 0
+ */
+static int
+test_replay_stream_stop (void)
+{
+  static const size_t sizes[] = { 64, 64, 0 };
+  SANE_Byte buffer[10];
+  SANE_Status status;
+  SANE_Int dn;
+  size_t size, total = 0;
+  int active;
+
+  if (!write_replay_capture (sizes) || !open_replay (REPLAY_CAPTURE, &dn))
+    return 0;
+
+  size = sizeof (buffer);
+  status = sanei_usb_start_bulk_stream (dn, 4, 64, 128);
+  if (status == SANE_STATUS_GOOD)
+    status = sanei_usb_read_bulk_stream (dn, buffer, &size);
+  sanei_usb_stop_bulk_stream (dn);
+  active = bulk_streams[dn].active;
+
+  /* the rest of the first transfer is dropped, a new stream continues
+     with the next recorded read */
+  if (status == SANE_STATUS_GOOD)
+    status = sanei_usb_start_bulk_stream (dn, 4, 64, 64);
+  if (status == SANE_STATUS_GOOD)
+    status = read_replay_stream (dn, 64, 64, &total);
+  sanei_usb_stop_bulk_stream (dn);
+  close_replay (dn);
+  unlink (REPLAY_CAPTURE);
+
+  if (active || status != SANE_STATUS_EOF || total != 64)
+    {
+      printf ("ERROR: expected a stopped stream and 64 bytes from the "
+	      "next one, got %lu bytes and status %d\n", (unsigned long) total,
+	      status);
+      return 0;
+    }
+  return 1;
+}
+
+#ifdef SANE_USB_CAPTURE_PACK
+/**
+ * capture written by sane-usb-capture-pack and its data file
+ */
+#define PACKED_CAPTURE "sanei_usb_test_packed.xml"
+#define PACKED_DATA "sanei_usb_test_packed.bin"
+
+/** replay the reads of a packed capture one by one
+ * @param dn opened device number
+ * @param sizes sizes of the recorded reads, terminated by 0
+ * @return status of the first failed read, else SANE_STATUS_GOOD
+ */
+static SANE_Status
+read_packed_capture (SANE_Int dn, const size_t * sizes)
+{
+  SANE_Byte buffer[256];
+  SANE_Status status;
+  size_t offset = 0, size, i;
+  int seq;
+
+  for (seq = 0; sizes[seq] != 0; seq++)
+    {
+      size = sizes[seq];
+      status = sanei_usb_read_bulk (dn, buffer, &size);
+      if (status != SANE_STATUS_GOOD)
+	return status;
+      if (size != sizes[seq])
+	{
+	  printf ("ERROR: read %d returned %lu bytes instead of %lu\n", seq,
+		  (unsigned long) size, (unsigned long) sizes[seq]);
+	  return SANE_STATUS_INVAL;
+	}
+      for (i = 0; i < size; i++, offset++)
+	if (buffer[i] != replay_byte (offset))
+	  {
+	    printf ("ERROR: wrong data at offset %lu\n",
+		    (unsigned long) offset);
+	    return SANE_STATUS_INVAL;
+	  }
+    }
+  return SANE_STATUS_GOOD;
+}
+
+/** test replaying a capture packed by sane-usb-capture-pack, with the large
+ * payloads in the data file and the small ones kept inline
+ * @return 1 on success, else 0
+ */
+static int
+test_replay_packed_capture (void)
+{
+  static const size_t sizes[] = { 200, 8, 100, 0 };
+  SANE_Status status;
+  SANE_Int dn;
+  int rc;
+
+  if (!write_replay_capture (sizes))
+    return 0;
+  rc = system (SANE_USB_CAPTURE_PACK " -m 16 " REPLAY_CAPTURE " "
+	       PACKED_CAPTURE);
+  unlink (REPLAY_CAPTURE);
+  if (rc != 0)
+    {
+      printf ("ERROR: couldn't pack the capture with %s\n",
+	      SANE_USB_CAPTURE_PACK);
+      return 0;
+    }
+
+  if (!open_replay (PACKED_CAPTURE, &dn))
+    return 0;
+  status = read_packed_capture (dn, sizes);
+  close_replay (dn);
+  if (status != SANE_STATUS_GOOD)
+    {
+      printf ("ERROR: replaying the packed capture failed (status %d)\n",
+	      status);
+      return 0;
+    }
+
+  /* a read of data beyond the end of the data file must fail */
+  if (truncate (PACKED_DATA, 250) != 0 || !open_replay (PACKED_CAPTURE, &dn))
+    return 0;
+  status = read_packed_capture (dn, sizes);
+  close_replay (dn);
+  unlink (PACKED_CAPTURE);
+  unlink (PACKED_DATA);
+  if (status != SANE_STATUS_IO_ERROR)
+    {
+      printf ("ERROR: expected a failed read from a truncated data file, "
+	      "got status %d\n", status);
+      return 0;
+    }
+  return 1;
+}
+#endif /* SANE_USB_CAPTURE_PACK */
+#endif /* WITH_USB_RECORD_REPLAY */
+
 int
 main (int __sane_unused__ argc, char **argv)
 {
@@ -942,6 +1267,16 @@ main (int __sane_unused__ argc, char **argv)
   /* finally free resources */
   assert (test_exit (0));
 
+#if WITH_USB_RECORD_REPLAY
+  /* replay bulk read streams from captures */
+  assert (test_replay_stream_read ());
+  assert (test_replay_stream_short ());
+  assert (test_replay_stream_stop ());
+#ifdef SANE_USB_CAPTURE_PACK
+  assert (test_replay_packed_capture ());
+#endif
+#endif
+
   /* all the tests are OK ! */
   return 0;
 }
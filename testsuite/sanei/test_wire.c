@@ -1,4 +1,5 @@
 #include "../include/sane/config.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,6 +24,11 @@ static SANE_String_Const mode_list[] = {
   "Lineart", "Grayscale", "Color", 0
 };
 
+/* more than fits into the wire buffer at once */
+#define NUM_TEST_WORDS 5000
+
+static SANE_Word test_words[NUM_TEST_WORDS];
+
 static char *program_name;
 static char *default_codec = "bin";
 static char *default_outfile = "test_wire.out";
@@ -57,10 +63,13 @@ int
 main (int __sane_unused__ arg, char **argv)
 {
   SANE_Option_Descriptor desc[2], *desc_ptr;
-  SANE_Word len;
+  SANE_Word len, words_len, *words_ptr;
+  SANE_String str;
+  char long_str[NUM_TEST_WORDS];
   char *codec = default_codec;
   char *outfile = default_outfile;
   int readonly = 0;
+  int i;
 
   program_name = argv[0];
   argv++;
@@ -157,6 +166,12 @@ main (int __sane_unused__ arg, char **argv)
   desc[1].constraint_type = SANE_CONSTRAINT_STRING_LIST;
   desc[1].constraint.string_list = mode_list;
 
+  for (i = 0; i < NUM_TEST_WORDS; ++i)
+    test_words[i] = (i % 2 ? -1 : 1) * (i * 7919);
+  for (i = 0; i < NUM_TEST_WORDS - 1; ++i)
+    long_str[i] = 'a' + i % 26;
+  long_str[NUM_TEST_WORDS - 1] = '\0';
+
   {
     int flags;
     if (readonly)
@@ -192,6 +207,13 @@ main (int __sane_unused__ arg, char **argv)
 		     (WireCodecFunc) sanei_w_option_descriptor,
 		     sizeof (desc[0]));
 
+      words_len = NUM_TEST_WORDS;
+      words_ptr = test_words;
+      sanei_w_array (&w, &words_len, (void **) &words_ptr,
+		     (WireCodecFunc) sanei_w_word, sizeof (SANE_Word));
+      str = long_str;
+      sanei_w_string (&w, &str);
+
       if (w.status == 0)
 	printf ("%s encode successful\n", codec);
       else
@@ -212,6 +234,24 @@ main (int __sane_unused__ arg, char **argv)
 
   sanei_w_array (&w, &len, (void **) &desc_ptr,
 		 (WireCodecFunc) sanei_w_option_descriptor, sizeof (desc[0]));
+  sanei_w_array (&w, &words_len, (void **) &words_ptr,
+		 (WireCodecFunc) sanei_w_word, sizeof (SANE_Word));
+  sanei_w_string (&w, &str);
+
+  if (w.status == 0
+      && (words_len != NUM_TEST_WORDS
+	  || memcmp (words_ptr, test_words, sizeof (test_words)) != 0))
+    {
+      fprintf (stderr, "%s: %s decode error: word array mismatch\n",
+	       program_name, codec);
+      w.status = EINVAL;
+    }
+  if (w.status == 0 && strcmp (str, long_str) != 0)
+    {
+      fprintf (stderr, "%s: %s decode error: string mismatch\n",
+	       program_name, codec);
+      w.status = EINVAL;
+    }
 
   if (w.status == 0)
     printf ("%s decode successful\n", codec);
@@ -223,6 +263,9 @@ main (int __sane_unused__ arg, char **argv)
   w.status = 0;
   sanei_w_array (&w, &len, (void **) &desc_ptr,
 		 (WireCodecFunc) sanei_w_option_descriptor, sizeof (desc[0]));
+  sanei_w_array (&w, &words_len, (void **) &words_ptr,
+		 (WireCodecFunc) sanei_w_word, sizeof (SANE_Word));
+  sanei_w_string (&w, &str);
 
   if (w.status == 0)
     printf ("free successful\n");
@@ -0,0 +1,286 @@
+/*
+   sane-usb-capture-pack.c -- move the payloads of a sanei_usb capture to a
+   binary data file
+
+   This file is part of the SANE package.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+   The USB captures that are recorded by sanei_usb store the data of each
+   transaction as hex text. Replaying large captures is dominated by parsing
+   the text and the whole capture needs to be kept in memory. This tool moves
+   the payloads of the transactions that are larger than a given size to a
+   data file next to the capture. The transactions then refer to their data
+   by data_offset and data_size attributes and sanei_usb maps the data file
+   into memory during replay. Small payloads are kept inline so that the
+   capture stays readable.
+*/
+
+#include "../include/sane/config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libxml/tree.h>
+#include <libxml/parser.h>
+
+#define DEFAULT_MIN_SIZE 64
+
+static int
+hex_value (char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/* Decodes hex text in the format of '00 11 ab 3f'. Returns NULL if the text
+   is not hex data, e.g. a placeholder of an unknown read. */
+static unsigned char *
+decode_hex (const char *text, size_t * size)
+{
+  unsigned char *data = malloc (strlen (text) / 2 + 1);
+  size_t count = 0;
+
+  if (!data)
+    return NULL;
+
+  while (*text)
+    {
+      int high, low;
+
+      if (*text == ' ' || *text == '\n' || *text == '\t' || *text == '\r')
+	{
+	  text++;
+	  continue;
+	}
+
+      high = hex_value (text[0]);
+      low = high < 0 ? -1 : hex_value (text[1]);
+      if (low < 0)
+	{
+	  free (data);
+	  return NULL;
+	}
+      data[count++] = (unsigned char) (high << 4 | low);
+      text += 2;
+    }
+
+  *size = count;
+  return data;
+}
+
+static int
+is_transaction (xmlNode * node)
+{
+  size_t length = strlen ((const char *) node->name);
+  return length > 3
+    && strcmp ((const char *) node->name + length - 3, "_tx") == 0;
+}
+
+/* Returns the data file path for the given capture path: the extension of
+   the capture is replaced by .bin */
+static char *
+get_data_file_path (const char *capture_path)
+{
+  const char *slash = strrchr (capture_path, '/');
+  const char *dot = strrchr (capture_path, '.');
+  size_t base_length = strlen (capture_path);
+  char *path;
+
+  if (dot && (!slash || dot > slash))
+    base_length = dot - capture_path;
+
+  path = malloc (base_length + 5);
+  if (!path)
+    return NULL;
+  memcpy (path, capture_path, base_length);
+  strcpy (path + base_length, ".bin");
+  return path;
+}
+
+static void
+usage (const char *name)
+{
+  fprintf (stderr,
+	   "Usage: %s [-m MIN_SIZE] INPUT_CAPTURE OUTPUT_CAPTURE\n"
+	   "\n"
+	   "Moves the data of the transactions of a sanei_usb capture that are\n"
+	   "at least MIN_SIZE bytes large (default: %d) into a binary data file\n"
+	   "next to OUTPUT_CAPTURE. The data file has the same name as\n"
+	   "OUTPUT_CAPTURE with the extension replaced by .bin.\n",
+	   name, DEFAULT_MIN_SIZE);
+}
+
+int
+main (int argc, char **argv)
+{
+  const char *input_path;
+  const char *output_path;
+  char *data_path;
+  const char *data_name;
+  size_t min_size = DEFAULT_MIN_SIZE;
+  size_t data_offset = 0;
+  size_t packed_count = 0;
+  xmlDoc *doc;
+  xmlNode *root;
+  xmlNode *transactions;
+  xmlNode *node;
+  xmlChar *attr;
+  FILE *data_file;
+  int arg = 1;
+
+  if (argc > 2 && strcmp (argv[1], "-m") == 0)
+    {
+      min_size = strtoul (argv[2], NULL, 0);
+      arg += 2;
+    }
+  if (argc - arg != 2)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+  input_path = argv[arg];
+  output_path = argv[arg + 1];
+
+  doc = xmlReadFile (input_path, NULL, XML_PARSE_HUGE);
+  if (!doc)
+    {
+      fprintf (stderr, "%s: could not parse %s\n", argv[0], input_path);
+      return 1;
+    }
+
+  root = xmlDocGetRootElement (doc);
+  if (!root || xmlStrcmp (root->name, (const xmlChar *) "device_capture") != 0)
+    {
+      fprintf (stderr, "%s: %s is not a USB capture\n", argv[0], input_path);
+      xmlFreeDoc (doc);
+      return 1;
+    }
+
+  attr = xmlGetProp (root, (const xmlChar *) "data_file");
+  if (attr)
+    {
+      fprintf (stderr, "%s: %s already refers to a data file\n", argv[0],
+	       input_path);
+      xmlFree (attr);
+      xmlFreeDoc (doc);
+      return 1;
+    }
+
+  transactions = root->children;
+  while (transactions
+	 && (transactions->type != XML_ELEMENT_NODE
+	     || xmlStrcmp (transactions->name,
+			   (const xmlChar *) "transactions") != 0))
+    transactions = transactions->next;
+
+  if (!transactions)
+    {
+      fprintf (stderr, "%s: %s contains no transactions\n", argv[0],
+	       input_path);
+      xmlFreeDoc (doc);
+      return 1;
+    }
+
+  data_path = get_data_file_path (output_path);
+  data_file = data_path ? fopen (data_path, "wb") : NULL;
+  if (!data_file)
+    {
+      fprintf (stderr, "%s: could not create the data file\n", argv[0]);
+      free (data_path);
+      xmlFreeDoc (doc);
+      return 1;
+    }
+
+  for (node = transactions->children; node; node = node->next)
+    {
+      xmlChar *content;
+      unsigned char *data;
+      size_t size = 0;
+      char number[32];
+
+      if (node->type != XML_ELEMENT_NODE || !is_transaction (node))
+	continue;
+
+      content = xmlNodeGetContent (node);
+      if (!content)
+	continue;
+      data = decode_hex ((const char *) content, &size);
+      xmlFree (content);
+
+      if (!data)
+	continue;
+      if (size < min_size)
+	{
+	  free (data);
+	  continue;
+	}
+
+      if (fwrite (data, 1, size, data_file) != size)
+	{
+	  fprintf (stderr, "%s: could not write to %s\n", argv[0], data_path);
+	  free (data);
+	  fclose (data_file);
+	  free (data_path);
+	  xmlFreeDoc (doc);
+	  return 1;
+	}
+      free (data);
+
+      xmlNodeSetContent (node, NULL);
+      snprintf (number, sizeof (number), "%lu", (unsigned long) data_offset);
+      xmlNewProp (node, (const xmlChar *) "data_offset",
+		  (const xmlChar *) number);
+      snprintf (number, sizeof (number), "%lu", (unsigned long) size);
+      xmlNewProp (node, (const xmlChar *) "data_size",
+		  (const xmlChar *) number);
+
+      data_offset += size;
+      packed_count++;
+    }
+
+  if (fclose (data_file) != 0)
+    {
+      fprintf (stderr, "%s: could not write to %s\n", argv[0], data_path);
+      free (data_path);
+      xmlFreeDoc (doc);
+      return 1;
+    }
+
+  /* the data file is referred to relative to the capture */
+  data_name = strrchr (data_path, '/');
+  data_name = data_name ? data_name + 1 : data_path;
+  xmlNewProp (root, (const xmlChar *) "data_file", (const xmlChar *) data_name);
+
+  if (xmlSaveFileEnc (output_path, doc, "UTF-8") < 0)
+    {
+      fprintf (stderr, "%s: could not write %s\n", argv[0], output_path);
+      free (data_path);
+      xmlFreeDoc (doc);
+      return 1;
+    }
+
+  printf ("moved %lu transactions (%lu bytes) to %s\n",
+	  (unsigned long) packed_count, (unsigned long) data_offset, data_path);
+
+  free (data_path);
+  xmlFreeDoc (doc);
+  xmlCleanupParser ();
+  return 0;
+}